@@ -18,6 +18,8 @@
 #include "../common/strlib.h"
 #include "../common/timer.h"
 #include "../common/cli.h"
+#include "../common/thread.h"
+#include "../common/mutex.h"
 #include "int_guild.h"
 #include "int_homun.h"
 #include "int_mercenary.h"
@@ -290,7 +292,7 @@ int char_mmo_char_tosql(uint32 char_id, struct mmo_charstatus* p){
 
 	//map inventory data
 	if( memcmp(p->inventory, cp->inventory, sizeof(p->inventory)) ) {
-		if (!char_inventory_to_sql(p->inventory, MAX_INVENTORY, p->char_id))
+		if (!char_save_queue(p->inventory, MAX_INVENTORY, p->char_id, TABLE_INVENTORY))
 			strcat(save_status, " inventory");
 		else
 			errors++;
@@ -298,7 +300,7 @@ int char_mmo_char_tosql(uint32 char_id, struct mmo_charstatus* p){
 
 	//map cart data
 	if( memcmp(p->cart, cp->cart, sizeof(p->cart)) ) {
-		if (!char_memitemdata_to_sql(p->cart, MAX_CART, p->char_id, TABLE_CART))
+		if (!char_save_queue(p->cart, MAX_CART, p->char_id, TABLE_CART))
 			strcat(save_status, " cart");
 		else
 			errors++;
@@ -306,7 +308,7 @@ int char_mmo_char_tosql(uint32 char_id, struct mmo_charstatus* p){
 
 	//map storage data
 	if( memcmp(p->storage.items, cp->storage.items, sizeof(p->storage.items)) ) {
-		if (!char_memitemdata_to_sql(p->storage.items, MAX_STORAGE, p->account_id, TABLE_STORAGE))
+		if (!char_save_queue(p->storage.items, MAX_STORAGE, p->account_id, TABLE_STORAGE))
 			strcat(save_status, " storage");
 		else
 			errors++;
@@ -314,7 +316,7 @@ int char_mmo_char_tosql(uint32 char_id, struct mmo_charstatus* p){
 	//map rentstorage data
 	if( memcmp(p->ext_storage.items, cp->ext_storage.items, sizeof(p->ext_storage.items)) )
 	{
-		if( !char_memitemdata_to_sql(p->ext_storage.items, MAX_EXTRA_STORAGE, p->account_id, TABLE_EXT_STORAGE))
+		if( !char_save_queue(p->ext_storage.items, MAX_EXTRA_STORAGE, p->account_id, TABLE_EXT_STORAGE))
 			strcat(save_status, " rentstorage");
 		else
 			errors++;
@@ -1021,6 +1023,578 @@ int char_inventory_to_sql(const struct item items[], int max, int id) {
 	return errors;
 }
 
+/*==========================================
+ * Write-behind item saves
+ *
+ * Inventory, cart, storage and extra storage saves are handed to save
+ * threads with their own SQL connections, so the char-server keeps
+ * parsing packets while the rows are compared and written.
+ * Saves are coalesced per (table, owner): while a write is queued only the
+ * latest data is kept, and an owner is never written by two threads at once.
+ * Anything that reads or modifies those tables directly calls
+ * char_save_barrier/char_save_flush first.
+ *------------------------------------------*/
+
+#define CHAR_SAVE_ROW_LENGTH 320 // "(...)," of a row in the upsert query
+#define CHAR_SAVE_IDLE_TIME 60000 // idle jobs are released after this time
+
+/// Item table write of an owner, only allocated and released by the main thread.
+struct char_save_job {
+	int table; // TABLE_*
+	int owner; // char_id or account_id
+	int max;
+	struct item* pending; // latest data, written by the main thread
+	struct item* running; // data being written
+	bool has_pending, queued, busy, retry;
+	bool sync; // too big for the save thread queries, written on the main connection by the timer
+	unsigned int tick; // last queued
+	struct char_save_job* next; // queue link
+};
+
+struct char_save_thread {
+	rAthread thread;
+	Sql* handle;
+	char* query[2]; // SELECT/DELETE, upsert
+	bool* matched;
+};
+
+static struct {
+	int count;
+	struct char_save_thread thread[MAX_SAVE_THREADS];
+	size_t query_size;
+	ramutex mutex; // protects the jobs, the queue and the statistics
+	racond work_cond; // a job was queued
+	racond done_cond; // a write finished
+	struct char_save_job *head, *tail;
+	DBMap* jobs; // ((uint64)table<<32|owner) -> struct char_save_job*, only used by the main thread
+	bool terminate;
+	// statistics
+	int queued, merged, written, errors;
+	char last_error[256];
+} char_save;
+
+/// Error of char_save_write when the changes don't fit in the query buffers.
+static const char char_save_toobig[] = "query buffer too small";
+
+/// Returns the table name and the owner column of an item table, or NULL.
+static const char* char_save_tablename(int table, const char** owner)
+{
+	switch( table ) {
+	case TABLE_INVENTORY:   *owner = "char_id";    return schema_config.inventory_db;
+	case TABLE_CART:        *owner = "char_id";    return schema_config.cart_db;
+	case TABLE_STORAGE:     *owner = "account_id"; return schema_config.storage_db;
+	case TABLE_EXT_STORAGE: *owner = "account_id"; return schema_config.rentstorage_db;
+	}
+	return NULL;
+}
+
+/// Appends to a save thread query (no memory manager), returns false when it doesn't fit.
+static bool char_save_append(char* query, size_t* length, const char* format, ...)
+{
+	va_list ap;
+	int n;
+
+	if( *length >= char_save.query_size )
+		return false;
+	va_start(ap, format);
+	n = vsnprintf(query + *length, char_save.query_size - *length, format, ap);
+	va_end(ap);
+	if( n < 0 || (size_t)n >= char_save.query_size - *length )
+	{
+		*length = char_save.query_size;
+		return false;
+	}
+	*length += n;
+	return true;
+}
+
+/// Returns a column of the current row of a save thread SELECT, NULL is 0.
+static int64 char_save_column(Sql* handle, size_t col)
+{
+	char* data = NULL;
+
+	Sql_GetData(handle, col, &data, NULL);
+	if( data == NULL )
+		return 0;
+	if( *data == '-' )
+		return strtoll(data, NULL, 10);
+	return (int64)strtoull(data, NULL, 10);
+}
+
+/// Reads the current row of a save thread SELECT.
+static void char_save_getitem(Sql* handle, struct item* item)
+{
+	int j;
+
+	item->id = (int)char_save_column(handle, 0);
+	item->nameid = (unsigned short)char_save_column(handle, 1);
+	item->amount = (short)char_save_column(handle, 2);
+	item->equip = (unsigned int)char_save_column(handle, 3);
+	item->identify = (char)char_save_column(handle, 4);
+	item->refine = (char)char_save_column(handle, 5);
+	item->attribute = (char)char_save_column(handle, 6);
+	item->expire_time = (unsigned int)char_save_column(handle, 7);
+	item->bound = (char)char_save_column(handle, 8);
+	item->unique_id = (uint64)char_save_column(handle, 9);
+	item->favorite = (char)char_save_column(handle, 10);
+	for( j = 0; j < MAX_SLOTS; ++j )
+		item->card[j] = (unsigned short)char_save_column(handle, 11+j);
+}
+
+/// Appends an item to the upsert query, a NULL id inserts a new row.
+static bool char_save_appenditem(char* query, size_t* length, bool first, int id, int owner, const struct item* item)
+{
+	int j;
+
+	if( !(id ? char_save_append(query, length, "%s('%d'", first ? "" : ",", id) : char_save_append(query, length, "%s(NULL", first ? "" : ","))
+	||  !char_save_append(query, length, ", '%d', '%hu', '%d', '%d', '%d', '%d', '%d', '%u', '%d', '%"PRIu64"', '%d'",
+			owner, item->nameid, item->amount, item->equip, item->identify, item->refine, item->attribute, item->expire_time, item->bound, item->unique_id, item->favorite) )
+		return false;
+	for( j = 0; j < MAX_SLOTS; ++j )
+		if( !char_save_append(query, length, ", '%hu'", item->card[j]) )
+			return false;
+	return char_save_append(query, length, ")");
+}
+
+/// Writes the running data of a job, on a save thread. Returns NULL or the error.
+/// Same comparison as char_memitemdata_to_sql, but the changes are sent as
+/// one DELETE and one INSERT ... ON DUPLICATE KEY UPDATE.
+static const char* char_save_write(struct char_save_thread* self, const struct char_save_job* job)
+{
+	const struct item* items = job->running;
+	const char* owner = NULL;
+	const char* tablename = char_save_tablename(job->table, &owner);
+	char* del = self->query[0];
+	char* ins = self->query[1];
+	size_t del_len = 0, ins_len = 0, del_start, ins_start;
+	bool has_delete, has_insert;
+	struct item item;
+	int i, j;
+
+	if( tablename == NULL )
+		return "unknown item table";
+
+	// SELECT (built in the DELETE buffer)
+	char_save_append(del, &del_len, "SELECT `id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`, `bound`, `unique_id`, `favorite`");
+	for( j = 0; j < MAX_SLOTS; ++j )
+		char_save_append(del, &del_len, ", `card%d`", j);
+	char_save_append(del, &del_len, " FROM `%s` WHERE `%s`='%d'", tablename, owner, job->owner);
+	if( SQL_ERROR == Sql_QueryRawResult(self->handle, del, del_len)
+	&&  (SQL_ERROR == Sql_Ping(self->handle) || SQL_ERROR == Sql_QueryRawResult(self->handle, del, del_len)) )
+		return Sql_LastError(self->handle);
+
+	del_len = 0;
+	char_save_append(del, &del_len, "DELETE FROM `%s` WHERE `id` IN (", tablename);
+	del_start = del_len;
+	char_save_append(ins, &ins_len, "INSERT INTO `%s` (`id`, `%s`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`, `bound`, `unique_id`, `favorite`", tablename, owner);
+	for( j = 0; j < MAX_SLOTS; ++j )
+		char_save_append(ins, &ins_len, ", `card%d`", j);
+	char_save_append(ins, &ins_len, ") VALUES ");
+	ins_start = ins_len;
+
+	memset(self->matched, 0, job->max*sizeof(bool));
+	while( SQL_SUCCESS == Sql_NextRow(self->handle) )
+	{
+		char_save_getitem(self->handle, &item);
+		// search for the presence of the item in the data
+		for( i = 0; i < job->max; ++i )
+		{
+			// skip empty and already matched entries
+			if( items[i].nameid == 0 || self->matched[i] )
+				continue;
+			if( job->table != TABLE_INVENTORY && items[i].unique_id && items[i].unique_id != item.unique_id )
+				continue;
+
+			if( items[i].nameid == item.nameid
+			&&  items[i].card[0] == item.card[0]
+			&&  items[i].card[2] == item.card[2]
+			&&  items[i].card[3] == item.card[3]
+			) {	//They are the same item.
+				ARR_FIND( 0, MAX_SLOTS, j, items[i].card[j] != item.card[j] );
+				if( !(j == MAX_SLOTS &&
+				    items[i].amount == item.amount &&
+				    items[i].equip == item.equip &&
+				    items[i].identify == item.identify &&
+				    items[i].refine == item.refine &&
+				    items[i].attribute == item.attribute &&
+				    items[i].expire_time == item.expire_time &&
+				    items[i].bound == item.bound &&
+				    items[i].favorite == item.favorite &&
+				    items[i].unique_id == item.unique_id) )
+					char_save_appenditem(ins, &ins_len, ins_len == ins_start, item.id, job->owner, &items[i]); // Differences found, update the row
+				self->matched[i] = true;
+				break;
+			}
+		}
+		if( i == job->max ) // Item not present in the data, remove it.
+			char_save_append(del, &del_len, "%s'%d'", del_len == del_start ? "" : ",", item.id);
+	}
+	Sql_FreeResult(self->handle);
+
+	// insert non-matched items as new rows
+	for( i = 0; i < job->max; ++i )
+	{
+		if( items[i].nameid == 0 || self->matched[i] )
+			continue;
+		char_save_appenditem(ins, &ins_len, ins_len == ins_start, 0, job->owner, &items[i]);
+	}
+
+	has_delete = (del_len > del_start);
+	has_insert = (ins_len > ins_start);
+	char_save_append(del, &del_len, ")");
+	char_save_append(ins, &ins_len, " ON DUPLICATE KEY UPDATE `nameid`=VALUES(`nameid`), `amount`=VALUES(`amount`), `equip`=VALUES(`equip`), `identify`=VALUES(`identify`), `refine`=VALUES(`refine`), `attribute`=VALUES(`attribute`), `expire_time`=VALUES(`expire_time`), `bound`=VALUES(`bound`), `unique_id`=VALUES(`unique_id`), `favorite`=VALUES(`favorite`)");
+	for( j = 0; j < MAX_SLOTS; ++j )
+		char_save_append(ins, &ins_len, ", `card%d`=VALUES(`card%d`)", j, j);
+	if( del_len >= char_save.query_size || ins_len >= char_save.query_size )
+		return char_save_toobig; // never write a partial save
+
+	if( has_delete && SQL_ERROR == Sql_QueryRaw(self->handle, del, del_len) )
+		return Sql_LastError(self->handle);
+	if( has_insert && SQL_ERROR == Sql_QueryRaw(self->handle, ins, ins_len) )
+		return Sql_LastError(self->handle);
+	return NULL;
+}
+
+/// Queues a job, the mutex must be held.
+static void char_save_push(struct char_save_job* job)
+{
+	job->queued = true;
+	job->next = NULL;
+	if( char_save.tail )
+		char_save.tail->next = job;
+	else
+		char_save.head = job;
+	char_save.tail = job;
+	racond_signal(char_save.work_cond);
+}
+
+/// Removes a queued job, the mutex must be held.
+static void char_save_unlink(struct char_save_job* job)
+{
+	struct char_save_job** p;
+	struct char_save_job* prev = NULL;
+
+	for( p = &char_save.head; *p != NULL; prev = *p, p = &(*p)->next )
+	{
+		if( *p != job )
+			continue;
+		*p = job->next;
+		if( char_save.tail == job )
+			char_save.tail = prev;
+		break;
+	}
+	job->next = NULL;
+	job->queued = false;
+}
+
+static void* char_save_main(void* param)
+{
+	struct char_save_thread* self = (struct char_save_thread*)param;
+
+	Sql_ThreadInit();
+	ramutex_lock(char_save.mutex);
+	for(;;)
+	{
+		struct char_save_job* job = char_save.head;
+		const char* error;
+
+		if( job == NULL )
+		{
+			if( char_save.terminate )
+				break; // the queue is drained before exiting
+			racond_wait(char_save.work_cond, char_save.mutex, -1);
+			continue;
+		}
+		char_save_unlink(job);
+		job->busy = true;
+		memcpy(job->running, job->pending, job->max*sizeof(struct item));
+		job->has_pending = false;
+		ramutex_unlock(char_save.mutex);
+
+		error = char_save_write(self, job);
+
+		ramutex_lock(char_save.mutex);
+		job->busy = false;
+		if( error == NULL )
+			char_save.written++;
+		else
+		{ // keep the data, the timer queues it again
+			if( error == char_save_toobig )
+				job->sync = true; // retrying can't help
+			else
+			{
+				char_save.errors++;
+				safestrncpy(char_save.last_error, error, sizeof(char_save.last_error));
+			}
+			if( !job->has_pending )
+			{
+				memcpy(job->pending, job->running, job->max*sizeof(struct item));
+				job->has_pending = true;
+			}
+			job->retry = true;
+		}
+		if( job->has_pending && !job->retry )
+			char_save_push(job); // saved again while it was written
+		racond_broadcast(char_save.done_cond);
+	}
+	ramutex_unlock(char_save.mutex);
+	Sql_ThreadEnd();
+	return NULL;
+}
+
+/// Writes an item table synchronously on the main connection.
+static int char_save_sync(const struct item items[], int max, int owner, int table)
+{
+	if( table == TABLE_INVENTORY )
+		return char_inventory_to_sql(items, max, owner);
+	return char_memitemdata_to_sql(items, max, owner, table);
+}
+
+/// Saves an item table of an owner, queued to the save threads when they are enabled.
+/// Returns the number of errors, like char_memitemdata_to_sql.
+int char_save_queue(const struct item items[], int max, int owner, int table)
+{
+	uint64 key = ((uint64)table<<32)|(uint32)owner;
+	struct char_save_job* job;
+
+	if( char_save.count == 0 || table == TABLE_GUILD_STORAGE )
+		return char_save_sync(items, max, owner, table);
+
+	if( (job = (struct char_save_job*)ui64db_get(char_save.jobs, key)) == NULL )
+	{
+		CREATE(job, struct char_save_job, 1);
+		job->table = table;
+		job->owner = owner;
+		job->max = max;
+		CREATE(job->pending, struct item, max);
+		CREATE(job->running, struct item, max);
+		ui64db_put(char_save.jobs, key, job);
+	}
+
+	ramutex_lock(char_save.mutex);
+	memcpy(job->pending, items, job->max*sizeof(struct item));
+	char_save.queued++;
+	if( job->has_pending )
+		char_save.merged++;
+	job->has_pending = true;
+	job->tick = gettick();
+	if( !job->queued && !job->busy && !job->retry )
+		char_save_push(job);
+	ramutex_unlock(char_save.mutex);
+	return 0;
+}
+
+/// Waits for the writes of a job and writes what is still pending.
+static void char_save_barrier_job(struct char_save_job* job)
+{
+	bool write = false;
+
+	ramutex_lock(char_save.mutex);
+	if( job->queued )
+		char_save_unlink(job);
+	while( job->busy )
+		racond_wait(char_save.done_cond, char_save.mutex, -1);
+	if( job->has_pending )
+	{
+		memcpy(job->running, job->pending, job->max*sizeof(struct item));
+		job->has_pending = false;
+		job->retry = false;
+		job->sync = false;
+		write = true;
+	}
+	ramutex_unlock(char_save.mutex);
+
+	if( !write )
+		return;
+	write = (char_save_sync(job->running, job->max, job->owner, job->table) == 0);
+	ramutex_lock(char_save.mutex);
+	if( write )
+		char_save.written++;
+	else
+	{ // already reported by the sync write
+		char_save.errors++;
+		if( !job->has_pending )
+		{
+			memcpy(job->pending, job->running, job->max*sizeof(struct item));
+			job->has_pending = true;
+		}
+		job->retry = true;
+	}
+	ramutex_unlock(char_save.mutex);
+}
+
+/// Makes sure the item table of an owner is written before it's accessed directly.
+void char_save_barrier(int table, int owner)
+{
+	struct char_save_job* job;
+
+	if( char_save.count == 0 )
+		return;
+	if( (job = (struct char_save_job*)ui64db_get(char_save.jobs, ((uint64)table<<32)|(uint32)owner)) != NULL )
+		char_save_barrier_job(job);
+}
+
+/// Makes sure all the queued item saves are written.
+void char_save_flush(void)
+{
+	DBIterator* iter;
+	struct char_save_job* job;
+
+	if( char_save.jobs == NULL )
+		return;
+	iter = db_iterator(char_save.jobs);
+	for( job = (struct char_save_job*)dbi_first(iter); dbi_exists(iter); job = (struct char_save_job*)dbi_next(iter) )
+		char_save_barrier_job(job);
+	dbi_destroy(iter);
+}
+
+/// Queues failed writes again, releases idle jobs and reports errors.
+/// Writes that don't fit in the save thread queries are written synchronously.
+static int char_save_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	static int errors = 0;
+	DBIterator* iter;
+	struct char_save_job* job;
+	bool sync = false;
+
+	iter = db_iterator(char_save.jobs);
+	ramutex_lock(char_save.mutex);
+	for( job = (struct char_save_job*)dbi_first(iter); dbi_exists(iter); job = (struct char_save_job*)dbi_next(iter) )
+	{
+		if( job->queued || job->busy )
+			continue;
+		if( job->retry && job->sync )
+			sync = true; // not queued again, written below
+		else if( job->retry )
+		{
+			job->retry = false;
+			char_save_push(job);
+		}
+		else if( !job->has_pending && DIFF_TICK(tick, job->tick) > CHAR_SAVE_IDLE_TIME )
+		{
+			dbi_remove(iter);
+			aFree(job->pending);
+			aFree(job->running);
+			aFree(job);
+		}
+	}
+	if( char_save.errors != errors )
+	{
+		ShowError("Char save: %d item table writes failed and will be retried. Last error: %s\n", char_save.errors - errors, char_save.last_error);
+		errors = char_save.errors;
+	}
+	ramutex_unlock(char_save.mutex);
+	dbi_destroy(iter);
+
+	if( sync )
+	{
+		iter = db_iterator(char_save.jobs);
+		for( job = (struct char_save_job*)dbi_first(iter); dbi_exists(iter); job = (struct char_save_job*)dbi_next(iter) )
+		{
+			ramutex_lock(char_save.mutex);
+			sync = job->sync;
+			ramutex_unlock(char_save.mutex);
+			if( sync )
+				char_save_barrier_job(job); // clears sync
+		}
+		dbi_destroy(iter);
+	}
+	return 0;
+}
+
+static void char_save_init(void)
+{
+	int i;
+
+	memset(&char_save, 0, sizeof(char_save));
+	add_timer_func_list(char_save_timer, "char_save_timer");
+
+	if( charserv_config.save_threads <= 0 )
+		return;
+
+	char_save.query_size = 1024 + MAX_STORAGE*CHAR_SAVE_ROW_LENGTH;
+	char_save.mutex = ramutex_create();
+	char_save.work_cond = racond_create();
+	char_save.done_cond = racond_create();
+	char_save.jobs = ui64db_alloc(DB_OPT_BASE);
+
+	for( i = 0; i < charserv_config.save_threads; i++ )
+	{
+		struct char_save_thread* t = &char_save.thread[i];
+
+		t->handle = Sql_Malloc();
+		if( SQL_ERROR == Sql_Connect(t->handle, char_server_id, char_server_pw, char_server_ip, (uint16)char_server_port, char_server_db) )
+		{
+			Sql_ShowDebug(t->handle);
+			Sql_Free(t->handle);
+			t->handle = NULL;
+			break;
+		}
+		if( *default_codepage && SQL_ERROR == Sql_SetEncoding(t->handle, default_codepage) )
+			Sql_ShowDebug(t->handle);
+		Sql_DisableKeepalive(t->handle); // the save thread pings it
+		CREATE(t->query[0], char, char_save.query_size);
+		CREATE(t->query[1], char, char_save.query_size);
+		CREATE(t->matched, bool, MAX_STORAGE);
+		if( (t->thread = rathread_create(char_save_main, t)) == NULL )
+			break;
+		char_save.count++;
+	}
+	if( char_save.count < charserv_config.save_threads )
+		ShowWarning("char_save_init: Only %d of %d save threads could be started.\n", char_save.count, charserv_config.save_threads);
+	if( char_save.count > 0 )
+		add_timer_interval(gettick() + 1000, char_save_timer, 0, 0, 1000);
+}
+
+static void char_save_final(void)
+{
+	DBIterator* iter;
+	struct char_save_job* job;
+	const char* owner;
+	int i;
+
+	if( char_save.mutex == NULL )
+		return;
+
+	ramutex_lock(char_save.mutex);
+	char_save.terminate = true;
+	racond_broadcast(char_save.work_cond);
+	ramutex_unlock(char_save.mutex);
+	for( i = 0; i < MAX_SAVE_THREADS; i++ )
+	{
+		struct char_save_thread* t = &char_save.thread[i];
+
+		if( t->thread != NULL )
+			rathread_wait(t->thread, NULL);
+		if( t->query[0] ) aFree(t->query[0]);
+		if( t->query[1] ) aFree(t->query[1]);
+		if( t->matched ) aFree(t->matched);
+		Sql_Free(t->handle);
+	}
+	char_save.count = 0; // nothing is queued anymore
+
+	char_save_flush(); // failed writes
+	if( charserv_config.save_log )
+		ShowInfo("Char save: %d item table writes queued, %d merged, %d written, %d failed.\n", char_save.queued, char_save.merged, char_save.written, char_save.errors);
+
+	iter = db_iterator(char_save.jobs);
+	for( job = (struct char_save_job*)dbi_first(iter); dbi_exists(iter); job = (struct char_save_job*)dbi_next(iter) )
+	{
+		if( job->has_pending )
+			ShowError("char_save_final: Lost the %s of %d, it couldn't be written.\n", char_save_tablename(job->table, &owner), job->owner);
+		aFree(job->pending);
+		aFree(job->running);
+		aFree(job);
+	}
+	dbi_destroy(iter);
+	db_destroy(char_save.jobs);
+
+	racond_destroy(char_save.work_cond);
+	racond_destroy(char_save.done_cond);
+	ramutex_destroy(char_save.mutex);
+	memset(&char_save, 0, sizeof(char_save));
+}
+
 /**
  * Returns the correct gender ID for the given character and enum value.
  *
@@ -1353,6 +1927,7 @@ int char_mmo_char_fromsql(uint32 char_id, struct mmo_charstatus* p, bool load_ev
 
 	//read inventory
 	//`inventory` (`id`,`char_id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `card0`, `card1`, `card2`, `card3`, `expire_time`, `favorite`, `unique_id`)
+	char_save_barrier(TABLE_INVENTORY, char_id);
 	StringBuf_Init(&buf);
 	StringBuf_AppendStr(&buf, "SELECT `id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`, `favorite`, `bound`, `unique_id`");
 	for( i = 0; i < MAX_SLOTS; ++i )
@@ -1385,6 +1960,7 @@ int char_mmo_char_fromsql(uint32 char_id, struct mmo_charstatus* p, bool load_ev
 
 	//read cart
 	//`cart_inventory` (`id`,`char_id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `card0`, `card1`, `card2`, `card3`, expire_time`, `unique_id`)
+	char_save_barrier(TABLE_CART, char_id);
 	StringBuf_Clear(&buf);
 	StringBuf_AppendStr(&buf, "SELECT `id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`, `bound`, `unique_id`, `favorite`");
 	for( j = 0; j < MAX_SLOTS; ++j )
@@ -2054,6 +2630,8 @@ int char_make_new_char_sql(struct char_session_data* sd, char* name_, int str, i
 int char_divorce_char_sql(int partner_id1, int partner_id2){
 	if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `partner_id`='0' WHERE `char_id`='%d' OR `char_id`='%d' LIMIT 2", schema_config.char_db, partner_id1, partner_id2) )
 		Sql_ShowDebug(sql_handle);
+	char_save_barrier(TABLE_INVENTORY, partner_id1);
+	char_save_barrier(TABLE_INVENTORY, partner_id2);
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE (`nameid`='%hu' OR `nameid`='%hu') AND (`char_id`='%d' OR `char_id`='%d') LIMIT 2", schema_config.inventory_db, WEDDING_RING_M, WEDDING_RING_F, partner_id1, partner_id2) )
 		Sql_ShowDebug(sql_handle);
 	chmapif_send_ackdivorce(partner_id1, partner_id2);
@@ -2068,6 +2646,8 @@ int char_item_remove4all(int nameid)
 	unsigned char buf[4];
 	ShowInfo("Destroying item ID %d on all Users...\n", nameid);
 
+	char_save_flush();
+
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `nameid` = '%d'", schema_config.inventory_db, nameid) )
 		Sql_ShowDebug(sql_handle);
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `nameid` = '%d'", schema_config.cart_db, nameid) )
@@ -2098,6 +2678,9 @@ int char_delete_char_sql(uint32 char_id){
 	char *data;
 	size_t len;
 
+	char_save_barrier(TABLE_INVENTORY, char_id);
+	char_save_barrier(TABLE_CART, char_id);
+
 	if (SQL_ERROR == Sql_Query(sql_handle, "SELECT `name`,`account_id`,`party_id`,`guild_id`,`base_level`,`homun_id`,`partner_id`,`father`,`mother`,`elemental_id` FROM `%s` WHERE `char_id`='%d'", schema_config.char_db, char_id))
 		Sql_ShowDebug(sql_handle);
 
@@ -3366,6 +3949,7 @@ void char_set_defaults(){
 	charserv_config.max_connect_user = -1;
 	charserv_config.gm_allow_group = -1;
 	charserv_config.autosave_interval = DEFAULT_AUTOSAVE_INTERVAL;
+	charserv_config.save_threads = 2;
 	charserv_config.start_zeny = 0;
 	charserv_config.guild_exp_rate = 100;
 
@@ -3554,6 +4138,12 @@ bool char_config_read(const char* cfgName, bool normal){
 			charserv_config.autosave_interval = atoi(w2)*1000;
 			if (charserv_config.autosave_interval <= 0)
 				charserv_config.autosave_interval = DEFAULT_AUTOSAVE_INTERVAL;
+		} else if (strcmpi(w1, "save_threads") == 0) {
+			charserv_config.save_threads = atoi(w2);
+			if (charserv_config.save_threads < 0)
+				charserv_config.save_threads = 0;
+			else if (charserv_config.save_threads > MAX_SAVE_THREADS)
+				charserv_config.save_threads = MAX_SAVE_THREADS;
 		} else if (strcmpi(w1, "save_log") == 0) {
 			charserv_config.save_log = config_switch(w2);
 #ifdef RENEWAL
@@ -3707,6 +4297,7 @@ void do_final(void)
 {
 	ShowStatus("Terminating...\n");
 
+	char_save_final();
 	char_set_all_offline(-1);
 	char_set_all_offline_sql();
 
@@ -3797,6 +4388,7 @@ int do_init(int argc, char **argv)
 	}
 
 	inter_init_sql((argc > 2) ? argv[2] : inter_cfgName); // inter server configuration
+	char_save_init();
 
 	auth_db = idb_alloc(DB_OPT_RELEASE_DATA);
 	online_char_db = idb_alloc(DB_OPT_RELEASE_DATA);
@@ -160,6 +160,7 @@ struct CharServ_Config {
 	int max_connect_user;
 	int gm_allow_group;
 	int autosave_interval;
+	int save_threads; // item table save threads, 0 saves synchronously
 	int start_zeny;
 	int guild_exp_rate;
 
@@ -261,6 +262,7 @@ extern struct fame_list bgrank_fame_list[MAX_FAME_LIST];
 extern struct fame_list bg_fame_list[MAX_FAME_LIST];
 
 #define DEFAULT_AUTOSAVE_INTERVAL 300*1000
+#define MAX_SAVE_THREADS 16
 #define MAX_CHAR_BUF 150 //Max size (for WFIFOHEAD calls)
 
 int char_search_mapserver(unsigned short map, uint32 ip, uint16 port);
@@ -288,6 +290,9 @@ int char_item_remove4all(int nameid); // eAmod Codes
 int char_dump2sql(int char_id); // eAmod Codes
 void char_ip_premium(uint32 ip, struct mmo_charstatus* p); // eAmod Codes
 int char_memitemdata_to_sql(const struct item items[], int max, int id, int tableswitch);
+int char_save_queue(const struct item items[], int max, int owner, int table);
+void char_save_barrier(int table, int owner);
+void char_save_flush(void);
 
 void disconnect_player(uint32 account_id);
 
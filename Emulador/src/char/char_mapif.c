@@ -484,6 +484,11 @@ int chmapif_parse_reqsavechar(int fd, int id){
 
 		if (RFIFOB(fd,12))
 		{	//Flag, set character offline after saving. [Skotlex]
+			// the ack means the character is written
+			char_save_barrier(TABLE_INVENTORY, cid);
+			char_save_barrier(TABLE_CART, cid);
+			char_save_barrier(TABLE_STORAGE, aid);
+			char_save_barrier(TABLE_EXT_STORAGE, aid);
 			char_set_char_offline(cid, aid);
 			WFIFOHEAD(fd,10);
 			WFIFOW(fd,0) = 0x2b21; //Save ack only needed on final save.
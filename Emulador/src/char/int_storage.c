@@ -17,7 +17,7 @@
 /// Save storage data to sql
 int storage_tosql(int account_id, struct storage_data* p)
 {
-	char_memitemdata_to_sql(p->items, MAX_STORAGE, account_id, TABLE_STORAGE);
+	char_save_queue(p->items, MAX_STORAGE, account_id, TABLE_STORAGE);
 	return 0;
 }
 
@@ -27,6 +27,7 @@ int storage_fromsql(uint32 account_id, struct storage_data* p)
 	StringBuf buf;
 	int i, j;
 
+	char_save_barrier(TABLE_STORAGE, account_id);
 	memset(p, 0, sizeof(struct storage_data)); //clean up memory
 	p->storage_amount = 0;
 
@@ -77,6 +78,7 @@ int ext_storage_fromsql(int account_id, struct extra_storage_data *p)
 	int i;
 	int j;
 
+	char_save_barrier(TABLE_EXT_STORAGE, account_id);
 	memset(p, 0, sizeof(struct extra_storage_data)); //clean up memory
 	p->storage_amount = 0;
 
@@ -189,12 +191,14 @@ void inter_storage_sql_final(void)
 // Delete char storage
 int inter_storage_delete(uint32 account_id)
 {
+	char_save_barrier(TABLE_STORAGE, account_id);
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `account_id`='%d'", schema_config.storage_db, account_id) )
 		Sql_ShowDebug(sql_handle);
 	return 0;
 }
 int inter_rentstorage_delete(int account_id) // [ZephStorage]
 {
+	char_save_barrier(TABLE_EXT_STORAGE, account_id);
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `account_id`='%d'", schema_config.rentstorage_db, account_id) )
 		Sql_ShowDebug(sql_handle);
 	return 0;
@@ -343,6 +347,9 @@ int mapif_parse_itembound_retrieve(int fd)
 	int j, guild_id = RFIFOW(fd,10);
 	uint32 char_id = RFIFOL(fd,2), account_id = RFIFOL(fd,6);
 
+	// Guild bound items are deleted for every character below
+	char_save_flush();
+
 	StringBuf_Init(&buf);
 
 	// Get bound items from player's inventory
@@ -568,6 +568,100 @@ void inter_savereg(uint32 account_id, uint32 char_id, const char *key, unsigned
 	}
 }
 
+/// Rows of a 0x3004 packet, written with one statement per table and kind.
+/// Tables: 0 = account int, 1 = account str, 2 = char int, 3 = char str
+struct inter_regbatch {
+	StringBuf replace[4]; // rows to insert or replace
+	StringBuf remove[4]; // (key,index) pairs to delete
+	int replaces[4], removes[4];
+};
+
+/**
+ * Adds a registry to a batch.
+ * Global account regs aren't stored here and go straight to the login-server.
+ **/
+static void inter_savereg_batch(struct inter_regbatch* batch, uint32 account_id, uint32 char_id, const char *key, unsigned int index, intptr_t val, bool is_string)
+{
+	char esc_key[32*2+1];
+	int t;
+
+	if( key[0] == '#' && key[1] == '#' ) {
+		inter_savereg(account_id,char_id,key,index,val,is_string);
+		return;
+	}
+
+	t = ( key[0] == '#' ? 0 : 2 ) + ( is_string ? 1 : 0 );
+	Sql_EscapeStringLen(sql_handle, esc_key, key, strnlen(key, 32));
+	if( val ) {
+		int owner_id = ( key[0] == '#' ? account_id : char_id );
+
+		if( batch->replaces[t]++ )
+			StringBuf_AppendStr(&batch->replace[t], ",");
+		if( is_string ) {
+			char esc_val[254*2+1];
+
+			Sql_EscapeStringLen(sql_handle, esc_val, (char*)val, strnlen((char*)val, 254));
+			StringBuf_Printf(&batch->replace[t], "('%d','%s','%u','%s')", owner_id, esc_key, index, esc_val);
+		} else
+			StringBuf_Printf(&batch->replace[t], "('%d','%s','%u','%d')", owner_id, esc_key, index, (int)val);
+	} else {
+		if( batch->removes[t]++ )
+			StringBuf_AppendStr(&batch->remove[t], ",");
+		StringBuf_Printf(&batch->remove[t], "('%s','%u')", esc_key, index);
+	}
+}
+
+/**
+ * Writes a batch in one transaction and frees it.
+ **/
+static void inter_savereg_flush(struct inter_regbatch* batch, uint32 account_id, uint32 char_id)
+{
+	const char* tables[4] = { schema_config.acc_reg_num_table, schema_config.acc_reg_str_table, schema_config.char_reg_num_table, schema_config.char_reg_str_table };
+	bool result = true, empty = true;
+	int t;
+
+	for( t = 0; t < 4; t++ )
+		if( batch->replaces[t] || batch->removes[t] )
+			empty = false;
+
+	if( !empty && SQL_ERROR == Sql_QueryStr(sql_handle, "START TRANSACTION") ) {
+		Sql_ShowDebug(sql_handle);
+		result = false;
+	}
+
+	for( t = 0; t < 4 && !empty && result; t++ ) {
+		const char* owner = ( t < 2 ? "account_id" : "char_id" );
+		int owner_id = ( t < 2 ? account_id : char_id );
+		StringBuf buf;
+
+		StringBuf_Init(&buf);
+		if( batch->removes[t] ) {
+			StringBuf_Printf(&buf, "DELETE FROM `%s` WHERE `%s` = '%d' AND (`key`,`index`) IN (%s)", tables[t], owner, owner_id, StringBuf_Value(&batch->remove[t]));
+			if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) ) {
+				Sql_ShowDebug(sql_handle);
+				result = false;
+			}
+			StringBuf_Clear(&buf);
+		}
+		if( batch->replaces[t] && result ) {
+			StringBuf_Printf(&buf, "REPLACE INTO `%s` (`%s`,`key`,`index`,`value`) VALUES %s", tables[t], owner, StringBuf_Value(&batch->replace[t]));
+			if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) ) {
+				Sql_ShowDebug(sql_handle);
+				result = false;
+			}
+		}
+		StringBuf_Destroy(&buf);
+	}
+
+	if( !empty && SQL_ERROR == Sql_QueryStr(sql_handle, result ? "COMMIT" : "ROLLBACK") )
+		Sql_ShowDebug(sql_handle);
+
+	for( t = 0; t < 4; t++ ) {
+		StringBuf_Destroy(&batch->replace[t]);
+		StringBuf_Destroy(&batch->remove[t]);
+	}
+}
+
 // Load account_reg from sql (type=2)
 int inter_accreg_fromsql(uint32 account_id, uint32 char_id, int fd, int type)
 {
@@ -1121,10 +1215,17 @@ int mapif_parse_Registry(int fd)
 		int cursor = 14, i;
 		char key[32], sval[254];
 		bool isLoginActive = session_isActive(login_fd);
+		struct inter_regbatch batch;
 
 		if( isLoginActive )
 			chlogif_upd_global_accreg(account_id,char_id);
 
+		memset(&batch, 0, sizeof(batch));
+		for( i = 0; i < 4; i++ ) {
+			StringBuf_Init(&batch.replace[i]);
+			StringBuf_Init(&batch.remove[i]);
+		}
+
 		for(i = 0; i < count; i++) {
 			unsigned int index;
 			safestrncpy(key, (char*)RFIFOP(fd, cursor + 1), RFIFOB(fd, cursor));
@@ -1136,28 +1237,31 @@ int mapif_parse_Registry(int fd)
 			switch (RFIFOB(fd, cursor++)) {
 				// int
 				case 0:
-					inter_savereg(account_id,char_id,key,index,RFIFOL(fd, cursor),false);
+					inter_savereg_batch(&batch,account_id,char_id,key,index,RFIFOL(fd, cursor),false);
 					cursor += 4;
 					break;
 				case 1:
-					inter_savereg(account_id,char_id,key,index,0,false);
+					inter_savereg_batch(&batch,account_id,char_id,key,index,0,false);
 					break;
 				// str
 				case 2:
 					safestrncpy(sval, (char*)RFIFOP(fd, cursor + 1), RFIFOB(fd, cursor));
 					cursor += RFIFOB(fd, cursor) + 1;
-					inter_savereg(account_id,char_id,key,index,(intptr_t)sval,true);
+					inter_savereg_batch(&batch,account_id,char_id,key,index,(intptr_t)sval,true);
 					break;
 				case 3:
-					inter_savereg(account_id,char_id,key,index,0,true);
+					inter_savereg_batch(&batch,account_id,char_id,key,index,0,true);
 					break;
 				default:
 					ShowError("mapif_parse_Registry: unknown type %d\n",RFIFOB(fd, cursor - 1));
+					inter_savereg_flush(&batch,account_id,char_id); // keep what was read so far
 					return 1;
 			}
 
 		}
 
+		inter_savereg_flush(&batch,account_id,char_id);
+
 		if (isLoginActive)
 			chlogif_prepsend_global_accreg();
 	}
@@ -5,7 +5,7 @@
 #include "winapi.h"
 #else
 #include <pthread.h>
-
+#include <sys/time.h>
 #endif
 
 #include "cbasetypes.h"
@@ -200,7 +200,12 @@ void racond_wait( racond c,  ramutex m,  sysint timeout_ticks){
 		pthread_cond_wait( &c->hCond,  &m->hMutex );
 	}else{
 		struct timespec wtime;
-		int64 exact_timeout = gettick() + timeout_ticks;
+		struct timeval now;
+		int64 exact_timeout;
+
+		// pthread_cond_timedwait expects an absolute wall clock time, gettick() is not
+		gettimeofday(&now, NULL);
+		exact_timeout = (int64)now.tv_sec*1000 + now.tv_usec/1000 + timeout_ticks;
 	
 		wtime.tv_sec = exact_timeout/1000;
 		wtime.tv_nsec = (exact_timeout%1000)*1000000;
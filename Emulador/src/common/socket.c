@@ -32,6 +32,9 @@
 	#ifdef HAVE_SETRLIMIT
 	#include <sys/resource.h>
 	#endif
+	#ifdef SOCKET_EPOLL
+	#include <sys/epoll.h>
+	#endif
 #endif
 
 /////////////////////////////////////////////////////////////////////
@@ -162,6 +165,20 @@ char* sErr(int code)
 #define sFD_ISSET(fd,set) FD_ISSET(fd2sock(fd),set)
 #define sFD_ZERO FD_ZERO
 
+typedef WSABUF sIovec;
+#define sIovecSet(v,p,l) ( (v).buf = (char*)(p), (v).len = (ULONG)(l) )
+
+/// Sends several buffers at once.
+/// Returns the number of bytes sent or SOCKET_ERROR.
+static int sSendv(int fd, sIovec* iov, int count)
+{
+	DWORD sent;
+
+	if( WSASend(fd2sock(fd), iov, count, &sent, 0, NULL, NULL) == SOCKET_ERROR )
+		return SOCKET_ERROR;
+	return (int)sent;
+}
+
 /////////////////////////////////////////////////////////////////////
 #else
 /////////////////////////////////////////////////////////////////////
@@ -194,6 +211,9 @@ char* sErr(int code)
 #define sFD_ISSET FD_ISSET
 #define sFD_ZERO FD_ZERO
 
+typedef struct iovec sIovec;
+#define sIovecSet(v,p,l) ( (v).iov_base = (void*)(p), (v).iov_len = (l) )
+
 /////////////////////////////////////////////////////////////////////
 #endif
 /////////////////////////////////////////////////////////////////////
@@ -202,7 +222,37 @@ char* sErr(int code)
 	#define MSG_NOSIGNAL 0
 #endif
 
+#ifndef WIN32
+/// Sends several buffers at once.
+/// Returns the number of bytes sent or SOCKET_ERROR.
+static int sSendv(int fd, sIovec* iov, int count)
+{
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+	return (int)sendmsg(fd, &msg, MSG_NOSIGNAL);
+}
+#endif
+
+/// Maximum number of buffers handed to sSendv at once.
+#define SEND_IOV_MAX 64
+
+#ifdef SOCKET_EPOLL
+static int epoll_fd = -1;
+static struct epoll_event* epoll_events = NULL;
+static int epoll_maxevents = 1024; // max. number of events fetched per loop
+static time_t epoll_sweep_tick = 0; // last time every session was visited
+/// Sessions whose fifo filled up before the socket was drained.
+static int recv_pending_list[MAXCONN];
+static int recv_pending_count = 0;
+/// Sessions with unparsed input data.
+static int parse_list[MAXCONN];
+static int parse_list_count = 0;
+#else
 fd_set readfds;
+#endif
 int fd_max;
 time_t last_tick;
 time_t stall_time = 60;
@@ -235,12 +285,16 @@ static time_t socket_data_last_tick = 0;
 // The connection is closed if it goes over the limit.
 #define WFIFO_MAX (1*1024*1024)
 
-struct socket_data* session[FD_SETSIZE];
+// Pending data in the write fifo of a client above which it's considered lagged,
+// and redundant packets aren't queued for it anymore. (0 disables)
+static size_t socket_lag_limit = 256*1024;
+
+struct socket_data* session[MAXCONN];
 
 #ifdef SEND_SHORTLIST
-int send_shortlist_array[FD_SETSIZE];// we only support FD_SETSIZE sockets, limit the array to that
+int send_shortlist_array[MAXCONN];// we only support MAXCONN sockets, limit the array to that
 int send_shortlist_count = 0;// how many fd's are in the shortlist
-uint32 send_shortlist_set[(FD_SETSIZE+31)/32];// to know if specific fd's are already in the shortlist
+uint32 send_shortlist_set[(MAXCONN+31)/32];// to know if specific fd's are already in the shortlist
 #endif
 
 static int create_session(int fd, RecvFunc func_recv, SendFunc func_send, ParseFunc func_parse);
@@ -337,6 +391,62 @@ void set_eof(int fd)
 	}
 }
 
+#ifdef SOCKET_EPOLL
+/// Starts watching a socket for incoming data.
+/// Listening sockets are level-triggered so that pending connections keep
+/// being reported until they are accepted, all other sockets are edge-triggered.
+static void socket_watch(int fd, bool listener)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = listener ? EPOLLIN : (EPOLLIN|EPOLLET);
+	ev.data.fd = fd;
+	if( epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0 )
+		ShowError("socket_watch: Failed to add socket #%d to the epoll set (%s)!\n", fd, error_msg());
+}
+
+/// Stops watching a socket.
+static void socket_unwatch(int fd)
+{
+	struct epoll_event ev; // kernels before 2.6.9 require a non-NULL event
+
+	memset(&ev, 0, sizeof(ev));
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+/// Queues a session whose fifo filled up before its socket was drained.
+/// Edge-triggered sockets are not reported again for data that is already
+/// waiting, so it is read on the next loop once the parser made room.
+static void recv_pending_add(int fd)
+{
+	if( session[fd]->flag.recv_pending )
+		return;// already queued
+	if( recv_pending_count >= ARRAYLENGTH(recv_pending_list) ) {
+		ShowDebug("recv_pending_add: list is full, ignoring... (fd=%d)\n", fd);
+		return;
+	}
+	session[fd]->flag.recv_pending = 1;
+	recv_pending_list[recv_pending_count++] = fd;
+}
+
+/// Queues a session for parsing on the next loop.
+static void parse_list_add(int fd)
+{
+	if( session[fd]->flag.parse_queued )
+		return;// already queued
+	if( parse_list_count >= ARRAYLENGTH(parse_list) ) {
+		ShowDebug("parse_list_add: list is full, ignoring... (fd=%d)\n", fd);
+		return;
+	}
+	session[fd]->flag.parse_queued = 1;
+	parse_list[parse_list_count++] = fd;
+}
+#else
+#define socket_watch(fd, listener) sFD_SET((fd), &readfds)
+#define socket_unwatch(fd) sFD_CLR((fd), &readfds)
+#endif
+
 int recv_to_fifo(int fd)
 {
 	int len;
@@ -344,34 +454,160 @@ int recv_to_fifo(int fd)
 	if( !session_isActive(fd) )
 		return -1;
 
-	len = sRecv(fd, (char *) session[fd]->rdata + session[fd]->rdata_size, (int)RFIFOSPACE(fd), 0);
+#ifdef SOCKET_EPOLL
+	if( RFIFOSPACE(fd) == 0 )
+	{// no room left, read once the parser is done with it
+		recv_pending_add(fd);
+		return 0;
+	}
+#endif
 
-	if( len == SOCKET_ERROR )
-	{//An exception has occured
-		if( sErrno != S_EWOULDBLOCK ) {
-			//ShowDebug("recv_to_fifo: %s, closing connection #%d\n", error_msg(), fd);
+	for(;;)
+	{
+		len = sRecv(fd, (char *) session[fd]->rdata + session[fd]->rdata_size, (int)RFIFOSPACE(fd), 0);
+
+		if( len == SOCKET_ERROR )
+		{//An exception has occured
+			if( sErrno != S_EWOULDBLOCK ) {
+				//ShowDebug("recv_to_fifo: %s, closing connection #%d\n", error_msg(), fd);
+				set_eof(fd);
+			}
+			return 0;
+		}
+
+		if( len == 0 )
+		{//Normal connection end.
 			set_eof(fd);
+			return 0;
 		}
-		return 0;
+
+		session[fd]->rdata_size += len;
+		session[fd]->rdata_tick = last_tick;
+#ifdef SHOW_SERVER_STATS
+		socket_data_i += len;
+		socket_data_qi += len;
+		if (!session[fd]->flag.server)
+		{
+			socket_data_ci += len;
+		}
+#endif
+#ifndef SOCKET_EPOLL
+		break;
+#else
+		parse_list_add(fd);
+		if( RFIFOSPACE(fd) == 0 )
+		{// the fifo is full but the socket may still hold data
+			recv_pending_add(fd);
+			break;
+		}
+		// edge-triggered: keep reading until the socket would block
+#endif
 	}
+	return 0;
+}
 
-	if( len == 0 )
-	{//Normal connection end.
-		set_eof(fd);
-		return 0;
+/// Drops the shared packets queued in a session.
+static void socket_wref_clear(struct socket_data* s)
+{
+	int i;
+
+	for( i = s->wref_head; i < s->wref_count; ++i )
+		socket_packet_release(s->wref[i].packet);
+	s->wref_head = s->wref_count = 0;
+	s->wref_sent = 0;
+	s->wshared_size = 0;
+}
+
+/// Sends the write fifo together with the shared packets interleaved in it.
+static int send_from_fifo_shared(int fd)
+{
+	struct socket_data* s = session[fd];
+	sIovec iov[SEND_IOV_MAX];
+	size_t pos = s->wdata_pos, skip = s->wref_sent;
+	int i, n = 0;
+
+	for( i = s->wref_head; i < s->wref_count && n < SEND_IOV_MAX-2; ++i )
+	{
+		struct socket_wref* ref = &s->wref[i];
+
+		if( ref->pos > pos )
+		{// private data before this packet
+			sIovecSet(iov[n], s->wdata + pos, ref->pos - pos);
+			++n;
+			pos = ref->pos;
+		}
+		sIovecSet(iov[n], ref->packet->data + skip, ref->packet->len - skip);
+		++n;
+		skip = 0;
+	}
+	if( i == s->wref_count && pos < s->wdata_size )
+	{// private data after the last packet
+		sIovecSet(iov[n], s->wdata + pos, s->wdata_size - pos);
+		++n;
 	}
 
-	session[fd]->rdata_size += len;
-	session[fd]->rdata_tick = last_tick;
-#ifdef SHOW_SERVER_STATS
-	socket_data_i += len;
-	socket_data_qi += len;
-	if (!session[fd]->flag.server)
+	return sSendv(fd, iov, n);
+}
+
+/// Removes len sent bytes from the front of the send queue.
+/// Only the send offsets move, the sent data is reclaimed later (see socket_wcompact).
+static void socket_wconsume(struct socket_data* s, size_t len)
+{
+	size_t pos = s->wdata_pos;
+	int i = s->wref_head;
+
+	while( len > 0 )
+	{
+		struct socket_wref* ref;
+		size_t n;
+
+		if( i == s->wref_count )
+		{// only private data left
+			pos += len;
+			break;
+		}
+		ref = &s->wref[i];
+
+		n = min(ref->pos - pos, len);
+		pos += n;
+		len -= n;
+		if( len == 0 )
+			break;
+
+		n = min(ref->packet->len - s->wref_sent, len);
+		s->wref_sent += n;
+		s->wshared_size -= n;
+		len -= n;
+		if( s->wref_sent == ref->packet->len )
+		{// packet fully sent
+			socket_packet_release(ref->packet);
+			s->wref_sent = 0;
+			++i;
+		}
+	}
+
+	s->wref_head = i;
+	s->wdata_pos = pos;
+	if( s->wref_head == s->wref_count )
 	{
-		socket_data_ci += len;
+		s->wref_head = s->wref_count = 0;
+		if( s->wdata_pos == s->wdata_size )
+			s->wdata_pos = s->wdata_size = 0; // everything sent
 	}
-#endif
-	return 0;
+}
+
+/// Moves the unsent data of the write fifo to the beginning of the buffer.
+static void socket_wcompact(struct socket_data* s)
+{
+	int i;
+
+	if( s->wdata_pos == 0 )
+		return;
+	memmove(s->wdata, s->wdata + s->wdata_pos, s->wdata_size - s->wdata_pos);
+	s->wdata_size -= s->wdata_pos;
+	for( i = s->wref_head; i < s->wref_count; ++i )
+		s->wref[i].pos -= s->wdata_pos;
+	s->wdata_pos = 0;
 }
 
 int send_from_fifo(int fd)
@@ -381,19 +617,23 @@ int send_from_fifo(int fd)
 	if( !session_isValid(fd) )
 		return -1;
 
-	if( session[fd]->wdata_size == 0 )
+	if( WFIFOPENDING(fd) == 0 )
 		return 0; // nothing to send
 
-	len = sSend(fd, (const char *) session[fd]->wdata, (int)session[fd]->wdata_size, MSG_NOSIGNAL);
+	if( session[fd]->wref_count > 0 )
+		len = send_from_fifo_shared(fd);
+	else
+		len = sSend(fd, (const char *) session[fd]->wdata + session[fd]->wdata_pos, (int)(session[fd]->wdata_size - session[fd]->wdata_pos), MSG_NOSIGNAL);
 
 	if( len == SOCKET_ERROR )
 	{//An exception has occured
 		if( sErrno != S_EWOULDBLOCK ) {
 			//ShowDebug("send_from_fifo: %s, ending connection #%d\n", error_msg(), fd);
 #ifdef SHOW_SERVER_STATS
-			socket_data_qo -= session[fd]->wdata_size;
+			socket_data_qo -= WFIFOPENDING(fd);
 #endif
-			session[fd]->wdata_size = 0; //Clear the send queue as we can't send anymore. [Skotlex]
+			session[fd]->wdata_size = session[fd]->wdata_pos = 0; //Clear the send queue as we can't send anymore. [Skotlex]
+			socket_wref_clear(session[fd]);
 			set_eof(fd);
 		}
 		return 0;
@@ -402,11 +642,8 @@ int send_from_fifo(int fd)
 	if( len > 0 )
 	{
 		// some data could not be transferred?
-		// shift unsent data to the beginning of the queue
-		if( (size_t)len < session[fd]->wdata_size )
-			memmove(session[fd]->wdata, session[fd]->wdata + len, session[fd]->wdata_size - len);
-
-		session[fd]->wdata_size -= len;
+		// the unsent data stays where it is, see socket_wcompact
+		socket_wconsume(session[fd], (size_t)len);
 #ifdef SHOW_SERVER_STATS
 		socket_data_o += len;
 		socket_data_qo -= len;
@@ -456,9 +693,9 @@ int connect_client(int listen_fd)
 		sClose(fd);
 		return -1;
 	}
-	if( fd >= FD_SETSIZE )
+	if( fd >= MAXCONN )
 	{// socket number too big
-		ShowError("connect_client: New socket #%d is greater than can we handle! Increase the value of FD_SETSIZE (currently %d) for your OS to fix this!\n", fd, FD_SETSIZE);
+		ShowError("connect_client: New socket #%d is greater than can we handle! Increase the value of MAXCONN (currently %d) for your OS to fix this!\n", fd, MAXCONN);
 		sClose(fd);
 		return -1;
 	}
@@ -474,7 +711,7 @@ int connect_client(int listen_fd)
 #endif
 
 	if( fd_max <= fd ) fd_max = fd + 1;
-	sFD_SET(fd,&readfds);
+	socket_watch(fd, false);
 
 	create_session(fd, recv_to_fifo, send_from_fifo, default_func_parse);
 	session[fd]->client_addr = ntohl(client_address.sin_addr.s_addr);
@@ -501,9 +738,9 @@ int make_listen_bind(uint32 ip, uint16 port)
 		sClose(fd);
 		return -1;
 	}
-	if( fd >= FD_SETSIZE )
+	if( fd >= MAXCONN )
 	{// socket number too big
-		ShowError("make_listen_bind: New socket #%d is greater than can we handle! Increase the value of FD_SETSIZE (currently %d) for your OS to fix this!\n", fd, FD_SETSIZE);
+		ShowError("make_listen_bind: New socket #%d is greater than can we handle! Increase the value of MAXCONN (currently %d) for your OS to fix this!\n", fd, MAXCONN);
 		sClose(fd);
 		return -1;
 	}
@@ -527,7 +764,7 @@ int make_listen_bind(uint32 ip, uint16 port)
 	}
 
 	if(fd_max <= fd) fd_max = fd + 1;
-	sFD_SET(fd, &readfds);
+	socket_watch(fd, true);
 
 	create_session(fd, connect_client, null_send, null_parse);
 	session[fd]->client_addr = 0; // just listens
@@ -553,9 +790,9 @@ int make_connection(uint32 ip, uint16 port, bool silent,int timeout) {
 		sClose(fd);
 		return -1;
 	}
-	if( fd >= FD_SETSIZE )
+	if( fd >= MAXCONN )
 	{// socket number too big
-		ShowError("make_connection: New socket #%d is greater than can we handle! Increase the value of FD_SETSIZE (currently %d) for your OS to fix this!\n", fd, FD_SETSIZE);
+		ShowError("make_connection: New socket #%d is greater than can we handle! Increase the value of MAXCONN (currently %d) for your OS to fix this!\n", fd, MAXCONN);
 		sClose(fd);
 		return -1;
 	}
@@ -580,7 +817,7 @@ int make_connection(uint32 ip, uint16 port, bool silent,int timeout) {
 	set_nonblocking(fd, 1);
 
 	if (fd_max <= fd) fd_max = fd + 1;
-	sFD_SET(fd,&readfds);
+	socket_watch(fd, false);
 
 	create_session(fd, recv_to_fifo, send_from_fifo, default_func_parse);
 	session[fd]->client_addr = ntohl(remote_address.sin_addr.s_addr);
@@ -608,8 +845,12 @@ static void delete_session(int fd)
 	{
 #ifdef SHOW_SERVER_STATS
 		socket_data_qi -= session[fd]->rdata_size - session[fd]->rdata_pos;
-		socket_data_qo -= session[fd]->wdata_size;
+		socket_data_qo -= WFIFOPENDING(fd);
 #endif
+		if( session[fd]->wqueue_dropped )
+			ShowInfo("Connection #%d (%d.%d.%d.%d) was lagged, %u packets dropped (write queue peak: %u bytes).\n", fd, CONVIP(session[fd]->client_addr), session[fd]->wqueue_dropped, (unsigned int)session[fd]->wqueue_peak);
+		socket_wref_clear(session[fd]);
+		aFree(session[fd]->wref);
 		aFree(session[fd]->rdata);
 		aFree(session[fd]->wdata);
 		aFree(session[fd]->session_data);
@@ -628,6 +869,7 @@ int realloc_fifo(int fd, unsigned int rfifo_size, unsigned int wfifo_size)
 		session[fd]->max_rdata  = rfifo_size;
 	}
 
+	socket_wcompact(session[fd]);
 	if( session[fd]->max_wdata != wfifo_size && session[fd]->wdata_size < wfifo_size) {
 		RECREATE(session[fd]->wdata, unsigned char, wfifo_size);
 		session[fd]->max_wdata  = wfifo_size;
@@ -637,27 +879,36 @@ int realloc_fifo(int fd, unsigned int rfifo_size, unsigned int wfifo_size)
 
 int realloc_writefifo(int fd, size_t addition)
 {
+	struct socket_data* s;
 	size_t newsize;
 
 	if( !session_isValid(fd) ) // might not happen
 		return 0;
 
-	if( session[fd]->wdata_size + addition  > session[fd]->max_wdata )
-	{	// grow rule; grow in multiples of WFIFO_SIZE
-		newsize = WFIFO_SIZE;
-		while( session[fd]->wdata_size + addition > newsize ) newsize += WFIFO_SIZE;
+	s = session[fd];
+
+	// reclaim the sent data once it's at least as big as the unsent data,
+	// so every byte is moved at most once for each time it's sent
+	if( s->wdata_size + addition > s->max_wdata && s->wdata_pos > 0 && s->wdata_pos >= s->wdata_size - s->wdata_pos )
+		socket_wcompact(s);
+
+	if( s->wdata_size + addition > s->max_wdata )
+	{	// grow rule; double the size, starting from WFIFO_SIZE
+		newsize = max(s->max_wdata, (size_t)WFIFO_SIZE);
+		while( s->wdata_size + addition > newsize ) newsize *= 2;
 	}
 	else
-	if( session[fd]->max_wdata >= (size_t)2*(session[fd]->flag.server?FIFOSIZE_SERVERLINK:WFIFO_SIZE)
-		&& (session[fd]->wdata_size+addition)*4 < session[fd]->max_wdata )
+	if( s->max_wdata >= (size_t)2*(s->flag.server?FIFOSIZE_SERVERLINK:WFIFO_SIZE)
+		&& (s->wdata_size-s->wdata_pos+addition)*4 < s->max_wdata )
 	{	// shrink rule, shrink by 2 when only a quarter of the fifo is used, don't shrink below nominal size.
-		newsize = session[fd]->max_wdata / 2;
+		socket_wcompact(s);
+		newsize = s->max_wdata / 2;
 	}
 	else // no change
 		return 0;
 
-	RECREATE(session[fd]->wdata, unsigned char, newsize);
-	session[fd]->max_wdata  = newsize;
+	RECREATE(s->wdata, unsigned char, newsize);
+	s->max_wdata  = newsize;
 
 	return 0;
 }
@@ -726,7 +977,7 @@ int WFIFOSET(int fd, size_t len)
 			return 0;
 		}
 
-		if( s->wdata_size+len > WFIFO_MAX ) {// reached maximum write fifo size
+		if( WFIFOPENDING(fd)+len > WFIFO_MAX ) {// reached maximum write fifo size
 			ShowError("WFIFOSET: Maximum write buffer size for client connection %d exceeded, most likely caused by packet 0x%04x (len=%u, ip=%lu.%lu.%lu.%lu).\n", fd, WFIFOW(fd,0), len, CONVIP(s->client_addr));
 			set_eof(fd);
 			return 0;
@@ -734,11 +985,13 @@ int WFIFOSET(int fd, size_t len)
 
 	}
 	s->wdata_size += len;
+	if( WFIFOPENDING(fd) > s->wqueue_peak )
+		s->wqueue_peak = WFIFOPENDING(fd);
 #ifdef SHOW_SERVER_STATS
 	socket_data_qo += len;
 #endif
 	//If the interserver has 200% of its normal size full, flush the data.
-	if( s->flag.server && s->wdata_size >= 2*FIFOSIZE_SERVERLINK )
+	if( s->flag.server && s->wdata_size - s->wdata_pos >= 2*FIFOSIZE_SERVERLINK )
 		flush_fifo(fd);
 
 	// always keep a WFIFO_SIZE reserve in the buffer
@@ -755,10 +1008,136 @@ int WFIFOSET(int fd, size_t len)
 	return 0;
 }
 
+/// Creates a shared packet from an encoded packet.
+/// The caller holds the first reference.
+struct socket_packet* socket_packet_create(const uint8* buf, size_t len)
+{
+	struct socket_packet* packet = (struct socket_packet*)aMalloc(sizeof(struct socket_packet) + len - 1);
+
+	packet->refcount = 1;
+	packet->len = len;
+	memcpy(packet->data, buf, len);
+	return packet;
+}
+
+/// Drops a reference to a shared packet, freeing it with the last one.
+void socket_packet_release(struct socket_packet* packet)
+{
+	if( --packet->refcount == 0 )
+		aFree(packet);
+}
+
+/// Queues a shared packet in the write fifo of a session.
+/// Same checks as WFIFOSET, but the session only keeps a reference to the packet.
+int WFIFOPACKET(int fd, struct socket_packet* packet)
+{
+	struct socket_data* s = session[fd];
+
+	if( !session_isValid(fd) || s->wdata == NULL || packet->len == 0 )
+		return 0;
+
+	if( !s->flag.server ) {
+
+		if( packet->len > socket_max_client_packet ) {// see declaration of socket_max_client_packet for details
+			ShowError("WFIFOPACKET: Dropped too large client packet 0x%04x (length=%u, max=%u).\n", RBUFW(packet->data,0), (unsigned int)packet->len, socket_max_client_packet);
+			return 0;
+		}
+
+		if( WFIFOPENDING(fd)+packet->len > WFIFO_MAX ) {// reached maximum write fifo size
+			ShowError("WFIFOPACKET: Maximum write buffer size for client connection %d exceeded, most likely caused by packet 0x%04x (len=%u, ip=%lu.%lu.%lu.%lu).\n", fd, RBUFW(packet->data,0), (unsigned int)packet->len, CONVIP(s->client_addr));
+			set_eof(fd);
+			return 0;
+		}
+
+	}
+
+	if( s->wref_count == s->wref_max )
+	{
+		if( s->wref_head > 0 && s->wref_head >= s->wref_count - s->wref_head )
+		{// reclaim the entries already sent
+			s->wref_count -= s->wref_head;
+			memmove(s->wref, s->wref + s->wref_head, s->wref_count * sizeof(struct socket_wref));
+			s->wref_head = 0;
+		}
+		else
+		{
+			s->wref_max = ( s->wref_max ) ? s->wref_max*2 : 8;
+			RECREATE(s->wref, struct socket_wref, s->wref_max);
+		}
+	}
+	s->wref[s->wref_count].packet = packet;
+	s->wref[s->wref_count].pos = s->wdata_size;
+	++s->wref_count;
+	++packet->refcount;
+	s->wshared_size += packet->len;
+	if( WFIFOPENDING(fd) > s->wqueue_peak )
+		s->wqueue_peak = WFIFOPENDING(fd);
+#ifdef SHOW_SERVER_STATS
+	socket_data_qo += packet->len;
+#endif
+
+#ifdef SEND_SHORTLIST
+	send_shortlist_add_fd(fd);
+#endif
+
+	return 0;
+}
+
+/// Tells whether a client has fallen so far behind (see socket_lag_limit),
+/// that a packet the next update supersedes anyway shouldn't be queued for it.
+/// The packet is counted as dropped.
+bool session_droppacket(int fd)
+{
+	struct socket_data* s = session[fd];
+
+	if( socket_lag_limit == 0 || !session_isActive(fd) || s->flag.server || WFIFOPENDING(fd) <= socket_lag_limit )
+		return false;
+
+	s->wqueue_dropped++;
+	return true;
+}
+
+/// Parses the input data of a session.
+static void session_parse(int fd)
+{
+	session[fd]->func_parse(fd);
+
+	if(!session[fd])
+		return;
+
+	// after parse, check client's RFIFO size to know if there is an invalid packet (too big and not parsed)
+	if (session[fd]->rdata_size == RFIFO_SIZE && session[fd]->max_rdata == RFIFO_SIZE) {
+		set_eof(fd);
+		return;
+	}
+	RFIFOFLUSH(fd);
+#ifdef SOCKET_EPOLL
+	// incomplete or deferred packets are parsed again on the next loop
+	if( session[fd]->rdata_size && !session[fd]->flag.eof )
+		parse_list_add(fd);
+#endif
+}
+
+/// Checks whether a session stalled for too long.
+static void session_check_timeout(int fd)
+{
+	if (session[fd]->rdata_tick && DIFF_TICK(last_tick, session[fd]->rdata_tick) > stall_time) {
+		if( session[fd]->flag.server ) {/* server is special */
+			if( session[fd]->flag.ping != 2 )/* only update if necessary otherwise it'd resend the ping unnecessarily */
+				session[fd]->flag.ping = 1;
+		} else {
+			ShowInfo("Session #%d timed out\n", fd);
+			set_eof(fd);
+		}
+	}
+}
+
 int do_sockets(int next)
 {
+#ifndef SOCKET_EPOLL
 	fd_set rfd;
 	struct timeval timeout;
+#endif
 	int ret,i;
 
 	// PRESEND Timers are executed before do_sendrecv and can send packets and/or set sessions to eof.
@@ -771,23 +1150,35 @@ int do_sockets(int next)
 		if(!session[i])
 			continue;
 
-		if(session[i]->wdata_size)
+		if(WFIFOPENDING(i))
 			session[i]->func_send(i);
 	}
 #endif
 
+#ifdef SOCKET_EPOLL
+	// don't wait when data is already known to be waiting
+	if( recv_pending_count > 0 )
+		next = 0;
+
+	ret = epoll_wait(epoll_fd, epoll_events, epoll_maxevents, next);
+#else
 	// can timeout until the next tick
 	timeout.tv_sec  = next/1000;
 	timeout.tv_usec = next%1000*1000;
 
 	memcpy(&rfd, &readfds, sizeof(rfd));
 	ret = sSelect(fd_max, &rfd, NULL, NULL, &timeout);
+#endif
 
 	if( ret == SOCKET_ERROR )
 	{
 		if( sErrno != S_EINTR )
 		{
+#ifdef SOCKET_EPOLL
+			ShowFatalError("do_sockets: epoll_wait() failed, %s!\n", error_msg());
+#else
 			ShowFatalError("do_sockets: select() failed, %s!\n", error_msg());
+#endif
 			exit(EXIT_FAILURE);
 		}
 		return 0; // interrupted by a signal, just loop and try again
@@ -795,7 +1186,28 @@ int do_sockets(int next)
 
 	last_tick = time(NULL);
 
-#if defined(WIN32)
+#if defined(SOCKET_EPOLL)
+	// read the data left behind by full fifos on the previous loop
+	{
+		int n = recv_pending_count;
+		recv_pending_count = 0;
+		for( i = 0; i < n; ++i )
+		{
+			int fd = recv_pending_list[i];
+			if( !session[fd] || !session[fd]->flag.recv_pending )
+				continue;// closed or already handled
+			session[fd]->flag.recv_pending = 0;
+			session[fd]->func_recv(fd);
+		}
+	}
+
+	for( i = 0; i < ret; ++i )
+	{
+		int fd = epoll_events[i].data.fd;
+		if( session[fd] )
+			session[fd]->func_recv(fd);
+	}
+#elif defined(WIN32)
 	// on windows, enumerating all members of the fd_set is way faster if we access the internals
 	for( i = 0; i < (int)rfd.fd_count; ++i )
 	{
@@ -824,7 +1236,7 @@ int do_sockets(int next)
 		if(!session[i])
 			continue;
 
-		if(session[i]->wdata_size)
+		if(WFIFOPENDING(i))
 			session[i]->func_send(i);
 
 		if(session[i]->flag.eof) //func_send can't free a session, this is safe.
@@ -834,41 +1246,57 @@ int do_sockets(int next)
 	}
 #endif
 
+#ifdef SOCKET_EPOLL
+	if( last_tick == epoll_sweep_tick )
+	{// parse input data only on the sessions that have some
+		int n = parse_list_count;
+		parse_list_count = 0;
+		for( i = 0; i < n; ++i )
+		{
+			int fd = parse_list[i];
+			if( !session[fd] || !session[fd]->flag.parse_queued )
+				continue;// closed or already handled
+			session[fd]->flag.parse_queued = 0;
+			session_parse(fd);
+		}
+	}
+	else
+	{// once per second, visit every session for timeouts and keepalives
+		epoll_sweep_tick = last_tick;
+		parse_list_count = 0;
+		for(i = 1; i < fd_max; i++)
+		{
+			if(!session[i])
+				continue;
+			session[i]->flag.parse_queued = 0;
+			session_check_timeout(i);
+			session_parse(i);
+		}
+	}
+#else
 	// parse input data on each socket
 	for(i = 1; i < fd_max; i++)
 	{
 		if(!session[i])
 			continue;
 
-		if (session[i]->rdata_tick && DIFF_TICK(last_tick, session[i]->rdata_tick) > stall_time) {
-			if( session[i]->flag.server ) {/* server is special */
-				if( session[i]->flag.ping != 2 )/* only update if necessary otherwise it'd resend the ping unnecessarily */
-					session[i]->flag.ping = 1;
-			} else {
-				ShowInfo("Session #%d timed out\n", i);
-				set_eof(i);
-			}
-		}
-
-		session[i]->func_parse(i);
-
-		if(!session[i])
-			continue;
-
-		// after parse, check client's RFIFO size to know if there is an invalid packet (too big and not parsed)
-		if (session[i]->rdata_size == RFIFO_SIZE && session[i]->max_rdata == RFIFO_SIZE) {
-			set_eof(i);
-			continue;
-		}
-		RFIFOFLUSH(i);
+		session_check_timeout(i);
+		session_parse(i);
 	}
+#endif
 
 #ifdef SHOW_SERVER_STATS
 	if (last_tick != socket_data_last_tick)
 	{
 		char buf[1024];
+		int lagged = 0;
+
+		if( socket_lag_limit )
+			for( i = 1; i < fd_max; i++ )
+				if( session[i] && !session[i]->flag.server && WFIFOPENDING(i) > socket_lag_limit )
+					lagged++;
 		
-		sprintf(buf, "In: %.03f kB/s (%.03f kB/s, Q: %.03f kB) | Out: %.03f kB/s (%.03f kB/s, Q: %.03f kB) | RAM: %.03f MB", socket_data_i/1024., socket_data_ci/1024., socket_data_qi/1024., socket_data_o/1024., socket_data_co/1024., socket_data_qo/1024., malloc_usage()/1024.);
+		sprintf(buf, "In: %.03f kB/s (%.03f kB/s, Q: %.03f kB) | Out: %.03f kB/s (%.03f kB/s, Q: %.03f kB, lagged: %d) | RAM: %.03f MB", socket_data_i/1024., socket_data_ci/1024., socket_data_qi/1024., socket_data_o/1024., socket_data_co/1024., socket_data_qo/1024., lagged, malloc_usage()/1024.);
 #ifdef _WIN32
 		SetConsoleTitle(buf);
 #else
@@ -1144,6 +1572,15 @@ int socket_config_read(const char* cfgName)
 			if( stall_time < 3 )
 				stall_time = 3;/* a minimum is required to refrain it from killing itself */
 		}
+		else if (!strcmpi(w1, "client_lag_limit"))
+			socket_lag_limit = (size_t)max(atoi(w2), 0) * 1024;
+#ifdef SOCKET_EPOLL
+		else if (!strcmpi(w1, "epoll_maxevents")) {
+			epoll_maxevents = atoi(w2);
+			if( epoll_maxevents < 1 )
+				epoll_maxevents = 1;
+		}
+#endif
 #ifndef MINICORE
 		else if (!strcmpi(w1, "enable_ip_rules")) {
 			ip_rules = config_switch(w2);
@@ -1212,6 +1649,15 @@ void socket_final(void)
 		if(session[i])
 			do_close(i);
 
+#ifdef SOCKET_EPOLL
+	if( epoll_fd != -1 ) {
+		sClose(epoll_fd);
+		epoll_fd = -1;
+	}
+	aFree(epoll_events);
+	epoll_events = NULL;
+#endif
+
 	// session[0]
 	aFree(session[0]->rdata);
 	aFree(session[0]->wdata);
@@ -1223,11 +1669,11 @@ void socket_final(void)
 /// Closes a socket.
 void do_close(int fd)
 {
-	if( fd <= 0 ||fd >= FD_SETSIZE )
+	if( fd <= 0 ||fd >= MAXCONN )
 		return;// invalid
 
 	flush_fifo(fd); // Try to send what's left (although it might not succeed since it's a nonblocking socket)
-	sFD_CLR(fd, &readfds);// this needs to be done before closing the socket
+	socket_unwatch(fd);// this needs to be done before closing the socket
 	sShutdown(fd, SHUT_RDWR); // Disallow further reads/writes
 	sClose(fd); // We don't really care if these closing functions return an error, we are just shutting down and not reusing this socket.
 	if (session[fd]) delete_session(fd);
@@ -1322,7 +1768,7 @@ int socket_getips(uint32* ips, int max)
 void socket_init(void)
 {
 	char *SOCKET_CONF_FILENAME = "conf/packet_athena.conf";
-	unsigned int rlim_cur = FD_SETSIZE;
+	unsigned int rlim_cur = MAXCONN;
 
 #ifdef WIN32
 	{// Start up windows networking
@@ -1342,14 +1788,14 @@ void socket_init(void)
 #elif defined(HAVE_SETRLIMIT) && !defined(CYGWIN)
 	// NOTE: getrlimit and setrlimit have bogus behaviour in cygwin.
 	//       "Number of fds is virtually unlimited in cygwin" (sys/param.h)
-	{// set socket limit to FD_SETSIZE
+	{// set socket limit to MAXCONN
 		struct rlimit rlp;
 		if( 0 == getrlimit(RLIMIT_NOFILE, &rlp) )
 		{
-			rlp.rlim_cur = FD_SETSIZE;
+			rlp.rlim_cur = MAXCONN;
 			if( 0 != setrlimit(RLIMIT_NOFILE, &rlp) )
 			{// failed, try setting the maximum too (permission to change system limits is required)
-				rlp.rlim_max = FD_SETSIZE;
+				rlp.rlim_max = MAXCONN;
 				if( 0 != setrlimit(RLIMIT_NOFILE, &rlp) )
 				{// failed
 					const char *errmsg = error_msg();
@@ -1362,7 +1808,7 @@ void socket_init(void)
 					// report limit
 					getrlimit(RLIMIT_NOFILE, &rlp);
 					rlim_cur = rlp.rlim_cur;
-					ShowWarning("socket_init: failed to set socket limit to %d, setting to maximum allowed (original limit=%d, current limit=%d, maximum allowed=%d, %s).\n", FD_SETSIZE, rlim_ori, (int)rlp.rlim_cur, (int)rlp.rlim_max, errmsg);
+					ShowWarning("socket_init: failed to set socket limit to %d, setting to maximum allowed (original limit=%d, current limit=%d, maximum allowed=%d, %s).\n", MAXCONN, rlim_ori, (int)rlp.rlim_cur, (int)rlp.rlim_max, errmsg);
 				}
 			}
 		}
@@ -1372,13 +1818,24 @@ void socket_init(void)
 	// Get initial local ips
 	naddr_ = socket_getips(addr_,16);
 
+#ifndef SOCKET_EPOLL
 	sFD_ZERO(&readfds);
+#endif
 #if defined(SEND_SHORTLIST)
 	memset(send_shortlist_set, 0, sizeof(send_shortlist_set));
 #endif
 
 	socket_config_read(SOCKET_CONF_FILENAME);
 
+#ifdef SOCKET_EPOLL
+	epoll_fd = epoll_create(MAXCONN);
+	if( epoll_fd == -1 ) {
+		ShowFatalError("socket_init: Failed to create the epoll event dispatcher (%s)!\n", error_msg());
+		exit(EXIT_FAILURE);
+	}
+	CREATE(epoll_events, struct epoll_event, epoll_maxevents);
+#endif
+
 	// initialise last send-receive tick
 	last_tick = time(NULL);
 
@@ -1399,7 +1856,7 @@ void socket_init(void)
 
 bool session_isValid(int fd)
 {
-	return ( fd > 0 && fd < FD_SETSIZE && session[fd] != NULL );
+	return ( fd > 0 && fd < MAXCONN && session[fd] != NULL );
 }
 
 bool session_isActive(int fd)
@@ -1414,6 +1871,151 @@ uint32 host2ip(const char* hostname)
 	return (h != NULL) ? ntohl(*(uint32*)h->h_addr) : 0;
 }
 
+/// Reads a big endian 16/32-bit value of a DNS message.
+#define DNS_W(p) ( (uint16)(((p)[0]<<8)|(p)[1]) )
+#define DNS_L(p) ( ((uint32)DNS_W(p)<<16)|DNS_W((p)+2) )
+
+/// Skips a (possibly compressed) name of a DNS message, returns NULL if it's invalid.
+static const uint8* dns_skip_name(const uint8* p, const uint8* end)
+{
+	while( p < end )
+	{
+		if( (*p&0xC0) == 0xC0 )
+			return ( p + 2 <= end ) ? p + 2 : NULL;
+		if( *p == 0 )
+			return p + 1;
+		p += *p + 1;
+	}
+	return NULL;
+}
+
+/// Resolves the A record of a hostname with an UDP query to a DNS server.
+/// Blocks up to 'timeout' ms, doesn't use the memory manager and is thread-safe.
+/// @param server DNS server (host byte order), 0 uses the system resolver
+/// @param ttl set to the time to live of the answer in seconds, 0 when unknown
+/// @return 1 if the name resolved, 0 if it doesn't exist, -1 on error or timeout
+int host2ip_query(const char* hostname, uint32 server, uint16 port, int timeout, uint32* ip, uint32* ttl)
+{
+	uint8 buf[512];
+	const uint8* p;
+	const uint8* end;
+	struct sockaddr_in addr;
+	size_t len = 12;
+	uint16 id, count;
+	int n, result = -1;
+#ifdef WIN32
+	SOCKET s;
+	DWORD tv = (DWORD)timeout;
+#else
+	int s;
+	struct timeval tv;
+#endif
+
+	*ip = *ttl = 0;
+	if( server == 0 )
+	{
+#ifdef WIN32
+		struct hostent* h = gethostbyname(hostname); // thread-local result on windows
+		if( h == NULL )
+			return ( WSAGetLastError() == WSAHOST_NOT_FOUND || WSAGetLastError() == WSANO_DATA ) ? 0 : -1;
+		*ip = ntohl(*(uint32*)h->h_addr);
+		return 1;
+#else
+		struct addrinfo hints, *res = NULL;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		n = getaddrinfo(hostname, NULL, &hints, &res);
+		if( n != 0 )
+			return ( n == EAI_NONAME
+#ifdef EAI_NODATA
+				|| n == EAI_NODATA
+#endif
+				) ? 0 : -1;
+		*ip = ntohl(((struct sockaddr_in*)res->ai_addr)->sin_addr.s_addr);
+		freeaddrinfo(res);
+		return 1;
+#endif
+	}
+
+	// query: header, question (labels, type A, class IN)
+	id = (uint16)(time(NULL) ^ (intptr_t)&buf ^ (uint32)strlen(hostname));
+	memset(buf, 0, 12);
+	buf[0] = (uint8)(id>>8); buf[1] = (uint8)id;
+	buf[2] = 0x01; // recursion desired
+	buf[5] = 1; // one question
+	while( *hostname )
+	{
+		const char* dot = strchr(hostname, '.');
+		size_t label = dot ? (size_t)(dot - hostname) : strlen(hostname);
+
+		if( label == 0 || label > 63 || len + label + 1 + 5 > sizeof(buf) )
+			return -1;
+		buf[len++] = (uint8)label;
+		memcpy(buf + len, hostname, label);
+		len += label;
+		hostname += label + (dot ? 1 : 0);
+	}
+	buf[len++] = 0;
+	buf[len++] = 0; buf[len++] = 1; // A
+	buf[len++] = 0; buf[len++] = 1; // IN
+
+	s = socket(AF_INET, SOCK_DGRAM, 0);
+#ifdef WIN32
+	if( s == INVALID_SOCKET )
+		return -1;
+#else
+	if( s < 0 )
+		return -1;
+	tv.tv_sec = timeout/1000;
+	tv.tv_usec = (timeout%1000)*1000;
+#endif
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(server);
+	addr.sin_port = htons(port);
+
+	if( sendto(s, (const char*)buf, (int)len, 0, (struct sockaddr*)&addr, sizeof(addr)) == (int)len )
+	{
+		// answers to other queries are ignored, the receive timeout ends the wait
+		while( (n = recvfrom(s, (char*)buf, sizeof(buf), 0, NULL, NULL)) >= 12 )
+		{
+			if( DNS_W(buf) != id || !(buf[2]&0x80) )
+				continue;
+			if( (buf[3]&0x0F) == 3 ) // NXDOMAIN
+				result = 0;
+			else if( (buf[3]&0x0F) == 0 )
+			{ // skip the questions, then look for an A record
+				end = buf + n;
+				p = buf + 12;
+				for( count = DNS_W(buf+4); count > 0 && p != NULL; count-- )
+					p = ( (p = dns_skip_name(p, end)) != NULL && p + 4 <= end ) ? p + 4 : NULL;
+				result = 0; // no data
+				for( count = DNS_W(buf+6); count > 0 && p != NULL; count-- )
+				{
+					if( (p = dns_skip_name(p, end)) == NULL || p + 10 > end || p + 10 + DNS_W(p+8) > end )
+						break;
+					if( DNS_W(p) == 1 && DNS_W(p+2) == 1 && DNS_W(p+8) == 4 )
+					{
+						*ttl = DNS_L(p+4);
+						*ip = DNS_L(p+10);
+						result = 1;
+						break;
+					}
+					p += 10 + DNS_W(p+8);
+				}
+			}
+			break;
+		}
+	}
+#ifdef WIN32
+	closesocket(s);
+#else
+	close(s);
+#endif
+	return result;
+}
+
 // Converts a numeric ip into a dot-formatted string.
 // Result is placed either into a user-provided buffer or a static system buffer.
 const char* ip2str(uint32 ip, char ip_str[16])
@@ -1481,7 +2083,7 @@ void send_shortlist_do_sends()
 		send_shortlist_array[i] = send_shortlist_array[send_shortlist_count];
 		send_shortlist_array[send_shortlist_count] = 0;
 
-		if( fd <= 0 || fd >= FD_SETSIZE )
+		if( fd <= 0 || fd >= MAXCONN )
 		{
 			ShowDebug("send_shortlist_do_sends: fd is out of range, corrupted memory? (fd=%d)\n", fd);
 			continue;
@@ -1497,7 +2099,7 @@ void send_shortlist_do_sends()
 		if( session[fd] )
 		{
 			// Send data
-			if( session[fd]->wdata_size )
+			if( WFIFOPENDING(fd) )
 				session[fd]->func_send(fd);
 
 			// If it's been marked as eof, call the parse func on it so that
@@ -1507,7 +2109,7 @@ void send_shortlist_do_sends()
 
 			// If the session still exists, is not eof and has things left to
 			// be sent from it we'll re-add it to the shortlist.
-			if( session[fd] && !session[fd]->flag.eof && session[fd]->wdata_size )
+			if( session[fd] && !session[fd]->flag.eof && WFIFOPENDING(fd) )
 				send_shortlist_add_fd(fd);
 		}
 	}
@@ -17,6 +17,27 @@
 
 #include <time.h>
 
+/// Use epoll instead of select() to wait for socket events (Linux only).
+/// Sessions are watched edge-triggered, so each loop only visits the sessions
+/// that actually became ready, and the number of sessions is no longer bound
+/// by FD_SETSIZE. Define SOCKET_SELECT to fall back to select().
+#if defined(__linux__) && !defined(SOCKET_SELECT)
+	#define SOCKET_EPOLL
+#endif
+
+/// Maximum number of concurrent sessions.
+/// select() can't watch fds past FD_SETSIZE, so that bound always wins without epoll.
+#ifndef MAXCONN
+	#ifdef SOCKET_EPOLL
+		#define MAXCONN 65536
+	#else
+		#define MAXCONN FD_SETSIZE
+	#endif
+#elif !defined(SOCKET_EPOLL) && MAXCONN > FD_SETSIZE
+	#undef MAXCONN
+	#define MAXCONN FD_SETSIZE
+#endif
+
 #define FIFOSIZE_SERVERLINK 256*1024
 
 // socket I/O macros
@@ -35,6 +56,7 @@
 #define WFIFOQ(fd,pos) (*(uint64*)WFIFOP(fd,pos))
 #define RFIFOSPACE(fd) (session[fd]->max_rdata - session[fd]->rdata_size)
 #define WFIFOSPACE(fd) (session[fd]->max_wdata - session[fd]->wdata_size)
+#define WFIFOPENDING(fd) (session[fd]->wdata_size - session[fd]->wdata_pos + session[fd]->wshared_size) // bytes waiting to be sent
 
 #define RFIFOREST(fd)  (session[fd]->flag.eof ? 0 : session[fd]->rdata_size - session[fd]->rdata_pos)
 #define RFIFOFLUSH(fd) \
@@ -71,12 +93,30 @@ typedef int (*RecvFunc)(int fd);
 typedef int (*SendFunc)(int fd);
 typedef int (*ParseFunc)(int fd);
 
+/// Encoded packet shared by several sessions.
+/// Sessions queue a reference to it instead of a copy (see WFIFOPACKET).
+struct socket_packet
+{
+	int refcount;
+	size_t len;
+	uint8 data[1];
+};
+
+/// Shared packet queued in a session, sent after the first pos bytes of wdata.
+struct socket_wref
+{
+	struct socket_packet* packet;
+	size_t pos;
+};
+
 struct socket_data
 {
 	struct {
 		unsigned char eof : 1;
 		unsigned char server : 1;
 		unsigned char ping : 2;
+		unsigned char recv_pending : 1; // fifo filled up before the socket was drained (epoll)
+		unsigned char parse_queued : 1; // queued for parsing on the next loop (epoll)
 	} flag;
 
 	uint32 client_addr; // remote client address
@@ -85,8 +125,17 @@ struct socket_data
 	size_t max_rdata, max_wdata;
 	size_t rdata_size, wdata_size;
 	size_t rdata_pos;
+	size_t wdata_pos; // bytes of wdata already sent; the sent prefix is reclaimed by realloc_writefifo
 	time_t rdata_tick; // time of last recv (for detecting timeouts); zero when timeout is disabled
 
+	struct socket_wref* wref; // shared packets interleaved with wdata, in send order
+	int wref_head; // wref entries already sent
+	int wref_count, wref_max;
+	size_t wref_sent; // bytes of wref[wref_head], the first unsent entry, already sent
+	size_t wshared_size; // bytes of the shared packets waiting to be sent
+	size_t wqueue_peak; // most bytes ever waiting to be sent
+	unsigned int wqueue_dropped; // packets dropped while lagged (see session_droppacket)
+
 	RecvFunc func_recv;
 	SendFunc func_send;
 	ParseFunc func_parse;
@@ -97,7 +146,7 @@ struct socket_data
 
 // Data prototype declaration
 
-extern struct socket_data* session[FD_SETSIZE];
+extern struct socket_data* session[MAXCONN];
 
 extern int fd_max;
 
@@ -117,7 +166,11 @@ int make_connection(uint32 ip, uint16 port, bool silent, int timeout);
 int realloc_fifo(int fd, unsigned int rfifo_size, unsigned int wfifo_size);
 int realloc_writefifo(int fd, size_t addition);
 int WFIFOSET(int fd, size_t len);
+int WFIFOPACKET(int fd, struct socket_packet* packet);
+struct socket_packet* socket_packet_create(const uint8* buf, size_t len);
+void socket_packet_release(struct socket_packet* packet);
 int RFIFOSKIP(int fd, size_t len);
+bool session_droppacket(int fd);
 
 int do_sockets(int next);
 void do_close(int fd);
@@ -150,6 +203,7 @@ enum chrif_req_op {
 
 // hostname/ip conversion functions
 uint32 host2ip(const char* hostname);
+int host2ip_query(const char* hostname, uint32 server, uint16 port, int timeout, uint32* ip, uint32* ttl);
 const char* ip2str(uint32 ip, char ip_str[16]);
 uint32 str2ip(const char* ip_str);
 #define CONVIP(ip) ((ip)>>24)&0xFF,((ip)>>16)&0xFF,((ip)>>8)&0xFF,((ip)>>0)&0xFF
@@ -85,6 +85,7 @@ Sql* Sql_Malloc(void)
 
 
 static int Sql_P_Keepalive(Sql* self);
+static int Sql_P_KeepaliveTimer(int tid, unsigned int tick, int id, intptr_t data);
 
 /**
  * Establishes a connection to schema
@@ -192,6 +193,34 @@ int Sql_Ping(Sql* self)
 
 
 
+/// Stops the periodic ping of the connection.
+void Sql_DisableKeepalive(Sql* self)
+{
+	if( self && self->keepalive != INVALID_TIMER )
+	{
+		delete_timer(self->keepalive, Sql_P_KeepaliveTimer);
+		self->keepalive = INVALID_TIMER;
+	}
+}
+
+
+
+/// Prepares the calling thread to use the mysql library.
+void Sql_ThreadInit(void)
+{
+	mysql_thread_init();
+}
+
+
+
+/// Releases the mysql library data of the calling thread.
+void Sql_ThreadEnd(void)
+{
+	mysql_thread_end();
+}
+
+
+
 /// Wrapper function for Sql_Ping.
 ///
 /// @private
@@ -321,6 +350,52 @@ int Sql_QueryStr(Sql* self, const char* query)
 
 
 
+/// Executes a query that doesn't return rows, without copying it.
+int Sql_QueryRaw(Sql* self, const char* query, size_t len)
+{
+	MYSQL_RES* result;
+
+	if( self == NULL || self->result != NULL )
+		return SQL_ERROR;
+
+	if( mysql_real_query(&self->handle, query, (unsigned long)len) )
+		return SQL_ERROR;
+	if( (result = mysql_store_result(&self->handle)) != NULL )
+		mysql_free_result(result);
+	if( mysql_errno(&self->handle) != 0 )
+		return SQL_ERROR;
+	return SQL_SUCCESS;
+}
+
+
+
+/// Executes a query and keeps its result, without copying it.
+int Sql_QueryRawResult(Sql* self, const char* query, size_t len)
+{
+	if( self == NULL )
+		return SQL_ERROR;
+
+	Sql_FreeResult(self);
+	if( mysql_real_query(&self->handle, query, (unsigned long)len) )
+		return SQL_ERROR;
+	self->result = mysql_store_result(&self->handle);
+	if( mysql_errno(&self->handle) != 0 )
+		return SQL_ERROR;
+	return SQL_SUCCESS;
+}
+
+
+
+/// Returns the error message of the last failed operation.
+const char* Sql_LastError(Sql* self)
+{
+	if( self == NULL )
+		return "";
+	return mysql_error(&self->handle);
+}
+
+
+
 /// Returns the number of the AUTO_INCREMENT column of the last INSERT/UPDATE query.
 uint64 Sql_LastInsertId(Sql* self)
 {
@@ -107,6 +107,23 @@ int Sql_Ping(Sql* self);
 
 
 
+/// Stops the periodic ping of the connection.
+/// Used when the handle is handed to another thread, which becomes responsible for pinging it.
+void Sql_DisableKeepalive(Sql* self);
+
+
+
+/// Prepares the calling thread to use the mysql library.
+/// Must be called by every thread, other than the main one, that uses an Sql handle.
+void Sql_ThreadInit(void);
+
+
+
+/// Releases the mysql library data of the calling thread.
+void Sql_ThreadEnd(void);
+
+
+
 /// Escapes a string.
 /// The output buffer must be at least strlen(from)*2+1 in size.
 ///
@@ -150,6 +167,30 @@ int Sql_QueryStr(Sql* self, const char* query);
 
 
 
+/// Executes a query that doesn't return rows, like an INSERT.
+/// The query is sent as is, without being copied, and errors are not reported.
+/// Doesn't use the memory manager nor the console, so it can be called from a
+/// thread that owns the handle.
+///
+/// @return SQL_SUCCESS or SQL_ERROR
+int Sql_QueryRaw(Sql* self, const char* query, size_t len);
+
+
+
+/// Executes a query and keeps its result for Sql_NextRow and Sql_GetData.
+/// Like Sql_QueryRaw, the query isn't copied, errors are not reported and
+/// the memory manager isn't used.
+///
+/// @return SQL_SUCCESS or SQL_ERROR
+int Sql_QueryRawResult(Sql* self, const char* query, size_t len);
+
+
+
+/// Returns the error message of the last failed operation.
+const char* Sql_LastError(Sql* self);
+
+
+
 /// Returns the number of the AUTO_INCREMENT column of the last INSERT/UPDATE query.
 ///
 /// @return Value of the auto-increment column
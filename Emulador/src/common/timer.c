@@ -35,16 +35,33 @@ static int free_timer_list_max = 0;
 static int free_timer_list_pos = 0;
 
 
-/// Comparator for the timer heap. (minimum tick at top)
-/// Returns negative if tid1's tick is smaller, positive if tid2's tick is smaller, 0 if equal.
-///
-/// @param tid1 First timer
-/// @param tid2 Second timer
-/// @return negative if tid1 is top, positive if tid2 is top, 0 if equal
-#define DIFFTICK_MINTOPCMP(tid1,tid2) DIFF_TICK(timer_data[tid1].tick,timer_data[tid2].tick)
-
-// timer heap (binary heap of tid's)
-static BHEAP_VAR(int, timer_heap);
+/// Hierarchical timer wheel.
+/// The first level has one slot per tick, each further level has slots that
+/// cover a whole turn of the level below it. Timers are kept in doubly linked
+/// lists per slot, so inserting, moving and removing a timer is O(1).
+/// When the first level wraps, the current slot of the next level is
+/// redistributed (cascaded) into the levels below.
+#define TIMER_WHEEL_BITS0 8
+#define TIMER_WHEEL_BITSN 6
+#define TIMER_WHEEL_SIZE0 (1<<TIMER_WHEEL_BITS0)
+#define TIMER_WHEEL_SIZEN (1<<TIMER_WHEEL_BITSN)
+#define TIMER_WHEEL_MASK0 (TIMER_WHEEL_SIZE0-1)
+#define TIMER_WHEEL_MASKN (TIMER_WHEEL_SIZEN-1)
+#define TIMER_WHEEL_LEVELS 5 // 8+6*4 bits, covers the whole tick range
+/// Number of tick bits below the given level (level > 0)
+#define TIMER_WHEEL_SHIFT(lvl) (TIMER_WHEEL_BITS0 + ((lvl)-1)*TIMER_WHEEL_BITSN)
+
+// first tid of each slot (INVALID_TIMER if empty)
+static int timer_wheel[TIMER_WHEEL_SIZE0 + (TIMER_WHEEL_LEVELS-1)*TIMER_WHEEL_SIZEN];
+// next tick to be processed
+static unsigned int timer_wheel_tick;
+
+// position of each timer in the wheel (array, parallel to timer_data)
+struct timer_link {
+	int prev, next;
+	int slot; // -1 if not in the wheel
+};
+static struct timer_link* timer_link = NULL;
 
 
 // server startup time
@@ -60,6 +77,19 @@ struct timer_func_list {
 	char* name;
 } *tfl_root = NULL;
 
+/// Execution statistics of a timer function.
+struct timer_func_stats {
+	TimerFunc func;
+	uint64 calls;
+	uint64 usec; // total time spent
+	uint32 max_usec; // longest call
+};
+
+// timer function statistics (open addressing hash table, keyed by function)
+#define TIMER_STATS_SIZE 1024
+static struct timer_func_stats timer_stats[TIMER_STATS_SIZE];
+static unsigned int timer_stats_since; // tick of the last reset
+
 /// Sets the name of a timer function.
 int add_timer_func_list(TimerFunc func, char* name)
 {
@@ -94,6 +124,71 @@ char* search_timer_func_list(TimerFunc func)
 	return "unknown timer function";
 }
 
+/// Returns the statistics entry of the timer function, or NULL if the table is full.
+static struct timer_func_stats* timer_stats_get(TimerFunc func)
+{
+	unsigned int i = (unsigned int)(((uintptr_t)func) >> 4) & (TIMER_STATS_SIZE-1);
+	unsigned int n;
+
+	for( n = 0; n < TIMER_STATS_SIZE; ++n, i = (i+1) & (TIMER_STATS_SIZE-1) )
+	{
+		if( timer_stats[i].func == func )
+			return &timer_stats[i];
+		if( timer_stats[i].func == NULL )
+		{// new entry
+			timer_stats[i].func = func;
+			return &timer_stats[i];
+		}
+	}
+	return NULL;
+}
+
+/// Sorts timer statistics by time spent, descending.
+static int timer_stats_cmp(const void* a, const void* b)
+{
+	const struct timer_func_stats* s1 = *(const struct timer_func_stats**)a;
+	const struct timer_func_stats* s2 = *(const struct timer_func_stats**)b;
+
+	if( s1->usec != s2->usec )
+		return ( s1->usec < s2->usec ) ? 1 : -1;
+	return ( s1->calls < s2->calls ) ? 1 : ( s1->calls > s2->calls ) ? -1 : 0;
+}
+
+/// Displays how often each timer function was called and how much time it
+/// took since the last report, then resets the statistics.
+void timer_report(void)
+{
+	struct timer_func_stats* list[TIMER_STATS_SIZE];
+	uint64 total_usec = 0, total_calls = 0;
+	unsigned int elapsed = DIFF_TICK(gettick(), timer_stats_since);
+	int i, n = 0;
+
+	for( i = 0; i < TIMER_STATS_SIZE; ++i )
+	{
+		if( timer_stats[i].func == NULL || timer_stats[i].calls == 0 )
+			continue;
+		list[n++] = &timer_stats[i];
+		total_usec += timer_stats[i].usec;
+		total_calls += timer_stats[i].calls;
+	}
+	qsort(list, n, sizeof(list[0]), timer_stats_cmp);
+
+	ShowMessage(CL_BOLD"[Timer report of the last %u ms]\n"CL_NORMAL, elapsed);
+	ShowMessage("\t%-32s %12s %12s %10s %10s %6s\n", "function", "calls", "total (ms)", "avg (us)", "max (us)", "share");
+	for( i = 0; i < n; ++i )
+	{
+		ShowMessage("\t%-32s %12"PRIu64" %12.2f %10.2f %10u %5.1f%%\n",
+			search_timer_func_list(list[i]->func), list[i]->calls, list[i]->usec/1000.,
+			(double)list[i]->usec/list[i]->calls, list[i]->max_usec,
+			total_usec ? 100.*list[i]->usec/total_usec : 0.);
+	}
+	ShowInfo("timer_report: '"CL_WHITE"%"PRIu64""CL_NORMAL"' calls of '"CL_WHITE"%d"CL_NORMAL"' functions, taking '"CL_WHITE"%.2f ms"CL_NORMAL"'\n", total_calls, n, total_usec/1000.);
+	ShowInfo("timer_report: '"CL_WHITE"%d"CL_NORMAL"' timers allocated, '"CL_WHITE"%d"CL_NORMAL"' free\n", timer_data_num, free_timer_list_pos);
+
+	memset(timer_stats, 0, sizeof(timer_stats));
+	timer_stats_since = gettick();
+}
+
 /*----------------------------
  * 	Get tick time
  *----------------------------*/
@@ -155,6 +250,27 @@ static unsigned int tick(void)
 #endif
 }
 
+/// platform-abstracted microsecond clock, used to profile timer functions
+static uint64 timer_usec(void)
+{
+#if defined(WIN32)
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+	if( freq.QuadPart == 0 )
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (uint64)(count.QuadPart * 1000000 / freq.QuadPart);
+#elif defined(HAVE_MONOTONIC_CLOCK)
+	struct timespec tval;
+	clock_gettime(CLOCK_MONOTONIC, &tval);
+	return (uint64)tval.tv_sec * 1000000 + tval.tv_nsec / 1000;
+#else
+	struct timeval tval;
+	gettimeofday(&tval, NULL);
+	return (uint64)tval.tv_sec * 1000000 + tval.tv_usec;
+#endif
+}
+
 //////////////////////////////////////////////////////////////////////////
 #if defined(TICK_CACHE) && TICK_CACHE > 1
 //////////////////////////////////////////////////////////////////////////
@@ -191,14 +307,68 @@ unsigned int gettick(void)
 //////////////////////////////////////////////////////////////////////////
 
 /*======================================
- * 	CORE : Timer Heap
+ * 	CORE : Timer Wheel
  *--------------------------------------*/
 
-/// Adds a timer to the timer_heap
-static void push_timer_heap(int tid)
+/// Adds a timer to the wheel slot that matches its tick.
+/// Timers that already expired go to the slot that is processed next.
+static void push_timer_wheel(int tid)
+{
+	unsigned int tick = timer_data[tid].tick;
+	int delta = DIFF_TICK(tick, timer_wheel_tick);
+	int slot;
+
+	if( delta < 0 )
+		slot = timer_wheel_tick & TIMER_WHEEL_MASK0;
+	else if( delta < TIMER_WHEEL_SIZE0 )
+		slot = tick & TIMER_WHEEL_MASK0;
+	else
+	{
+		int lvl = 1;
+		while( lvl < TIMER_WHEEL_LEVELS-1 && delta >= (1<<(TIMER_WHEEL_SHIFT(lvl)+TIMER_WHEEL_BITSN)) )
+			++lvl;
+		slot = TIMER_WHEEL_SIZE0 + (lvl-1)*TIMER_WHEEL_SIZEN + ((tick>>TIMER_WHEEL_SHIFT(lvl)) & TIMER_WHEEL_MASKN);
+	}
+
+	timer_link[tid].slot = slot;
+	timer_link[tid].prev = INVALID_TIMER;
+	timer_link[tid].next = timer_wheel[slot];
+	if( timer_wheel[slot] != INVALID_TIMER )
+		timer_link[timer_wheel[slot]].prev = tid;
+	timer_wheel[slot] = tid;
+}
+
+/// Removes a timer from the wheel.
+static void pop_timer_wheel(int tid)
 {
-	BHEAP_ENSURE(timer_heap, 1, 256);
-	BHEAP_PUSH(timer_heap, tid, DIFFTICK_MINTOPCMP, swap);
+	struct timer_link* link = &timer_link[tid];
+
+	if( link->prev != INVALID_TIMER )
+		timer_link[link->prev].next = link->next;
+	else
+		timer_wheel[link->slot] = link->next;
+	if( link->next != INVALID_TIMER )
+		timer_link[link->next].prev = link->prev;
+	link->prev = link->next = INVALID_TIMER;
+	link->slot = -1;
+}
+
+/// Moves the timers of the current slot of a level to the levels below it.
+/// Returns the index of the slot that was cascaded.
+static int cascade_timer_wheel(int lvl)
+{
+	int idx = (timer_wheel_tick>>TIMER_WHEEL_SHIFT(lvl)) & TIMER_WHEEL_MASKN;
+	int slot = TIMER_WHEEL_SIZE0 + (lvl-1)*TIMER_WHEEL_SIZEN + idx;
+	int tid = timer_wheel[slot];
+
+	timer_wheel[slot] = INVALID_TIMER;
+	while( tid != INVALID_TIMER )
+	{
+		int next = timer_link[tid].next;
+		push_timer_wheel(tid);
+		tid = next;
+	}
+	return idx;
 }
 
 /*==========================
@@ -223,12 +393,25 @@ static int acquire_timer(void)
 		for (tid = timer_data_num; tid < timer_data_max && timer_data[tid].type; tid++);
 	if (tid >= timer_data_num && tid >= timer_data_max)
 	{// expand timer array
+		int i;
+
 		timer_data_max += 256;
 		if( timer_data )
+		{
 			RECREATE(timer_data, struct TimerData, timer_data_max);
+			RECREATE(timer_link, struct timer_link, timer_data_max);
+		}
 		else
+		{
 			CREATE(timer_data, struct TimerData, timer_data_max);
+			CREATE(timer_link, struct timer_link, timer_data_max);
+		}
 		memset(timer_data + (timer_data_max - 256), 0, sizeof(struct TimerData)*256);
+		for( i = timer_data_max - 256; i < timer_data_max; ++i )
+		{
+			timer_link[i].prev = timer_link[i].next = INVALID_TIMER;
+			timer_link[i].slot = -1;
+		}
 	}
 
 	if( tid >= timer_data_num )
@@ -250,7 +433,7 @@ int add_timer(unsigned int tick, TimerFunc func, int id, intptr_t data)
 	timer_data[tid].data     = data;
 	timer_data[tid].type     = TIMER_ONCE_AUTODEL;
 	timer_data[tid].interval = 1000;
-	push_timer_heap(tid);
+	push_timer_wheel(tid);
 
 	return tid;
 }
@@ -274,7 +457,7 @@ int add_timer_interval(unsigned int tick, TimerFunc func, int id, intptr_t data,
 	timer_data[tid].data     = data;
 	timer_data[tid].type     = TIMER_INTERVAL;
 	timer_data[tid].interval = interval;
-	push_timer_heap(tid);
+	push_timer_wheel(tid);
 
 	return tid;
 }
@@ -318,11 +501,7 @@ int addtick_timer(int tid, unsigned int tick)
 /// Returns the new tick value, or -1 if it fails.
 int settick_timer(int tid, unsigned int tick)
 {
-	size_t i;
-
-	// search timer position
-	ARR_FIND(0, BHEAP_LENGTH(timer_heap), i, BHEAP_DATA(timer_heap)[i] == tid);
-	if( i == BHEAP_LENGTH(timer_heap) )
+	if( tid < 0 || tid >= timer_data_num || timer_link[tid].slot == -1 )
 	{
 		ShowError("settick_timer: no such timer %d (%p(%s))\n", tid, timer_data[tid].func, search_timer_func_list(timer_data[tid].func));
 		return -1;
@@ -334,70 +513,106 @@ int settick_timer(int tid, unsigned int tick)
 	if( timer_data[tid].tick == tick )
 		return (int)tick;// nothing to do, already in propper position
 
-	// pop and push adjusted timer
-	BHEAP_POPINDEX(timer_heap, i, DIFFTICK_MINTOPCMP, swap);
+	// move the adjusted timer to its new slot
+	pop_timer_wheel(tid);
 	timer_data[tid].tick = tick;
-	BHEAP_PUSH(timer_heap, tid, DIFFTICK_MINTOPCMP, swap);
+	push_timer_wheel(tid);
 	return (int)tick;
 }
 
-/// Executes all expired timers.
-/// Returns the value of the smallest non-expired timer (or 1 second if there aren't any).
-int do_timer(unsigned int tick)
+/// Executes a timer that expired, and either frees or restarts it.
+static void run_timer(int tid, unsigned int tick)
 {
-	int diff = TIMER_MAX_INTERVAL; // return value
+	int diff = DIFF_TICK(timer_data[tid].tick, tick);
 
-	// process all timers one by one
-	while( BHEAP_LENGTH(timer_heap) )
-	{
-		int tid = BHEAP_PEEK(timer_heap);// top element in heap (smallest tick)
+	// remove timer
+	pop_timer_wheel(tid);
+	timer_data[tid].type |= TIMER_REMOVE_HEAP;
 
-		diff = DIFF_TICK(timer_data[tid].tick, tick);
-		if( diff > 0 )
-			break; // no more expired timers to process
+	if( timer_data[tid].func )
+	{
+		struct timer_func_stats* stats = timer_stats_get(timer_data[tid].func);
+		uint64 start = timer_usec();
 
-		// remove timer
-		BHEAP_POP(timer_heap, DIFFTICK_MINTOPCMP, swap);
-		timer_data[tid].type |= TIMER_REMOVE_HEAP;
+		if( diff < -1000 )
+			// timer was delayed for more than 1 second, use current tick instead
+			timer_data[tid].func(tid, tick, timer_data[tid].id, timer_data[tid].data);
+		else
+			timer_data[tid].func(tid, timer_data[tid].tick, timer_data[tid].id, timer_data[tid].data);
 
-		if( timer_data[tid].func )
+		if( stats != NULL )
 		{
-			if( diff < -1000 )
-				// timer was delayed for more than 1 second, use current tick instead
-				timer_data[tid].func(tid, tick, timer_data[tid].id, timer_data[tid].data);
-			else
-				timer_data[tid].func(tid, timer_data[tid].tick, timer_data[tid].id, timer_data[tid].data);
+			uint32 usec = (uint32)(timer_usec() - start);
+			stats->calls++;
+			stats->usec += usec;
+			if( usec > stats->max_usec )
+				stats->max_usec = usec;
 		}
+	}
+
+	// in the case the function didn't change anything...
+	if( timer_data[tid].type & TIMER_REMOVE_HEAP )
+	{
+		timer_data[tid].type &= ~TIMER_REMOVE_HEAP;
 
-		// in the case the function didn't change anything...
-		if( timer_data[tid].type & TIMER_REMOVE_HEAP )
+		switch( timer_data[tid].type )
 		{
-			timer_data[tid].type &= ~TIMER_REMOVE_HEAP;
-
-			switch( timer_data[tid].type )
-			{
-			default:
-			case TIMER_ONCE_AUTODEL:
-				timer_data[tid].type = 0;
-				if (free_timer_list_pos >= free_timer_list_max) {
-					free_timer_list_max += 256;
-					RECREATE(free_timer_list,int,free_timer_list_max);
-					memset(free_timer_list + (free_timer_list_max - 256), 0, 256 * sizeof(int));
-				}
-				free_timer_list[free_timer_list_pos++] = tid;
-			break;
-			case TIMER_INTERVAL:
-				if( DIFF_TICK(timer_data[tid].tick, tick) < -1000 )
-					timer_data[tid].tick = tick + timer_data[tid].interval;
-				else
-					timer_data[tid].tick += timer_data[tid].interval;
-				push_timer_heap(tid);
-			break;
+		default:
+		case TIMER_ONCE_AUTODEL:
+			timer_data[tid].type = 0;
+			if (free_timer_list_pos >= free_timer_list_max) {
+				free_timer_list_max += 256;
+				RECREATE(free_timer_list,int,free_timer_list_max);
+				memset(free_timer_list + (free_timer_list_max - 256), 0, 256 * sizeof(int));
 			}
+			free_timer_list[free_timer_list_pos++] = tid;
+		break;
+		case TIMER_INTERVAL:
+			if( DIFF_TICK(timer_data[tid].tick, tick) < -1000 )
+				timer_data[tid].tick = tick + timer_data[tid].interval;
+			else
+				timer_data[tid].tick += timer_data[tid].interval;
+			push_timer_wheel(tid);
+		break;
 		}
 	}
+}
 
-	return cap_value(diff, TIMER_MIN_INTERVAL, TIMER_MAX_INTERVAL);
+/// Executes all expired timers.
+/// Returns the time until the next timer expires (or 1 second if there aren't any).
+int do_timer(unsigned int tick)
+{
+	int diff;
+
+	// advance the wheel one tick at a time
+	while( DIFF_TICK(tick, timer_wheel_tick) >= 0 )
+	{
+		int idx = timer_wheel_tick & TIMER_WHEEL_MASK0;
+		int tid;
+
+		if( idx == 0 )
+		{// the first level wrapped, cascade the levels above it
+			int lvl = 1;
+			while( lvl < TIMER_WHEEL_LEVELS && cascade_timer_wheel(lvl) == 0 )
+				++lvl;
+		}
+
+		// timers started with an expired tick while processing land in this slot too
+		while( (tid = timer_wheel[idx]) != INVALID_TIMER )
+			run_timer(tid, tick);
+
+		++timer_wheel_tick;
+	}
+
+	// look for the next timer, higher levels are only due after the next wrap
+	for( diff = 0; diff < TIMER_WHEEL_SIZE0; ++diff )
+	{
+		int idx = (timer_wheel_tick + diff) & TIMER_WHEEL_MASK0;
+		if( timer_wheel[idx] != INVALID_TIMER || (diff > 0 && idx == 0) )
+			break;
+	}
+
+	return cap_value(diff + 1, TIMER_MIN_INTERVAL, TIMER_MAX_INTERVAL);
 }
 
 unsigned long get_uptime(void)
@@ -505,10 +720,17 @@ double solve_time(char* modif_p) {
 
 void timer_init(void)
 {
+	int i;
+
 #if defined(ENABLE_RDTSC)
 	rdtsc_calibrate();
 #endif
 
+	for( i = 0; i < ARRAYLENGTH(timer_wheel); ++i )
+		timer_wheel[i] = INVALID_TIMER;
+	timer_wheel_tick = gettick_nocache();
+	timer_stats_since = timer_wheel_tick;
+
 	time(&start_time);
 }
 
@@ -524,6 +746,6 @@ void timer_final(void)
 	}
 
 	if (timer_data) aFree(timer_data);
-	BHEAP_CLEAR(timer_heap);
+	if (timer_link) aFree(timer_link);
 	if (free_timer_list) aFree(free_timer_list);
 }
@@ -48,6 +48,7 @@ int addtick_timer(int tid, unsigned int tick);
 int settick_timer(int tid, unsigned int tick);
 
 int add_timer_func_list(TimerFunc func, char* name);
+void timer_report(void);
 
 unsigned long get_uptime(void);
 
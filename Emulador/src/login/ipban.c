@@ -9,6 +9,8 @@
  */
 
 #include "../common/cbasetypes.h"
+#include "../common/db.h"
+#include "../common/malloc.h"
 #include "../common/showmsg.h"
 #include "../common/sql.h"
 #include "../common/strlib.h"
@@ -17,6 +19,7 @@
 #include "ipban.h"
 #include "loginlog.h"
 #include <stdlib.h>
+#include <time.h>
 
 // login sql settings
 static char   ipban_db_hostname[32] = "127.0.0.1";
@@ -32,38 +35,130 @@ static Sql* sql_handle = NULL;
 static int cleanup_timer_id = INVALID_TIMER;
 static bool ipban_inited = false;
 
+/// Active bans, one table per pattern (a.*.*.*, a.b.*.*, a.b.c.*, a.b.c.d).
+/// Keyed by the masked ip, the value is the expiration time.
+static DBMap* ipban_active[4];
+static const uint32 ipban_masks[4] = { 0xFF000000, 0xFFFF0000, 0xFFFFFF00, 0xFFFFFFFF };
+static time_t ipban_refresh_time = 0; // database time of the last refresh
+
+/// Recent failed login attempts of an ip, the last dynamic_pass_failure_ban_limit ticks.
+struct ipban_failures {
+	unsigned int count, pos;
+	unsigned int tick[1];
+};
+static DBMap* ipban_failures_db = NULL; // uint32 ip -> struct ipban_failures*
+
+/// Dynamic bans not written to the database yet (written by ipban_flush_timer).
+static uint32* ipban_pending = NULL;
+static int ipban_pending_count = 0;
+static int ipban_pending_max = 0;
+
 //early declaration
 int ipban_cleanup(int tid, unsigned int tick, int id, intptr_t data);
 
 /**
- * Check if ip is in the active bans list.
- * @param ip: ipv4 ip to check if ban
- * @return true if found or error, false if not in list
+ * Parse a `list` entry of the ban table.
+ * @param list: pattern like "a.b.*.*"
+ * @param ip: masked ip of the pattern
+ * @return index in ipban_active, -1 if the pattern is invalid
  */
-bool ipban_check(uint32 ip) {
-	uint8* p = (uint8*)&ip;
-	char* data = NULL;
-	int matches;
+static int ipban_parse(const char* list, uint32* ip) {
+	int i;
 
-	if( !login_config.ipban )
-		return false;// ipban disabled
+	*ip = 0;
+	for( i = 0; i < 4; i++ )
+	{
+		char* end;
+		unsigned long part;
+
+		if( *list == '*' )
+			break;
+		if( !ISDIGIT(*list) || (part = strtoul(list, &end, 10)) > 255 )
+			return -1;
+		*ip |= (uint32)part<<(24 - 8*i);
+		list = end;
+		if( i < 3 && *list++ != '.' )
+			return -1;
+	}
+	return i - 1;
+}
+
+/**
+ * Load the active bans into memory.
+ * @param full: reload everything, otherwise only the bans added since the last refresh
+ */
+static void ipban_load(bool full) {
+	time_t since = ipban_refresh_time;
+	char* data;
+	int i;
 
-	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT count(*) FROM `%s` WHERE `rtime` > NOW() AND (`list` = '%u.*.*.*' OR `list` = '%u.%u.*.*' OR `list` = '%u.%u.%u.*' OR `list` = '%u.%u.%u.%u')",
-		ipban_table, p[3], p[3], p[2], p[3], p[2], p[1], p[3], p[2], p[1], p[0]) )
+	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT UNIX_TIMESTAMP(NOW())") || SQL_SUCCESS != Sql_NextRow(sql_handle) )
 	{
 		Sql_ShowDebug(sql_handle);
-		// close connection because we can't verify their connectivity.
-		return true;
+		Sql_FreeResult(sql_handle);
+		return;
 	}
+	Sql_GetData(sql_handle, 0, &data, NULL);
+	ipban_refresh_time = (time_t)strtoul(data, NULL, 10);
+	Sql_FreeResult(sql_handle);
 
-	if( SQL_ERROR == Sql_NextRow(sql_handle) )
-		return true;// Shouldn't happen, but just in case...
+	if( full )
+	{
+		for( i = 0; i < ARRAYLENGTH(ipban_active); i++ )
+			db_clear(ipban_active[i]);
+		since = 0;
+	}
 
-	Sql_GetData(sql_handle, 0, &data, NULL);
-	matches = atoi(data);
+	// rows added in the second of the last refresh are loaded again
+	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT `list`, UNIX_TIMESTAMP(`rtime`) FROM `%s` WHERE `rtime` > NOW() AND `btime` >= FROM_UNIXTIME(%u)", ipban_table, (unsigned int)since) )
+	{
+		Sql_ShowDebug(sql_handle);
+		return;
+	}
+	while( SQL_SUCCESS == Sql_NextRow(sql_handle) )
+	{
+		uint32 ip;
+		unsigned int rtime;
+
+		Sql_GetData(sql_handle, 0, &data, NULL);
+		if( (i = ipban_parse(data, &ip)) < 0 )
+			continue;
+		Sql_GetData(sql_handle, 1, &data, NULL);
+		rtime = (unsigned int)strtoul(data, NULL, 10);
+		if( rtime > uidb_uiget(ipban_active[i], ip) )
+			uidb_uiput(ipban_active[i], ip, rtime);
+	}
 	Sql_FreeResult(sql_handle);
+}
 
-	return( matches > 0 );
+/**
+ * Add a ban to the memory tables.
+ * @param ip: masked ip
+ * @param type: index in ipban_active
+ * @param rtime: expiration time
+ */
+static void ipban_add(uint32 ip, int type, time_t rtime) {
+	if( (unsigned int)rtime > uidb_uiget(ipban_active[type], ip) )
+		uidb_uiput(ipban_active[type], ip, (unsigned int)rtime);
+}
+
+/**
+ * Check if ip is in the active bans list.
+ * @param ip: ipv4 ip to check if ban
+ * @return true if found or error, false if not in list
+ */
+bool ipban_check(uint32 ip) {
+	unsigned int now;
+	int i;
+
+	if( !login_config.ipban )
+		return false;// ipban disabled
+
+	now = (unsigned int)time(NULL);
+	for( i = 0; i < ARRAYLENGTH(ipban_active); i++ )
+		if( uidb_uiget(ipban_active[i], ip&ipban_masks[i]) > now )
+			return true;
+	return false;
 }
 
 /**
@@ -72,27 +167,90 @@ bool ipban_check(uint32 ip) {
  * @param ip: ipv4 ip to record the failure
  */
 void ipban_log(uint32 ip) {
-	unsigned long failures;
+	struct ipban_failures* f;
+	unsigned int limit = umax(login_config.dynamic_pass_failure_ban_limit, 1);
+	unsigned int tick = gettick();
 
 	if( !login_config.ipban )
 		return;// ipban disabled
 
-	failures = loginlog_failedattempts(ip, login_config.dynamic_pass_failure_ban_interval);// how many times failed account? in one ip.
+	// how many times failed account? in one ip.
+	if( (f = (struct ipban_failures*)uidb_get(ipban_failures_db, ip)) == NULL )
+	{
+		f = (struct ipban_failures*)aCalloc(1, sizeof(struct ipban_failures) + (limit - 1)*sizeof(unsigned int));
+		uidb_put(ipban_failures_db, ip, f);
+	}
+	f->tick[f->pos] = tick;
+	f->pos = (f->pos + 1)%limit;
+	if( f->count < limit )
+		f->count++;
 
 	// if over the limit, add a temporary ban entry
-	if( failures >= login_config.dynamic_pass_failure_ban_limit )
+	// (the oldest of the last 'limit' failures is in the interval)
+	if( login_config.dynamic_pass_failure_ban_limit == 0
+	||  (f->count == limit && DIFF_TICK(tick, f->tick[f->pos]) < (int)login_config.dynamic_pass_failure_ban_interval*60*1000) )
+	{
+		ipban_add(ip&ipban_masks[2], 2, time(NULL) + login_config.dynamic_pass_failure_ban_duration*60);
+		uidb_remove(ipban_failures_db, ip);
+		if( ipban_pending_count == ipban_pending_max )
+		{
+			ipban_pending_max += 16;
+			RECREATE(ipban_pending, uint32, ipban_pending_max);
+		}
+		ipban_pending[ipban_pending_count++] = ip;
+	}
+}
+
+/**
+ * Timered function to write the dynamic bans to the database, in one query.
+ *  Also forgets the failed attempts older than the interval once a minute.
+ * @param tid: timer id
+ * @param tick: tick of execution
+ * @param id: unused
+ * @param data: unused
+ * @return 0
+ */
+static int ipban_flush_timer(int tid, unsigned int tick, int id, intptr_t data) {
+	static unsigned int last_purge = 0;
+	StringBuf buf;
+	int i;
+
+	if( tid != INVALID_TIMER && DIFF_TICK(tick, last_purge) >= 60*1000 )
 	{
-		uint8* p = (uint8*)&ip;
-		if( SQL_ERROR == Sql_Query(sql_handle, "INSERT INTO `%s`(`list`,`btime`,`rtime`,`reason`) VALUES ('%u.%u.%u.*', NOW() , NOW() +  INTERVAL %d MINUTE ,'Password error ban')",
-			ipban_table, p[3], p[2], p[1], login_config.dynamic_pass_failure_ban_duration) )
-			Sql_ShowDebug(sql_handle);
+		unsigned int limit = umax(login_config.dynamic_pass_failure_ban_limit, 1);
+		DBIterator* iter = db_iterator(ipban_failures_db);
+		struct ipban_failures* f;
+
+		for( f = (struct ipban_failures*)dbi_first(iter); dbi_exists(iter); f = (struct ipban_failures*)dbi_next(iter) )
+			if( DIFF_TICK(tick, f->tick[(f->pos + limit - 1)%limit]) >= (int)login_config.dynamic_pass_failure_ban_interval*60*1000 )
+				dbi_remove(iter);
+		dbi_destroy(iter);
+		last_purge = tick;
 	}
+
+	if( ipban_pending_count == 0 )
+		return 0;
+
+	StringBuf_Init(&buf);
+	StringBuf_Printf(&buf, "INSERT INTO `%s`(`list`,`btime`,`rtime`,`reason`) VALUES ", ipban_table);
+	for( i = 0; i < ipban_pending_count; i++ )
+	{
+		uint8* p = (uint8*)&ipban_pending[i];
+		StringBuf_Printf(&buf, "%s('%u.%u.%u.*', NOW() , NOW() +  INTERVAL %d MINUTE ,'Password error ban')",
+			i ? "," : "", p[3], p[2], p[1], login_config.dynamic_pass_failure_ban_duration);
+	}
+	if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) )
+		Sql_ShowDebug(sql_handle);
+	StringBuf_Destroy(&buf);
+	ipban_pending_count = 0;
+	return 0;
 }
 
 /**
  * Timered function to remove expired bans.
- *  Request all characters to update their registered ip and transmit their new ip.
- *  Performed each ip_sync_interval.
+ *  Also forgets old failed attempts and loads the bans added to the
+ *  database by others (the whole list if some were removed).
+ *  Performed each ipban_cleanup_interval.
  * @param tid: timer id
  * @param tick: tick of execution
  * @param id: unused
@@ -100,12 +258,43 @@ void ipban_log(uint32 ip) {
  * @return 0
  */
 int ipban_cleanup(int tid, unsigned int tick, int id, intptr_t data) {
+	DBIterator* iter;
+	unsigned int now = (unsigned int)time(NULL), rtime;
+	int i, active = 0;
+	char* value;
+
 	if( !login_config.ipban )
 		return 0;// ipban disabled
 
+	ipban_flush_timer(INVALID_TIMER, tick, 0, 0);
+
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `ipbanlist` WHERE `rtime` <= NOW()") )
 		Sql_ShowDebug(sql_handle);
 
+	// expired bans
+	for( i = 0; i < ARRAYLENGTH(ipban_active); i++ )
+	{
+		iter = db_iterator(ipban_active[i]);
+		for( rtime = db_data2ui(iter->first(iter, NULL)); dbi_exists(iter); rtime = db_data2ui(iter->next(iter, NULL)) )
+			if( rtime <= now )
+				dbi_remove(iter);
+		dbi_destroy(iter);
+	}
+
+	// new bans, and a full reload when the number of active bans doesn't match
+	ipban_load(false);
+	for( i = 0; i < ARRAYLENGTH(ipban_active); i++ )
+		active += db_size(ipban_active[i]);
+	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT COUNT(DISTINCT `list`) FROM `%s` WHERE `rtime` > NOW()", ipban_table) )
+		Sql_ShowDebug(sql_handle);
+	else if( SQL_SUCCESS == Sql_NextRow(sql_handle) )
+	{
+		Sql_GetData(sql_handle, 0, &value, NULL);
+		i = atoi(value);
+		Sql_FreeResult(sql_handle);
+		if( i != active )
+			ipban_load(true);
+	}
 	return 0;
 }
 
@@ -190,6 +379,7 @@ void ipban_init(void) {
 	uint16      port     = ipban_db_port;
 	const char* database = ipban_db_database;
 	const char* codepage = ipban_codepage;
+	int i;
 
 	ipban_inited = true;
 
@@ -221,6 +411,13 @@ void ipban_init(void) {
 	if( codepage[0] != '\0' && SQL_ERROR == Sql_SetEncoding(sql_handle, codepage) )
 		Sql_ShowDebug(sql_handle);
 
+	for( i = 0; i < ARRAYLENGTH(ipban_active); i++ )
+		ipban_active[i] = uidb_alloc(DB_OPT_BASE);
+	ipban_failures_db = uidb_alloc(DB_OPT_RELEASE_DATA);
+	ipban_load(true);
+	add_timer_func_list(ipban_flush_timer, "ipban_flush_timer");
+	add_timer_interval(gettick()+1000, ipban_flush_timer, 0, 0, 1000);
+
 	if( login_config.ipban_cleanup_interval > 0 )
 	{ // set up periodic cleanup of connection history and active bans
 		add_timer_func_list(ipban_cleanup, "ipban_cleanup");
@@ -234,6 +431,8 @@ void ipban_init(void) {
  * Launched at login-serv end, cleanup db connection or other thing here.
  */
 void ipban_final(void) {
+	int i;
+
 	if( !login_config.ipban )
 		return;// ipban disabled
 
@@ -241,7 +440,17 @@ void ipban_final(void) {
 		// release data
 		delete_timer(cleanup_timer_id, ipban_cleanup);
 
-	ipban_cleanup(0,0,0,0); // always clean up on login-server stop
+	ipban_flush_timer(INVALID_TIMER, 0, 0, 0);
+	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `ipbanlist` WHERE `rtime` <= NOW()") ) // always clean up on login-server stop
+		Sql_ShowDebug(sql_handle);
+
+	for( i = 0; i < ARRAYLENGTH(ipban_active); i++ )
+		db_destroy(ipban_active[i]);
+	db_destroy(ipban_failures_db);
+	if( ipban_pending )
+		aFree(ipban_pending);
+	ipban_pending = NULL;
+	ipban_pending_count = ipban_pending_max = 0;
 
 	// close connections
 	Sql_Free(sql_handle);
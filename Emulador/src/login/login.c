@@ -17,6 +17,8 @@
 #include "../common/socket.h" //ip2str
 #include "../common/strlib.h"
 #include "../common/timer.h"
+#include "../common/thread.h"
+#include "../common/mutex.h"
 #include "../common/msg_conf.h"
 #include "../common/cli.h"
 #include "../common/utils.h"
@@ -261,6 +263,261 @@ int login_mmo_auth_new(const char* userid, const char* pass, const char sex, con
 	return -1;
 }
 
+/*==========================================
+ * DNS blacklist
+ *
+ * Lookups are done by the dnsbl threads, so a slow resolver doesn't stall
+ * the login-server. The verdict of an ip is cached, and its auth packets
+ * stay in the receive buffer until the verdict arrives.
+ *------------------------------------------*/
+
+#define MAX_DNSBL_SERVERS 16
+#define DNSBL_QUEUE 1024 // ips being looked up
+
+enum e_dnsbl_state {
+	DNSBL_PENDING,
+	DNSBL_CLEAN,
+	DNSBL_LISTED,
+};
+
+struct dnsbl_entry {
+	enum e_dnsbl_state state;
+	time_t expire; // cached until
+};
+
+struct dnsbl_result {
+	uint32 ip;
+	bool listed;
+	uint32 ttl; // seconds
+};
+
+static struct {
+	char servers[MAX_DNSBL_SERVERS][128]; // parsed dnsbl_servers, read-only while running
+	int server_count;
+	uint32 resolver; // 0 uses the system resolver
+	uint16 resolver_port;
+	int thread_count;
+	rAthread threads[MAX_DNSBL_THREADS];
+	ramutex mutex; // protects everything below
+	racond cond;
+	uint32 requests[DNSBL_QUEUE];
+	int request_head, request_count;
+	struct dnsbl_result results[DNSBL_QUEUE];
+	int result_count;
+	int outstanding; // requests queued or being looked up, and results not collected
+	bool terminate;
+	DBMap* cache; // uint32 ip -> struct dnsbl_entry*, only used by the main thread
+} dnsbl;
+
+/// Looks up an ip on every DNSBL server, on a dnsbl thread.
+static void login_dnsbl_lookup(uint32 ip, struct dnsbl_result* result)
+{
+	int i;
+
+	result->ip = ip;
+	result->listed = false;
+	result->ttl = login_config.dnsbl_negative_cache_time;
+	for( i = 0; i < dnsbl.server_count; i++ )
+	{
+		char name[256];
+		uint32 addr, ttl;
+
+		snprintf(name, sizeof(name), "%u.%u.%u.%u.%s", ip&0xFF, (ip>>8)&0xFF, (ip>>16)&0xFF, ip>>24, dnsbl.servers[i]);
+		if( host2ip_query(name, dnsbl.resolver, dnsbl.resolver_port, login_config.dnsbl_timeout, &addr, &ttl) == 1 )
+		{
+			result->listed = true;
+			result->ttl = ( ttl ? ttl : login_config.dnsbl_cache_time );
+			return;
+		}
+	}
+}
+
+static void* login_dnsbl_main(void* param)
+{
+	ramutex_lock(dnsbl.mutex);
+	for(;;)
+	{
+		struct dnsbl_result result;
+		uint32 ip;
+
+		if( dnsbl.request_count == 0 )
+		{
+			if( dnsbl.terminate )
+				break;
+			racond_wait(dnsbl.cond, dnsbl.mutex, -1);
+			continue;
+		}
+		ip = dnsbl.requests[dnsbl.request_head];
+		dnsbl.request_head = (dnsbl.request_head + 1)%DNSBL_QUEUE;
+		dnsbl.request_count--;
+		ramutex_unlock(dnsbl.mutex);
+
+		login_dnsbl_lookup(ip, &result);
+
+		ramutex_lock(dnsbl.mutex);
+		dnsbl.results[dnsbl.result_count++] = result; // never full, see outstanding
+	}
+	ramutex_unlock(dnsbl.mutex);
+	return NULL;
+}
+
+/**
+ * Timered function to collect the verdicts of the dnsbl threads.
+ *  Also releases the expired verdicts once a minute.
+ * @param tid: timer id
+ * @param tick: tick of execution
+ * @param id: unused
+ * @param data: unused
+ * @return 0
+ */
+static int login_dnsbl_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	static unsigned int last_purge = 0;
+	time_t now = time(NULL);
+	int i;
+
+	ramutex_lock(dnsbl.mutex);
+	for( i = 0; i < dnsbl.result_count; i++ )
+	{
+		struct dnsbl_result* result = &dnsbl.results[i];
+		struct dnsbl_entry* entry = (struct dnsbl_entry*)uidb_get(dnsbl.cache, result->ip);
+
+		if( entry == NULL )
+			continue;
+		entry->state = ( result->listed ? DNSBL_LISTED : DNSBL_CLEAN );
+		entry->expire = now + result->ttl;
+	}
+	dnsbl.outstanding -= dnsbl.result_count;
+	dnsbl.result_count = 0;
+	ramutex_unlock(dnsbl.mutex);
+
+	if( DIFF_TICK(tick, last_purge) >= 60*1000 )
+	{
+		DBIterator* iter = db_iterator(dnsbl.cache);
+		struct dnsbl_entry* entry;
+
+		for( entry = (struct dnsbl_entry*)dbi_first(iter); dbi_exists(iter); entry = (struct dnsbl_entry*)dbi_next(iter) )
+			if( entry->state != DNSBL_PENDING && entry->expire <= now )
+				dbi_remove(iter);
+		dbi_destroy(iter);
+		last_purge = tick;
+	}
+	return 0;
+}
+
+/**
+ * Check an ip against the DNS blacklists.
+ *  Starts the lookup when the verdict isn't cached.
+ * @param ip: ipv4 ip to check
+ * @return 1 if listed, 0 if not listed or dnsbl is disabled, -1 while the lookup is pending
+ */
+int login_dnsbl_check(uint32 ip)
+{
+	struct dnsbl_entry* entry;
+
+	if( !login_config.use_dnsbl || dnsbl.thread_count == 0 )
+		return 0;
+
+	entry = (struct dnsbl_entry*)uidb_get(dnsbl.cache, ip);
+	if( entry != NULL )
+	{
+		if( entry->state == DNSBL_PENDING )
+			return -1;
+		if( entry->expire > time(NULL) )
+			return ( entry->state == DNSBL_LISTED ) ? 1 : 0;
+	}
+
+	ramutex_lock(dnsbl.mutex);
+	if( dnsbl.outstanding >= DNSBL_QUEUE )
+	{ // try again on the next parse
+		ramutex_unlock(dnsbl.mutex);
+		return -1;
+	}
+	dnsbl.requests[(dnsbl.request_head + dnsbl.request_count)%DNSBL_QUEUE] = ip;
+	dnsbl.request_count++;
+	dnsbl.outstanding++;
+	racond_signal(dnsbl.cond);
+	ramutex_unlock(dnsbl.mutex);
+
+	if( entry == NULL )
+	{
+		CREATE(entry, struct dnsbl_entry, 1);
+		uidb_put(dnsbl.cache, ip, entry);
+	}
+	entry->state = DNSBL_PENDING;
+	return -1;
+}
+
+/// Starts the dnsbl threads.
+static void login_dnsbl_init(void)
+{
+	char servers[sizeof(login_config.dnsbl_servs)];
+	char* server;
+	int i;
+
+	memset(&dnsbl, 0, sizeof(dnsbl));
+	add_timer_func_list(login_dnsbl_timer, "login_dnsbl_timer");
+	if( !login_config.use_dnsbl )
+		return;
+
+	safestrncpy(servers, login_config.dnsbl_servs, sizeof(servers));
+	for( server = strtok(servers, ","); server != NULL && dnsbl.server_count < MAX_DNSBL_SERVERS; server = strtok(NULL, ",") )
+	{
+		trim(server);
+		if( *server )
+			safestrncpy(dnsbl.servers[dnsbl.server_count++], server, sizeof(dnsbl.servers[0]));
+	}
+	if( login_config.dnsbl_resolver[0] )
+	{ // ip[:port]
+		char resolver[sizeof(login_config.dnsbl_resolver)];
+		char* port;
+
+		safestrncpy(resolver, login_config.dnsbl_resolver, sizeof(resolver));
+		if( (port = strchr(resolver, ':')) != NULL )
+			*port++ = '\0';
+		dnsbl.resolver = host2ip(resolver);
+		dnsbl.resolver_port = ( port ? (uint16)atoi(port) : 53 );
+		if( dnsbl.resolver == 0 )
+			ShowWarning("login_dnsbl_init: Invalid dnsbl_resolver '%s', using the system resolver.\n", login_config.dnsbl_resolver);
+	}
+
+	dnsbl.mutex = ramutex_create();
+	dnsbl.cond = racond_create();
+	dnsbl.cache = uidb_alloc(DB_OPT_RELEASE_DATA);
+	for( i = 0; i < login_config.dnsbl_threads; i++ )
+	{
+		if( (dnsbl.threads[i] = rathread_create(login_dnsbl_main, NULL)) == NULL )
+			break;
+		dnsbl.thread_count++;
+	}
+	if( dnsbl.thread_count == 0 )
+		ShowError("login_dnsbl_init: Couldn't create the dnsbl threads, DNSBL checks are disabled.\n");
+	else
+		add_timer_interval(gettick() + 50, login_dnsbl_timer, 0, 0, 50);
+}
+
+/// Stops the dnsbl threads.
+static void login_dnsbl_final(void)
+{
+	int i;
+
+	if( dnsbl.mutex == NULL )
+		return;
+
+	ramutex_lock(dnsbl.mutex);
+	dnsbl.terminate = true;
+	dnsbl.request_count = 0; // pending lookups are dropped
+	racond_broadcast(dnsbl.cond);
+	ramutex_unlock(dnsbl.mutex);
+	for( i = 0; i < dnsbl.thread_count; i++ )
+		rathread_wait(dnsbl.threads[i], NULL);
+
+	db_destroy(dnsbl.cache);
+	racond_destroy(dnsbl.cond);
+	ramutex_destroy(dnsbl.mutex);
+	memset(&dnsbl, 0, sizeof(dnsbl));
+}
+
 /**
  * Check/authentication of a connection.
  * @param sd: string (atm:md5key or dbpass)
@@ -283,22 +540,10 @@ int login_mmo_auth(struct login_session_data* sd, bool isServer) {
 	ip2str(session[sd->fd]->client_addr, ip);
 
 	// DNS Blacklist check
-	if( login_config.use_dnsbl ) {
-		char r_ip[16];
-		char ip_dnsbl[256];
-		char* dnsbl_serv;
-		uint8* sin_addr = (uint8*)&session[sd->fd]->client_addr;
-
-		sprintf(r_ip, "%u.%u.%u.%u", sin_addr[0], sin_addr[1], sin_addr[2], sin_addr[3]);
-
-		for( dnsbl_serv = strtok(login_config.dnsbl_servs,","); dnsbl_serv != NULL; dnsbl_serv = strtok(NULL,",") ) {
-			sprintf(ip_dnsbl, "%s.%s", r_ip, trim(dnsbl_serv));
-			if( host2ip(ip_dnsbl) ) {
-				ShowInfo("DNSBL: (%s) Blacklisted. User Kicked.\n", r_ip);
-				return 3;
-			}
-		}
-
+	// a pending lookup lets the client through, the auth packets wait for it (see logclif_parse)
+	if( login_config.use_dnsbl && login_dnsbl_check(session[sd->fd]->client_addr) == 1 ) {
+		ShowInfo("DNSBL: (%s) Blacklisted. User Kicked.\n", ip);
+		return 3;
 	}
 
 	//Client Version check
@@ -609,6 +854,16 @@ bool login_config_read(const char* cfgName, bool normal) {
 			login_config.use_dnsbl = (bool)config_switch(w2);
 		else if(!strcmpi(w1, "dnsbl_servers"))
 			safestrncpy(login_config.dnsbl_servs, w2, sizeof(login_config.dnsbl_servs));
+		else if(!strcmpi(w1, "dnsbl_resolver"))
+			safestrncpy(login_config.dnsbl_resolver, w2, sizeof(login_config.dnsbl_resolver));
+		else if(!strcmpi(w1, "dnsbl_threads"))
+			login_config.dnsbl_threads = cap_value(atoi(w2), 1, MAX_DNSBL_THREADS);
+		else if(!strcmpi(w1, "dnsbl_timeout"))
+			login_config.dnsbl_timeout = max(atoi(w2), 100);
+		else if(!strcmpi(w1, "dnsbl_cache_time"))
+			login_config.dnsbl_cache_time = max(atoi(w2), 0);
+		else if(!strcmpi(w1, "dnsbl_negative_cache_time"))
+			login_config.dnsbl_negative_cache_time = max(atoi(w2), 0);
 		else if(!strcmpi(w1, "ipban_cleanup_interval"))
 			login_config.ipban_cleanup_interval = (unsigned int)atoi(w2);
 		else if(!strcmpi(w1, "ip_sync_interval"))
@@ -705,6 +960,11 @@ void login_set_defaults() {
 	login_config.dynamic_pass_failure_ban_duration = 5;
 	login_config.use_dnsbl = false;
 	safestrncpy(login_config.dnsbl_servs, "", sizeof(login_config.dnsbl_servs));
+	safestrncpy(login_config.dnsbl_resolver, "", sizeof(login_config.dnsbl_resolver));
+	login_config.dnsbl_threads = 2;
+	login_config.dnsbl_timeout = 2000;
+	login_config.dnsbl_cache_time = 3600;
+	login_config.dnsbl_negative_cache_time = 600;
 	login_config.allowed_regs = 1;
 	login_config.time_allowed = 10; //in second
 
@@ -750,6 +1010,7 @@ void do_final(void) {
 
 	do_final_msg();
 	ipban_final();
+	login_dnsbl_final();
 	do_final_loginclif();
 	do_final_logincnslif();
 
@@ -838,6 +1099,7 @@ int do_init(int argc, char** argv) {
 
 	// initialize static and dynamic ipban system
 	ipban_init();
+	login_dnsbl_init();
 
 	// Online user database init
 	online_db = idb_alloc(DB_OPT_RELEASE_DATA);
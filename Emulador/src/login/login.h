@@ -51,6 +51,7 @@ struct login_session_data {
 };
 
 #define MAX_SERVERS 30 //max number of mapserv that could be attach
+#define MAX_DNSBL_THREADS 16 //max number of threads doing dnsbl lookups
 ///Struct describing 1 char-serv attach to us
 struct mmo_char_server {
 	char name[20];	///char-serv name
@@ -92,6 +93,11 @@ struct Login_Config {
 	unsigned int dynamic_pass_failure_ban_duration; /// duration of the ipban in minutes
 	bool use_dnsbl;                                 /// dns blacklist blocking ?
 	char dnsbl_servs[1024];                         /// comma-separated list of dnsbl servers
+	char dnsbl_resolver[64];                        /// dns server queried for the dnsbl lookups, "ip[:port]" (empty: system resolver)
+	int dnsbl_threads;                              /// number of threads doing the dnsbl lookups
+	int dnsbl_timeout;                              /// timeout of each dnsbl query in milliseconds
+	int dnsbl_cache_time;                           /// how long a listed ip is cached in seconds, when the answer has no ttl
+	int dnsbl_negative_cache_time;                  /// how long a not listed ip is cached in seconds
 
 	int allowed_regs;								/// max number of registration
 	int time_allowed;								/// registration interval in seconds
@@ -234,4 +240,12 @@ int login_mmo_auth_new(const char* userid, const char* pass, const char sex, con
  */
 int login_mmo_auth(struct login_session_data* sd, bool isServer);
 
+/**
+ * Check an ip against the DNS blacklists.
+ *  Starts the lookup when the verdict isn't cached.
+ * @param ip: ipv4 ip to check
+ * @return 1 if listed, 0 if not listed or dnsbl is disabled, -1 while the lookup is pending
+ */
+int login_dnsbl_check(uint32 ip);
+
 #endif /* _LOGIN_H_ */
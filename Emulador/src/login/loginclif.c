@@ -288,6 +288,8 @@ static int logclif_parse_reqauth(int fd, struct login_session_data *sd, int comm
 	||  (command == 0x027c && packet_len < 60)
 	||  (command == 0x0825 && (packet_len < 4 || packet_len < RFIFOW(fd, 2))) )
 		return 0;
+	else if( login_config.use_dnsbl && login_dnsbl_check(session[fd]->client_addr) < 0 )
+		return 0; // parsed again once the dnsbl lookup is done
 	else {
 		int result;
 		uint32 version;
@@ -400,6 +402,8 @@ static int logclif_parse_reqkey(int fd, struct login_session_data *sd){
 static int logclif_parse_reqcharconnec(int fd, struct login_session_data *sd, char* ip){
 	if (RFIFOREST(fd) < 86)
 		return 0;
+	else if( login_config.use_dnsbl && login_dnsbl_check(session[fd]->client_addr) < 0 )
+		return 0; // parsed again once the dnsbl lookup is done
 	else {
 		int result;
 		char server_name[20];
@@ -502,6 +506,9 @@ int logclif_parse(int fd) {
 		CREATE(session[fd]->session_data, struct login_session_data, 1);
 		sd = (struct login_session_data*)session[fd]->session_data;
 		sd->fd = fd;
+		// start the dnsbl lookup while the client is still talking
+		if( login_config.use_dnsbl )
+			login_dnsbl_check(ipl);
 	}
 
 	while( RFIFOREST(fd) >= 2 )
@@ -8,12 +8,18 @@
  */
 
 #include "../common/cbasetypes.h"
+#include "../common/atomic.h"
+#include "../common/malloc.h"
 #include "../common/mmo.h"
+#include "../common/mutex.h"
 #include "../common/socket.h"
 #include "../common/sql.h"
 #include "../common/strlib.h"
 #include "../common/showmsg.h"
+#include "../common/thread.h"
+#include "../common/timer.h"
 #include <stdlib.h> // exit
+#include <time.h>
 
 // global sql settings (in ipban_sql.c)
 static char   global_db_hostname[64] = "127.0.0.1"; // Doubled to reflect the change on commit #0f2dd7f
@@ -30,37 +36,135 @@ static char   log_db_password[32] = "";
 static char   log_db_database[32] = "";
 static char   log_codepage[32] = "";
 static char   log_login_db[256] = "loginlog";
+static bool   log_login_async = true;
 
 static Sql* sql_handle = NULL;
 static bool enabled = false;
 
+#define LOGINLOG_ROW_LENGTH 640 // values of a row, "(...)"
+#define LOGINLOG_QUEUE 4096 // rows
+#define LOGINLOG_BATCH 256 // rows per query
+#define LOGINLOG_INTERVAL 1000 // ms the writer waits for a full batch
 
-/**
- * Get the number of failed login attempts by the ip in the last minutes.
- * @param ip: ip to search attempt from
- * @param minutes: intervall to search
- * @return number of failed attempts
- */
-unsigned long loginlog_failedattempts(uint32 ip, unsigned int minutes) {
-	unsigned long failures = 0;
+struct loginlog_row {
+	unsigned short length;
+	char values[LOGINLOG_ROW_LENGTH];
+};
 
-	if( !enabled )
-		return 0;
+/// Writer thread, the login log is written in batches on its own connection.
+static struct {
+	struct loginlog_row* queue; // ring buffer
+	volatile int32 head; // next row written by the main thread
+	volatile int32 tail; // next row read by the writer thread
+	rAthread thread;
+	ramutex mutex;
+	racond cond;
+	volatile int32 terminate;
+	Sql* handle; // only used by the writer thread
+	char* query; // batch query being built by the writer thread
+	size_t query_size;
+	// statistics
+	volatile int32 written, lost;
+	char last_error[256]; // protected by mutex
+} loginlog_writer;
 
-	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT count(*) FROM `%s` WHERE `ip` = '%s' AND `rcode` = '1' AND `time` > NOW() - INTERVAL %d MINUTE",
-		log_login_db, ip2str(ip,NULL), minutes) )// how many times failed account? in one ip.
-		Sql_ShowDebug(sql_handle);
+static int loginlog_pending(void) {
+	int32 head = InterlockedExchangeAdd(&loginlog_writer.head, 0);
+	int32 tail = InterlockedExchangeAdd(&loginlog_writer.tail, 0);
+
+	return (head - tail + LOGINLOG_QUEUE)%LOGINLOG_QUEUE;
+}
+
+/// Writes the queued rows, on the writer thread.
+static void loginlog_flush(void) {
+	int32 head = InterlockedExchangeAdd(&loginlog_writer.head, 0);
+	int32 tail = loginlog_writer.tail;
+
+	while( tail != head )
+	{
+		size_t length = (size_t)snprintf(loginlog_writer.query, loginlog_writer.query_size, "INSERT INTO `%s`(`time`,`ip`,`user`,`rcode`,`log`) VALUES ", log_login_db);
+		int rows = 0;
+
+		for( ; tail != head && rows < LOGINLOG_BATCH; tail = (tail + 1)%LOGINLOG_QUEUE, rows++ )
+		{
+			struct loginlog_row* row = &loginlog_writer.queue[tail];
+
+			if( rows )
+				loginlog_writer.query[length++] = ',';
+			memcpy(loginlog_writer.query + length, row->values, row->length);
+			length += row->length;
+		}
+
+		if( SQL_ERROR == Sql_QueryRaw(loginlog_writer.handle, loginlog_writer.query, length)
+		&&  (SQL_ERROR == Sql_Ping(loginlog_writer.handle) || SQL_ERROR == Sql_QueryRaw(loginlog_writer.handle, loginlog_writer.query, length)) )
+		{
+			InterlockedExchangeAdd(&loginlog_writer.lost, rows);
+			ramutex_lock(loginlog_writer.mutex);
+			safestrncpy(loginlog_writer.last_error, Sql_LastError(loginlog_writer.handle), sizeof(loginlog_writer.last_error));
+			ramutex_unlock(loginlog_writer.mutex);
+		}
+		else
+			InterlockedExchangeAdd(&loginlog_writer.written, rows);
+		InterlockedExchange(&loginlog_writer.tail, tail); // release the rows
+	}
+}
+
+static void* loginlog_writer_main(void* param) {
+	Sql_ThreadInit();
+
+	while( !InterlockedExchangeAdd(&loginlog_writer.terminate, 0) )
+	{
+		ramutex_lock(loginlog_writer.mutex);
+		if( loginlog_pending() < LOGINLOG_BATCH && !InterlockedExchangeAdd(&loginlog_writer.terminate, 0) )
+			racond_wait(loginlog_writer.cond, loginlog_writer.mutex, LOGINLOG_INTERVAL);
+		ramutex_unlock(loginlog_writer.mutex);
+
+		loginlog_flush();
+	}
+	loginlog_flush(); // rows queued before the shutdown
 
-	if( SQL_SUCCESS == Sql_NextRow(sql_handle) )
+	Sql_ThreadEnd();
+	return NULL;
+}
+
+/**
+ * Timered function to report the rows the writer thread couldn't write.
+ * @param tid: timer id
+ * @param tick: tick of execution
+ * @param id: unused
+ * @param data: unused
+ * @return 0
+ */
+static int loginlog_writer_timer(int tid, unsigned int tick, int id, intptr_t data) {
+	static int32 lost = 0;
+
+	if( loginlog_writer.lost != lost )
 	{
-		char* data;
-		Sql_GetData(sql_handle, 0, &data, NULL);
-		failures = strtoul(data, NULL, 10);
-		Sql_FreeResult(sql_handle);
+		ramutex_lock(loginlog_writer.mutex);
+		ShowError("Login log: %d rows couldn't be written. Last error: %s\n", (int)(loginlog_writer.lost - lost), loginlog_writer.last_error);
+		ramutex_unlock(loginlog_writer.mutex);
+		lost = loginlog_writer.lost;
 	}
-	return failures;
+	return 0;
 }
 
+/// Stops the writer thread after it wrote the queued rows.
+static void loginlog_writer_final(void) {
+	if( loginlog_writer.thread != NULL )
+	{
+		InterlockedExchange(&loginlog_writer.terminate, 1);
+		racond_signal(loginlog_writer.cond);
+		rathread_wait(loginlog_writer.thread, NULL);
+		loginlog_writer.thread = NULL;
+		loginlog_writer_timer(INVALID_TIMER, 0, 0, 0);
+	}
+	if( loginlog_writer.cond ) racond_destroy(loginlog_writer.cond);
+	if( loginlog_writer.mutex ) ramutex_destroy(loginlog_writer.mutex);
+	if( loginlog_writer.queue ) aFree(loginlog_writer.queue);
+	if( loginlog_writer.query ) aFree(loginlog_writer.query);
+	Sql_Free(loginlog_writer.handle);
+	memset(&loginlog_writer, 0, sizeof(loginlog_writer));
+}
 
 /**
  * Records an event in the login log.
@@ -70,9 +174,14 @@ unsigned long loginlog_failedattempts(uint32 ip, unsigned int minutes) {
  * @param message:
  */
 void login_log(uint32 ip, const char* username, int rcode, const char* message) {
+	static char now[32];
+	static time_t last = 0;
 	char esc_username[NAME_LENGTH*2+1];
 	char esc_message[255*2+1];
-	int retcode;
+	char values[LOGINLOG_ROW_LENGTH];
+	int32 head, next;
+	int length;
+	time_t t;
 
 	if( !enabled )
 		return;
@@ -80,12 +189,37 @@ void login_log(uint32 ip, const char* username, int rcode, const char* message)
 	Sql_EscapeStringLen(sql_handle, esc_username, username, strnlen(username, NAME_LENGTH));
 	Sql_EscapeStringLen(sql_handle, esc_message, message, strnlen(message, 255));
 
-	retcode = Sql_Query(sql_handle,
-		"INSERT INTO `%s`(`time`,`ip`,`user`,`rcode`,`log`) VALUES (NOW(), '%s', '%s', '%d', '%s')",
-		log_login_db, ip2str(ip,NULL), esc_username, rcode, esc_message);
+	if( loginlog_writer.thread == NULL )
+	{ // Synchronous
+		if( SQL_ERROR == Sql_Query(sql_handle,
+			"INSERT INTO `%s`(`time`,`ip`,`user`,`rcode`,`log`) VALUES (NOW(), '%s', '%s', '%d', '%s')",
+			log_login_db, ip2str(ip,NULL), esc_username, rcode, esc_message) )
+			Sql_ShowDebug(sql_handle);
+		return;
+	}
+
+	// queued rows keep the time they were logged at
+	if( (t = time(NULL)) != last )
+	{
+		last = t;
+		strftime(now, sizeof(now), "'%Y-%m-%d %H:%M:%S'", localtime(&t));
+	}
+	length = safesnprintf(values, sizeof(values), "(%s, '%s', '%s', '%d', '%s')", now, ip2str(ip,NULL), esc_username, rcode, esc_message);
 
-	if( retcode != SQL_SUCCESS )
-		Sql_ShowDebug(sql_handle);
+	head = loginlog_writer.head;
+	next = (head + 1)%LOGINLOG_QUEUE;
+	if( length < 0 || length >= (int)sizeof(values) || next == InterlockedExchangeAdd(&loginlog_writer.tail, 0) )
+	{ // too long or queue full, write it on the main connection
+		if( SQL_ERROR == Sql_Query(sql_handle, "INSERT INTO `%s`(`time`,`ip`,`user`,`rcode`,`log`) VALUES (%s, '%s', '%s', '%d', '%s')",
+			log_login_db, now, ip2str(ip,NULL), esc_username, rcode, esc_message) )
+			Sql_ShowDebug(sql_handle);
+		return;
+	}
+	memcpy(loginlog_writer.queue[head].values, values, length);
+	loginlog_writer.queue[head].length = (unsigned short)length;
+	InterlockedExchange(&loginlog_writer.head, next); // publish the row
+	if( loginlog_pending() == LOGINLOG_BATCH )
+		racond_signal(loginlog_writer.cond);
 }
 
 /**
@@ -143,6 +277,9 @@ bool loginlog_config_read(const char* key, const char* value) {
 	else
 	if( strcmpi(key, "log_login_db") == 0 )
 		safestrncpy(log_login_db, value, sizeof(log_login_db));
+	else
+	if( strcmpi(key, "log_login_async") == 0 )
+		log_login_async = (bool)config_switch(value);
 	else
 		return false;
 
@@ -200,6 +337,37 @@ bool loginlog_init(void) {
 
 	enabled = true;
 
+	memset(&loginlog_writer, 0, sizeof(loginlog_writer));
+	if( log_login_async )
+	{// writer thread with its own connection
+		loginlog_writer.handle = Sql_Malloc();
+		if( SQL_ERROR == Sql_Connect(loginlog_writer.handle, username, password, hostname, port, database) )
+		{
+			ShowError("loginlog_init: The writer thread couldn't connect, the login log will be written synchronously.\n");
+			Sql_ShowDebug(loginlog_writer.handle);
+			Sql_Free(loginlog_writer.handle);
+			loginlog_writer.handle = NULL;
+			return true;
+		}
+		if( codepage[0] != '\0' && SQL_ERROR == Sql_SetEncoding(loginlog_writer.handle, codepage) )
+			Sql_ShowDebug(loginlog_writer.handle);
+		Sql_DisableKeepalive(loginlog_writer.handle); // the writer thread pings it
+
+		CREATE(loginlog_writer.queue, struct loginlog_row, LOGINLOG_QUEUE);
+		loginlog_writer.query_size = 512 + LOGINLOG_BATCH*(LOGINLOG_ROW_LENGTH + 1);
+		CREATE(loginlog_writer.query, char, loginlog_writer.query_size);
+		loginlog_writer.mutex = ramutex_create();
+		loginlog_writer.cond = racond_create();
+		if( (loginlog_writer.thread = rathread_create(loginlog_writer_main, NULL)) == NULL )
+		{
+			ShowError("loginlog_init: Couldn't create the writer thread, the login log will be written synchronously.\n");
+			loginlog_writer_final();
+			return true;
+		}
+		add_timer_func_list(loginlog_writer_timer, "loginlog_writer_timer");
+		add_timer_interval(gettick() + 1000, loginlog_writer_timer, 0, 0, 1000);
+	}
+
 	return true;
 }
 
@@ -210,7 +378,9 @@ bool loginlog_init(void) {
  * @return true success
  */
 bool loginlog_final(void) {
+	loginlog_writer_final();
 	Sql_Free(sql_handle);
 	sql_handle = NULL;
+	enabled = false;
 	return true;
 }
@@ -14,16 +14,9 @@
 extern "C" {
 #endif
 
-/**
- * Get the number of failed login attempts by the ip in the last minutes.
- * @param ip: ip to search attempt from
- * @param minutes: intervall to search
- * @return number of failed attempts
- */
-unsigned long loginlog_failedattempts(uint32 ip, unsigned int minutes);
-
 /**
  * Records an event in the login log.
+ *  Queued to the writer thread when log_login_async is enabled.
  * @param ip:
  * @param username:
  * @param rcode:
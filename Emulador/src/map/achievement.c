@@ -36,11 +36,61 @@
 
 static DBMap* achievement_db; // int id -> struct achievement_data*
 
+/// Achievements that can progress on a given event.
+struct achievement_list {
+	int count;
+	struct achievement_data** data;
+};
+
+static DBMap* achievement_event_db; // uint64 (type,objective value) -> struct achievement_list*
+static struct achievement_list achievement_type_list[AT_MAX]; // all achievements of each type
+static int achievement_num = 0; // number of achievements, achievement_data.index is below it
+static unsigned int achievement_gen = 1; // changes each time the database is loaded
+
+#define achievement_event_key(type,value) ( ((uint64)(type)<<32) | (uint32)(value) )
+
 struct achievement_data* achievement_search(int id)
 {
 	return (struct achievement_data*)idb_get(achievement_db,id);
 }
 
+/// Returns the achievements of the type that have an objective with the given value.
+static struct achievement_list* achievement_event_search(enum AchievementType type, int value)
+{
+	return (struct achievement_list*)ui64db_get(achievement_event_db,achievement_event_key(type,value));
+}
+
+/// Rebuilds the bitmap of completed achievements of a character.
+static void achievement_done_build(struct map_session_data* sd)
+{
+	struct achievement_data* ad;
+	int i;
+
+	RECREATE(sd->achievement_done,unsigned int,(achievement_num+31)/32 + 1);
+	memset(sd->achievement_done,0,sizeof(unsigned int) * ((achievement_num+31)/32 + 1));
+	for( i = 0; i < sd->achievement_count; i++ )
+	{
+		if( sd->achievement[i].completed && (ad = achievement_search(sd->achievement[i].id)) != NULL )
+			sd->achievement_done[ad->index/32] |= 1U<<(ad->index%32);
+	}
+	sd->achievement_done_gen = achievement_gen;
+}
+
+/// Returns true if the character completed the achievement.
+static bool achievement_isdone(struct map_session_data* sd, struct achievement_data* ad)
+{
+	if( sd->achievement_done_gen != achievement_gen )
+		achievement_done_build(sd);
+	return ( sd->achievement_done[ad->index/32] & (1U<<(ad->index%32)) ) != 0;
+}
+
+/// Forgets the completed achievements of a character, they are rebuilt from
+/// sd->achievement on the next check.
+void achievement_reset_done(struct map_session_data* sd)
+{
+	sd->achievement_done_gen = 0;
+}
+
 int achievement_empty_slot(struct map_session_data* sd)
 {
 	int i;
@@ -90,6 +140,8 @@ void achievement_complete(struct map_session_data* sd, struct achievement_data*
 	sad = &sd->achievement[index];
 	sad->completed = true;
 	sd->save_achievement = true;
+	if( sd->achievement_done_gen == achievement_gen )
+		sd->achievement_done[ad->index/32] |= 1U<<(ad->index%32);
 
 	// Sync with Achievement DB
 	for( i = 0; i < ad->objectives; i++ ) sad->count[i] = ad->ao[i].count;
@@ -150,19 +202,16 @@ void achievement_complete(struct map_session_data* sd, struct achievement_data*
 /*==========================================
  * Main Achievement Check
  *------------------------------------------*/
-static int achievement_validate(DBKey key, DBData *data, va_list ap)
+static int achievement_validate_sub(struct achievement_data* ad, struct map_session_data* sd, enum AchievementType type, va_list ap)
 {
-	struct achievement_data* ad; // Link to Database
 	struct s_achievement* sad;   // Link to Character Achievement
-	struct map_session_data* sd;
-	enum AchievementType type;
 	int i, index;
 	bool changed = false;
 
-	if( (ad = (struct achievement_data *)db_data2ptr(data)) == NULL || (sd = va_arg(ap,struct map_session_data*)) == NULL )
+	if( ad == NULL || sd == NULL )
 		return 0;
 	
-	if( (type = (enum AchievementType)va_arg(ap,int)) < AT_SCRIPT || type >= AT_MAX )
+	if( type < AT_SCRIPT || type >= AT_MAX )
 		return 0;
 
 	if( type == AT_MOB_KILL_CLASS && ad->type >= AT_MOB_KILL_CLASS && ad->type <= AT_MOB_CASTLE )
@@ -170,6 +219,9 @@ static int achievement_validate(DBKey key, DBData *data, va_list ap)
 	else if( type != ad->type )
 		return 0;
 
+	if( achievement_isdone(sd,ad) )
+		return 0;
+
 	index = achievement_index(sd,ad->id);
 	if( index < 0 || sd->achievement[index].completed )
 		return 0;
@@ -200,7 +252,6 @@ static int achievement_validate(DBKey key, DBData *data, va_list ap)
 			if( ad->type == AT_MOB_CASTLE && sd->bl.id != killer_id )
 				break; // Achievement of Mob Castles don't work for party
 
-			if( !mobdb_checkid(mob_id) ) return 0;
 			mob = mob_db(mob_id);
 
 			ARR_FIND(0,ad->objectives,i,ad->ao[i].count && sad->count[i] < ad->ao[i].count && (
@@ -319,83 +370,134 @@ static int achievement_validate(DBKey key, DBData *data, va_list ap)
 	return 1;
 }
 
+static int achievement_validate(struct achievement_data* ad, struct map_session_data* sd, enum AchievementType type, ...)
+{
+	int ret;
+	va_list ap;
+
+	va_start(ap,type);
+	ret = achievement_validate_sub(ad,sd,type,ap);
+	va_end(ap);
+	return ret;
+}
+
+/// Runs the achievement check for every achievement of the list.
+static void achievement_validate_list(struct achievement_list* list, struct map_session_data* sd, enum AchievementType type, ...)
+{
+	int i;
+
+	if( list == NULL )
+		return;
+
+	for( i = 0; i < list->count; i++ )
+	{
+		va_list ap;
+
+		va_start(ap,type);
+		achievement_validate_sub(list->data[i],sd,type,ap);
+		va_end(ap);
+	}
+}
+
 /*==========================================
  * Achievement Check Process by Type
  *------------------------------------------*/
 void achievement_validate_explore(struct map_session_data* sd, int mapid)
 {
-	if( sd && mapid >= 0 ) achievement_db->foreach(achievement_db,achievement_validate,sd,(int)AT_EXPLORE,mapid);
+	if( sd && mapid >= 0 ) achievement_validate_list(achievement_event_search(AT_EXPLORE,mapid),sd,AT_EXPLORE,mapid);
 }
 
-int achievement_validate_mob_sub(struct block_list* bl, va_list ap)
+/// Checks the monster kill achievements that the monster's class, race, element and size can progress.
+static void achievement_validate_mob_kill(struct map_session_data* sd, int mob_id, int killer_id)
 {
-	struct map_session_data *sd;
-	int party_id, mob_id, killer_id;
-
-	nullpo_ret(bl);
-	nullpo_ret(sd = (struct map_session_data*)bl);
-	party_id = va_arg(ap,int);
-	mob_id = va_arg(ap,int);
-	killer_id = va_arg(ap,int);
+	struct mob_db* mob = mob_db(mob_id);
 
-	if( sd->status.party_id != party_id )
-		return 0;
-
-	achievement_db->foreach(achievement_db,achievement_validate,sd,(int)AT_MOB_KILL_CLASS,mob_id,killer_id);
-	return 1;
+	achievement_validate_list(achievement_event_search(AT_MOB_KILL_CLASS,mob->vd.class_),sd,AT_MOB_KILL_CLASS,mob_id,killer_id);
+	achievement_validate_list(achievement_event_search(AT_MOB_CASTLE,mob->vd.class_),sd,AT_MOB_KILL_CLASS,mob_id,killer_id);
+	achievement_validate_list(achievement_event_search(AT_MOB_KILL_RACE,mob->status.race),sd,AT_MOB_KILL_CLASS,mob_id,killer_id);
+	achievement_validate_list(achievement_event_search(AT_MOB_KILL_ELEM,mob->status.def_ele),sd,AT_MOB_KILL_CLASS,mob_id,killer_id);
+	achievement_validate_list(achievement_event_search(AT_MOB_KILL_SIZE,mob->status.size),sd,AT_MOB_KILL_CLASS,mob_id,killer_id);
 }
 
 void achievement_validate_mob(struct map_session_data* sd, int mob_id)
 {
 	struct party_data* pd;
+	int i;
 
-	if( !sd || mob_id <= 0 ) return;
+	if( !sd || mob_id <= 0 || !mobdb_checkid(mob_id) ) return;
 	if( sd->status.party_id && (pd = party_search(sd->status.party_id)) != NULL )
-		map_foreachinrange(achievement_validate_mob_sub,&sd->bl,AREA_SIZE,BL_PC,sd->status.party_id,mob_id,sd->bl.id);
+	{ // Party members in the killer's area
+		for( i = 0; i < MAX_PARTY; i++ )
+		{
+			struct map_session_data* psd = pd->data[i].sd;
+
+			if( psd == NULL || psd->bl.prev == NULL || psd->bl.m != sd->bl.m || psd->status.party_id != sd->status.party_id )
+				continue;
+			if( psd != sd && !check_distance_bl(&sd->bl,&psd->bl,AREA_SIZE) )
+				continue;
+			achievement_validate_mob_kill(psd,mob_id,sd->bl.id);
+		}
+	}
 	else
-		achievement_db->foreach(achievement_db,achievement_validate,sd,(int)AT_MOB_KILL_CLASS,mob_id,sd->bl.id);
+		achievement_validate_mob_kill(sd,mob_id,sd->bl.id);
 }
 
 void achievement_validate_killer(struct map_session_data* sd)
 {
-	if( sd ) achievement_db->foreach(achievement_db,achievement_validate,sd,(int)AT_PC_KILL);
+	if( sd ) achievement_validate_list(&achievement_type_list[AT_PC_KILL],sd,AT_PC_KILL);
 }
 
 void achievement_validate_damage(struct map_session_data* sd, int damage)
 {
-	if( sd && damage > 0 ) achievement_db->foreach(achievement_db,achievement_validate,sd,(int)AT_PC_DAMAGE_DONE,damage);
+	if( sd && damage > 0 ) achievement_validate_list(&achievement_type_list[AT_PC_DAMAGE_DONE],sd,AT_PC_DAMAGE_DONE,damage);
 }
 
 void achievement_validate_quest(struct map_session_data* sd, int quest_id)
 {
-	if( sd && quest_id > 0 ) achievement_db->foreach(achievement_db,achievement_validate,sd,(int)AT_QUEST,quest_id);
+	if( sd && quest_id > 0 ) achievement_validate_list(achievement_event_search(AT_QUEST,quest_id),sd,AT_QUEST,quest_id);
 }
 
 void achievement_validate_achievement(struct map_session_data* sd, int achievement_id)
 {
-	if( sd && achievement_id > 0 ) achievement_db->foreach(achievement_db,achievement_validate,sd,(int)AT_ACHIEVEMENT,achievement_id);
+	if( sd && achievement_id > 0 ) achievement_validate_list(achievement_event_search(AT_ACHIEVEMENT,achievement_id),sd,AT_ACHIEVEMENT,achievement_id);
 }
 
 void achievement_validate_zeny(struct map_session_data* sd, enum AchievementType_Zeny sub_type, int amount)
 {
-	if( sd && amount > 0 ) achievement_db->foreach(achievement_db,achievement_validate,sd,(int)AT_ZENY,(int)sub_type,amount);
+	if( sd && amount > 0 ) achievement_validate_list(achievement_event_search(AT_ZENY,sub_type),sd,AT_ZENY,(int)sub_type,amount);
 }
 
 void achievement_validate_item(struct map_session_data* sd, enum AchievementType type, int nameid, int amount)
 {
 	struct item_data* it;
+	struct achievement_list* list;
+	int i, j;
 	
 	if( !sd || amount <= 0 || !(type >= AT_ITEM_FIND && type <= AT_ITEM_CONSUME) )
 		return;
 	if( (it = itemdb_exists(nameid)) == NULL )
 		return;
 
-	achievement_db->foreach(achievement_db,achievement_validate,sd,(int)type,it,amount);
+	if( it->nameid > 500 )
+		achievement_validate_list(achievement_event_search(type,it->nameid),sd,type,it,amount);
+
+	if( (list = achievement_event_search(type,it->type)) == NULL )
+		return;
+	for( i = 0; i < list->count; i++ )
+	{
+		struct achievement_data* ad = list->data[i];
+
+		// Already checked by item id
+		ARR_FIND(0,ad->objectives,j,it->nameid > 500 && ad->ao[j].value == it->nameid);
+		if( j < ad->objectives )
+			continue;
+		achievement_validate(ad,sd,type,it,amount);
+	}
 }
 
 void achievement_validate_bg(struct map_session_data* sd, enum AchievementType_BG sub_type, int amount)
 {
-	if( sd ) achievement_db->foreach(achievement_db,achievement_validate,sd,(int)AT_BATTLEGROUND,(int)sub_type,amount);
+	if( sd ) achievement_validate_list(achievement_event_search(AT_BATTLEGROUND,sub_type),sd,AT_BATTLEGROUND,(int)sub_type,amount);
 }
 
 /*==========================================
@@ -458,20 +560,103 @@ static bool achievement_read_achievementdb(char* str[], int columns, int current
 	return true;
 }
 
+/// Appends an achievement to a list, unless it's already the last one.
+static void achievement_list_add(struct achievement_list* list, struct achievement_data* ad)
+{
+	if( list->count && list->data[list->count-1] == ad )
+		return;
+	RECREATE(list->data,struct achievement_data*,list->count+1);
+	list->data[list->count++] = ad;
+}
+
+static void achievement_list_clear(struct achievement_list* list)
+{
+	if( list->data )
+		aFree(list->data);
+	list->data = NULL;
+	list->count = 0;
+}
+
+static int achievement_event_db_final(DBKey key, DBData *data, va_list ap)
+{
+	struct achievement_list* list = (struct achievement_list*)db_data2ptr(data);
+
+	if( list )
+	{
+		achievement_list_clear(list);
+		aFree(list);
+	}
+	return 0;
+}
+
+/// Indexes an achievement by type and by the value of each objective.
+static int achievement_db_index(DBKey key, DBData *data, va_list ap)
+{
+	struct achievement_data* ad = (struct achievement_data*)db_data2ptr(data);
+	int i;
+
+	ad->index = achievement_num++;
+	achievement_list_add(&achievement_type_list[ad->type],ad);
+
+	switch( ad->type )
+	{
+	case AT_SCRIPT:
+	case AT_PC_KILL:
+	case AT_PC_DAMAGE_DONE:
+		return 0; // Objectives are conditions, not targets
+	}
+
+	for( i = 0; i < ad->objectives; i++ )
+	{
+		struct achievement_list* list = achievement_event_search(ad->type,ad->ao[i].value);
+
+		if( list == NULL )
+		{
+			CREATE(list,struct achievement_list,1);
+			ui64db_put(achievement_event_db,achievement_event_key(ad->type,ad->ao[i].value),list);
+		}
+		achievement_list_add(list,ad);
+	}
+	return 0;
+}
+
+/// Rebuilds the event lookup tables.
+static void achievement_db_reindex(void)
+{
+	int i;
+
+	achievement_event_db->clear(achievement_event_db,achievement_event_db_final);
+	for( i = 0; i < AT_MAX; i++ )
+		achievement_list_clear(&achievement_type_list[i]);
+	achievement_num = 0;
+	achievement_db->foreach(achievement_db,achievement_db_index);
+
+	// Every cached completion bitmap is outdated
+	if( ++achievement_gen == 0 )
+		achievement_gen = 1;
+}
+
 void achievement_db_load(bool clear)
 {
 	if( clear ) achievement_db->clear(achievement_db,NULL);
 	sv_readdb(db_path, "achievement_db.txt", ',', 9, 9 + (ACHIEVEMENT_OBJETIVE_MAX * 2), -1, &achievement_read_achievementdb, false);
+	achievement_db_reindex();
 }
 
 void do_init_achievement(void)
 {
 	achievement_db = idb_alloc(DB_OPT_RELEASE_DATA);
+	achievement_event_db = ui64db_alloc(DB_OPT_BASE);
 	add_timer_func_list(achievement_delete_cutin_timer, "achievement_delete_cutin_timer");
 	achievement_db_load(false);
 }
 
 void do_final_achievement(void)
 {
+	int i;
+
+	achievement_event_db->destroy(achievement_event_db,achievement_event_db_final);
+	for( i = 0; i < AT_MAX; i++ )
+		achievement_list_clear(&achievement_type_list[i]);
 	achievement_db->destroy(achievement_db,NULL);
 }
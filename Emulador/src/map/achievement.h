@@ -108,6 +108,7 @@ struct achievement_objetive {
 
 struct achievement_data {
 	int id;
+	int index; // dense index, position in the completion bitmap of each character
 	char name[ACHIEVEMENT_NAME_LENGTH];
 	char cutin[ACHIEVEMENT_CUTIN_LENGTH];
 	int bexp, jexp, nameid, amount, objectives;
@@ -120,6 +121,7 @@ struct achievement_data {
 
 struct achievement_data* achievement_search(int id);
 int achievement_index(struct map_session_data* sd, int id);
+void achievement_reset_done(struct map_session_data* sd);
 void achievement_complete(struct map_session_data* sd, struct achievement_data* ad);
 void achievement_validate_explore(struct map_session_data* sd, int mapid);
 void achievement_validate_mob(struct map_session_data* sd, int mob_id);
@@ -3979,6 +3979,7 @@ ACMD_FUNC(mapinfo) {
 	int i, m_id, chat_num = 0, list = 0, vend_num = 0;
 	unsigned short m_index;
 	char mapname[24];
+	size_t cell_own, cell_shared;
 
 	nullpo_retr(-1, sd);
 
@@ -4023,6 +4024,19 @@ ACMD_FUNC(mapinfo) {
 
 	sprintf(atcmd_output, msg_txt(sd,1040), mapname, map[m_id].users, map[m_id].npc_num, chat_num, vend_num); // Map: %s | Players: %d | NPCs: %d | Chats: %d | Vendings: %d
 	clif_displaymessage(fd, atcmd_output);
+
+	// Cell memory, instances share the cells of their source map until they change them
+	cell_own = map_cell_memory(m_id, &cell_shared);
+	if (map[m_id].cell_page)
+		sprintf(atcmd_output, msg_txt(sd,1498), // Cells: %u KB own (%d/%d pages copied) | %u KB shared with %s
+			(unsigned int)(cell_own / 1024), map[m_id].cell_copied, (map[m_id].xs * map[m_id].ys + MAP_CELL_PAGE_SIZE - 1) >> MAP_CELL_PAGE_SHIFT,
+			(unsigned int)(cell_shared / 1024), map[map[m_id].instance_src_map].name);
+	else if (cell_shared)
+		sprintf(atcmd_output, msg_txt(sd,1499), // Cells: %u KB own | %u KB shared with %d instance(s)
+			(unsigned int)(cell_own / 1024), (unsigned int)(cell_shared / 1024), map[m_id].cell_share->refcount - 1);
+	else
+		sprintf(atcmd_output, msg_txt(sd,1500), (unsigned int)(cell_own / 1024)); // Cells: %u KB own
+	clif_displaymessage(fd, atcmd_output);
 	clif_displaymessage(fd, msg_txt(sd,1041)); // ------ Map Flags ------
 	if (map[m_id].flag.town)
 		clif_displaymessage(fd, msg_txt(sd,1042)); // Town Map
@@ -8653,14 +8667,14 @@ ACMD_FUNC(mobevent)
  *------------------------------------------*/
 ACMD_FUNC(whosell)
 {
-	struct map_session_data *pl_sd, *b_sd[MAX_SEARCH];
-	struct s_mapiterator* iter;
+	struct map_session_data *b_sd[MAX_SEARCH];
+	const struct s_search_store_entry* entry;
 
 	struct item_data *item_array[MAX_SEARCH];
 	int total[MAX_SEARCH], amount[MAX_SEARCH];
 	unsigned int MinPrice[MAX_SEARCH], MaxPrice[MAX_SEARCH];
 	char output[256];
-	int i, j, count = 1;
+	int i, j, n, count = 1;
 
 	if( !message || !*message )
 	{
@@ -8687,31 +8701,23 @@ ACMD_FUNC(whosell)
 		b_sd[i] = NULL;
 	}
 
-	iter = mapit_getallusers();
-	for( pl_sd = (TBL_PC*)mapit_first(iter); mapit_exists(iter); pl_sd = (TBL_PC*)mapit_next(iter) )
-	{
-		if( !pl_sd->vender_id ) continue;
-		for( i = 0; i < pl_sd->vend_num; i++ )
-		{ // Searching in the Vending List
-			for( j = 0; j < count; j++ )
-			{ // Compares with each search result
-				if( pl_sd->status.cart[pl_sd->vending[i].index].nameid != item_array[j]->nameid )
-					continue;
-
-				amount[j] += pl_sd->vending[i].amount;
-				total[j]++;
+	for( j = 0; j < count; j++ )
+	{ // Searching in the Vending Catalogue
+		entry = searchstore_catalogue_search(SEARCHTYPE_VENDING, item_array[j]->nameid, &n);
+		for( i = 0; i < n; i++ )
+		{
+			amount[j] += entry[i].sd->vending[entry[i].slot].amount;
+			total[j]++;
 
-				if( pl_sd->vending[i].value < MinPrice[j] )
-				{ // Best Price
-					MinPrice[j] = pl_sd->vending[i].value;
-					b_sd[j] = pl_sd;
-				}
-				if( pl_sd->vending[i].value > MaxPrice[j] )
-					MaxPrice[j] = pl_sd->vending[i].value;
+			if( entry[i].price < MinPrice[j] )
+			{ // Best Price
+				MinPrice[j] = entry[i].price;
+				b_sd[j] = entry[i].sd;
 			}
+			if( entry[i].price > MaxPrice[j] )
+				MaxPrice[j] = entry[i].price;
 		}
 	}
-	mapit_free(iter);
 
 	for( i = 0; i < count; i++ )
 	{
@@ -9659,6 +9665,8 @@ ACMD_FUNC(stats)
 		{ "JobChangeLvl (2nd) - %d", 0 },
 		{ "JobChangeLvl (3rd) - %d", 0 },
 		{ "Attack Speed MS - %d", 0 },
+		{ "Full Status Recalcs - %d", 0 },
+		{ "Partial Status Recalcs - %d", 0 },
 		{ NULL, 0 }
 	};
 
@@ -9685,6 +9693,8 @@ ACMD_FUNC(stats)
 	output_table[15].value = sd->change_level_2nd;
 	output_table[16].value = sd->change_level_3rd;
 	output_table[17].value = status_get_adelay(&sd->bl);
+	output_table[18].value = sd->status_calc_full;
+	output_table[19].value = sd->status_calc_partial;
 
 	sprintf(job_jobname, "Job - %s %s", job_name(sd->status.class_), "(level %d)");
 	sprintf(output, msg_txt(sd,53), sd->status.name); // '%s' stats:
@@ -10608,6 +10618,7 @@ ACMD_FUNC(unachieve)
 
 		memset(&sd->achievement[sd->achievement_count],0,sizeof(struct s_achievement));
 		sd->save_achievement = true;
+		achievement_reset_done(sd);
 		clif_displaymessage(fd,"Achievement removed at all from this Character.");
 	}
 	else
@@ -8635,6 +8635,7 @@ static const struct _battle_data {
 	{ "exp_cost_inspiration",               &battle_config.exp_cost_inspiration,            1,      0,      100,            },
 	{ "mvp_exp_reward_message",             &battle_config.mvp_exp_reward_message,          0,      0,      1,              },
 	{ "can_damage_skill",                   &battle_config.can_damage_skill,                1,      0,      BL_ALL,         },
+	{ "monster_ai_threads",                 &battle_config.mob_ai_threads,                  0,      0,      16,             },
 };
 
 #ifndef STATS_OPT_OUT
@@ -8781,6 +8782,12 @@ int battle_set_value(const char* w1, const char* w2)
 		val = battle_data[i].defval;
 	}
 
+	if (battle_data[i].val == &battle_config.area_size && val != battle_config.area_size) {
+		battle_config.area_size = val;
+		map_viewers_rebuild(); // viewer sets depend on the area size
+		return 1;
+	}
+
 	*battle_data[i].val = val;
 	return 1;
 }
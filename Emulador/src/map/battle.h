@@ -712,6 +712,8 @@ extern struct Battle_Config
 
 	int max_stat_validate;
 
+	int mob_ai_threads; // Worker threads of the hard monster AI (0: single-threaded)
+
 } battle_config;
 
 void do_init_battle(void);
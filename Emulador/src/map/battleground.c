@@ -529,9 +529,9 @@ int bg_send_message(struct map_session_data *sd, const char *mes, int len)
 int bg_send_xy_timer_sub(DBKey key, DBData *data, va_list ap)
 {
 	struct battleground_data *bg = (struct battleground_data *)db_data2ptr(data);
-	struct map_session_data *sd;
+	struct map_session_data *sd, *reveal[MAX_BG_MEMBERS];
 	char output[128];
-	int i, m;
+	int i, m, reveal_count = 0;
 
 	nullpo_ret(bg);
 	m = map_mapindex2mapid(bg->mapindex);
@@ -559,7 +559,7 @@ int bg_send_xy_timer_sub(DBKey key, DBData *data, va_list ap)
 			clif_bg_xy(sd);
 		}
 		if( bg->reveal_pos && bg->reveal_flag && sd->bl.m == m ) // Reveal each 4 seconds
-			map_foreachinmap(bg_reveal_pos,m,BL_PC,sd,1,bg->color);
+			reveal[reveal_count++] = sd;
 		if( battle_config.bg_idle_announce && !sd->state.bg_afk && DIFF_TICK(last_tick, sd->idletime) >= battle_config.bg_idle_announce && bg->g )
 		{ // Idle announces
 			sd->state.bg_afk = 1;
@@ -567,6 +567,10 @@ int bg_send_xy_timer_sub(DBKey key, DBData *data, va_list ap)
 			clif_bg_message(bg, bg->bg_id, bg->g->name, output, strlen(output) + 1);
 		}
 	}
+
+	// the whole team at once, instead of going through the map for each member
+	if( reveal_count )
+		clif_bg_reveal_pos(reveal, reveal_count, bg->bg_id, m, bg->color);
 	return 0;
 }
 
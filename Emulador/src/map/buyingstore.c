@@ -14,6 +14,7 @@
 #include "clif.h"  // clif_buyingstore_*
 #include "log.h"  // log_pick_pc, log_zeny
 #include "pc.h"  // struct map_session_data
+#include "searchstore.h"  // searchstore_catalogue_*
 #include "chrif.h"
 
 #include <stdlib.h> // atoi
@@ -253,6 +254,7 @@ int8 buyingstore_create(struct map_session_data* sd, int zenylimit, unsigned cha
 	clif_buyingstore_myitemlist(sd);
 	clif_buyingstore_entry(sd);
 	idb_put(buyingstore_db, sd->status.char_id, sd);
+	searchstore_catalogue_update(sd, SEARCHTYPE_BUYING_STORE);
 
 	if( map[sd->bl.m].flag.vending_cell )
 		map_setcell(sd->bl.m, sd->bl.x, sd->bl.y, CELL_NOVENDING, false);
@@ -279,6 +281,7 @@ void buyingstore_close(struct map_session_data* sd) {
 		sd->buyer_id = 0;
 		memset(&sd->buyingstore, 0, sizeof(sd->buyingstore));
 		idb_remove(buyingstore_db, sd->status.char_id);
+		searchstore_catalogue_remove(sd, SEARCHTYPE_BUYING_STORE);
 
 		// notify other players
 		clif_buyingstore_disappear_entry(sd);
@@ -496,6 +499,7 @@ void buyingstore_trade(struct map_session_data* sd, uint32 account_id, unsigned
 		clif_buyingstore_delete_item(sd, index, amount, pl_sd->buyingstore.items[listidx].price);
 		clif_buyingstore_update_item(pl_sd, nameid, amount, sd->status.char_id, zeny);
 	}
+	searchstore_catalogue_update(pl_sd, SEARCHTYPE_BUYING_STORE);
 
 	if( save_settings&CHARSAVE_BANK ) {
 		chrif_save(sd, 0);
@@ -554,53 +558,6 @@ bool buyingstore_search(struct map_session_data* sd, unsigned short nameid)
 }
 
 
-/// Searches for all items in a buyingstore, that match given ids, price and possible cards.
-/// @return Whether or not the search should be continued.
-bool buyingstore_searchall(struct map_session_data* sd, const struct s_search_store_search* s)
-{
-	unsigned int i, idx;
-	struct s_buyingstore_item* it;
-
-	nullpo_ret(sd);
-
-	if( !sd->state.buyingstore )
-	{// not buying
-		return true;
-	}
-
-	for( idx = 0; idx < s->item_count; idx++ )
-	{
-		ARR_FIND( 0, sd->buyingstore.slots, i, sd->buyingstore.items[i].nameid == s->itemlist[idx] && sd->buyingstore.items[i].amount );
-		if( i == sd->buyingstore.slots )
-		{// not found
-			continue;
-		}
-		it = &sd->buyingstore.items[i];
-
-		if( s->min_price && s->min_price > (unsigned int)it->price )
-		{// too low price
-			continue;
-		}
-
-		if( s->max_price && s->max_price < (unsigned int)it->price )
-		{// too high price
-			continue;
-		}
-
-		if( s->card_count )
-		{// ignore cards, as there cannot be any
-			;
-		}
-
-		if( !searchstore_result(s->search_sd, sd->buyer_id, sd->status.account_id, sd->message, it->nameid, it->amount, it->price, buyingstore_blankslots, 0) )
-		{// result set full
-			return false;
-		}
-	}
-
-	return true;
-}
-
 /**
 * Open buyingstore for Autotrader
 * @param sd Player as autotrader
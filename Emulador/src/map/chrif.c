@@ -172,6 +172,9 @@ bool chrif_auth_delete(uint32 account_id, uint32 char_id, enum sd_state state) {
 			if (node->sd->regs.arrays)
 				node->sd->regs.arrays->destroy(node->sd->regs.arrays, script_free_array_db);
 
+			if (node->sd->vars_dirty_list)
+				aFree(node->sd->vars_dirty_list);
+
 			aFree(node->sd);
 		}
 
@@ -1404,10 +1407,11 @@ int chrif_updatefamelist_ack(int fd) {
 
 int chrif_save_scdata(struct map_session_data *sd) { //parses the sc_data of the player and sends it to the char-server for saving. [Skotlex]
 #ifdef ENABLE_SC_SAVING
-	int i, count=0;
+	int i, j, n, count=0;
 	unsigned int tick;
 	struct status_change_data data;
 	struct status_change *sc = &sd->sc;
+	enum sc_type list[SC_MAX];
 	const struct TimerData *timer;
 
 	chrif_check(-1);
@@ -1418,7 +1422,9 @@ int chrif_save_scdata(struct map_session_data *sd) { //parses the sc_data of the
 	WFIFOL(char_fd,4) = sd->status.account_id;
 	WFIFOL(char_fd,8) = sd->status.char_id;
 
-	for (i = 0; i < SC_MAX; i++) {
+	n = status_change_getactive(sc, list);
+	for (j = 0; j < n; j++) {
+		i = list[j];
 		if (!sc->data[i])
 			continue;
 		if (sc->data[i]->timer != INVALID_TIMER) {
@@ -2086,6 +2092,9 @@ int auth_db_final(DBKey key, DBData *data, va_list ap) {
 		if (node->sd->regs.arrays)
 			node->sd->regs.arrays->destroy(node->sd->regs.arrays, script_free_array_db);
 
+		if (node->sd->vars_dirty_list)
+			aFree(node->sd->vars_dirty_list);
+
 		aFree(node->sd);
 	}
 
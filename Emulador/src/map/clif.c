@@ -438,9 +438,23 @@ static bool clif_session_isValid(struct map_session_data *sd) {
 	return false;
 }
 
+/// Parameters of an area-wise clif_send
+struct clif_send_area {
+	const uint8* buf;
+	int len;
+	struct block_list* src_bl;
+	int type;
+	int faction_id, lang_id; // *_CHAT_WOC faction/language filters
+	struct socket_packet* packet; // shared copy of buf, or NULL
+};
+
+/// Minimum length of an area packet to be queued as a shared buffer
+/// instead of being copied into every write fifo.
+#define CLIF_SHARED_PACKET_MIN 64
+
 /*==========================================
  * sub process of clif_send
- * Called from a map_foreachinarea (grabs all players in specific area and subjects them to this function)
+ * Called from a map_iterateinarea (grabs all players in specific area and subjects them to this function)
  * In order to send area-wise packets, such as:
  * - AREA : everyone nearby your area
  * - AREA_WOSC (AREA WITHOUT SAME CHAT) : Not run for people in the same chat as yours
@@ -448,11 +462,12 @@ static bool clif_session_isValid(struct map_session_data *sd) {
  * - AREA_WOS (AREA WITHOUT SELF) : Not run for self
  * - AREA_CHAT_WOC : Everyone in the area of your chat without a chat
  *------------------------------------------*/
-static int clif_send_sub(struct block_list *bl, va_list ap)
+static int clif_send_sub(struct block_list *bl, void* data)
 {
+	struct clif_send_area* area = (struct clif_send_area*)data;
 	struct block_list *src_bl;
 	struct map_session_data *sd;
-	unsigned char *buf;
+	const uint8 *buf;
 	int len, type, fd;
 
 	nullpo_ret(bl);
@@ -462,10 +477,10 @@ static int clif_send_sub(struct block_list *bl, va_list ap)
 	if (!fd) //Don't send to disconnected clients.
 		return 0;
 
-	buf = va_arg(ap,unsigned char*);
-	len = va_arg(ap,int);
-	nullpo_ret(src_bl = va_arg(ap,struct block_list*));
-	type = va_arg(ap,int);
+	buf = area->buf;
+	len = area->len;
+	nullpo_ret(src_bl = area->src_bl);
+	type = area->type;
 
 	switch(type) {
 	case AREA:
@@ -498,7 +513,7 @@ static int clif_send_sub(struct block_list *bl, va_list ap)
 		if( sd->chatID || bl == src_bl )
 			return 0;
 
-		faction_id = va_arg(ap,int);
+		faction_id = area->faction_id;
 		if( faction_id == sd->status.faction_id && (type == OTHER_FACTION_AREA_CHAT_WOC || type == OTHER_FACTION_LANG_AREA_CHAT_WOC || type == OTHER_FACTION_OTHER_LANG_AREA_CHAT_WOC) )
 			return 0;
 		if( faction_id != sd->status.faction_id && (type == FACTION_AREA_CHAT_WOC || type == FACTION_LANG_AREA_CHAT_WOC || type == FACTION_OTHER_LANG_AREA_CHAT_WOC) )
@@ -506,7 +521,7 @@ static int clif_send_sub(struct block_list *bl, va_list ap)
 
 		if( type != OTHER_FACTION_AREA_CHAT_WOC && type != FACTION_AREA_CHAT_WOC )
 		{
-			lang_id = va_arg(ap,int);
+			lang_id = area->lang_id;
 			if( sd->status.faction_id ) fd = faction_search(sd->status.faction_id);
 			known = (sd->lang_id == lang_id || (sd->lang_mastery&lang_pow[lang_id-1]) || (fd && fd->lang_id == lang_id));
 
@@ -558,6 +573,16 @@ static int clif_send_sub(struct block_list *bl, va_list ap)
 		!sd->sc.data[SC_INTRAVISION] && battle_check_target(src_bl,&sd->bl,BCT_ENEMY) > 0)
 		return 0;
 
+	// walking of others is redundant for a client that can't keep up, the next update corrects it
+	if (bl != src_bl && RBUFW(buf,0) == 0x86 && session_droppacket(fd))
+		return 0;
+
+	if (area->packet) {
+		if (packet_db[sd->packet_ver][RBUFW(buf,0)].len) // packet must exist for the client version
+			WFIFOPACKET(fd, area->packet);
+		return 0;
+	}
+
 	WFIFOHEAD(fd, len);
 	if (WFIFOP(fd,0) == buf) {
 		ShowError("WARNING: Invalid use of clif_send function\n");
@@ -577,6 +602,37 @@ static int clif_send_sub(struct block_list *bl, va_list ap)
 	return 0;
 }
 
+/*==========================================
+ * Sends an area packet to the players within range cells of bl.
+ * Objects on a map use their viewer set; anything else (dummy objects,
+ * ranges larger than AREA_SIZE) falls back to searching the blocks.
+ *------------------------------------------*/
+static void clif_send_area(struct clif_send_area* area, struct block_list* bl, int range)
+{
+	struct map_viewers* v;
+	int i;
+
+	if( range > AREA_SIZE || map_id2bl(bl->id) != bl || bl->prev == NULL ) {
+		area->packet = NULL;
+		map_iterateinarea(clif_send_sub, bl->m, bl->x-range, bl->y-range, bl->x+range, bl->y+range, BL_PC, area);
+		return;
+	}
+
+	v = &bl->viewers;
+	area->packet = ( v->count > 1 && area->len >= CLIF_SHARED_PACKET_MIN ) ? socket_packet_create(area->buf, area->len) : NULL;
+	for( i = 0; i < v->count; i++ ) {
+		struct map_session_data* tsd = v->sd[i];
+
+		if( range < AREA_SIZE && (abs(tsd->bl.x-bl->x) > range || abs(tsd->bl.y-bl->y) > range) )
+			continue;
+		clif_send_sub(&tsd->bl, area);
+	}
+	if( area->packet ) {
+		socket_packet_release(area->packet);
+		area->packet = NULL;
+	}
+}
+
 /*==========================================
  * Packet Delegation (called on all packets that require data to be sent to more than one client)
  * functions that are sent solely to one use whose ID it posses use WFIFOSET
@@ -590,10 +646,18 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 	struct battleground_data *bg = NULL;
 	int x0 = 0, x1 = 0, y0 = 0, y1 = 0, fd;
 	struct s_mapiterator* iter;
+	struct clif_send_area area;
 
 	if( type != ALL_CLIENT && type != BG_LISTEN )
 		nullpo_ret(bl);
 
+	area.buf = buf;
+	area.len = len;
+	area.src_bl = bl;
+	area.type = type;
+	area.faction_id = area.lang_id = 0;
+	area.packet = NULL;
+
 	if( type == ALL_REGION && map[bl->m].region_id < 1 )
 		return 0; // Not on a Region
 
@@ -640,12 +704,11 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 			clif_send (buf, len, bl, SELF);
 	case AREA_WOC:
 	case AREA_WOS:
-		map_foreachinarea(clif_send_sub, bl->m, bl->x-AREA_SIZE, bl->y-AREA_SIZE, bl->x+AREA_SIZE, bl->y+AREA_SIZE,
-			BL_PC, buf, len, bl, type);
+		clif_send_area(&area, bl, AREA_SIZE);
 		break;
 	case AREA_CHAT_WOC:
-		map_foreachinarea(clif_send_sub, bl->m, bl->x-(AREA_SIZE-5), bl->y-(AREA_SIZE-5),
-			bl->x+(AREA_SIZE-5), bl->y+(AREA_SIZE-5), BL_PC, buf, len, bl, AREA_WOC);
+		area.type = AREA_WOC;
+		clif_send_area(&area, bl, AREA_SIZE-5);
 		break;
 	case LANG_AREA_CHAT_WOC:
 	case OTHER_LANG_AREA_CHAT_WOC:
@@ -656,19 +719,18 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 	case OTHER_FACTION_LANG_AREA_CHAT_WOC:
 	case OTHER_FACTION_OTHER_LANG_AREA_CHAT_WOC:
 		if( !sd ) break;
-		map_foreachinarea(clif_send_sub, bl->m, bl->x-(AREA_SIZE-5), bl->y-(AREA_SIZE-5),
-			bl->x+(AREA_SIZE-5), bl->y+(AREA_SIZE-5), BL_PC, buf, len, bl, type, sd->status.faction_id, sd->lang_id);
+		area.faction_id = sd->status.faction_id;
+		area.lang_id = sd->lang_id;
+		clif_send_area(&area, bl, AREA_SIZE-5);
 		break;
 	case FACTION_AREA_WOS:
-		map_foreachinarea(clif_send_sub, bl->m, bl->x-AREA_SIZE, bl->y-AREA_SIZE, bl->x+AREA_SIZE, bl->y+AREA_SIZE,
-			BL_PC, buf, len, bl, type);
+		clif_send_area(&area, bl, AREA_SIZE);
 		break;
 
 	case AREA_IWS:
 	case AREA_IWOS:
 	case AREA_WOI:
-		map_foreachinarea(clif_send_sub, bl->m, bl->x-AREA_SIZE, bl->y-AREA_SIZE, bl->x+AREA_SIZE, bl->y+AREA_SIZE,
-			BL_PC, buf, len, bl, type);
+		clif_send_area(&area, bl, AREA_SIZE);
 		break;
 
 	case CHAT:
@@ -3503,6 +3565,8 @@ void clif_updatestatus(struct map_session_data *sd,int type)
 			clif_hpmeter(sd);
 		if( !battle_config.party_hp_mode && sd->status.party_id )
 			clif_party_hp(sd);
+		else if( sd->status.party_id )
+			party_send_xy_dirty(sd); // sent with the party map dots
 		if( sd->bg_id )
 			clif_bg_hp(sd);
 		if( map[sd->bl.m].flag.fvf )
@@ -17369,6 +17433,48 @@ void clif_bg_xy_remove(struct map_session_data *sd)
 	clif_send(buf, packet_len(0x2df), &sd->bl, BG_SAMEMAP_WOS);
 }
 
+static int clif_bg_reveal_pos_sub(struct block_list *bl, va_list ap)
+{
+	struct map_session_data *sd = (struct map_session_data *)bl;
+	const unsigned char* buf = va_arg(ap, const unsigned char*);
+	int len = va_arg(ap, int);
+	int bg_id = va_arg(ap, int);
+
+	if( sd->bg_id == bg_id )
+		return 0; // Same Team
+
+	WFIFOHEAD(sd->fd, len);
+	memcpy(WFIFOP(sd->fd,0), buf, len);
+	WFIFOSET(sd->fd, len);
+	return 1;
+}
+
+/// Shows the members of a battleground team on the minimap of the other players on the map.
+/// The viewpoints of all the members are built once and sent as a set to each player.
+/// 0144 <npc id>.L <type>.L <x>.L <y>.L <id>.B <color>.L (ZC_COMPASS)
+void clif_bg_reveal_pos(struct map_session_data **members, int count, int bg_id, int16 m, int color)
+{
+	unsigned char buf[MAX_BG_MEMBERS*32];
+	int i, len = packet_len(0x144); // 23
+
+	if( len > 32 )
+		return;
+	count = min(count, MAX_BG_MEMBERS);
+	for( i = 0; i < count; i++ ) {
+		unsigned char* p = buf + i*len;
+
+		WBUFW(p,0) = 0x144;
+		WBUFL(p,2) = members[i]->bl.id;
+		WBUFL(p,6) = 1;
+		WBUFL(p,10) = members[i]->bl.x;
+		WBUFL(p,14) = members[i]->bl.y;
+		WBUFB(p,18) = (uint8)members[i]->bl.id;
+		WBUFL(p,19) = color;
+	}
+	if( count > 0 )
+		map_foreachinmap(clif_bg_reveal_pos_sub, m, BL_PC, buf, count*len, bg_id);
+}
+
 void clif_bg_belonginfo(struct map_session_data *sd)
 {
 	int fd;
@@ -778,6 +778,7 @@ void clif_bg_hp(struct map_session_data *sd);
 void clif_bg_hp_single(int fd, struct map_session_data* ssd);
 void clif_bg_xy(struct map_session_data *sd);
 void clif_bg_xy_remove(struct map_session_data *sd);
+void clif_bg_reveal_pos(struct map_session_data **members, int count, int bg_id, int16 m, int color);
 void clif_bg_belonginfo(struct map_session_data *sd);
 int clif_visual_guild_id(struct block_list *bl);
 int clif_visual_emblem_id(struct block_list *bl);
@@ -358,10 +358,7 @@ int intif_wis_message_to_gm(char *wisp_name, int permission, char *mes)
  */
 int intif_saveregistry(struct map_session_data *sd)
 {
-	DBIterator *iter;
-	DBKey key;
-	DBData *data;
-	int plen = 0;
+	int i, plen = 0;
 	size_t len;
 
 	if (CheckForCharServer() || !sd->regs.vars)
@@ -376,23 +373,16 @@ int intif_saveregistry(struct map_session_data *sd)
 
 	plen = 14;
 
-	iter = db_iterator(sd->regs.vars);
-	for( data = iter->first(iter,&key); iter->exists(iter); data = iter->next(iter,&key) ) {
+	// only the registries changed since the last save, see pc_setregistry
+	for( i = 0; i < sd->vars_dirty_count; i++ ) {
+		int64 reg = sd->vars_dirty_list[i];
 		const char *varname = NULL;
-		struct script_reg_state *src = NULL;
+		struct script_reg_state *src = (struct script_reg_state *)i64db_get(sd->regs.vars, reg);
 
-		if( data->type != DB_DATA_PTR ) // it's a @number
+		if( src == NULL || !src->update )
 			continue;
 
-		varname = get_str(script_getvarid(key.i64));
-
-		if( varname[0] == '@' ) // @string$ can get here, so we skip
-			continue;
-
-		src = (struct script_reg_state *)db_data2ptr(data);
-
-		if( !src->update )
-			continue;
+		varname = get_str(script_getvarid(reg));
 
 		src->update = false;
 
@@ -404,7 +394,7 @@ int intif_saveregistry(struct map_session_data *sd)
 		safestrncpy((char*)WFIFOP(inter_fd,plen), varname, len);
 		plen += len;
 
-		WFIFOL(inter_fd, plen) = script_getvaridx(key.i64);
+		WFIFOL(inter_fd, plen) = script_getvaridx(reg);
 		plen += 4;
 
 		if( src->type ) {
@@ -422,7 +412,7 @@ int intif_saveregistry(struct map_session_data *sd)
 				safestrncpy((char*)WFIFOP(inter_fd,plen), p->value, len);
 				plen += len;
 			} else {
-				script_reg_destroy_single(sd,key.i64,&p->flag);
+				script_reg_destroy_single(sd,reg,&p->flag);
 			}
 
 		} else {
@@ -435,7 +425,7 @@ int intif_saveregistry(struct map_session_data *sd)
 				WFIFOL(inter_fd, plen) = p->value;
 				plen += 4;
 			} else {
-				script_reg_destroy_single(sd,key.i64,&p->flag);
+				script_reg_destroy_single(sd,reg,&p->flag);
 			}
 
 		}
@@ -457,7 +447,7 @@ int intif_saveregistry(struct map_session_data *sd)
 			plen = 14;
 		}
 	}
-	dbi_destroy(iter);
+	sd->vars_dirty_count = 0;
 
 	WFIFOW(inter_fd, 2) = plen;
 	WFIFOSET(inter_fd, plen);
@@ -1999,6 +1989,7 @@ int intif_parse_Achievement_data(int fd)
 	}
 
 	sd->achievement_count = count; // Number of Achievements on process
+	achievement_reset_done(sd);
 
 	// Check if new Achievements of type AT_ACHIEVEMENT are implemented
 	for( i = 0; i < count; i++ )
@@ -19,6 +19,21 @@ static DBMap* itemdb; /// Item DB
 static DBMap *itemdb_combo; /// Item Combo DB
 static DBMap *itemdb_group; /// Item Group DB
 
+/// Name indexes of the Item DB, rebuilt by itemdb_read
+static struct {
+	struct item_data** items; /// all the items
+	int count;
+	DBMap* name; /// const char* name (case insensitive) -> struct item_data*
+	DBMap* jname; /// const char* jname (case insensitive) -> struct item_data*
+	DBMap* trigrams; /// uint32 trigram (upper case) -> struct itemdb_trigram*
+} itemdb_names;
+
+/// Items with a trigram in their name or jname
+struct itemdb_trigram {
+	int count, max;
+	int* items; /// index in itemdb_names.items, ascending
+};
+
 struct item_data *dummy_item; /// This is the default dummy item used for non-existant items. [Skotlex]
 
 /**
@@ -39,59 +54,107 @@ struct s_item_group_db *itemdb_group_exists(unsigned short group_id) {
 	return (struct s_item_group_db *)uidb_get(itemdb_group, group_id);
 }
 
+/// Trigram of the upper case characters at str.
+static inline uint32 itemdb_trigram(const char *str) {
+	return ((uint32)TOUPPER(str[0])<<16) | ((uint32)TOUPPER(str[1])<<8) | (uint32)TOUPPER(str[2]);
+}
+
+/**
+ * Adds the trigrams of a name to the substring index.
+ * @param str: name or jname of the item
+ * @param idx: index of the item in itemdb_names.items
+ */
+static void itemdb_names_addtrigrams(const char *str, int idx) {
+	for( ; str[0] && str[1] && str[2]; str++ ) {
+		uint32 key = itemdb_trigram(str);
+		struct itemdb_trigram *tri = (struct itemdb_trigram *)uidb_get(itemdb_names.trigrams, key);
+
+		if( tri == NULL ) {
+			CREATE(tri, struct itemdb_trigram, 1);
+			uidb_put(itemdb_names.trigrams, key, tri);
+		}
+		if( tri->count && tri->items[tri->count-1] == idx )
+			continue; // already there (name and jname are added one after the other)
+		if( tri->count == tri->max ) {
+			tri->max += 16;
+			RECREATE(tri->items, int, tri->max);
+		}
+		tri->items[tri->count++] = idx;
+	}
+}
+
 /**
- * Search for item name
- * name = item alias, so we should find items aliases first. if not found then look for "jname" (full name)
  * @see DBApply
  */
-static int itemdb_searchname_sub(DBKey key, DBData *data, va_list ap)
-{
-	struct item_data *item = (struct item_data *)db_data2ptr(data), **dst, **dst2;
-	char *str;
-	str = va_arg(ap,char *);
-	dst = va_arg(ap,struct item_data **);
-	dst2 = va_arg(ap,struct item_data **);
-
-	//Absolute priority to Aegis code name.
-	if (strcmpi(item->name,str) == 0)
-		*dst = item;
-
-	//Second priority to Client displayed name.
-	if (strcmpi(item->jname,str) == 0)
-		*dst2 = item;
+static int itemdb_names_final_sub(DBKey key, DBData *data, va_list ap) {
+	struct itemdb_trigram *tri = (struct itemdb_trigram *)db_data2ptr(data);
+
+	if( tri->items )
+		aFree(tri->items);
+	aFree(tri);
 	return 0;
 }
 
+/**
+* Releases the name indexes of the Item DB
+*/
+static void itemdb_names_final(void) {
+	if( itemdb_names.items )
+		aFree(itemdb_names.items);
+	if( itemdb_names.name )
+		db_destroy(itemdb_names.name);
+	if( itemdb_names.jname )
+		db_destroy(itemdb_names.jname);
+	if( itemdb_names.trigrams )
+		itemdb_names.trigrams->destroy(itemdb_names.trigrams, itemdb_names_final_sub);
+	memset(&itemdb_names, 0, sizeof(itemdb_names));
+}
+
+/**
+* Builds the name indexes of the Item DB, used by itemdb_searchname and itemdb_searchname_array
+*/
+static void itemdb_names_build(void) {
+	DBIterator *iter;
+	struct item_data *id;
+
+	itemdb_names_final();
+	itemdb_names.name = stridb_alloc(DB_OPT_BASE, ITEM_NAME_LENGTH);
+	itemdb_names.jname = stridb_alloc(DB_OPT_BASE, ITEM_NAME_LENGTH);
+	itemdb_names.trigrams = uidb_alloc(DB_OPT_BASE);
+	CREATE(itemdb_names.items, struct item_data *, db_size(itemdb) + 1);
+
+	iter = db_iterator(itemdb);
+	for( id = (struct item_data *)dbi_first(iter); dbi_exists(iter); id = (struct item_data *)dbi_next(iter) ) {
+		int idx = itemdb_names.count++;
+
+		itemdb_names.items[idx] = id;
+		// the last item with a name wins, like the full scan did
+		strdb_put(itemdb_names.name, id->name, id);
+		strdb_put(itemdb_names.jname, id->jname, id);
+		itemdb_names_addtrigrams(id->jname, idx);
+		itemdb_names_addtrigrams(id->name, idx);
+	}
+	dbi_destroy(iter);
+}
+
 /*==========================================
  * Return item data from item name. (lookup)
+ * Absolute priority to Aegis code name, then to the client displayed name.
  * @param str Item Name
  * @return item data
  *------------------------------------------*/
 struct item_data* itemdb_searchname(const char *str)
 {
-	struct item_data *item = NULL, * item2 = NULL;
-
-	itemdb->foreach(itemdb,itemdb_searchname_sub,str,&item,&item2);
-	return item ? item : item2;
-}
-
-/**
- * @see DBMatcher
- */
-static int itemdb_searchname_array_sub(DBKey key, DBData data, va_list ap)
-{
-	struct item_data *item = (struct item_data *)db_data2ptr(&data);
-	char *str = va_arg(ap,char *);
+	struct item_data *item = (struct item_data *)strdb_get(itemdb_names.name, str);
 
-	if (stristr(item->jname,str))
-		return 0;
-	if (stristr(item->name,str))
-		return 0;
-	return strcmpi(item->jname,str);
+	if( item == NULL )
+		item = (struct item_data *)strdb_get(itemdb_names.jname, str);
+	return item;
 }
 
 /*==========================================
  * Founds up to N matches. Returns number of matches [Skotlex]
+ * Items are matched if str is part of their name or jname.
  * @param *data
  * @param size
  * @param str
@@ -99,13 +162,37 @@ static int itemdb_searchname_array_sub(DBKey key, DBData data, va_list ap)
  *------------------------------------------*/
 int itemdb_searchname_array(struct item_data** data, int size, const char *str)
 {
-	DBData *db_data[MAX_SEARCH];
-	int i, count = 0, db_count;
+	int i, count = 0;
+
+	if( str[0] && str[1] && str[2] ) {
+		// candidates are the items with the least common trigram of str
+		struct itemdb_trigram *best = NULL;
+		const char *p;
+
+		for( p = str; p[2]; p++ ) {
+			struct itemdb_trigram *tri = (struct itemdb_trigram *)uidb_get(itemdb_names.trigrams, itemdb_trigram(p));
+
+			if( tri == NULL )
+				return 0;
+			if( best == NULL || tri->count < best->count )
+				best = tri;
+		}
+		for( i = 0; i < best->count && count < size; i++ ) {
+			struct item_data *item = itemdb_names.items[best->items[i]];
 
-	db_count = itemdb->getall(itemdb, (DBData**)&db_data, size, itemdb_searchname_array_sub, str);
-	for (i = 0; i < db_count && count < size; i++)
-		data[count++] = (struct item_data*)db_data2ptr(db_data[i]);
+			if( stristr(item->jname, str) || stristr(item->name, str) )
+				data[count++] = item;
+		}
+		return count;
+	}
 
+	// too short for the index
+	for( i = 0; i < itemdb_names.count && count < size; i++ ) {
+		struct item_data *item = itemdb_names.items[i];
+
+		if( stristr(item->jname, str) || stristr(item->name, str) )
+			data[count++] = item;
+	}
 	return count;
 }
 
@@ -1738,6 +1825,7 @@ static void itemdb_read(void) {
 		itemdb_read_sqldb();
 	else
 		itemdb_readdb();
+	itemdb_names_build(); // the groups below can refer to items by name
 	
 	itemdb_read_customrates(); // [Zephyrus] Drop Rate Bonus
 	itemdb_read_ancientdb();
@@ -1862,6 +1950,7 @@ void itemdb_reload(void) {
 
 	int i,d,k;
 
+	itemdb_names_final();
 	itemdb_group->clear(itemdb_group, itemdb_group_free);
 	itemdb->clear(itemdb, itemdb_final_sub);
 	db_clear(itemdb_combo);
@@ -1928,6 +2017,7 @@ void itemdb_reload(void) {
 * Finalizing Item DB
 */
 void do_final_itemdb(void) {
+	itemdb_names_final();
 	db_destroy(itemdb_combo);
 	itemdb_group->destroy(itemdb_group, itemdb_group_free);
 	itemdb->destroy(itemdb, itemdb_final_sub);
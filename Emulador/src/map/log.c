@@ -2,10 +2,16 @@
 // For more information, see LICENCE in the main folder
 
 #include "../common/cbasetypes.h"
+#include "../common/atomic.h"
+#include "../common/malloc.h"
+#include "../common/mutex.h"
 #include "../common/sql.h" // SQL_INNODB
 #include "../common/strlib.h"
 #include "../common/nullpo.h"
 #include "../common/showmsg.h"
+#include "../common/thread.h"
+#include "../common/timer.h"
+#include "../common/utils.h"
 #include "map.h"
 #include "battle.h"
 #include "itemdb.h"
@@ -16,6 +22,7 @@
 #include "pc.h"
 
 #include <stdlib.h>
+#include <stdarg.h>
 
 static char log_timestamp_format[20];
 
@@ -52,6 +59,382 @@ struct Log_Config log_config;
 #endif
 
 
+/// Tables written through log_sql().
+enum e_log_table
+{
+	LOG_TABLE_BRANCH = 0,
+	LOG_TABLE_PICK,
+	LOG_TABLE_ZENY,
+	LOG_TABLE_MVPDROP,
+	LOG_TABLE_GM,
+	LOG_TABLE_NPC,
+	LOG_TABLE_CHAT,
+	LOG_TABLE_CASH,
+	LOG_TABLE_FEEDING,
+	LOG_TABLE_BG_KILL,
+	LOG_TABLE_WOE_KILL,
+	LOG_TABLE_MAX
+};
+
+/// Columns of each table, in the order the values are formatted.
+static const struct {
+	const char* columns;
+	bool map_db; // table is in the map server database instead of the log one
+} log_tables[LOG_TABLE_MAX] = {
+	{ "`branch_date`, `account_id`, `char_id`, `char_name`, `map`", false },
+	{ "`time`, `account_id`, `char_id`, `name`, `type`, `nameid`, `amount`, `refine`, `card0`, `card1`, `card2`, `card3`, `map`, `unique_id`, `bound`", false },
+	{ "`time`, `char_id`, `src_id`, `type`, `amount`, `map`", false },
+	{ "`mvp_date`, `kill_char_id`, `monster_id`, `prize`, `mvpexp`, `map`", false },
+	{ "`atcommand_date`, `account_id`, `char_id`, `char_name`, `map`, `command`", false },
+	{ "`npc_date`, `account_id`, `char_id`, `char_name`, `map`, `mes`", false },
+	{ "`time`, `type`, `type_id`, `src_charid`, `src_accountid`, `src_map`, `src_map_x`, `src_map_y`, `dst_charname`, `message`", false },
+	{ "`time`, `char_id`, `type`, `cash_type`, `amount`, `map`", false },
+	{ "`time`, `char_id`, `target_id`, `target_class`, `type`, `intimacy`, `item_id`, `map`, `x`, `y`", false },
+	{ "`time`,`killer`,`killer_id`,`killed`,`killed_id`,`map`,`skill`", true },
+	{ "`time`,`killer`,`killer_id`,`killed`,`killed_id`,`map`,`skill`", true },
+};
+
+static const char* log_table_name(enum e_log_table table)
+{
+	switch( table )
+	{
+		case LOG_TABLE_BRANCH:   return log_config.log_branch;
+		case LOG_TABLE_PICK:     return log_config.log_pick;
+		case LOG_TABLE_ZENY:     return log_config.log_zeny;
+		case LOG_TABLE_MVPDROP:  return log_config.log_mvpdrop;
+		case LOG_TABLE_GM:       return log_config.log_gm;
+		case LOG_TABLE_NPC:      return log_config.log_npc;
+		case LOG_TABLE_CHAT:     return log_config.log_chat;
+		case LOG_TABLE_CASH:     return log_config.log_cash;
+		case LOG_TABLE_FEEDING:  return log_config.log_feeding;
+		case LOG_TABLE_BG_KILL:  return "char_bg_log";
+		case LOG_TABLE_WOE_KILL: return "char_woe_log";
+	}
+	return "";
+}
+
+
+/*==========================================
+ * Log writer
+ * Log rows are queued by the main thread in a single producer/single consumer
+ * ring buffer. The writer thread drains it, groups the rows by table in
+ * multi-row INSERT queries and appends them to the spill file when the
+ * database can't be reached. The writer doesn't use the memory manager nor
+ * the console, everything it needs is allocated before it starts.
+ *------------------------------------------*/
+
+#define LOG_ROW_LENGTH 1280 // values of a row, "(...)"
+
+struct log_row {
+	unsigned short table; // enum e_log_table
+	unsigned short length;
+	char values[LOG_ROW_LENGTH];
+};
+
+static struct {
+	struct log_row* queue; // ring buffer, log_config.async_queue rows
+	volatile int32 head; // next row written by the main thread
+	volatile int32 tail; // next row read by the writer thread
+	rAthread thread;
+	ramutex mutex;
+	racond cond;
+	ramutex spill_mutex; // the main thread spills when the queue is full
+	volatile int32 terminate;
+	Sql* handle[2]; // log database, map database (only used by the writer thread)
+	char* query; // batch query being built by the writer thread
+	size_t query_size;
+	// statistics
+	volatile int32 written, spilled, dropped, errors;
+	char last_error[256];
+} log_writer;
+
+/// Returns the current time as a quoted SQL datetime, so queued rows keep the time they were logged at.
+static const char* log_sql_now(void)
+{
+	static char now[32];
+	static time_t last = 0;
+	time_t t = time(NULL);
+
+	if( t != last )
+	{
+		last = t;
+		strftime(now, sizeof(now), "'%Y-%m-%d %H:%M:%S'", localtime(&t));
+	}
+	return now;
+}
+
+/// Number of rows waiting in the queue.
+static int log_writer_pending(void)
+{
+	int32 head = InterlockedExchangeAdd(&log_writer.head, 0);
+	int32 tail = InterlockedExchangeAdd(&log_writer.tail, 0);
+
+	return ( head - tail + log_config.async_queue ) % log_config.async_queue;
+}
+
+/// Appends a query to the spill file, to be imported manually once the database is back.
+static void log_writer_spill(enum e_log_table table, const char* values, size_t length)
+{
+	FILE* fp;
+
+	ramutex_lock(log_writer.spill_mutex);
+	if( (fp = fopen(log_config.async_spill_file, "a")) != NULL )
+	{
+		fprintf(fp, LOG_QUERY " INTO `%s`.`%s` (%s) VALUES %.*s;\n", log_tables[table].map_db ? map_server_db : log_db_db, log_table_name(table), log_tables[table].columns, (int)length, values);
+		fclose(fp);
+		InterlockedIncrement(&log_writer.spilled);
+	}
+	else
+		InterlockedIncrement(&log_writer.dropped);
+	ramutex_unlock(log_writer.spill_mutex);
+}
+
+/// Sends the query built for the table, or spills it if the database is unreachable.
+/// Called by the writer thread.
+static void log_writer_send(enum e_log_table table, size_t values_start, size_t length, int rows)
+{
+	Sql* handle = log_writer.handle[log_tables[table].map_db ? 1 : 0];
+
+	if( SQL_SUCCESS == Sql_QueryRaw(handle, log_writer.query, length)
+	||  (SQL_SUCCESS == Sql_Ping(handle) && SQL_SUCCESS == Sql_QueryRaw(handle, log_writer.query, length)) )
+	{ // Ping reconnects if the connection was lost
+		InterlockedExchangeAdd(&log_writer.written, rows);
+		return;
+	}
+
+	InterlockedIncrement(&log_writer.errors);
+	ramutex_lock(log_writer.spill_mutex);
+	safestrncpy(log_writer.last_error, Sql_LastError(handle), sizeof(log_writer.last_error));
+	ramutex_unlock(log_writer.spill_mutex);
+	log_writer_spill(table, log_writer.query + values_start, length - values_start);
+}
+
+/// Writes every queued row, grouped by table in queries of up to log_config.async_batch rows.
+/// Called by the writer thread.
+static void log_writer_flush(void)
+{
+	int32 head = InterlockedExchangeAdd(&log_writer.head, 0);
+	int32 tail = log_writer.tail;
+	int table;
+
+	if( head == tail )
+		return;
+
+	for( table = 0; table < LOG_TABLE_MAX; table++ )
+	{
+		size_t start = 0, length = 0;
+		int32 i, rows = 0;
+
+		for( i = tail; i != head; i = (i + 1) % log_config.async_queue )
+		{
+			struct log_row* row = &log_writer.queue[i];
+
+			if( row->table != table )
+				continue;
+
+			if( rows == 0 )
+			{
+				length = snprintf(log_writer.query, log_writer.query_size, LOG_QUERY " INTO `%s` (%s) VALUES ", log_table_name((enum e_log_table)table), log_tables[table].columns);
+				start = length;
+			}
+			else
+				log_writer.query[length++] = ',';
+			memcpy(log_writer.query + length, row->values, row->length);
+			length += row->length;
+
+			if( ++rows == log_config.async_batch )
+			{
+				log_writer_send((enum e_log_table)table, start, length, rows);
+				rows = 0;
+			}
+		}
+		if( rows )
+			log_writer_send((enum e_log_table)table, start, length, rows);
+	}
+
+	InterlockedExchange(&log_writer.tail, head); // release the rows
+}
+
+static void* log_writer_main(void* param)
+{
+	Sql_ThreadInit();
+
+	while( !InterlockedExchangeAdd(&log_writer.terminate, 0) )
+	{
+		ramutex_lock(log_writer.mutex);
+		if( log_writer_pending() < log_config.async_batch && !InterlockedExchangeAdd(&log_writer.terminate, 0) )
+			racond_wait(log_writer.cond, log_writer.mutex, log_config.async_interval);
+		ramutex_unlock(log_writer.mutex);
+
+		log_writer_flush();
+	}
+	log_writer_flush(); // rows queued before the shutdown
+
+	Sql_ThreadEnd();
+	return NULL;
+}
+
+/// Logs a row of the table, the values are formatted like sprintf and must be escaped.
+static void log_sql(enum e_log_table table, const char* format, ...)
+{
+	struct log_row* row;
+	struct log_row overflow;
+	int32 head, next;
+	int length;
+	va_list ap;
+
+	if( log_writer.thread == NULL )
+	{ // Synchronous
+		char values[LOG_ROW_LENGTH];
+		Sql* handle = log_tables[table].map_db ? mmysql_handle : logmysql_handle;
+
+		va_start(ap, format);
+		length = vsnprintf(values, sizeof(values), format, ap);
+		va_end(ap);
+		if( length < 0 || (size_t)length >= sizeof(values) )
+		{
+			ShowWarning("log_sql: Row for table '%s' is too long, ignoring.\n", log_table_name(table));
+			return;
+		}
+		if( SQL_ERROR == Sql_Query(handle, LOG_QUERY " INTO `%s` (%s) VALUES %s", log_table_name(table), log_tables[table].columns, values) )
+			Sql_ShowDebug(handle);
+		return;
+	}
+
+	head = log_writer.head;
+	next = (head + 1) % log_config.async_queue;
+	if( next == InterlockedExchangeAdd(&log_writer.tail, 0) )
+		row = &overflow; // Queue is full, the row goes to the spill file
+	else
+		row = &log_writer.queue[head];
+
+	va_start(ap, format);
+	length = vsnprintf(row->values, sizeof(row->values), format, ap);
+	va_end(ap);
+	if( length < 0 || (size_t)length >= sizeof(row->values) )
+	{
+		ShowWarning("log_sql: Row for table '%s' is too long, ignoring.\n", log_table_name(table));
+		return;
+	}
+	row->table = table;
+	row->length = length;
+
+	if( row == &overflow )
+	{
+		log_writer_spill(table, row->values, row->length);
+		return;
+	}
+
+	InterlockedExchange(&log_writer.head, next); // publish the row
+	if( log_writer_pending() == log_config.async_batch )
+		racond_signal(log_writer.cond);
+}
+
+/// Shows the log writer statistics.
+void log_writer_report(void)
+{
+	if( log_writer.thread == NULL )
+	{
+		ShowInfo("Log writer is not running, SQL logs are written synchronously.\n");
+		return;
+	}
+	ShowInfo("Log writer: %d queued, %d written, %d spilled to '%s', %d dropped, %d errors.\n",
+		log_writer_pending(), (int)log_writer.written, (int)log_writer.spilled, log_config.async_spill_file, (int)log_writer.dropped, (int)log_writer.errors);
+	if( log_writer.errors )
+	{
+		ramutex_lock(log_writer.spill_mutex);
+		ShowInfo("Last error: %s\n", log_writer.last_error);
+		ramutex_unlock(log_writer.spill_mutex);
+	}
+}
+
+/// Reports the errors of the writer thread on the console, which it can't use.
+static int log_writer_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	static int32 errors = 0;
+
+	if( log_writer.errors != errors )
+	{
+		ramutex_lock(log_writer.spill_mutex);
+		ShowError("Log writer: %d queries failed, rows were spilled to '%s'. Last error: %s\n", (int)(log_writer.errors - errors), log_config.async_spill_file, log_writer.last_error);
+		ramutex_unlock(log_writer.spill_mutex);
+		errors = log_writer.errors;
+	}
+	return 0;
+}
+
+static Sql* log_writer_connect(const char* user, const char* passwd, const char* host, uint16 port, const char* db)
+{
+	Sql* handle = Sql_Malloc();
+
+	if( SQL_ERROR == Sql_Connect(handle, user, passwd, host, port, db) )
+	{
+		Sql_ShowDebug(handle);
+		Sql_Free(handle);
+		return NULL;
+	}
+	if( strlen(default_codepage) > 0 && SQL_ERROR == Sql_SetEncoding(handle, default_codepage) )
+		Sql_ShowDebug(handle);
+	Sql_DisableKeepalive(handle); // the writer thread pings it
+	return handle;
+}
+
+void do_init_log(void)
+{
+	memset(&log_writer, 0, sizeof(log_writer));
+	add_timer_func_list(log_writer_timer, "log_writer_timer");
+
+	if( !log_config.async )
+		return;
+
+	if( (log_config.sql_logs && (log_writer.handle[0] = log_writer_connect(log_db_id, log_db_pw, log_db_ip, log_db_port, log_db_db)) == NULL)
+	||  (log_writer.handle[1] = log_writer_connect(map_server_id, map_server_pw, map_server_ip, map_server_port, map_server_db)) == NULL )
+	{
+		ShowError("do_init_log: Log writer couldn't connect to the database, SQL logs will be written synchronously.\n");
+		Sql_Free(log_writer.handle[0]);
+		log_writer.handle[0] = NULL;
+		return;
+	}
+
+	CREATE(log_writer.queue, struct log_row, log_config.async_queue);
+	log_writer.query_size = 1024 + log_config.async_batch * (LOG_ROW_LENGTH + 1);
+	CREATE(log_writer.query, char, log_writer.query_size);
+	log_writer.mutex = ramutex_create();
+	log_writer.cond = racond_create();
+	log_writer.spill_mutex = ramutex_create();
+
+	if( (log_writer.thread = rathread_create(log_writer_main, NULL)) == NULL )
+	{
+		ShowError("do_init_log: Couldn't create the log writer thread, SQL logs will be written synchronously.\n");
+		do_final_log();
+		return;
+	}
+	add_timer_interval(gettick() + 1000, log_writer_timer, 0, 0, 1000);
+}
+
+void do_final_log(void)
+{
+	int i;
+
+	if( log_writer.thread != NULL )
+	{
+		InterlockedExchange(&log_writer.terminate, 1);
+		racond_signal(log_writer.cond);
+		rathread_wait(log_writer.thread, NULL);
+		log_writer.thread = NULL;
+		log_writer_timer(INVALID_TIMER, 0, 0, 0);
+	}
+	if( log_writer.cond ) racond_destroy(log_writer.cond);
+	if( log_writer.mutex ) ramutex_destroy(log_writer.mutex);
+	if( log_writer.spill_mutex ) ramutex_destroy(log_writer.spill_mutex);
+	if( log_writer.queue ) aFree(log_writer.queue);
+	if( log_writer.query ) aFree(log_writer.query);
+	for( i = 0; i < ARRAYLENGTH(log_writer.handle); i++ )
+		Sql_Free(log_writer.handle[i]);
+	memset(&log_writer, 0, sizeof(log_writer));
+}
+
+
 /// obtain log type character for item/zeny logs
 static char log_picktype2char(e_log_pick_type type)
 {
@@ -168,24 +551,10 @@ void log_branch(struct map_session_data* sd)
 		return;
 
 	if( log_config.sql_logs ) {
-#ifdef BETA_THREAD_TEST
-		char entry[512];
-		int e_length = 0;
-		e_length = sprintf(entry, LOG_QUERY " INTO `%s` (`branch_date`, `account_id`, `char_id`, `char_name`, `map`) VALUES (NOW(), '%d', '%d', '%s', '%s')", log_config.log_branch, sd->status.account_id, sd->status.char_id, sd->status.name, mapindex_id2name(sd->mapindex));
-		queryThread_log(entry,e_length);
-#else
-		SqlStmt* stmt;
-		stmt = SqlStmt_Malloc(logmysql_handle);
-		if( SQL_SUCCESS != SqlStmt_Prepare(stmt, LOG_QUERY " INTO `%s` (`branch_date`, `account_id`, `char_id`, `char_name`, `map`) VALUES (NOW(), '%d', '%d', ?, '%s')", log_config.log_branch, sd->status.account_id, sd->status.char_id, mapindex_id2name(sd->mapindex) )
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 0, SQLDT_STRING, sd->status.name, strnlen(sd->status.name, NAME_LENGTH))
-		||  SQL_SUCCESS != SqlStmt_Execute(stmt) )
-		{
-			SqlStmt_ShowDebug(stmt);
-			SqlStmt_Free(stmt);
-			return;
-		}
-		SqlStmt_Free(stmt);
-#endif
+		char esc_name[NAME_LENGTH*2+1];
+
+		Sql_EscapeStringLen(mmysql_handle, esc_name, sd->status.name, strnlen(sd->status.name, NAME_LENGTH));
+		log_sql(LOG_TABLE_BRANCH, "(%s, '%d', '%d', '%s', '%s')", log_sql_now(), sd->status.account_id, sd->status.char_id, esc_name, mapindex_id2name(sd->mapindex));
 	}
 	else
 	{
@@ -210,9 +579,7 @@ void log_bg_kill(struct map_session_data* ssd, struct map_session_data* tsd, uin
 	Sql_EscapeStringLen(mmysql_handle, esc_sname, ssd->status.name, strnlen(ssd->status.name, NAME_LENGTH));
 	Sql_EscapeStringLen(mmysql_handle, esc_tname, tsd->status.name, strnlen(tsd->status.name, NAME_LENGTH));
 
-	if( SQL_ERROR == Sql_Query(mmysql_handle,LOG_QUERY " INTO `char_bg_log` (`time`,`killer`,`killer_id`,`killed`,`killed_id`,`map`,`skill`) VALUES (NOW(), '%s', '%d', '%s', '%d', '%s', '%d')", esc_sname, ssd->status.char_id, esc_tname, tsd->status.char_id, map[tsd->bl.m].name, skill_id) )
-		Sql_ShowDebug(mmysql_handle);
-
+	log_sql(LOG_TABLE_BG_KILL, "(%s, '%s', '%d', '%s', '%d', '%s', '%d')", log_sql_now(), esc_sname, ssd->status.char_id, esc_tname, tsd->status.char_id, map[tsd->bl.m].name, skill_id);
 	return;
 }
 
@@ -224,9 +591,7 @@ void log_woe_kill(struct map_session_data* ssd, struct map_session_data* tsd, ui
 	Sql_EscapeStringLen(mmysql_handle, esc_sname, ssd->status.name, strnlen(ssd->status.name, NAME_LENGTH));
 	Sql_EscapeStringLen(mmysql_handle, esc_tname, tsd->status.name, strnlen(tsd->status.name, NAME_LENGTH));
 
-	if( SQL_ERROR == Sql_Query(mmysql_handle,LOG_QUERY " INTO `char_woe_log` (`time`,`killer`,`killer_id`,`killed`,`killed_id`,`map`,`skill`) VALUES (NOW(), '%s', '%d', '%s', '%d', '%s', '%d')", esc_sname, ssd->status.char_id, esc_tname, tsd->status.char_id, map[tsd->bl.m].name, skill_id) )
-		Sql_ShowDebug(mmysql_handle);
-
+	log_sql(LOG_TABLE_WOE_KILL, "(%s, '%s', '%d', '%s', '%d', '%s', '%d')", log_sql_now(), esc_sname, ssd->status.char_id, esc_tname, tsd->status.char_id, map[tsd->bl.m].name, skill_id);
 	return;
 }
 
@@ -256,12 +621,12 @@ void log_pick(struct block_list* bl, int16 m, e_log_pick_type type, int amount,
 		case BL_PC:
 			id = ((TBL_PC*)bl)->status.char_id;
 			account_id = ((TBL_PC*)bl)->status.account_id;
-			Sql_EscapeStringLen(logmysql_handle, esc_name, ((TBL_PC*)bl)->status.name, NAME_LENGTH);
+			Sql_EscapeStringLen(mmysql_handle, esc_name, ((TBL_PC*)bl)->status.name, strnlen(((TBL_PC*)bl)->status.name, NAME_LENGTH));
 			break;
 		case BL_MOB:
 			id = ((TBL_MOB*)bl)->mob_id;
 			account_id = 0;
-			Sql_EscapeStringLen(logmysql_handle, esc_name, ((TBL_MOB*)bl)->name, NAME_LENGTH);
+			Sql_EscapeStringLen(mmysql_handle, esc_name, ((TBL_MOB*)bl)->name, strnlen(((TBL_MOB*)bl)->name, NAME_LENGTH));
 			break;
 		default:
 			ShowDebug("log_pick: Unhandled bl type %d.\n", bl->type);
@@ -271,20 +636,8 @@ void log_pick(struct block_list* bl, int16 m, e_log_pick_type type, int amount,
 
 	if( log_config.sql_logs )
 	{
-#ifdef BETA_THREAD_TEST
-		char entry[512];
-		int e_length = 0;
-		e_length = sprintf(entry, LOG_QUERY " INTO `%s` (`time`, `account_id`, `char_id`, `name`, `type`, `nameid`, `amount`, `refine`, `card0`, `card1`, `card2`, `card3`, `map`, `unique_id`, `bound`) VALUES (NOW(), '%d', '%d', '%s', '%c', '%hu', '%d', '%d', '%hu', '%hu', '%hu', '%hu', '%s', '%"PRIu64"', '%d')",
-				log_config.log_pick, account_id, id, esc_name, log_picktype2char(type), itm->nameid, amount, itm->refine, itm->card[0], itm->card[1], itm->card[2], itm->card[3], mapname, itm->unique_id, itm->bound);
-		queryThread_log(entry,e_length);
-#else
-		if( SQL_ERROR == Sql_Query(logmysql_handle, LOG_QUERY " INTO `%s` (`time`, `account_id`, `char_id`, `name`, `type`, `nameid`, `amount`, `refine`, `card0`, `card1`, `card2`, `card3`, `map`, `unique_id`, `bound`) VALUES (NOW(), '%d', '%d', '%s', '%c', '%hu', '%d', '%d', '%hu', '%hu', '%hu', '%hu', '%s', '%"PRIu64"', '%d')",
-			log_config.log_pick, account_id, id, esc_name, log_picktype2char(type), itm->nameid, amount, itm->refine, itm->card[0], itm->card[1], itm->card[2], itm->card[3], mapname, itm->unique_id, itm->bound) )
-		{
-			Sql_ShowDebug(logmysql_handle);
-			return;
-		}
-#endif
+		log_sql(LOG_TABLE_PICK, "(%s, '%d', '%d', '%s', '%c', '%hu', '%d', '%d', '%hu', '%hu', '%hu', '%hu', '%s', '%"PRIu64"', '%d')",
+			log_sql_now(), account_id, id, esc_name, log_picktype2char(type), itm->nameid, amount, itm->refine, itm->card[0], itm->card[1], itm->card[2], itm->card[3], mapname, itm->unique_id, itm->bound);
 	}
 	else
 	{
@@ -326,20 +679,8 @@ void log_zeny(struct map_session_data* sd, e_log_pick_type type, struct map_sess
 
 	if( log_config.sql_logs )
 	{
-#ifdef BETA_THREAD_TEST
-		char entry[512];
-		int e_length = 0;
-		e_length = sprintf(entry,  LOG_QUERY " INTO `%s` (`time`, `char_id`, `src_id`, `type`, `amount`, `map`) VALUES (NOW(), '%d', '%d', '%c', '%d', '%s')",
-				log_config.log_zeny, sd->status.char_id, src_sd->status.char_id, log_picktype2char(type), amount, mapindex_id2name(sd->mapindex));
-		queryThread_log(entry,e_length);
-#else
-		if( SQL_ERROR == Sql_Query(logmysql_handle, LOG_QUERY " INTO `%s` (`time`, `char_id`, `src_id`, `type`, `amount`, `map`) VALUES (NOW(), '%d', '%d', '%c', '%d', '%s')",
-			log_config.log_zeny, sd->status.char_id, src_sd->status.char_id, log_picktype2char(type), amount, mapindex_id2name(sd->mapindex)) )
-		{
-			Sql_ShowDebug(logmysql_handle);
-			return;
-		}
-#endif
+		log_sql(LOG_TABLE_ZENY, "(%s, '%d', '%d', '%c', '%d', '%s')",
+			log_sql_now(), sd->status.char_id, src_sd->status.char_id, log_picktype2char(type), amount, mapindex_id2name(sd->mapindex));
 	}
 	else
 	{
@@ -367,20 +708,8 @@ void log_mvpdrop(struct map_session_data* sd, int monster_id, unsigned int* log_
 
 	if( log_config.sql_logs )
 	{
-#ifdef BETA_THREAD_TEST
-		char entry[512];
-		int e_length = 0;
-		e_length = sprintf(entry,  LOG_QUERY " INTO `%s` (`mvp_date`, `kill_char_id`, `monster_id`, `prize`, `mvpexp`, `map`) VALUES (NOW(), '%d', '%d', '%hu', '%u', '%s') ",
-						   log_config.log_mvpdrop, sd->status.char_id, monster_id, (unsigned short)log_mvp[0], log_mvp[1], mapindex_id2name(sd->mapindex));
-		queryThread_log(entry,e_length);
-#else
-		if( SQL_ERROR == Sql_Query(logmysql_handle, LOG_QUERY " INTO `%s` (`mvp_date`, `kill_char_id`, `monster_id`, `prize`, `mvpexp`, `map`) VALUES (NOW(), '%d', '%d', '%hu', '%u', '%s') ",
-			log_config.log_mvpdrop, sd->status.char_id, monster_id, (unsigned short)log_mvp[0], log_mvp[1], mapindex_id2name(sd->mapindex)) )
-		{
-			Sql_ShowDebug(logmysql_handle);
-			return;
-		}
-#endif
+		log_sql(LOG_TABLE_MVPDROP, "(%s, '%d', '%d', '%hu', '%u', '%s')",
+			log_sql_now(), sd->status.char_id, monster_id, (unsigned short)log_mvp[0], log_mvp[1], mapindex_id2name(sd->mapindex));
 	}
 	else
 	{
@@ -409,26 +738,12 @@ void log_atcommand(struct map_session_data* sd, const char* message)
 
 	if( log_config.sql_logs )
 	{
-#ifdef BETA_THREAD_TEST
-		char entry[512];
-		int e_length = 0;
-		e_length = sprintf(entry,  LOG_QUERY " INTO `%s` (`atcommand_date`, `account_id`, `char_id`, `char_name`, `map`, `command`) VALUES (NOW(), '%d', '%d', '%s', '%s', '%s')", log_config.log_gm, sd->status.account_id, sd->status.char_id, sd->status.name ,mapindex_id2name(sd->mapindex), message);
-		queryThread_log(entry,e_length);
-#else
-		SqlStmt* stmt;
+		char esc_name[NAME_LENGTH*2+1];
+		char esc_message[255*2+1];
 
-		stmt = SqlStmt_Malloc(logmysql_handle);
-		if( SQL_SUCCESS != SqlStmt_Prepare(stmt, LOG_QUERY " INTO `%s` (`atcommand_date`, `account_id`, `char_id`, `char_name`, `map`, `command`) VALUES (NOW(), '%d', '%d', ?, '%s', ?)", log_config.log_gm, sd->status.account_id, sd->status.char_id, mapindex_id2name(sd->mapindex) )
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 0, SQLDT_STRING, sd->status.name, strnlen(sd->status.name, NAME_LENGTH))
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 1, SQLDT_STRING, (char*)message, safestrnlen(message, 255))
-		||  SQL_SUCCESS != SqlStmt_Execute(stmt) )
-		{
-			SqlStmt_ShowDebug(stmt);
-			SqlStmt_Free(stmt);
-			return;
-		}
-		SqlStmt_Free(stmt);
-#endif
+		Sql_EscapeStringLen(mmysql_handle, esc_name, sd->status.name, strnlen(sd->status.name, NAME_LENGTH));
+		Sql_EscapeStringLen(mmysql_handle, esc_message, message, safestrnlen(message, 255));
+		log_sql(LOG_TABLE_GM, "(%s, '%d', '%d', '%s', '%s', '%s')", log_sql_now(), sd->status.account_id, sd->status.char_id, esc_name, mapindex_id2name(sd->mapindex), esc_message);
 	}
 	else
 	{
@@ -456,25 +771,12 @@ void log_npc(struct map_session_data* sd, const char* message)
 
 	if( log_config.sql_logs )
 	{
-#ifdef BETA_THREAD_TEST
-		char entry[512];
-		int e_length = 0;
-		e_length = sprintf(entry, LOG_QUERY " INTO `%s` (`npc_date`, `account_id`, `char_id`, `char_name`, `map`, `mes`) VALUES (NOW(), '%d', '%d', '%s', '%s', '%s')", log_config.log_npc, sd->status.account_id, sd->status.char_id, sd->status.name, mapindex_id2name(sd->mapindex), message );
-		queryThread_log(entry,e_length);
-#else
-		SqlStmt* stmt;
-		stmt = SqlStmt_Malloc(logmysql_handle);
-		if( SQL_SUCCESS != SqlStmt_Prepare(stmt, LOG_QUERY " INTO `%s` (`npc_date`, `account_id`, `char_id`, `char_name`, `map`, `mes`) VALUES (NOW(), '%d', '%d', ?, '%s', ?)", log_config.log_npc, sd->status.account_id, sd->status.char_id, mapindex_id2name(sd->mapindex) )
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 0, SQLDT_STRING, sd->status.name, strnlen(sd->status.name, NAME_LENGTH))
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 1, SQLDT_STRING, (char*)message, safestrnlen(message, 255))
-		||  SQL_SUCCESS != SqlStmt_Execute(stmt) )
-		{
-			SqlStmt_ShowDebug(stmt);
-			SqlStmt_Free(stmt);
-			return;
-		}
-		SqlStmt_Free(stmt);
-#endif
+		char esc_name[NAME_LENGTH*2+1];
+		char esc_message[255*2+1];
+
+		Sql_EscapeStringLen(mmysql_handle, esc_name, sd->status.name, strnlen(sd->status.name, NAME_LENGTH));
+		Sql_EscapeStringLen(mmysql_handle, esc_message, message, safestrnlen(message, 255));
+		log_sql(LOG_TABLE_NPC, "(%s, '%d', '%d', '%s', '%s', '%s')", log_sql_now(), sd->status.account_id, sd->status.char_id, esc_name, mapindex_id2name(sd->mapindex), esc_message);
 	}
 	else
 	{
@@ -506,26 +808,12 @@ void log_chat(e_log_chat_type type, int type_id, int src_charid, int src_accid,
 	}
 
 	if( log_config.sql_logs ) {
-#ifdef BETA_THREAD_TEST
-		char entry[512];
-		int e_length = 0;
-		e_length = sprintf(entry, LOG_QUERY " INTO `%s` (`time`, `type`, `type_id`, `src_charid`, `src_accountid`, `src_map`, `src_map_x`, `src_map_y`, `dst_charname`, `message`) VALUES (NOW(), '%c', '%d', '%d', '%d', '%s', '%d', '%d', '%s', '%s')", log_config.log_chat, log_chattype2char(type), type_id, src_charid, src_accid, mapname, x, y, dst_charname, message );
-		queryThread_log(entry,e_length);
-#else
-		SqlStmt* stmt;
+		char esc_name[NAME_LENGTH*2+1];
+		char esc_message[CHAT_SIZE_MAX*2+1];
 
-		stmt = SqlStmt_Malloc(logmysql_handle);
-		if( SQL_SUCCESS != SqlStmt_Prepare(stmt, LOG_QUERY " INTO `%s` (`time`, `type`, `type_id`, `src_charid`, `src_accountid`, `src_map`, `src_map_x`, `src_map_y`, `dst_charname`, `message`) VALUES (NOW(), '%c', '%d', '%d', '%d', '%s', '%d', '%d', ?, ?)", log_config.log_chat, log_chattype2char(type), type_id, src_charid, src_accid, mapname, x, y)
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 0, SQLDT_STRING, (char*)dst_charname, safestrnlen(dst_charname, NAME_LENGTH))
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 1, SQLDT_STRING, (char*)message, safestrnlen(message, CHAT_SIZE_MAX))
-		||  SQL_SUCCESS != SqlStmt_Execute(stmt) )
-		{
-			SqlStmt_ShowDebug(stmt);
-			SqlStmt_Free(stmt);
-			return;
-		}
-		SqlStmt_Free(stmt);
-#endif
+		Sql_EscapeStringLen(mmysql_handle, esc_name, dst_charname, safestrnlen(dst_charname, NAME_LENGTH));
+		Sql_EscapeStringLen(mmysql_handle, esc_message, message, safestrnlen(message, CHAT_SIZE_MAX));
+		log_sql(LOG_TABLE_CHAT, "(%s, '%c', '%d', '%d', '%d', '%s', '%d', '%d', '%s', '%s')", log_sql_now(), log_chattype2char(type), type_id, src_charid, src_accid, mapname, x, y, esc_name, esc_message);
 	}
 	else
 	{
@@ -550,20 +838,8 @@ void log_cash( struct map_session_data* sd, e_log_pick_type type, e_log_cash_typ
 		return;
 
 	if( log_config.sql_logs ){
-#ifdef BETA_THREAD_TEST
-		char entry[512];
-		int e_length = 0;
-		e_length = sprintf( entry,  LOG_QUERY " INTO `%s` ( `time`, `char_id`, `type`, `cash_type`, `amount`, `map` ) VALUES ( NOW(), '%d', '%c', '%c', '%d', '%s' )",
-			log_config.log_cash, sd->status.char_id, log_picktype2char( type ), log_cashtype2char( cash_type ), amount, mapindex_id2name( sd->mapindex ) );
-		queryThread_log( entry, e_length );
-#else
-		if( SQL_ERROR == Sql_Query( logmysql_handle, LOG_QUERY " INTO `%s` ( `time`, `char_id`, `type`, `cash_type`, `amount`, `map` ) VALUES ( NOW(), '%d', '%c', '%c', '%d', '%s' )",
-			log_config.log_cash, sd->status.char_id, log_picktype2char( type ), log_cashtype2char( cash_type ), amount, mapindex_id2name( sd->mapindex ) ) )
-		{
-			Sql_ShowDebug( logmysql_handle );
-			return;
-		}
-#endif
+		log_sql( LOG_TABLE_CASH, "( %s, '%d', '%c', '%c', '%d', '%s' )",
+			log_sql_now(), sd->status.char_id, log_picktype2char( type ), log_cashtype2char( cash_type ), amount, mapindex_id2name( sd->mapindex ) );
 	}else{
 		char timestring[255];
 		time_t curtime;
@@ -611,20 +887,8 @@ void log_feeding(struct map_session_data *sd, e_log_feeding_type type, unsigned
 	}
 
 	if (log_config.sql_logs) {
-#ifdef BETA_THREAD_TEST
-		char entry[512];
-		int e_length = 0;
-		e_length = sprintf(entry, LOG_QUERY " INTO `%s` (`time`, `char_id`, `target_id`, `target_class`, `type`, `intimacy`, `item_id`, `map`, `x`, `y`) VALUES ( NOW(), '%"PRIu32"', '%"PRIu32"', '%hu', '%c', '%"PRIu32"', '%hu', '%s', '%hu', '%hu' )",
-			log_config.log_feeding, sd->status.char_id, target_id, target_class, log_feedingtype2char(type), intimacy, nameid, mapindex_id2name(sd->mapindex), sd->bl.x, sd->bl.y);
-		queryThread_log(entry, e_length);
-#else
-		if (SQL_ERROR == Sql_Query(logmysql_handle, LOG_QUERY " INTO `%s` (`time`, `char_id`, `target_id`, `target_class`, `type`, `intimacy`, `item_id`, `map`, `x`, `y`) VALUES ( NOW(), '%"PRIu32"', '%"PRIu32"', '%hu', '%c', '%"PRIu32"', '%hu', '%s', '%hu', '%hu' )",
-			log_config.log_feeding, sd->status.char_id, target_id, target_class, log_feedingtype2char(type), intimacy, nameid, mapindex_id2name(sd->mapindex), sd->bl.x, sd->bl.y))
-		{
-			Sql_ShowDebug(logmysql_handle);
-			return;
-		}
-#endif
+		log_sql(LOG_TABLE_FEEDING, "( %s, '%"PRIu32"', '%"PRIu32"', '%hu', '%c', '%"PRIu32"', '%hu', '%s', '%hu', '%hu' )",
+			log_sql_now(), sd->status.char_id, target_id, target_class, log_feedingtype2char(type), intimacy, nameid, mapindex_id2name(sd->mapindex), sd->bl.x, sd->bl.y);
 	} else {
 		char timestring[255];
 		time_t curtime;
@@ -649,6 +913,12 @@ void log_set_defaults(void)
 	log_config.price_items_log  = 1000; // 1000z
 	log_config.amount_items_log = 100;
 
+	log_config.async = true;
+	log_config.async_queue = 8192;
+	log_config.async_batch = 100;
+	log_config.async_interval = 1000;
+	safestrncpy(log_config.async_spill_file, "log/sql_spill.sql", sizeof(log_config.async_spill_file));
+
 	safestrncpy(log_timestamp_format, "%m/%d/%Y %H:%M:%S", sizeof(log_timestamp_format));
 }
 
@@ -727,6 +997,16 @@ int log_config_read(const char* cfgName)
 				safestrncpy( log_config.log_cash, w2, sizeof( log_config.log_cash ) );
 			else if( strcmpi( w1, "log_feeding_db" ) == 0 )
 				safestrncpy( log_config.log_feeding, w2, sizeof( log_config.log_feeding ) );
+			else if( strcmpi(w1, "log_async") == 0 )
+				log_config.async = (bool)config_switch(w2);
+			else if( strcmpi(w1, "log_async_queue") == 0 )
+				log_config.async_queue = atoi(w2);
+			else if( strcmpi(w1, "log_async_batch") == 0 )
+				log_config.async_batch = atoi(w2);
+			else if( strcmpi(w1, "log_async_interval") == 0 )
+				log_config.async_interval = atoi(w2);
+			else if( strcmpi(w1, "log_async_spill_file") == 0 )
+				safestrncpy(log_config.async_spill_file, w2, sizeof(log_config.async_spill_file));
 			// log file timestamp format
 			else if( strcmpi( w1, "log_timestamp_format" ) == 0 )
 				safestrncpy(log_timestamp_format, w2, sizeof(log_timestamp_format));
@@ -744,6 +1024,10 @@ int log_config_read(const char* cfgName)
 	{// report final logging state
 		const char* target = log_config.sql_logs ? "table" : "file";
 
+		log_config.async_batch = cap_value(log_config.async_batch, 1, 1000);
+		log_config.async_queue = max(log_config.async_queue, log_config.async_batch * 4);
+		log_config.async_interval = max(log_config.async_interval, 10);
+
 		if( log_config.enable_logs && log_config.filter )
 		{
 			ShowInfo("Logging item transactions to %s '%s'.\n", target, log_config.log_pick);
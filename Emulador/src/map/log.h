@@ -95,13 +95,14 @@ extern struct Log_Config
 	unsigned feeding : 2;
 	char log_branch[64], log_pick[64], log_zeny[64], log_mvpdrop[64], log_gm[64], log_npc[64], log_chat[64], log_cash[64];
 	char log_feeding[64];
+	bool async; // write SQL logs from the log writer thread
+	int async_queue, async_batch, async_interval;
+	char async_spill_file[256];
 } log_config;
 
-#ifdef BETA_THREAD_TEST
-	struct {
-		char** entry;
-		int count;
-	} logThreadData;
-#endif
+void log_writer_report(void);
+
+void do_init_log(void);
+void do_final_log(void);
 
 #endif /* _LOG_H_ */
@@ -14,6 +14,8 @@
 #include "../common/utils.h"
 #include "../common/cli.h"
 #include "../common/ers.h"
+#include "../common/thread.h"
+#include "../common/atomic.h"
 
 #include "map.h"
 #include "path.h"
@@ -44,6 +46,9 @@
 #include <stdlib.h>
 #include <math.h>
 #ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#ifndef _WIN32
 #endif
 
 char default_codepage[32] = "";
@@ -101,11 +106,7 @@ static int map_users=0;
 struct block_list *block_free[block_free_max];
 static int block_free_count = 0, block_free_lock = 0;
 
-#define BL_LIST_MAX 1048576
-static struct block_list *bl_list[BL_LIST_MAX];
-static int bl_list_count = 0;
-
-#define MAP_MAX_MSG 1500
+#define MAP_MAX_MSG 1550
 
 struct map_data map[MAX_MAP_PER_SERVER];
 int map_num = 0;
@@ -147,6 +148,28 @@ struct map_cache_map_info {
 	int32 len;
 };
 
+// Map cache v2: main header, map_count index entries sorted by name, then the compressed cells of every map.
+// Cells are stored in struct mapcell form (terrain flags byte, dynamic flags byte), so they can be inflated in place.
+#define MAP_CACHE_V2_MAGIC "MCv2"
+#define MAP_CACHE_V2_CELL_SIZE 2
+
+struct map_cache_v2_header {
+	char magic[4];
+	uint32 file_size;
+	uint32 map_count;
+	uint32 cell_size;
+};
+
+struct map_cache_v2_index {
+	char name[MAP_NAME_LENGTH];
+	int16 xs;
+	int16 ys;
+	uint32 offset; // from the beginning of the file
+	uint32 len; // compressed length
+};
+
+#define MAX_MAP_CACHE_THREADS 32
+
 char motd_txt[256] = "conf/motd.txt";
 char help_txt[256] = "conf/help.txt";
 char help2_txt[256] = "conf/help2.txt";
@@ -159,6 +182,7 @@ struct s_map_default map_default;
 int console = 0;
 int enable_spy = 0; //To enable/disable @spy commands, which consume too much cpu time when sending packets. [Skotlex]
 int enable_grf = 0;	//To enable/disable reading maps from GRF files, bypassing mapcache [blackhole89]
+int map_cache_threads = 4; // Additional threads decoding the map cache at startup
 
 /*==========================================
  * server player count (of all mapservers)
@@ -250,6 +274,109 @@ int map_freeblock_timer(int tid, unsigned int tick, int id, intptr_t data)
  *------------------------------------------*/
 static struct block_list bl_head;
 
+/*==========================================
+ * Copy-on-write cells of instance maps
+ * A map shares a copy of its cells with the instances created from it.
+ * Instances read the copy through cell_page and copy a page before changing it,
+ * the source map drops its reference before changing its own cells.
+ *------------------------------------------*/
+static void map_cell_share_release(struct map_cell_share *share)
+{
+	if( --share->refcount > 0 )
+		return;
+	aFree(share->cell);
+	aFree(share);
+}
+
+/// Returns cell xy of a local map, ready to be changed
+static struct mapcell* map_cell_write(struct map_data *m, int xy)
+{
+	if( m->cell_page ) {
+		int page = xy >> MAP_CELL_PAGE_SHIFT;
+
+		if( m->cell_page[page] == m->cell_share->cell + (page << MAP_CELL_PAGE_SHIFT) ) { // Still shared, copy it
+			struct mapcell *cells;
+
+			CREATE(cells, struct mapcell, MAP_CELL_PAGE_SIZE);
+			memcpy(cells, m->cell_page[page], min(MAP_CELL_PAGE_SIZE, m->xs*m->ys - (page << MAP_CELL_PAGE_SHIFT)) * sizeof(struct mapcell));
+			m->cell_page[page] = cells;
+			m->cell_copied++;
+		}
+		return &m->cell_page[page][xy & (MAP_CELL_PAGE_SIZE-1)];
+	}
+
+	if( m->cell_share ) { // Instances keep the cells they were created with
+		map_cell_share_release(m->cell_share);
+		m->cell_share = NULL;
+	}
+	return &m->cell[xy];
+}
+
+/// Makes instance map dst_m read the cells of src_m
+static void map_cell_share(int16 src_m, int16 dst_m)
+{
+	struct map_data *src = &map[src_m], *dst = &map[dst_m];
+	int i, num_cell = src->xs * src->ys, num_page = (num_cell + MAP_CELL_PAGE_SIZE - 1) >> MAP_CELL_PAGE_SHIFT;
+
+	if( src->cell_share == NULL ) {
+		CREATE(src->cell_share, struct map_cell_share, 1);
+		CREATE(src->cell_share->cell, struct mapcell, num_cell);
+		memcpy(src->cell_share->cell, src->cell, num_cell * sizeof(struct mapcell));
+		src->cell_share->refcount = 1;
+	}
+
+	dst->cell_share = src->cell_share;
+	dst->cell_share->refcount++;
+	dst->cell = dst->cell_share->cell;
+	CREATE(dst->cell_page, struct mapcell*, num_page);
+	for( i = 0; i < num_page; i++ )
+		dst->cell_page[i] = dst->cell + (i << MAP_CELL_PAGE_SHIFT);
+	dst->cell_copied = 0;
+}
+
+/// Frees the cells of a map
+static void map_cell_free(struct map_data *m)
+{
+	if( m->cell_page ) {
+		int i, num_page = (m->xs * m->ys + MAP_CELL_PAGE_SIZE - 1) >> MAP_CELL_PAGE_SHIFT;
+
+		for( i = 0; i < num_page; i++ ) {
+			if( m->cell_page[i] != m->cell + (i << MAP_CELL_PAGE_SHIFT) )
+				aFree(m->cell_page[i]);
+		}
+		aFree(m->cell_page);
+	} else if( m->cell )
+		aFree(m->cell);
+
+	if( m->cell_share )
+		map_cell_share_release(m->cell_share);
+
+	m->cell = NULL;
+	m->cell_page = NULL;
+	m->cell_share = NULL;
+	m->cell_copied = 0;
+}
+
+/**
+ * Memory used by the cells of a map
+ * @param m: Map ID
+ * @param shared: Receives the size of the copy shared with instances, or with the source map
+ * @return Size of the cells owned by the map
+ */
+size_t map_cell_memory(int16 m, size_t *shared)
+{
+	struct map_data *mapdata = &map[m];
+	size_t num_cell = (size_t)mapdata->xs * mapdata->ys;
+
+	*shared = mapdata->cell_share ? num_cell * sizeof(struct mapcell) : 0;
+	if( mapdata->cell == NULL )
+		return 0;
+	if( mapdata->cell_page )
+		return ((num_cell + MAP_CELL_PAGE_SIZE - 1) >> MAP_CELL_PAGE_SHIFT) * sizeof(struct mapcell*)
+			+ (size_t)mapdata->cell_copied * MAP_CELL_PAGE_SIZE * sizeof(struct mapcell);
+	return num_cell * sizeof(struct mapcell);
+}
+
 #ifdef CELL_NOSTACK
 /*==========================================
  * These pair of functions update the counter of how many objects
@@ -259,7 +386,7 @@ static void map_addblcell(struct block_list *bl)
 {
 	if( bl->m<0 || bl->x<0 || bl->x>=map[bl->m].xs || bl->y<0 || bl->y>=map[bl->m].ys || !(bl->type&BL_CHAR) )
 		return;
-	map[bl->m].cell[bl->x+bl->y*map[bl->m].xs].cell_bl++;
+	map_cell_write(&map[bl->m], bl->x+bl->y*map[bl->m].xs)->cell_bl++;
 	return;
 }
 
@@ -267,10 +394,257 @@ static void map_delblcell(struct block_list *bl)
 {
 	if( bl->m <0 || bl->x<0 || bl->x>=map[bl->m].xs || bl->y<0 || bl->y>=map[bl->m].ys || !(bl->type&BL_CHAR) )
 		return;
-	map[bl->m].cell[bl->x+bl->y*map[bl->m].xs].cell_bl--;
+	map_cell_write(&map[bl->m], bl->x+bl->y*map[bl->m].xs)->cell_bl--;
 }
 #endif
 
+/*==========================================
+ * Block arrays
+ * Each BLOCK_SIZE x BLOCK_SIZE square of a map keeps its objects in
+ * parallel arrays (object, x, y, type) so that area searches only read
+ * the coordinates and touch an object once it matched.
+ *------------------------------------------*/
+
+/// Returns the block that holds bl (bl must be on a map).
+static struct map_block* map_getblock(struct block_list* bl)
+{
+	int pos = bl->x/BLOCK_SIZE+(bl->y/BLOCK_SIZE)*map[bl->m].bxs;
+
+	return ( bl->type == BL_MOB ) ? &map[bl->m].block_mob[pos] : &map[bl->m].block[pos];
+}
+
+/// Appends bl to the block.
+static void map_block_add(struct map_block* blk, struct block_list* bl)
+{
+	if( blk->count == blk->max ) {
+		blk->max = ( blk->max ) ? blk->max*2 : 8;
+		RECREATE(blk->bl, struct block_list*, blk->max);
+		RECREATE(blk->x, int16, blk->max);
+		RECREATE(blk->y, int16, blk->max);
+		RECREATE(blk->type, int, blk->max);
+	}
+	blk->bl[blk->count] = bl;
+	blk->x[blk->count] = bl->x;
+	blk->y[blk->count] = bl->y;
+	blk->type[blk->count] = bl->type;
+	bl->block_index = blk->count++;
+}
+
+/// Removes bl from the block, moving the last entry into its slot.
+static void map_block_remove(struct map_block* blk, struct block_list* bl)
+{
+	int i = bl->block_index, last = blk->count-1;
+
+	if( i < 0 || i > last || blk->bl[i] != bl ) {
+		ShowError("map_block_remove: object %d not found in its block (index %d, count %d)\n", bl->id, i, blk->count);
+		return;
+	}
+	if( i != last ) {
+		blk->bl[i] = blk->bl[last];
+		blk->x[i] = blk->x[last];
+		blk->y[i] = blk->y[last];
+		blk->type[i] = blk->type[last];
+		blk->bl[i]->block_index = i;
+	}
+	blk->count--;
+	bl->block_index = -1;
+}
+
+/// Allocates the block arrays of a map.
+static void map_block_alloc(int16 m)
+{
+	int size = map[m].bxs * map[m].bys;
+
+	CREATE(map[m].block, struct map_block, size);
+	CREATE(map[m].block_mob, struct map_block, size);
+	map[m].skill_units = NULL;
+	map[m].skill_unit_count = map[m].skill_unit_max = 0;
+}
+
+/// Frees the block arrays of a map.
+static void map_block_free(int16 m)
+{
+	int i, size = map[m].bxs * map[m].bys;
+	struct map_block* blocks[2];
+	int j, k;
+
+	blocks[0] = map[m].block;
+	blocks[1] = map[m].block_mob;
+	for( j = 0; j < 2; j++ ) {
+		if( blocks[j] == NULL )
+			continue;
+		for( i = 0; i < size; i++ ) {
+			if( blocks[j][i].max == 0 )
+				continue;
+			for( k = 0; k < blocks[j][i].count; k++ ) {// objects still on the map
+				struct block_list* bl = blocks[j][i].bl[k];
+
+				if( bl->viewers.sd )
+					aFree(bl->viewers.sd);
+				memset(&bl->viewers, 0, sizeof(bl->viewers));
+			}
+			aFree(blocks[j][i].bl);
+			aFree(blocks[j][i].x);
+			aFree(blocks[j][i].y);
+			aFree(blocks[j][i].type);
+		}
+		aFree(blocks[j]);
+	}
+	map[m].block = NULL;
+	map[m].block_mob = NULL;
+	if( map[m].skill_units )
+		aFree(map[m].skill_units);
+	map[m].skill_units = NULL;
+	map[m].skill_unit_count = map[m].skill_unit_max = 0;
+}
+
+/*==========================================
+ * Viewer sets
+ * Every object on a map keeps the players within AREA_SIZE cells of it,
+ * so AREA packets are sent without searching the blocks around the source.
+ * The sets are updated when objects are added, removed or moved.
+ *------------------------------------------*/
+
+/// Adds sd to the viewers (no-op if already there).
+static void map_viewers_insert(struct map_viewers* v, struct map_session_data* sd)
+{
+	int i;
+
+	ARR_FIND(0, v->count, i, v->sd[i] == sd);
+	if( i < v->count )
+		return;
+	if( v->count == v->max ) {
+		v->max = ( v->max ) ? v->max*2 : 8;
+		RECREATE(v->sd, struct map_session_data*, v->max);
+	}
+	v->sd[v->count++] = sd;
+}
+
+/// Removes sd from the viewers (no-op if not there).
+static void map_viewers_erase(struct map_viewers* v, struct map_session_data* sd)
+{
+	int i;
+
+	ARR_FIND(0, v->count, i, v->sd[i] == sd);
+	if( i == v->count )
+		return;
+	v->sd[i] = v->sd[--v->count];
+}
+
+/// Returns true if (x,y) is within AREA_SIZE of (cx,cy); cx < 0 means off-map.
+static bool map_viewers_inarea(int cx, int cy, int x, int y)
+{
+	return ( cx >= 0 && abs(x-cx) <= AREA_SIZE && abs(y-cy) <= AREA_SIZE );
+}
+
+/// Updates the viewer sets between bl and the objects in a rectangle,
+/// for bl moving from (ox,oy) to (nx,ny). Negative coordinates mean off-map.
+static void map_viewers_scan(struct block_list* bl, int x0, int y0, int x1, int y1, int ox, int oy, int nx, int ny)
+{
+	struct map_session_data* sd = ( bl->type == BL_PC ) ? (TBL_PC*)bl : NULL;
+	int16 m = bl->m;
+	int bx, by, i, j;
+
+	x0 = max(x0, 0);
+	y0 = max(y0, 0);
+	x1 = min(x1, map[m].xs-1);
+	y1 = min(y1, map[m].ys-1);
+
+	for( by = y0/BLOCK_SIZE; by <= y1/BLOCK_SIZE; by++ ) {
+		for( bx = x0/BLOCK_SIZE; bx <= x1/BLOCK_SIZE; bx++ ) {
+			for( j = 0; j < 2; j++ ) {
+				struct map_block* blk;
+
+				if( j == 1 && sd == NULL )
+					break; // mobs only need updating for players
+				blk = ( j == 0 ) ? &map[m].block[bx+by*map[m].bxs] : &map[m].block_mob[bx+by*map[m].bxs];
+				for( i = 0; i < blk->count; i++ ) {
+					struct block_list* obj = blk->bl[i];
+					bool was_in, is_in;
+
+					if( obj == bl || blk->x[i] < x0 || blk->x[i] > x1 || blk->y[i] < y0 || blk->y[i] > y1 )
+						continue;
+					if( sd == NULL && blk->type[i] != BL_PC )
+						continue;
+
+					was_in = map_viewers_inarea(ox, oy, blk->x[i], blk->y[i]);
+					is_in = map_viewers_inarea(nx, ny, blk->x[i], blk->y[i]);
+					if( was_in == is_in )
+						continue;
+
+					if( blk->type[i] == BL_PC ) {// obj sees bl
+						if( is_in )
+							map_viewers_insert(&bl->viewers, (TBL_PC*)obj);
+						else
+							map_viewers_erase(&bl->viewers, (TBL_PC*)obj);
+					}
+					if( sd ) {// bl sees obj
+						if( is_in )
+							map_viewers_insert(&obj->viewers, sd);
+						else
+							map_viewers_erase(&obj->viewers, sd);
+					}
+				}
+			}
+		}
+	}
+}
+
+/// Updates the viewer sets after bl moved from (ox,oy) to its current position.
+/// Negative coordinates mean bl was (or is no longer) on the map.
+static void map_viewers_update(struct block_list* bl, int ox, int oy, int nx, int ny)
+{
+	int area = AREA_SIZE;
+
+	if( ox >= 0 && nx >= 0 && abs(nx-ox) <= area && abs(ny-oy) <= area )
+		map_viewers_scan(bl, min(ox,nx)-area, min(oy,ny)-area, max(ox,nx)+area, max(oy,ny)+area, ox, oy, nx, ny);
+	else {// far jump: scan both areas
+		if( ox >= 0 )
+			map_viewers_scan(bl, ox-area, oy-area, ox+area, oy+area, ox, oy, nx, ny);
+		if( nx >= 0 )
+			map_viewers_scan(bl, nx-area, ny-area, nx+area, ny+area, ox, oy, nx, ny);
+	}
+}
+
+/// Rebuilds all the viewer sets (after area_size changed).
+void map_viewers_rebuild(void)
+{
+	int16 m;
+	int i, j, k;
+
+	for( m = 0; m < map_num; m++ ) {
+		int size = map[m].bxs * map[m].bys;
+
+		if( map[m].block == NULL )
+			continue;
+		for( i = 0; i < size; i++ ) {
+			for( k = 0; k < map[m].block[i].count; k++ )
+				map[m].block[i].bl[k]->viewers.count = 0;
+			for( k = 0; k < map[m].block_mob[i].count; k++ )
+				map[m].block_mob[i].bl[k]->viewers.count = 0;
+		}
+	}
+
+	for( m = 0; m < map_num; m++ ) {
+		int size = map[m].bxs * map[m].bys;
+
+		if( map[m].block == NULL )
+			continue;
+		for( i = 0; i < size; i++ ) {
+			struct map_block* blk = &map[m].block[i];
+
+			for( j = 0; j < blk->count; j++ ) {
+				struct block_list* bl = blk->bl[j];
+
+				if( bl->type != BL_PC )
+					continue;
+				map_viewers_insert(&bl->viewers, (TBL_PC*)bl);
+				map_viewers_scan(bl, bl->x-AREA_SIZE, bl->y-AREA_SIZE, bl->x+AREA_SIZE, bl->y+AREA_SIZE, -1, -1, bl->x, bl->y);
+			}
+		}
+	}
+}
+
 /*==========================================
  * Adds a block to the map.
  * Returns 0 on success, 1 on failure (illegal coordinates).
@@ -278,7 +652,6 @@ static void map_delblcell(struct block_list *bl)
 int map_addblock(struct block_list* bl)
 {
 	int16 m, x, y;
-	int pos;
 
 	nullpo_ret(bl);
 
@@ -301,24 +674,21 @@ int map_addblock(struct block_list* bl)
 		return 1;
 	}
 
-	pos = x/BLOCK_SIZE+(y/BLOCK_SIZE)*map[m].bxs;
-
-	if (bl->type == BL_MOB) {
-		bl->next = map[m].block_mob[pos];
-		bl->prev = &bl_head;
-		if (bl->next) bl->next->prev = bl;
-		map[m].block_mob[pos] = bl;
-	} else {
-		bl->next = map[m].block[pos];
-		bl->prev = &bl_head;
-		if (bl->next) bl->next->prev = bl;
-		map[m].block[pos] = bl;
-	}
+	map_block_add(map_getblock(bl), bl);
+	bl->prev = &bl_head;
 
 #ifdef CELL_NOSTACK
 	map_addblcell(bl);
 #endif
 
+	// the viewer set may have been copied along with the object, start a new one
+	memset(&bl->viewers, 0, sizeof(bl->viewers));
+	if( bl->type == BL_PC ) {
+		map_viewers_insert(&bl->viewers, (TBL_PC*)bl);
+		party_send_xy_dirty((TBL_PC*)bl); // party map dots
+	}
+	map_viewers_update(bl, -1, -1, x, y);
+
 	return 0;
 }
 
@@ -327,37 +697,20 @@ int map_addblock(struct block_list* bl)
  *------------------------------------------*/
 int map_delblock(struct block_list* bl)
 {
-	int pos;
 	nullpo_ret(bl);
 
-	// blocklist (2ways chainlist)
-	if (bl->prev == NULL) {
-		if (bl->next != NULL) {
-			// can't delete block (already at the beginning of the chain)
-			ShowError("map_delblock error : bl->next!=NULL\n");
-		}
+	if (bl->prev == NULL)
 		return 0;
-	}
 
 #ifdef CELL_NOSTACK
 	map_delblcell(bl);
 #endif
 
-	pos = bl->x/BLOCK_SIZE+(bl->y/BLOCK_SIZE)*map[bl->m].bxs;
-
-	if (bl->next)
-		bl->next->prev = bl->prev;
-	if (bl->prev == &bl_head) {
-	//Since the head of the list, update the block_list map of []
-		if (bl->type == BL_MOB) {
-			map[bl->m].block_mob[pos] = bl->next;
-		} else {
-			map[bl->m].block[pos] = bl->next;
-		}
-	} else {
-		bl->prev->next = bl->next;
-	}
-	bl->next = NULL;
+	map_block_remove(map_getblock(bl), bl);
+	map_viewers_update(bl, bl->x, bl->y, -1, -1);
+	if( bl->viewers.sd )
+		aFree(bl->viewers.sd);
+	memset(&bl->viewers, 0, sizeof(bl->viewers));
 	bl->prev = NULL;
 
 	return 0;
@@ -406,19 +759,33 @@ int map_moveblock(struct block_list *bl, int x1, int y1, unsigned int tick)
 	if (bl->type == BL_NPC)
 		npc_unsetcells((TBL_NPC*)bl);
 
-	if (moveblock) map_delblock(bl);
+	if (x1 < 0 || x1 >= map[bl->m].xs || y1 < 0 || y1 >= map[bl->m].ys) {
+		map_delblock(bl);
+		bl->x = x1;
+		bl->y = y1;
+		return map_addblock(bl); // reports the error
+	}
+
 #ifdef CELL_NOSTACK
-	else map_delblcell(bl);
+	map_delblcell(bl);
 #endif
+	if (moveblock) map_block_remove(map_getblock(bl), bl);
 	bl->x = x1;
 	bl->y = y1;
-	if (moveblock) {
-		if(map_addblock(bl))
-			return 1;
+	if (moveblock)
+		map_block_add(map_getblock(bl), bl);
+	else {
+		struct map_block* blk = map_getblock(bl);
+
+		blk->x[bl->block_index] = x1;
+		blk->y[bl->block_index] = y1;
 	}
 #ifdef CELL_NOSTACK
-	else map_addblcell(bl);
+	map_addblcell(bl);
 #endif
+	map_viewers_update(bl, x0, y0, x1, y1);
+	if (bl->type == BL_PC)
+		party_send_xy_dirty((TBL_PC*)bl); // party map dots
 
 	if (bl->type&BL_CHAR) {
 
@@ -491,39 +858,42 @@ int map_moveblock(struct block_list *bl, int x1, int y1, unsigned int tick)
  *------------------------------------------*/
 int map_count_oncell(int16 m, int16 x, int16 y, int type, int flag)
 {
-	int bx,by;
-	struct block_list *bl;
+	int b, i;
+	struct map_block* blk;
 	int count = 0;
 
 	if (x < 0 || y < 0 || (x >= map[m].xs) || (y >= map[m].ys))
 		return 0;
 
-	bx = x/BLOCK_SIZE;
-	by = y/BLOCK_SIZE;
+	b = x/BLOCK_SIZE+(y/BLOCK_SIZE)*map[m].bxs;
 
-	if (type&~BL_MOB)
-		for( bl = map[m].block[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-			if(bl->x == x && bl->y == y && bl->type&type) {
+	if (type&~BL_MOB) {
+		blk = &map[m].block[b];
+		for( i = 0; i < blk->count; i++ )
+			if(blk->x[i] == x && blk->y[i] == y && blk->type[i]&type) {
 				if(flag&1) {
-					struct unit_data *ud = unit_bl2ud(bl);
+					struct unit_data *ud = unit_bl2ud(blk->bl[i]);
 					if(!ud || ud->walktimer == INVALID_TIMER)
 						count++;
 				} else {
 					count++;
 				}
 			}
+	}
 
-	if (type&BL_MOB)
-		for( bl = map[m].block_mob[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-			if(bl->x == x && bl->y == y) {
+	if (type&BL_MOB) {
+		blk = &map[m].block_mob[b];
+		for( i = 0; i < blk->count; i++ )
+			if(blk->x[i] == x && blk->y[i] == y) {
 				if(flag&1) {
-					struct unit_data *ud = unit_bl2ud(bl);
+					struct unit_data *ud = unit_bl2ud(blk->bl[i]);
 					if(!ud || ud->walktimer == INVALID_TIMER)
 						count++;
 				} else {
 					count++;
 				}
 			}
+	}
 
 	return count;
 }
@@ -533,23 +903,23 @@ int map_count_oncell(int16 m, int16 x, int16 y, int type, int flag)
  * flag&1: runs battle_check_target check based on unit->group->target_flag
  */
 struct skill_unit* map_find_skill_unit_oncell(struct block_list* target,int16 x,int16 y,uint16 skill_id,struct skill_unit* out_unit, int flag) {
-	int16 m,bx,by;
-	struct block_list *bl;
+	int16 m;
+	int i;
+	struct map_block* blk;
 	struct skill_unit *unit;
 	m = target->m;
 
 	if (x < 0 || y < 0 || (x >= map[m].xs) || (y >= map[m].ys))
 		return NULL;
 
-	bx = x/BLOCK_SIZE;
-	by = y/BLOCK_SIZE;
+	blk = &map[m].block[x/BLOCK_SIZE+(y/BLOCK_SIZE)*map[m].bxs];
 
-	for( bl = map[m].block[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
+	for( i = 0; i < blk->count; i++ )
 	{
-		if (bl->x != x || bl->y != y || bl->type != BL_SKILL)
+		if (blk->x[i] != x || blk->y[i] != y || blk->type[i] != BL_SKILL)
 			continue;
 
-		unit = (struct skill_unit *) bl;
+		unit = (struct skill_unit *) blk->bl[i];
 		if( unit == out_unit || !unit->alive || !unit->group || unit->group->skill_id != skill_id )
 			continue;
 		if( !(flag&1) || battle_check_target(&unit->bl,target,unit->group->target_flag) > 0 )
@@ -558,16 +928,130 @@ struct skill_unit* map_find_skill_unit_oncell(struct block_list* target,int16 x,
 	return NULL;
 }
 
+/*==========================================
+ * Search results
+ * The objects found by a map_foreach* search are collected before func()
+ * runs, as func() may move or delete them. The list lives on the stack of
+ * the search, so func() is free to start searches of its own.
+ *------------------------------------------*/
+struct map_bl_list {
+	struct block_list** bl;
+	int count, max;
+	struct block_list* local[256];
+};
+
+static void map_bl_list_init(struct map_bl_list* list)
+{
+	list->bl = list->local;
+	list->count = 0;
+	list->max = ARRAYLENGTH(list->local);
+}
+
+static void map_bl_list_add(struct map_bl_list* list, struct block_list* bl)
+{
+	if( list->count == list->max ) {
+		list->max *= 2;
+		if( list->bl == list->local ) {
+			CREATE(list->bl, struct block_list*, list->max);
+			memcpy(list->bl, list->local, sizeof(list->local));
+		} else
+			RECREATE(list->bl, struct block_list*, list->max);
+	}
+	list->bl[list->count++] = bl;
+}
+
+static void map_bl_list_free(struct map_bl_list* list)
+{
+	if( list->bl != list->local )
+		aFree(list->bl);
+	list->bl = list->local;
+	list->count = 0;
+}
+
+/// Adds the objects of a block that match type and lie in (x0,y0)-(x1,y1).
+static void map_block_collect(struct map_bl_list* list, const struct map_block* blk, int type, int16 x0, int16 y0, int16 x1, int16 y1)
+{
+	int i;
+
+	for( i = 0; i < blk->count; i++ )
+		if( blk->type[i]&type && blk->x[i] >= x0 && blk->x[i] <= x1 && blk->y[i] >= y0 && blk->y[i] <= y1 )
+			map_bl_list_add(list, blk->bl[i]);
+}
+
+/// Adds the objects of map m that match type and lie in (x0,y0)-(x1,y1).
+/// Coordinates must already be clipped to the map.
+static void map_collect_inarea(struct map_bl_list* list, int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int type)
+{
+	int bx, by;
+
+	if( type&~BL_MOB )
+		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ )
+			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ )
+				map_block_collect(list, &map[ m ].block[ bx + by * map[ m ].bxs ], type, x0, y0, x1, y1);
+
+	if( type&BL_MOB )
+		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ )
+			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ )
+				map_block_collect(list, &map[ m ].block_mob[ bx + by * map[ m ].bxs ], BL_MOB, x0, y0, x1, y1);
+}
+
+#ifdef CIRCULAR_AREA
+/// Drops the objects that are out of range of center.
+static void map_bl_list_inrange(struct map_bl_list* list, struct block_list* center, int16 range)
+{
+	int i, j;
+
+	for( i = j = 0; i < list->count; i++ )
+		if( check_distance_bl(center, list->bl[i], range) )
+			list->bl[j++] = list->bl[i];
+	list->count = j;
+}
+#endif
+
+/// Drops the objects that cannot be shot from (x,y).
+static void map_bl_list_inshoot(struct map_bl_list* list, int16 m, int16 x, int16 y)
+{
+	int i, j;
+
+	for( i = j = 0; i < list->count; i++ )
+		if( path_search_long(NULL, m, x, y, list->bl[i]->x, list->bl[i]->y, CELL_CHKWALL) )
+			list->bl[j++] = list->bl[i];
+	list->count = j;
+}
+
+/// Calls func for each collected object still on a map, then releases the list.
+/// Stops once the sum of the values returned by func reaches count (0: no limit).
+static int map_bl_list_apply(struct map_bl_list* list, int (*func)(struct block_list*,va_list), int count, va_list ap)
+{
+	int returnCount = 0;	//total sum of returned values of func() [Skotlex]
+	int i;
+
+	map_freeblock_lock();
+
+	for( i = 0; i < list->count; i++ )
+		if( list->bl[ i ]->prev ) { //func() may delete this bl, checking for prev ensures it wasn't queued for deletion.
+			va_list apcopy;
+			va_copy(apcopy, ap);
+			returnCount += func(list->bl[ i ], apcopy);
+			va_end(apcopy);
+			if( count && returnCount >= count )
+				break;
+		}
+
+	map_freeblock_unlock();
+
+	map_bl_list_free(list);
+	return returnCount;
+}
+
 /*==========================================
  * Adapted from foreachinarea for an easier invocation. [Skotlex]
  *------------------------------------------*/
 int map_foreachinrange(int (*func)(struct block_list*,va_list), struct block_list* center, int16 range, int type, ...)
 {
-	int bx, by, m;
-	int returnCount = 0;	//total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
-	int blockcount = bl_list_count, i;
+	int m, returnCount;
 	int x0, x1, y0, y1;
+	struct map_bl_list list;
 	va_list ap;
 
 	m = center->m;
@@ -576,50 +1060,16 @@ int map_foreachinrange(int (*func)(struct block_list*,va_list), struct block_lis
 	x1 = i16min(center->x + range, map[ m ].xs - 1);
 	y1 = i16min(center->y + range, map[ m ].ys - 1);
 
-	if ( type&~BL_MOB )
-		for ( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
-				for( bl = map[m].block[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next ) {
-					if( bl->type&type
-						&& bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
+	map_bl_list_init(&list);
+	map_collect_inarea(&list, m, x0, y0, x1, y1, type);
 #ifdef CIRCULAR_AREA
-						&& check_distance_bl(center, bl, range)
+	map_bl_list_inrange(&list, center, range);
 #endif
-						&& bl_list_count < BL_LIST_MAX )
-						bl_list[ bl_list_count++ ] = bl;
-				}
-			}
-		}
 
-	if( type&BL_MOB )
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
-			for(bx=x0/BLOCK_SIZE;bx<=x1/BLOCK_SIZE;bx++) {
-				for( bl = map[ m ].block_mob[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next ) {
-					if( bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
-#ifdef CIRCULAR_AREA
-						&& check_distance_bl(center, bl, range)
-#endif
-						&& bl_list_count < BL_LIST_MAX )
-						bl_list[ bl_list_count++ ] = bl;
-				}
-			}
-		}
-
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachinrange: block count too many!\n");
-
-	map_freeblock_lock();
-
-	for( i = blockcount; i < bl_list_count; i++ )
-		if( bl_list[ i ]->prev ) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion.
-			va_start(ap, type);
-			returnCount += func(bl_list[ i ], ap);
-			va_end(ap);
-		}
-
-	map_freeblock_unlock();
+	va_start(ap, type);
+	returnCount = map_bl_list_apply(&list, func, 0, ap);
+	va_end(ap);
 
-	bl_list_count = blockcount;
 	return returnCount;	//[Skotlex]
 }
 
@@ -628,11 +1078,9 @@ int map_foreachinrange(int (*func)(struct block_list*,va_list), struct block_lis
  *------------------------------------------*/
 int map_foreachinshootrange(int (*func)(struct block_list*,va_list),struct block_list* center, int16 range, int type,...)
 {
-	int bx, by, m;
-	int returnCount = 0;	//total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
-	int blockcount = bl_list_count, i;
+	int m, returnCount;
 	int x0, x1, y0, y1;
+	struct map_bl_list list;
 	va_list ap;
 
 	m = center->m;
@@ -644,51 +1092,17 @@ int map_foreachinshootrange(int (*func)(struct block_list*,va_list),struct block
 	x1 = i16min(center->x+range, map[m].xs-1);
 	y1 = i16min(center->y+range, map[m].ys-1);
 
-	if ( type&~BL_MOB )
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
-				for( bl = map[ m ].block[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next ) {
-					if( bl->type&type
-						&& bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
-#ifdef CIRCULAR_AREA
-						&& check_distance_bl(center, bl, range)
-#endif
-						&& path_search_long(NULL, center->m, center->x, center->y, bl->x, bl->y, CELL_CHKWALL)
-					  	&& bl_list_count < BL_LIST_MAX )
-						bl_list[ bl_list_count++ ] = bl;
-				}
-			}
-		}
-	if( type&BL_MOB )
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
-			for( bx=x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
-				for( bl = map[ m ].block_mob[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next ) {
-					if( bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
+	map_bl_list_init(&list);
+	map_collect_inarea(&list, m, x0, y0, x1, y1, type);
 #ifdef CIRCULAR_AREA
-						&& check_distance_bl(center, bl, range)
+	map_bl_list_inrange(&list, center, range);
 #endif
-						&& path_search_long(NULL, center->m, center->x, center->y, bl->x, bl->y, CELL_CHKWALL)
-						&& bl_list_count < BL_LIST_MAX )
-						bl_list[ bl_list_count++ ] = bl;
-				}
-			}
-		}
-
-	if( bl_list_count >= BL_LIST_MAX )
-			ShowWarning("map_foreachinrange: block count too many!\n");
+	map_bl_list_inshoot(&list, center->m, center->x, center->y);
 
-	map_freeblock_lock();
-
-	for( i = blockcount; i < bl_list_count; i++ )
-		if( bl_list[ i ]->prev ) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion.
-			va_start(ap, type);
-			returnCount += func(bl_list[ i ], ap);
-			va_end(ap);
-		}
-
-	map_freeblock_unlock();
+	va_start(ap, type);
+	returnCount = map_bl_list_apply(&list, func, 0, ap);
+	va_end(ap);
 
-	bl_list_count = blockcount;
 	return returnCount;	//[Skotlex]
 }
 
@@ -699,10 +1113,8 @@ int map_foreachinshootrange(int (*func)(struct block_list*,va_list),struct block
  *------------------------------------------*/
 int map_foreachinarea(int (*func)(struct block_list*,va_list), int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int type, ...)
 {
-	int bx, by;
-	int returnCount = 0;	//total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
-	int blockcount = bl_list_count, i;
+	int returnCount;
+	struct map_bl_list list;
 	va_list ap;
 
 	if ( m < 0 || m >= map_num)
@@ -717,35 +1129,14 @@ int map_foreachinarea(int (*func)(struct block_list*,va_list), int16 m, int16 x0
 	y0 = i16max(y0, 0);
 	x1 = i16min(x1, map[ m ].xs - 1);
 	y1 = i16min(y1, map[ m ].ys - 1);
-	if ( type&~BL_MOB )
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ )
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ )
-				for( bl = map[ m ].block[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next )
-					if( bl->type&type && bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1 && bl_list_count < BL_LIST_MAX )
-						bl_list[ bl_list_count++ ] = bl;
-
-	if( type&BL_MOB )
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ )
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ )
-				for( bl = map[ m ].block_mob[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next )
-					if( bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1 && bl_list_count < BL_LIST_MAX )
-						bl_list[ bl_list_count++ ] = bl;
-
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachinarea: block count too many!\n");
-
-	map_freeblock_lock();
 
-	for( i = blockcount; i < bl_list_count; i++ )
-		if( bl_list[ i ]->prev ) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion.
-			va_start(ap, type);
-			returnCount += func(bl_list[ i ], ap);
-			va_end(ap);
-		}
+	map_bl_list_init(&list);
+	map_collect_inarea(&list, m, x0, y0, x1, y1, type);
 
-	map_freeblock_unlock();
+	va_start(ap, type);
+	returnCount = map_bl_list_apply(&list, func, 0, ap);
+	va_end(ap);
 
-	bl_list_count = blockcount;
 	return returnCount;	//[Skotlex]
 }
 
@@ -760,10 +1151,8 @@ int map_foreachinarea(int (*func)(struct block_list*,va_list), int16 m, int16 x0
 *------------------------------------------*/
 int map_foreachinshootarea(int(*func)(struct block_list*, va_list), int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int type, ...)
 {
-	int bx, by, cx, cy;
-	int returnCount = 0;	//total sum of returned values of func()
-	struct block_list *bl;
-	int blockcount = bl_list_count, i;
+	int returnCount;	//total sum of returned values of func()
+	struct map_bl_list list;
 	va_list ap;
 
 	if (m < 0 || m >= map_num)
@@ -779,42 +1168,14 @@ int map_foreachinshootarea(int(*func)(struct block_list*, va_list), int16 m, int
 	x1 = i16min(x1, map[m].xs - 1);
 	y1 = i16min(y1, map[m].ys - 1);
 
-	cx = x0 + (x1 - x0) / 2;
-	cy = y0 + (y1 - y0) / 2;
-
-	if (type&~BL_MOB)
-		for (by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++)
-			for (bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++)
-				for (bl = map[m].block[bx + by * map[m].bxs]; bl != NULL; bl = bl->next)
-					if (bl->type&type && bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
-						&& path_search_long(NULL, m, cx, cy, bl->x, bl->y, CELL_CHKWALL)
-						&& bl_list_count < BL_LIST_MAX)
-						bl_list[bl_list_count++] = bl;
-
-	if (type&BL_MOB)
-		for (by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++)
-			for (bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++)
-				for (bl = map[m].block_mob[bx + by * map[m].bxs]; bl != NULL; bl = bl->next)
-					if (bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
-						&& path_search_long(NULL, m, cx, cy, bl->x, bl->y, CELL_CHKWALL)
-						&& bl_list_count < BL_LIST_MAX)
-						bl_list[bl_list_count++] = bl;
-
-	if (bl_list_count >= BL_LIST_MAX)
-		ShowWarning("map_foreachinshootarea: block count too many!\n");
-
-	map_freeblock_lock();
-
-	for (i = blockcount; i < bl_list_count; i++)
-		if (bl_list[i]->prev) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion.
-			va_start(ap, type);
-			returnCount += func(bl_list[i], ap);
-			va_end(ap);
-		}
+	map_bl_list_init(&list);
+	map_collect_inarea(&list, m, x0, y0, x1, y1, type);
+	map_bl_list_inshoot(&list, m, x0 + (x1 - x0) / 2, y0 + (y1 - y0) / 2);
 
-	map_freeblock_unlock();
+	va_start(ap, type);
+	returnCount = map_bl_list_apply(&list, func, 0, ap);
+	va_end(ap);
 
-	bl_list_count = blockcount;
 	return returnCount;
 }
 
@@ -823,11 +1184,9 @@ int map_foreachinshootarea(int(*func)(struct block_list*, va_list), int16 m, int
  *------------------------------------------*/
 int map_forcountinrange(int (*func)(struct block_list*,va_list), struct block_list* center, int16 range, int count, int type, ...)
 {
-	int bx, by, m;
-	int returnCount = 0;	//total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
-	int blockcount = bl_list_count, i;
+	int m, returnCount;
 	int x0, x1, y0, y1;
+	struct map_bl_list list;
 	va_list ap;
 
 	m = center->m;
@@ -836,59 +1195,22 @@ int map_forcountinrange(int (*func)(struct block_list*,va_list), struct block_li
 	x1 = i16min(center->x + range, map[ m ].xs - 1);
 	y1 = i16min(center->y + range, map[ m ].ys - 1);
 
-	if ( type&~BL_MOB )
-		for ( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
-				for( bl = map[ m ].block[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next ) {
-					if( bl->type&type
-						&& bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
+	map_bl_list_init(&list);
+	map_collect_inarea(&list, m, x0, y0, x1, y1, type);
 #ifdef CIRCULAR_AREA
-						&& check_distance_bl(center, bl, range)
+	map_bl_list_inrange(&list, center, range);
 #endif
-					  	&& bl_list_count < BL_LIST_MAX )
-						bl_list[ bl_list_count++ ] = bl;
-				}
-			}
-		}
-	if( type&BL_MOB )
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ){
-				for( bl = map[ m ].block_mob[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next ) {
-					if( bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
-#ifdef CIRCULAR_AREA
-						&& check_distance_bl(center, bl, range)
-#endif
-						&& bl_list_count < BL_LIST_MAX )
-						bl_list[ bl_list_count++ ] = bl;
-				}
-			}
-		}
 
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_forcountinrange: block count too many!\n");
+	va_start(ap, type);
+	returnCount = map_bl_list_apply(&list, func, count, ap);
+	va_end(ap);
 
-	map_freeblock_lock();
-
-	for( i = blockcount; i < bl_list_count; i++ )
-		if( bl_list[ i ]->prev ) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion.
-			va_start(ap, type);
-			returnCount += func(bl_list[ i ], ap);
-			va_end(ap);
-			if( count && returnCount >= count )
-				break;
-		}
-
-	map_freeblock_unlock();
-
-	bl_list_count = blockcount;
 	return returnCount;	//[Skotlex]
 }
 int map_forcountinarea(int (*func)(struct block_list*,va_list), int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int count, int type, ...)
 {
-	int bx, by;
-	int returnCount = 0;	//total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
-	int blockcount = bl_list_count, i;
+	int returnCount;
+	struct map_bl_list list;
 	va_list ap;
 
 	if ( m < 0 )
@@ -904,37 +1226,13 @@ int map_forcountinarea(int (*func)(struct block_list*,va_list), int16 m, int16 x
 	x1 = i16min(x1, map[ m ].xs - 1);
 	y1 = i16min(y1, map[ m ].ys - 1);
 
-	if ( type&~BL_MOB )
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ )
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ )
-				for( bl = map[ m ].block[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next )
-					if( bl->type&type && bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1 && bl_list_count < BL_LIST_MAX )
-						bl_list[ bl_list_count++ ] = bl;
-
-	if( type&BL_MOB )
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ )
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ )
-				for( bl = map[ m ].block_mob[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next )
-					if( bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1 && bl_list_count < BL_LIST_MAX )
-						bl_list[ bl_list_count++ ] = bl;
-
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachinarea: block count too many!\n");
+	map_bl_list_init(&list);
+	map_collect_inarea(&list, m, x0, y0, x1, y1, type);
 
-	map_freeblock_lock();
+	va_start(ap, type);
+	returnCount = map_bl_list_apply(&list, func, count, ap);
+	va_end(ap);
 
-	for( i = blockcount; i < bl_list_count; i++ )
-		if(bl_list[ i ]->prev) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion.
-			va_start(ap, type);
-			returnCount += func(bl_list[ i ], ap);
-			va_end(ap);
-			if( count && returnCount >= count )
-				break;
-		}
-
-	map_freeblock_unlock();
-
-	bl_list_count = blockcount;
 	return returnCount;	//[Skotlex]
 }
 
@@ -944,11 +1242,9 @@ int map_forcountinarea(int (*func)(struct block_list*,va_list), int16 m, int16 x
  *------------------------------------------*/
 int map_foreachinmovearea(int (*func)(struct block_list*,va_list), struct block_list* center, int16 range, int16 dx, int16 dy, int type, ...)
 {
-	int bx, by, m;
-	int returnCount = 0;  //total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
-	int blockcount = bl_list_count, i;
+	int m, returnCount;
 	int16 x0, x1, y0, y1;
+	struct map_bl_list list;
 	va_list ap;
 
 	if ( !range ) return 0;
@@ -966,6 +1262,8 @@ int map_foreachinmovearea(int (*func)(struct block_list*,va_list), struct block_
 	if ( y1 < y0 )
 		swap(y0, y1);
 
+	map_bl_list_init(&list);
+
 	if( dx == 0 || dy == 0 ) {
 		//Movement along one axis only.
 		if( dx == 0 ){
@@ -985,80 +1283,34 @@ int map_foreachinmovearea(int (*func)(struct block_list*,va_list), struct block_
 		x1 = i16min(x1, map[ m ].xs - 1);
 		y1 = i16min(y1, map[ m ].ys - 1);
 
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
-				if ( type&~BL_MOB ) {
-					for( bl = map[m].block[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next ) {
-						if( bl->type&type &&
-							bl->x >= x0 && bl->x <= x1 &&
-							bl->y >= y0 && bl->y <= y1 &&
-							bl_list_count < BL_LIST_MAX )
-							bl_list[ bl_list_count++ ] = bl;
-					}
-				}
-				if ( type&BL_MOB ) {
-					for( bl = map[ m ].block_mob[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next ) {
-						if( bl->x >= x0 && bl->x <= x1 &&
-							bl->y >= y0 && bl->y <= y1 &&
-							bl_list_count < BL_LIST_MAX )
-							bl_list[ bl_list_count++ ] = bl;
-					}
-				}
-			}
-		}
-	} else { // Diagonal movement
-		x0 = i16max(x0, 0);
-		y0 = i16max(y0, 0);
-		x1 = i16min(x1, map[ m ].xs - 1);
-		y1 = i16min(y1, map[ m ].ys - 1);
-
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
-				if ( type & ~BL_MOB ) {
-					for( bl = map[ m ].block[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next ) {
-						if( bl->type&type &&
-							bl->x >= x0 && bl->x <= x1 &&
-							bl->y >= y0 && bl->y <= y1 &&
-							bl_list_count < BL_LIST_MAX )
-						if( ( dx > 0 && bl->x < x0 + dx) ||
-							( dx < 0 && bl->x > x1 + dx) ||
-							( dy > 0 && bl->y < y0 + dy) ||
-							( dy < 0 && bl->y > y1 + dy) )
-							bl_list[ bl_list_count++ ] = bl;
-					}
-				}
-				if ( type&BL_MOB ) {
-					for( bl = map[ m ].block_mob[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next ) {
-						if( bl->x >= x0 && bl->x <= x1 &&
-							bl->y >= y0 && bl->y <= y1 &&
-							bl_list_count < BL_LIST_MAX)
-						if( ( dx > 0 && bl->x < x0 + dx) ||
-							( dx < 0 && bl->x > x1 + dx) ||
-							( dy > 0 && bl->y < y0 + dy) ||
-							( dy < 0 && bl->y > y1 + dy) )
-							bl_list[ bl_list_count++ ] = bl;
-					}
-				}
-			}
-		}
+		map_collect_inarea(&list, m, x0, y0, x1, y1, type);
+	} else { // Diagonal movement
+		int i, j;
 
-	}
+		x0 = i16max(x0, 0);
+		y0 = i16max(y0, 0);
+		x1 = i16min(x1, map[ m ].xs - 1);
+		y1 = i16min(y1, map[ m ].ys - 1);
 
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachinmovearea: block count too many!\n");
+		map_collect_inarea(&list, m, x0, y0, x1, y1, type);
 
-	map_freeblock_lock();	// Prohibit the release from memory
+		// keep the objects in the newly entered strips only
+		for( i = j = 0; i < list.count; i++ ) {
+			struct block_list* bl = list.bl[i];
 
-	for( i = blockcount; i < bl_list_count; i++ )
-		if( bl_list[ i ]->prev ) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion.
-			va_start(ap, type);
-			returnCount += func(bl_list[ i ], ap);
-			va_end(ap);
+			if( ( dx > 0 && bl->x < x0 + dx) ||
+				( dx < 0 && bl->x > x1 + dx) ||
+				( dy > 0 && bl->y < y0 + dy) ||
+				( dy < 0 && bl->y > y1 + dy) )
+				list.bl[j++] = bl;
 		}
+		list.count = j;
+	}
 
-	map_freeblock_unlock();	// Allow Free
+	va_start(ap, type);
+	returnCount = map_bl_list_apply(&list, func, 0, ap);
+	va_end(ap);
 
-	bl_list_count = blockcount;
 	return returnCount;
 }
 
@@ -1068,41 +1320,19 @@ int map_foreachinmovearea(int (*func)(struct block_list*,va_list), struct block_
 //
 int map_foreachincell(int (*func)(struct block_list*,va_list), int16 m, int16 x, int16 y, int type, ...)
 {
-	int bx, by;
-	int returnCount = 0;  //total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
-	int blockcount = bl_list_count, i;
+	int returnCount;
+	struct map_bl_list list;
 	va_list ap;
 
 	if ( x < 0 || y < 0 || x >= map[ m ].xs || y >= map[ m ].ys ) return 0;
 
-	by = y / BLOCK_SIZE;
-	bx = x / BLOCK_SIZE;
+	map_bl_list_init(&list);
+	map_collect_inarea(&list, m, x, y, x, y, type);
 
-	if( type&~BL_MOB )
-		for( bl = map[ m ].block[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next )
-			if( bl->type&type && bl->x == x && bl->y == y && bl_list_count < BL_LIST_MAX )
-				bl_list[ bl_list_count++ ] = bl;
-	if( type&BL_MOB )
-		for( bl = map[ m ].block_mob[ bx + by * map[ m ].bxs]; bl != NULL; bl = bl->next )
-			if( bl->x == x && bl->y == y && bl_list_count < BL_LIST_MAX)
-				bl_list[ bl_list_count++ ] = bl;
-
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachincell: block count too many!\n");
-
-	map_freeblock_lock();
-
-	for( i = blockcount; i < bl_list_count; i++ )
-		if( bl_list[ i ]->prev ) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion.
-			va_start(ap, type);
-			returnCount += func(bl_list[ i ], ap);
-			va_end(ap);
-		}
-
-	map_freeblock_unlock();
+	va_start(ap, type);
+	returnCount = map_bl_list_apply(&list, func, 0, ap);
+	va_end(ap);
 
-	bl_list_count = blockcount;
 	return returnCount;
 }
 
@@ -1111,7 +1341,7 @@ int map_foreachincell(int (*func)(struct block_list*,va_list), int16 m, int16 x,
 *------------------------------------------------------------*/
 int map_foreachinpath(int (*func)(struct block_list*,va_list),int16 m,int16 x0,int16 y0,int16 x1,int16 y1,int16 range,int length, int type,...)
 {
-	int returnCount = 0;  //total sum of returned values of func() [Skotlex]
+	int returnCount;  //total sum of returned values of func() [Skotlex]
 //////////////////////////////////////////////////////////////
 //
 // sharp shooting 3 [Skotlex]
@@ -1146,9 +1376,8 @@ int map_foreachinpath(int (*func)(struct block_list*,va_list),int16 m,int16 x0,i
 // kRO.
 
 	//Generic map_foreach* variables.
-	int i, blockcount = bl_list_count;
-	struct block_list *bl;
-	int bx, by;
+	int i, j;
+	struct map_bl_list list;
 	//method specific variables
 	int magnitude2, len_limit; //The square of the magnitude
 	int k, xi, yi, xu, yu;
@@ -1201,87 +1430,42 @@ int map_foreachinpath(int (*func)(struct block_list*,va_list),int16 m,int16 x0,i
 
 	range *= range << 8; //Values are shifted later on for higher precision using int math.
 
-	if ( type&~BL_MOB )
-		for ( by = my0 / BLOCK_SIZE; by <= my1 / BLOCK_SIZE; by++ ) {
-			for( bx = mx0 / BLOCK_SIZE; bx <= mx1 / BLOCK_SIZE; bx++ ) {
-				for( bl = map[ m ].block[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next ) {
-					if( bl->prev && bl->type&type && bl_list_count < BL_LIST_MAX ) {
-						xi = bl->x;
-						yi = bl->y;
-
-						k = ( xi - x0 ) * ( x1 - x0 ) + ( yi - y0 ) * ( y1 - y0 );
+	map_bl_list_init(&list);
+	map_collect_inarea(&list, m, mx0, my0, mx1, my1, type);
 
-						if ( k < 0 || k > len_limit ) //Since more skills use this, check for ending point as well.
-							continue;
+	for( i = j = 0; i < list.count; i++ ) {
+		xi = list.bl[i]->x;
+		yi = list.bl[i]->y;
 
-						if ( k > magnitude2 && !path_search_long(NULL, m, x0, y0, xi, yi, CELL_CHKWALL) )
-							continue; //Targets beyond the initial ending point need the wall check.
+		k = ( xi - x0 ) * ( x1 - x0 ) + ( yi - y0 ) * ( y1 - y0 );
 
-						//All these shifts are to increase the precision of the intersection point and distance considering how it's
-						//int math.
-						k  = ( k << 4 ) / magnitude2; //k will be between 1~16 instead of 0~1
-						xi <<= 4;
-						yi <<= 4;
-						xu = ( x0 << 4 ) + k * ( x1 - x0 );
-						yu = ( y0 << 4 ) + k * ( y1 - y0 );
-						k  = MAGNITUDE2(xi, yi, xu, yu);
-
-						//If all dot coordinates were <<4 the square of the magnitude is <<8
-						if ( k > range )
-							continue;
+		if ( k < 0 || k > len_limit ) //Since more skills use this, check for ending point as well.
+			continue;
 
-						bl_list[ bl_list_count++ ] = bl;
-					}
-				}
-			}
-		}
-	 if( type&BL_MOB )
-		for( by = my0 / BLOCK_SIZE; by <= my1 / BLOCK_SIZE; by++ ) {
-			for( bx = mx0 / BLOCK_SIZE; bx <= mx1 / BLOCK_SIZE; bx++ ) {
-				for( bl = map[ m ].block_mob[ bx + by * map[ m ].bxs ]; bl != NULL; bl = bl->next ) {
-					if( bl->prev && bl_list_count < BL_LIST_MAX ) {
-						xi = bl->x;
-						yi = bl->y;
-						k = ( xi - x0 ) * ( x1 - x0 ) + ( yi - y0 ) * ( y1 - y0 );
-
-						if ( k < 0 || k > len_limit )
-							continue;
-
-						if ( k > magnitude2 && !path_search_long(NULL, m, x0, y0, xi, yi, CELL_CHKWALL) )
-							continue; //Targets beyond the initial ending point need the wall check.
-
-						k  = ( k << 4 ) / magnitude2; //k will be between 1~16 instead of 0~1
-						xi <<= 4;
-						yi <<= 4;
-						xu = ( x0 << 4 ) + k * ( x1 - x0 );
-						yu = ( y0 << 4 ) + k * ( y1 - y0 );
-						k  = MAGNITUDE2(xi, yi, xu, yu);
-
-						//If all dot coordinates were <<4 the square of the magnitude is <<8
-						if ( k > range )
-							continue;
-
-						bl_list[ bl_list_count++ ] = bl;
-					}
-				}
-			}
-		}
+		if ( k > magnitude2 && !path_search_long(NULL, m, x0, y0, xi, yi, CELL_CHKWALL) )
+			continue; //Targets beyond the initial ending point need the wall check.
 
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachinpath: block count too many!\n");
+		//All these shifts are to increase the precision of the intersection point and distance considering how it's
+		//int math.
+		k  = ( k << 4 ) / magnitude2; //k will be between 1~16 instead of 0~1
+		xi <<= 4;
+		yi <<= 4;
+		xu = ( x0 << 4 ) + k * ( x1 - x0 );
+		yu = ( y0 << 4 ) + k * ( y1 - y0 );
+		k  = MAGNITUDE2(xi, yi, xu, yu);
 
-	map_freeblock_lock();
+		//If all dot coordinates were <<4 the square of the magnitude is <<8
+		if ( k > range )
+			continue;
 
-	for( i = blockcount; i < bl_list_count; i++ )
-		if( bl_list[ i ]->prev ) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion.
-			va_start(ap, type);
-			returnCount += func(bl_list[ i ], ap);
-			va_end(ap);
-		}
+		list.bl[j++] = list.bl[i];
+	}
+	list.count = j;
 
-	map_freeblock_unlock();
+	va_start(ap, type);
+	returnCount = map_bl_list_apply(&list, func, 0, ap);
+	va_end(ap);
 
-	bl_list_count = blockcount;
 	return returnCount;	//[Skotlex]
 
 }
@@ -1303,11 +1487,10 @@ int map_foreachinpath(int (*func)(struct block_list*,va_list),int16 m,int16 x0,i
 *------------------------------------------*/
 int map_foreachindir(int(*func)(struct block_list*, va_list), int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int16 range, int length, int offset, int type, ...)
 {
-	int returnCount = 0;  //Total sum of returned values of func()
+	int returnCount;  //Total sum of returned values of func()
 
-	int i, blockcount = bl_list_count;
-	struct block_list *bl;
-	int bx, by;
+	int i, j;
+	struct map_bl_list list;
 	int mx0, mx1, my0, my1, rx, ry;
 	uint8 dir = map_calc_dir_xy(x0, y0, x1, y1, 6);
 	short dx = dirx[dir];
@@ -1355,138 +1538,194 @@ int map_foreachindir(int(*func)(struct block_list*, va_list), int16 m, int16 x0,
 	mx1 = min(mx1, map[m].xs - 1);
 	my1 = min(my1, map[m].ys - 1);
 
-	if (type&~BL_MOB) {
-		for (by = my0 / BLOCK_SIZE; by <= my1 / BLOCK_SIZE; by++) {
-			for (bx = mx0 / BLOCK_SIZE; bx <= mx1 / BLOCK_SIZE; bx++) {
-				for (bl = map[m].block[bx + by * map[m].bxs]; bl != NULL; bl = bl->next) {
-					if (bl->prev && bl->type&type && bl_list_count < BL_LIST_MAX) {
-						//Check if inside search area
-						if (bl->x < mx0 || bl->x > mx1 || bl->y < my0 || bl->y > my1)
-							continue;
-						//What matters now is the relative x and y from the start point
-						rx = (bl->x - x0);
-						ry = (bl->y - y0);
-						//Do not hit source cell
-						if (rx == 0 && ry == 0)
-							continue;
-						//This turns it so that the area that is hit is always with positive rx and ry
-						rx *= dx;
-						ry *= dy;
-						//These checks only need to be done for diagonal paths
-						if (dir % 2) {
-							//Check for length
-							if ((rx + ry < offset) || (rx + ry > 2 * (length + (offset/2) - 1)))
-								continue;
-							//Check for width
-							if (abs(rx - ry) > 2 * range)
-								continue;
-						}
-						//Everything else ok, check for line of sight from source
-						if (!path_search_long(NULL, m, x0, y0, bl->x, bl->y, CELL_CHKWALL))
-							continue;
-						//All checks passed, add to list
-						bl_list[bl_list_count++] = bl;
-					}
-				}
-			}
-		}
-	}
-	if (type&BL_MOB) {
-		for (by = my0 / BLOCK_SIZE; by <= my1 / BLOCK_SIZE; by++) {
-			for (bx = mx0 / BLOCK_SIZE; bx <= mx1 / BLOCK_SIZE; bx++) {
-				for (bl = map[m].block_mob[bx + by * map[m].bxs]; bl != NULL; bl = bl->next) {
-					if (bl->prev && bl_list_count < BL_LIST_MAX) {
-						//Check if inside search area
-						if (bl->x < mx0 || bl->x > mx1 || bl->y < my0 || bl->y > my1)
-							continue;
-						//What matters now is the relative x and y from the start point
-						rx = (bl->x - x0);
-						ry = (bl->y - y0);
-						//Do not hit source cell
-						if (rx == 0 && ry == 0)
-							continue;
-						//This turns it so that the area that is hit is always with positive rx and ry
-						rx *= dx;
-						ry *= dy;
-						//These checks only need to be done for diagonal paths
-						if (dir % 2) {
-							//Check for length
-							if ((rx + ry < offset) || (rx + ry > 2 * (length + (offset / 2) - 1)))
-								continue;
-							//Check for width
-							if (abs(rx - ry) > 2 * range)
-								continue;
-						}
-						//Everything else ok, check for line of sight from source
-						if (!path_search_long(NULL, m, x0, y0, bl->x, bl->y, CELL_CHKWALL))
-							continue;
-						//All checks passed, add to list
-						bl_list[bl_list_count++] = bl;
-					}
-				}
-			}
-		}
-	}
-
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachindir: block count too many!\n");
+	map_bl_list_init(&list);
+	map_collect_inarea(&list, m, mx0, my0, mx1, my1, type);
 
-	map_freeblock_lock();
+	for (i = j = 0; i < list.count; i++) {
+		struct block_list* bl = list.bl[i];
 
-	for( i = blockcount; i < bl_list_count; i++ )
-		if( bl_list[ i ]->prev ) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion.
-			va_start(ap, type);
-			returnCount += func(bl_list[ i ], ap);
-			va_end(ap);
+		//What matters now is the relative x and y from the start point
+		rx = (bl->x - x0);
+		ry = (bl->y - y0);
+		//Do not hit source cell
+		if (rx == 0 && ry == 0)
+			continue;
+		//This turns it so that the area that is hit is always with positive rx and ry
+		rx *= dx;
+		ry *= dy;
+		//These checks only need to be done for diagonal paths
+		if (dir % 2) {
+			//Check for length
+			if ((rx + ry < offset) || (rx + ry > 2 * (length + (offset/2) - 1)))
+				continue;
+			//Check for width
+			if (abs(rx - ry) > 2 * range)
+				continue;
 		}
+		//Everything else ok, check for line of sight from source
+		if (!path_search_long(NULL, m, x0, y0, bl->x, bl->y, CELL_CHKWALL))
+			continue;
+		//All checks passed, add to list
+		list.bl[j++] = bl;
+	}
+	list.count = j;
 
-	map_freeblock_unlock();
+	va_start(ap, type);
+	returnCount = map_bl_list_apply(&list, func, 0, ap);
+	va_end(ap);
 
-	bl_list_count = blockcount;
 	return returnCount;
 }
 
 // Copy of map_foreachincell, but applied to the whole map. [Skotlex]
 int map_foreachinmap(int (*func)(struct block_list*,va_list), int16 m, int type,...)
 {
-	int b, bsize;
-	int returnCount = 0;  //total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
-	int blockcount = bl_list_count, i;
+	int b, bsize, i;
+	int returnCount;  //total sum of returned values of func() [Skotlex]
+	struct map_block* blk;
+	struct map_bl_list list;
 	va_list ap;
 
 	bsize = map[ m ].bxs * map[ m ].bys;
 
+	map_bl_list_init(&list);
+
 	if( type&~BL_MOB )
-		for( b = 0; b < bsize; b++ )
-			for( bl = map[ m ].block[ b ]; bl != NULL; bl = bl->next )
-				if( bl->type&type && bl_list_count < BL_LIST_MAX )
-					bl_list[ bl_list_count++ ] = bl;
+		for( b = 0; b < bsize; b++ ) {
+			blk = &map[ m ].block[ b ];
+			for( i = 0; i < blk->count; i++ )
+				if( blk->type[i]&type )
+					map_bl_list_add(&list, blk->bl[i]);
+		}
 
 	if( type&BL_MOB )
-		for( b = 0; b < bsize; b++ )
-			for( bl = map[ m ].block_mob[ b ]; bl != NULL; bl = bl->next )
-				if( bl_list_count < BL_LIST_MAX )
-					bl_list[ bl_list_count++ ] = bl;
+		for( b = 0; b < bsize; b++ ) {
+			blk = &map[ m ].block_mob[ b ];
+			for( i = 0; i < blk->count; i++ )
+				map_bl_list_add(&list, blk->bl[i]);
+		}
+
+	va_start(ap, type);
+	returnCount = map_bl_list_apply(&list, func, 0, ap);
+	va_end(ap);
+
+	return returnCount;
+}
 
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachinmap: block count too many!\n");
+/*==========================================
+ * Typed area iteration
+ * Same as map_foreachinarea/map_foreachinrange, but func gets a context
+ * pointer instead of a va_list, so callers on hot paths pay neither the
+ * varargs unpacking nor a va_copy per object.
+ *------------------------------------------*/
+static int map_bl_list_iterate(struct map_bl_list* list, map_iterate_func func, void* data)
+{
+	int returnCount = 0;
+	int i;
 
 	map_freeblock_lock();
 
-	for( i = blockcount; i < bl_list_count ; i++ )
-		if( bl_list[ i ]->prev ) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion.
-			va_start(ap, type);
-			returnCount += func(bl_list[ i ], ap);
-			va_end(ap);
-		}
+	for( i = 0; i < list->count; i++ )
+		if( list->bl[ i ]->prev ) //func() may delete this bl, checking for prev ensures it wasn't queued for deletion.
+			returnCount += func(list->bl[ i ], data);
 
 	map_freeblock_unlock();
 
-	bl_list_count = blockcount;
+	map_bl_list_free(list);
 	return returnCount;
 }
 
+/// Calls func(bl, data) for each object of type in (x0,y0)-(x1,y1) of map m.
+/// @return Sum of the values returned by func
+int map_iterateinarea(map_iterate_func func, int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int type, void* data)
+{
+	struct map_bl_list list;
+
+	if ( m < 0 || m >= map_num )
+		return 0;
+
+	if ( x1 < x0 )
+		swap(x0, x1);
+	if ( y1 < y0 )
+		swap(y0, y1);
+
+	x0 = i16max(x0, 0);
+	y0 = i16max(y0, 0);
+	x1 = i16min(x1, map[ m ].xs - 1);
+	y1 = i16min(y1, map[ m ].ys - 1);
+
+	map_bl_list_init(&list);
+	map_collect_inarea(&list, m, x0, y0, x1, y1, type);
+
+	return map_bl_list_iterate(&list, func, data);
+}
+
+/// Calls func(bl, data) for each object of type within range of center.
+/// @return Sum of the values returned by func
+int map_iterateinrange(map_iterate_func func, struct block_list* center, int16 range, int type, void* data)
+{
+	struct map_bl_list list;
+	int16 m = center->m;
+
+	if ( m < 0 || m >= map_num )
+		return 0;
+
+	map_bl_list_init(&list);
+	map_collect_inarea(&list, m, i16max(center->x - range, 0), i16max(center->y - range, 0),
+		i16min(center->x + range, map[ m ].xs - 1), i16min(center->y + range, map[ m ].ys - 1), type);
+#ifdef CIRCULAR_AREA
+	map_bl_list_inrange(&list, center, range);
+#endif
+
+	return map_bl_list_iterate(&list, func, data);
+}
+
+/// Stores the objects of type within range of center in out (up to max of them).
+/// Does not allocate nor modify anything, so worker threads may call it
+/// while the main thread leaves the maps alone.
+/// @return Number of objects found, which may be larger than max
+int map_getinrange(struct block_list* center, int16 range, int type, struct block_list** out, int max)
+{
+	int16 m = center->m, x0, y0, x1, y1;
+	int bx, by, i, j, count = 0;
+
+	if ( m < 0 || m >= map_num )
+		return 0;
+
+	x0 = i16max(center->x - range, 0);
+	y0 = i16max(center->y - range, 0);
+	x1 = i16min(center->x + range, map[ m ].xs - 1);
+	y1 = i16min(center->y + range, map[ m ].ys - 1);
+
+	for( j = 0; j < 2; j++ ) {
+		const struct map_block* blocks;
+
+		if( j == 0 && !(type&~BL_MOB) )
+			continue;
+		if( j == 1 && !(type&BL_MOB) )
+			break;
+		blocks = ( j == 0 ) ? map[ m ].block : map[ m ].block_mob;
+		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
+			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
+				const struct map_block* blk = &blocks[ bx + by * map[ m ].bxs ];
+
+				for( i = 0; i < blk->count; i++ ) {
+					if( !(blk->type[i]&type) || blk->x[i] < x0 || blk->x[i] > x1 || blk->y[i] < y0 || blk->y[i] > y1 )
+						continue;
+#ifdef CIRCULAR_AREA
+					if( !check_distance_blxy(center, blk->x[i], blk->y[i], range) )
+						continue;
+#endif
+					if( count < max )
+						out[count] = blk->bl[i];
+					count++;
+				}
+			}
+		}
+	}
+
+	return count;
+}
 
 /// Generates a new flooritem object id from the interval [MIN_FLOORITEM, MAX_FLOORITEM).
 /// Used for floor items, skill units and chatroom objects.
@@ -1783,7 +2022,7 @@ int map_addflooritem(struct item *item, int amount, int16 m, int16 x, int16 y, i
 
 	CREATE(fitem, struct flooritem_data, 1);
 	fitem->bl.type=BL_ITEM;
-	fitem->bl.prev = fitem->bl.next = NULL;
+	fitem->bl.prev = NULL;
 	fitem->bl.m=m;
 	fitem->bl.x=x;
 	fitem->bl.y=y;
@@ -2157,11 +2396,15 @@ int map_quit(struct map_session_data *sd) {
 		}
 	}
 
-	if (sd->state.vending)
+	if (sd->state.vending) {
 		idb_remove(vending_getdb(), sd->status.char_id);
+		searchstore_catalogue_remove(sd, SEARCHTYPE_VENDING);
+	}
 
-	if (sd->state.buyingstore)
+	if (sd->state.buyingstore) {
 		idb_remove(buyingstore_getdb(), sd->status.char_id);
+		searchstore_catalogue_remove(sd, SEARCHTYPE_BUYING_STORE);
+	}
 
 	pc_damage_log_clear(sd,0);
 	party_booking_delete(sd); // Party Booking [Spiria]
@@ -2624,7 +2867,6 @@ int map_addinstancemap(const char *name, unsigned short instance_id)
 	int src_m = map_mapname2mapid(name);
 	int dst_m = -1, i;
 	char iname[MAP_NAME_LENGTH];
-	size_t num_cell, size;
 
 	if(src_m < 0)
 		return -1;
@@ -2679,14 +2921,10 @@ int map_addinstancemap(const char *name, unsigned short instance_id)
 	memset(map[dst_m].npc, 0, sizeof(map[dst_m].npc));
 	map[dst_m].npc_num = 0;
 
-	// Reallocate cells
-	num_cell = map[dst_m].xs * map[dst_m].ys;
-	CREATE( map[dst_m].cell, struct mapcell, num_cell );
-	memcpy( map[dst_m].cell, map[src_m].cell, num_cell * sizeof(struct mapcell) );
+	// Share cells, copied on write
+	map_cell_share(src_m, dst_m);
 
-	size = map[dst_m].bxs * map[dst_m].bys * sizeof(struct block_list*);
-	map[dst_m].block = (struct block_list **)aCalloc(1,size);
-	map[dst_m].block_mob = (struct block_list **)aCalloc(1,size);
+	map_block_alloc(dst_m);
 
 	map[dst_m].index = mapindex_addmap(-1, map[dst_m].name);
 	map[dst_m].channel = NULL;
@@ -2760,9 +2998,8 @@ int map_delinstancemap(int m)
 		delete_timer(map[m].mob_delete_timer, map_removemobs_timer);
 
 	// Free memory
-	aFree(map[m].cell);
-	aFree(map[m].block);
-	aFree(map[m].block_mob);
+	map_cell_free(&map[m]);
+	map_block_free(m);
 	map_free_questinfo(m);
 
 	mapindex_removemap( map[m].index );
@@ -3103,7 +3340,11 @@ int map_getcellp(struct map_data* m,int16 x,int16 y,cell_chk cellchk)
 	if(x<0 || x>=m->xs-1 || y<0 || y>=m->ys-1)
 		return( cellchk == CELL_CHKNOPASS );
 
-	cell = m->cell[x + y*m->xs];
+	if( m->cell_page ) {
+		int xy = x + y*m->xs;
+		cell = m->cell_page[xy >> MAP_CELL_PAGE_SHIFT][xy & (MAP_CELL_PAGE_SIZE-1)];
+	} else
+		cell = m->cell[x + y*m->xs];
 
 	switch(cellchk)
 	{
@@ -3172,25 +3413,25 @@ int map_getcellp(struct map_data* m,int16 x,int16 y,cell_chk cellchk)
  *------------------------------------------*/
 void map_setcell(int16 m, int16 x, int16 y, cell_t cell, bool flag)
 {
-	int j;
+	struct mapcell *c;
 
 	if( m < 0 || m >= map_num || x < 0 || x >= map[m].xs || y < 0 || y >= map[m].ys )
 		return;
 
-	j = x + y*map[m].xs;
+	c = map_cell_write(&map[m], x + y*map[m].xs);
 
 	switch( cell ) {
-		case CELL_WALKABLE:      map[m].cell[j].walkable = flag;      break;
-		case CELL_SHOOTABLE:     map[m].cell[j].shootable = flag;     break;
-		case CELL_WATER:         map[m].cell[j].water = flag;         break;
-
-		case CELL_NPC:           map[m].cell[j].npc = flag;           break;
-		case CELL_BASILICA:      map[m].cell[j].basilica = flag;      break;
-		case CELL_LANDPROTECTOR: map[m].cell[j].landprotector = flag; break;
-		case CELL_NOVENDING:     map[m].cell[j].novending = flag;     break;
-		case CELL_NOCHAT:        map[m].cell[j].nochat = flag;        break;
-		case CELL_MAELSTROM:	 map[m].cell[j].maelstrom = flag;	  break;
-		case CELL_ICEWALL:		 map[m].cell[j].icewall = flag;		  break;
+		case CELL_WALKABLE:      c->walkable = flag;      break;
+		case CELL_SHOOTABLE:     c->shootable = flag;     break;
+		case CELL_WATER:         c->water = flag;         break;
+
+		case CELL_NPC:           c->npc = flag;           break;
+		case CELL_BASILICA:      c->basilica = flag;      break;
+		case CELL_LANDPROTECTOR: c->landprotector = flag; break;
+		case CELL_NOVENDING:     c->novending = flag;     break;
+		case CELL_NOCHAT:        c->nochat = flag;        break;
+		case CELL_MAELSTROM:	 c->maelstrom = flag;	  break;
+		case CELL_ICEWALL:		 c->icewall = flag;		  break;
 		default:
 			ShowWarning("map_setcell: invalid cell type '%d'\n", (int)cell);
 			break;
@@ -3199,18 +3440,17 @@ void map_setcell(int16 m, int16 x, int16 y, cell_t cell, bool flag)
 
 void map_setgatcell(int16 m, int16 x, int16 y, int gat)
 {
-	int j;
-	struct mapcell cell;
+	struct mapcell cell, *c;
 
 	if( m < 0 || m >= map_num || x < 0 || x >= map[m].xs || y < 0 || y >= map[m].ys )
 		return;
 
-	j = x + y*map[m].xs;
+	c = map_cell_write(&map[m], x + y*map[m].xs);
 
 	cell = map_gat2cell(gat);
-	map[m].cell[j].walkable = cell.walkable;
-	map[m].cell[j].shootable = cell.shootable;
-	map[m].cell[j].water = cell.water;
+	c->walkable = cell.walkable;
+	c->shootable = cell.shootable;
+	c->water = cell.water;
 }
 
 /*==========================================
@@ -3396,86 +3636,333 @@ int map_eraseipport(unsigned short mapindex, uint32 ip, uint16 port)
 	return 0;
 }
 
+/// Map found in a map cache file
+struct map_cache_entry {
+	const char *name;
+	int16 xs;
+	int16 ys;
+	const uint8 *data; ///< Compressed cells
+	uint32 len;
+	uint8 version; ///< 1: gat types, 2: struct mapcell
+};
+
+/// Map cache file loaded by map_init_mapcache
+struct map_cache {
+	char *buffer;
+	size_t size;
+	bool mapped; ///< buffer is a read-only mapping of the file
+	struct map_cache_entry *entry; ///< Sorted by name
+	int count;
+};
+
+/// Map cells waiting to be decoded by the map cache workers
+struct map_cache_job {
+	const struct map_cache_entry *entry; ///< NULL if the map isn't decoded from the cache
+	int bad_gat; ///< Cells with an unrecognized gat type
+	bool success;
+};
+
+static struct {
+	struct map_cache_job *job; ///< One per map, same index as map[]
+	int32 count;
+	volatile int32 next;
+	bool native; ///< v2 cells match struct mapcell and are inflated straight into map_data.cell
+} map_cache_decoder;
+
 /*==========================================
  * [Shinryo]: Init the mapcache
  *------------------------------------------*/
-static char *map_init_mapcache(FILE *fp)
+static bool map_init_mapcache(struct map_cache *cache, FILE *fp)
 {
 	size_t size = 0;
-	char *buffer;
+
+	memset(cache, 0, sizeof(struct map_cache));
 
 	// No file open? Return..
-	nullpo_ret(fp);
+	nullpo_retr(false, fp);
 
 	// Get file size
 	fseek(fp, 0, SEEK_END);
 	size = ftell(fp);
 	fseek(fp, 0, SEEK_SET);
 
-	// Allocate enough space
-	CREATE(buffer, char, size);
+	if( size < sizeof(struct map_cache_main_header) ) {
+		ShowError("map_init_mapcache: Mapcache file is too small\n");
+		return false;
+	}
+	cache->size = size;
+
+#ifndef _WIN32
+	// Map the file instead of copying it
+	cache->buffer = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+	if( cache->buffer != (char *)MAP_FAILED ) {
+		cache->mapped = true;
+		return true;
+	}
+	cache->buffer = NULL;
+#endif
 
-	// No memory? Return..
-	nullpo_ret(buffer);
+	// Allocate enough space
+	CREATE(cache->buffer, char, size);
 
 	// Read file into buffer..
-	if(fread(buffer, 1, size, fp) != size) {
+	if(fread(cache->buffer, 1, size, fp) != size) {
 		ShowError("map_init_mapcache: Could not read entire mapcache file\n");
+		return false;
+	}
+
+	return true;
+}
+
+static void map_final_mapcache(struct map_cache *cache)
+{
+#ifndef _WIN32
+	if( cache->mapped )
+		munmap(cache->buffer, cache->size);
+	else
+#endif
+	if( cache->buffer )
+		aFree(cache->buffer);
+	if( cache->entry )
+		aFree(cache->entry);
+	memset(cache, 0, sizeof(struct map_cache));
+}
+
+/// Sorts map cache entries by name, then by position in the file
+static int map_cache_compare(const void *a, const void *b)
+{
+	const struct map_cache_entry *ea = (const struct map_cache_entry *)a, *eb = (const struct map_cache_entry *)b;
+	int cmp = strncmp(ea->name, eb->name, MAP_NAME_LENGTH);
+
+	if( cmp == 0 && ea->data != eb->data )
+		cmp = ( ea->data < eb->data ) ? -1 : 1;
+	return cmp;
+}
+
+static int map_cache_compare_name(const void *key, const void *b)
+{
+	return strncmp((const char *)key, ((const struct map_cache_entry *)b)->name, MAP_NAME_LENGTH);
+}
+
+/*==========================================
+ * Builds the name index of a loaded mapcache
+ * v1 files are scanned once, v2 files carry a sorted index
+ *------------------------------------------*/
+static bool map_index_mapcache(struct map_cache *cache, const char *filename)
+{
+	bool sorted = true;
+	int i;
+
+	if( cache->size >= sizeof(struct map_cache_v2_header) && memcmp(cache->buffer, MAP_CACHE_V2_MAGIC, 4) == 0 ) {
+		struct map_cache_v2_header *header = (struct map_cache_v2_header *)cache->buffer;
+		struct map_cache_v2_index *index = (struct map_cache_v2_index *)(cache->buffer + sizeof(struct map_cache_v2_header));
+
+		if( header->cell_size != MAP_CACHE_V2_CELL_SIZE || sizeof(struct map_cache_v2_header) + (size_t)header->map_count*sizeof(struct map_cache_v2_index) > cache->size ) {
+			ShowError("map_index_mapcache: Invalid v2 header in %s\n", filename);
+			return false;
+		}
+
+		CREATE(cache->entry, struct map_cache_entry, max(header->map_count, 1));
+		for( i = 0; i < (int)header->map_count; i++ ) {
+			struct map_cache_entry *entry = &cache->entry[i];
+
+			if( (size_t)index[i].offset + index[i].len > cache->size ) {
+				ShowError("map_index_mapcache: Map '%.*s' exceeds the end of %s\n", MAP_NAME_LENGTH, index[i].name, filename);
+				return false;
+			}
+			entry->name = index[i].name;
+			entry->xs = index[i].xs;
+			entry->ys = index[i].ys;
+			entry->data = (const uint8 *)cache->buffer + index[i].offset;
+			entry->len = index[i].len;
+			entry->version = 2;
+			if( i > 0 && sorted && map_cache_compare(&cache->entry[i-1], entry) > 0 )
+				sorted = false;
+		}
+		cache->count = i;
+	} else {
+		struct map_cache_main_header *header = (struct map_cache_main_header *)cache->buffer;
+		char *p = cache->buffer + sizeof(struct map_cache_main_header);
+		char *end = cache->buffer + cache->size;
+
+		CREATE(cache->entry, struct map_cache_entry, max(header->map_count, 1));
+		for( i = 0; i < header->map_count; i++ ) {
+			struct map_cache_map_info *info = (struct map_cache_map_info *)p;
+			struct map_cache_entry *entry = &cache->entry[i];
+
+			if( p + sizeof(struct map_cache_map_info) > end || info->len < 0 || p + sizeof(struct map_cache_map_info) + info->len > end ) {
+				ShowError("map_index_mapcache: Map %d exceeds the end of %s\n", i, filename);
+				return false;
+			}
+			entry->name = info->name;
+			entry->xs = info->xs;
+			entry->ys = info->ys;
+			entry->data = (const uint8 *)p + sizeof(struct map_cache_map_info);
+			entry->len = info->len;
+			entry->version = 1;
+
+			// Jump to next entry..
+			p += sizeof(struct map_cache_map_info) + info->len;
+		}
+		cache->count = i;
+		sorted = false;
+	}
+
+	if( !sorted )
+		qsort(cache->entry, cache->count, sizeof(struct map_cache_entry), map_cache_compare);
+
+	return true;
+}
+
+/// Finds a map in a mapcache, the first one in the file if it's there several times
+static const struct map_cache_entry *map_cache_find(struct map_cache *cache, const char *name)
+{
+	const struct map_cache_entry *entry;
+
+	if( cache->entry == NULL )
 		return NULL;
+
+	entry = (const struct map_cache_entry *)bsearch(name, cache->entry, cache->count, sizeof(struct map_cache_entry), map_cache_compare_name);
+	if( entry ) {
+		while( entry > cache->entry && map_cache_compare_name(name, entry - 1) == 0 )
+			entry--;
 	}
+	return entry;
+}
 
-	return buffer;
+/// Whether map cache v2 cells can be used as struct mapcell without conversion
+static bool map_cache_native(void)
+{
+	struct mapcell cell;
+	const uint8 *p = (const uint8 *)&cell;
+
+	if( sizeof(struct mapcell) != MAP_CACHE_V2_CELL_SIZE )
+		return false;
+	memset(&cell, 0, sizeof(struct mapcell));
+	cell.walkable = 1;
+	cell.water = 1;
+	return p[0] == 0x05 && p[1] == 0;
 }
 
 /*==========================================
  * Map cache reading
  * [Shinryo]: Optimized some behaviour to speed this up
+ * Sets up the map for map_cache_decode, the cells are decoded later
  *==========================================*/
-int map_readfromcache(struct map_data *m, char *buffer, char *decode_buffer)
+static bool map_readfromcache(struct map_data *m, const struct map_cache_entry *entry)
 {
-	int i;
-	struct map_cache_main_header *header = (struct map_cache_main_header *)buffer;
-	struct map_cache_map_info *info = NULL;
-	char *p = buffer + sizeof(struct map_cache_main_header);
+	unsigned long size;
+
+	if( entry == NULL )
+		return false; // Not found
 
-	for(i = 0; i < header->map_count; i++) {
-		info = (struct map_cache_map_info *)p;
+	if( entry->xs <= 0 || entry->ys <= 0 )
+		return false;// Invalid
 
-		if( strcmp(m->name, info->name) == 0 )
-			break; // Map found
+	size = (unsigned long)entry->xs*(unsigned long)entry->ys;
 
-		// Jump to next entry..
-		p += sizeof(struct map_cache_map_info) + info->len;
+	if(size > MAX_MAP_SIZE) {
+		ShowWarning("map_readfromcache: %s exceeded MAX_MAP_SIZE of %d\n", m->name, MAX_MAP_SIZE);
+		return false; // Say not found to remove it from list.. [Shinryo]
 	}
 
-	if( info && i < header->map_count ) {
-		unsigned long size, xy;
+	m->xs = entry->xs;
+	m->ys = entry->ys;
+	CREATE(m->cell, struct mapcell, size);
+
+	return true;
+}
+
+/*==========================================
+ * Decodes the cells of a map set up by map_readfromcache
+ * Runs on the map cache workers: must not allocate nor print
+ * @param buffer: MAX_MAP_SIZE*MAP_CACHE_V2_CELL_SIZE bytes of scratch space
+ *------------------------------------------*/
+static bool map_cache_decode(struct map_data *m, struct map_cache_job *job, uint8 *buffer)
+{
+	const struct map_cache_entry *entry = job->entry;
+	unsigned long size = (unsigned long)m->xs*(unsigned long)m->ys, len, xy;
 
-		if( info->xs <= 0 || info->ys <= 0 )
-			return 0;// Invalid
+	if( entry->version == 2 ) {
+		if( map_cache_decoder.native ) {
+			len = size*sizeof(struct mapcell);
+			return decode_zip(m->cell, &len, entry->data, entry->len) == 0 && len == size*sizeof(struct mapcell);
+		}
 
-		m->xs = info->xs;
-		m->ys = info->ys;
-		size = (unsigned long)info->xs*(unsigned long)info->ys;
+		len = size*MAP_CACHE_V2_CELL_SIZE;
+		if( decode_zip(buffer, &len, entry->data, entry->len) != 0 || len != size*MAP_CACHE_V2_CELL_SIZE )
+			return false;
+		for( xy = 0; xy < size; ++xy ) {
+			uint8 flags = buffer[xy*MAP_CACHE_V2_CELL_SIZE];
 
-		if(size > MAX_MAP_SIZE) {
-			ShowWarning("map_readfromcache: %s exceeded MAX_MAP_SIZE of %d\n", info->name, MAX_MAP_SIZE);
-			return 0; // Say not found to remove it from list.. [Shinryo]
+			m->cell[xy].walkable = flags&1;
+			m->cell[xy].shootable = (flags>>1)&1;
+			m->cell[xy].water = (flags>>2)&1;
 		}
+		return true;
+	}
 
-		// TO-DO: Maybe handle the scenario, if the decoded buffer isn't the same size as expected? [Shinryo]
-		decode_zip(decode_buffer, &size, p+sizeof(struct map_cache_map_info), info->len);
+	// TO-DO: Maybe handle the scenario, if the decoded buffer isn't the same size as expected? [Shinryo]
+	len = size;
+	if( decode_zip(buffer, &len, entry->data, entry->len) != 0 )
+		return false;
+	for( xy = 0; xy < len; ++xy ) {
+		if( buffer[xy] > 6 )
+			job->bad_gat++; // left as an empty cell, like map_gat2cell does
+		else
+			m->cell[xy] = map_gat2cell(buffer[xy]);
+	}
+	return true;
+}
 
-		CREATE(m->cell, struct mapcell, size);
+static void *map_cache_worker(void *param)
+{
+	uint8 *buffer = (uint8 *)param;
+	int32 i;
 
+	while( (i = InterlockedIncrement(&map_cache_decoder.next) - 1) < map_cache_decoder.count ) {
+		struct map_cache_job *job = &map_cache_decoder.job[i];
 
-		for( xy = 0; xy < size; ++xy )
-			m->cell[xy] = map_gat2cell(decode_buffer[xy]);
+		if( job->entry )
+			job->success = map_cache_decode(&map[i], job, buffer);
+	}
+	return NULL;
+}
 
-		return 1;
+/*==========================================
+ * Decodes the cells of all the maps set up by map_readfromcache,
+ * on map_cache_threads threads plus the main one
+ *------------------------------------------*/
+static void map_cache_decode_all(void)
+{
+	rAthread thread[MAX_MAP_CACHE_THREADS];
+	uint8 *buffer[MAX_MAP_CACHE_THREADS+1];
+	int i, thread_count = 0, buffer_count;
+
+	if( map_cache_decoder.count <= 0 )
+		return;
+
+	map_cache_decoder.next = 0;
+	map_cache_decoder.native = map_cache_native();
+
+	// No more threads than maps, the main thread takes its share too
+	buffer_count = min(map_cache_threads, map_cache_decoder.count - 1) + 1;
+	for( i = 0; i < buffer_count; i++ )
+		CREATE(buffer[i], uint8, MAX_MAP_SIZE*MAP_CACHE_V2_CELL_SIZE);
+
+	for( thread_count = 0; thread_count < buffer_count - 1; thread_count++ ) {
+		if( (thread[thread_count] = rathread_create(map_cache_worker, buffer[thread_count+1])) == NULL ) {
+			ShowWarning("map_cache_decode_all: Couldn't create map cache thread %d, using %d thread(s).\n", thread_count+1, thread_count);
+			break;
+		}
 	}
 
-	return 0; // Not found
+	map_cache_worker(buffer[0]);
+
+	for( i = 0; i < thread_count; i++ )
+		rathread_wait(thread[i], NULL);
+	for( i = 0; i < buffer_count; i++ )
+		aFree(buffer[i]);
 }
 
 int map_addmap(char* mapname)
@@ -3649,15 +4136,13 @@ void map_removemapdb(struct map_data *m)
  *--------------------------------------*/
 int map_readallmaps (void)
 {
-	int i;
+	int i, j;
 	FILE* fp=NULL;
 	int maps_removed = 0;
-	// Has the uncompressed gat data of all maps, so just one allocation has to be made
-	char *map_cache_buffer[2] = {
-		NULL,
-		NULL
-	};
-	char map_cache_decode_buffer[MAX_MAP_SIZE];
+	// Map cache files, indexed by name
+	struct map_cache map_cache[2];
+
+	memset(map_cache, 0, sizeof(map_cache));
 
 	if( enable_grf )
 		ShowStatus("Loading maps (using GRF files)...\n");
@@ -3681,19 +4166,30 @@ int map_readallmaps (void)
 			}
 
 			// Init mapcache data. [Shinryo]
-			map_cache_buffer[i] = map_init_mapcache(fp);
-
-			if( !map_cache_buffer[i] ) {
-				ShowFatalError( "Failed to initialize mapcache data (%s)..\n", mapcachefilepath );
+			if( !map_init_mapcache(&map_cache[i], fp) || !map_index_mapcache(&map_cache[i], mapcachefilepath[i]) ) {
+				ShowFatalError( "Failed to initialize mapcache data (%s)..\n", mapcachefilepath[i] );
 				exit(EXIT_FAILURE);
 			}
 
 			fclose(fp);
 		}
+
+		// Set up every map, then decode all the cells at once
+		CREATE(map_cache_decoder.job, struct map_cache_job, max(map_num, 1));
+		map_cache_decoder.count = map_num;
+		for( i = 0; i < map_num; i++ ) {
+			// Read from import first, in case of override
+			const struct map_cache_entry *entry = map_cache_find(&map_cache[1], map[i].name);
+
+			// Nothing was found in import - try to find it in the main file
+			if( !map_readfromcache(&map[i], entry) && !map_readfromcache(&map[i], (entry = map_cache_find(&map_cache[0], map[i].name))) )
+				entry = NULL;
+			map_cache_decoder.job[i].entry = entry;
+		}
+		map_cache_decode_all();
 	}
 
-	for(i = 0; i < map_num; i++) {
-		size_t size;
+	for(i = 0, j = 0; i < map_num; i++, j++) {
 		bool success = false;
 		unsigned short idx = 0;
 
@@ -3704,20 +4200,18 @@ int map_readallmaps (void)
 			// try to load the map
 			success = map_readgat(&map[i]) != 0;
 		}else{
-			// try to load the map
-			// Read from import first, in case of override
-			if( map_cache_buffer[1] != NULL ){
-				success = map_readfromcache( &map[i], map_cache_buffer[1], map_cache_decode_buffer ) != 0;
-			}
-
-			// Nothing was found in import - try to find it in the main file
-			if( !success ){
-				success = map_readfromcache( &map[i], map_cache_buffer[0], map_cache_decode_buffer ) != 0;
-			}
+			// j follows the map through the removals, jobs keep the original order
+			success = map_cache_decoder.job[j].success;
+			if( map_cache_decoder.job[j].bad_gat )
+				ShowWarning("map_readallmaps: %d cells of %s have an unrecognized gat type\n", map_cache_decoder.job[j].bad_gat, map[i].name);
 		}
 
 		// The map was not found - remove it
 		if( !(idx = mapindex_name2id(map[i].name)) || !success ){
+			if (map[i].cell) {
+				aFree(map[i].cell);
+				map[i].cell = NULL;
+			}
 			map_delmapid(i);
 			maps_removed++;
 			i--;
@@ -3748,9 +4242,7 @@ int map_readallmaps (void)
 		map[i].bxs = (map[i].xs + BLOCK_SIZE - 1) / BLOCK_SIZE;
 		map[i].bys = (map[i].ys + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
-		size = map[i].bxs * map[i].bys * sizeof(struct block_list*);
-		map[i].block = (struct block_list**)aCalloc(size, 1);
-		map[i].block_mob = (struct block_list**)aCalloc(size, 1);
+		map_block_alloc(i);
 	}
 
 	// intialization and configuration-dependent adjustments of mapflags
@@ -3758,10 +4250,11 @@ int map_readallmaps (void)
 
 	if( !enable_grf ) {
 		// The cache isn't needed anymore, so free it. [Shinryo]
-		if( map_cache_buffer[1] != NULL ){
-			aFree(map_cache_buffer[1]);
-		}
-		aFree(map_cache_buffer[0]);
+		map_final_mapcache(&map_cache[1]);
+		map_final_mapcache(&map_cache[0]);
+		aFree(map_cache_decoder.job);
+		map_cache_decoder.job = NULL;
+		map_cache_decoder.count = 0;
 	}
 
 	// finished map loading
@@ -3791,6 +4284,7 @@ int parse_console(const char* buf){
 	struct map_session_data sd;
 
 	memset(&sd, 0, sizeof(struct map_session_data));
+	sd.sc.data = status_sc_nodata;
 	strcpy(sd.status.name, "console");
 
 	if( ( n = sscanf(buf, "%63[^:]:%63[^:]:%63s %6hd %6hd[^\n]", type, command, mapname, &x, &y) ) < 5 ){
@@ -3839,12 +4333,20 @@ int parse_console(const char* buf){
 	else if( strcmpi("ers_report", type) == 0 ){
 		ers_report();
 	}
+	else if( strcmpi("timer_report", type) == 0 ){
+		timer_report();
+	}
+	else if( strcmpi("log_report", type) == 0 ){
+		log_writer_report();
+	}
 	else if( strcmpi("help", type) == 0 ) {
 		ShowInfo("Available commands:\n");
 		ShowInfo("\t admin:@<atcommand> => Uses an atcommand. Do NOT use commands requiring an attached player.\n");
 		ShowInfo("\t admin:map:<map> <x> <y> => Changes the map from which console commands are executed.\n");
 		ShowInfo("\t server:shutdown => Stops the server.\n");
 		ShowInfo("\t ers_report => Displays database usage.\n");
+		ShowInfo("\t timer_report => Displays timer function usage since the last report.\n");
+		ShowInfo("\t log_report => Displays the SQL log writer queue and counters.\n");
 	}
 
 	return 0;
@@ -3943,6 +4445,8 @@ int map_config_read(char *cfgName)
 			enable_spy = config_switch(w2);
 		else if (strcmpi(w1, "use_grf") == 0)
 			enable_grf = config_switch(w2);
+		else if (strcmpi(w1, "map_cache_threads") == 0)
+			map_cache_threads = cap_value(atoi(w2), 0, MAX_MAP_CACHE_THREADS);
 		else if (strcmpi(w1, "console_msg_log") == 0)
 			console_msg_log = atoi(w2);//[Ind]
 		else if (strcmpi(w1, "console_log_filepath") == 0)
@@ -4479,14 +4983,14 @@ void do_final(void)
 	do_final_channel(); //should be called after final guild
 	do_final_vending();
 	do_final_buyingstore();
+	do_final_searchstore();
 	do_final_path();
 
 	map_db->destroy(map_db, map_db_final);
 
 	for (i=0; i<map_num; i++) {
-		if(map[i].cell) aFree(map[i].cell);
-		if(map[i].block) aFree(map[i].block);
-		if(map[i].block_mob) aFree(map[i].block_mob);
+		map_cell_free(&map[i]);
+		map_block_free(i);
 		if(battle_config.dynamic_mobs) { //Dynamic mobs flag by [random]
 			if(map[i].mob_delete_timer != INVALID_TIMER)
 				delete_timer(map[i].mob_delete_timer, map_removemobs_timer);
@@ -4517,6 +5021,7 @@ void do_final(void)
 	ers_destroy(map_skill_damage_ers);
 #endif
 
+	do_final_log();
 	map_sql_close();
 
 	ShowStatus("Finished.\n");
@@ -4772,6 +5277,7 @@ int do_init(int argc, char *argv[])
 	map_sql_init();
 	if (log_config.sql_logs)
 		log_sql_init();
+	do_init_log();
 
 	mapindex_init();
 	if(enable_grf)
@@ -4793,6 +5299,7 @@ int do_init(int argc, char *argv[])
 	do_init_chrif();
 	do_init_clif();
 	do_init_script();
+	script_cache_begin();
 	do_init_itemdb();
 	do_init_cashshop();
 	do_init_skill();
@@ -4813,9 +5320,11 @@ int do_init(int argc, char *argv[])
 	do_init_duel();
 	do_init_vending();
 	do_init_buyingstore();
+	do_init_searchstore();
 	do_init_achievement();
 	do_init_faction();
 	do_init_region();
+	script_cache_end(true);
 
 	npc_event_do_oninit();	// Init npcs (OnInit)
 
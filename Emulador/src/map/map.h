@@ -383,13 +383,34 @@ struct Ranking_Slot {
 	int char_id;
 };
 
+/// Players that have an object in sight (within AREA_SIZE cells).
+struct map_viewers {
+	struct map_session_data** sd;
+	int count, max;
+};
+
 struct block_list {
-	struct block_list *next,*prev;
+	struct block_list *prev; // set while the object is on a map
 	int id;
 	int16 m,x,y;
 	enum bl_type type;
+	int block_index; // position in its struct map_block
+	struct map_viewers viewers; // maintained while the object is on a map
+};
+
+/// Objects in a BLOCK_SIZE x BLOCK_SIZE square of a map, stored as parallel arrays
+/// so area searches can filter on coordinates without dereferencing the objects.
+struct map_block {
+	struct block_list** bl;
+	int16* x;
+	int16* y;
+	int* type; // enum bl_type
+	int count, max;
 };
 
+/// Callback of the typed area iterators (map_iterateinarea, map_iterateinrange)
+typedef int (*map_iterate_func)(struct block_list* bl, void* data);
+
 
 // Mob List Held in memory for Dynamic Mobs [Wizputer]
 // Expanded to specify all mob-related spawn data by [Skotlex]
@@ -583,6 +604,16 @@ struct mapcell
 #endif
 };
 
+// Instance maps copy the cells they share with their source map by pages of MAP_CELL_PAGE_SIZE cells
+#define MAP_CELL_PAGE_SHIFT 8
+#define MAP_CELL_PAGE_SIZE (1<<MAP_CELL_PAGE_SHIFT)
+
+/// Copy of the cells of a map, shared with the instances created from it
+struct map_cell_share {
+	struct mapcell* cell;
+	int refcount; // source map (until it changes its cells) and instances using it
+};
+
 struct iwall_data {
 	char wall_name[50];
 	short m, x, y, size;
@@ -626,9 +657,14 @@ struct questinfo {
 struct map_data {
 	char name[MAP_NAME_LENGTH];
 	uint16 index; // The map index used by the mapindex* functions.
-	struct mapcell* cell; // Holds the information of each map cell (NULL if the map is not on this map-server).
-	struct block_list **block;
-	struct block_list **block_mob;
+	struct mapcell* cell; // Holds the information of each map cell (NULL if the map is not on this map-server). Read-only on instance maps.
+	struct mapcell** cell_page; // Instance maps: cells by page, pointing into cell_share until changed
+	struct map_cell_share* cell_share; // Cells shared between a map and its instances
+	int cell_copied; // Instance maps: pages copied from cell_share
+	struct map_block* block;
+	struct map_block* block_mob;
+	struct skill_unit** skill_units; // Skill units on the map, ticked by skill_unit_timer (may have NULL holes)
+	int skill_unit_count, skill_unit_max;
 	int16 m;
 	int region_id;
 	int16 xs,ys; // map dimensions (in cells)
@@ -844,6 +880,10 @@ int map_foreachincell(int (*func)(struct block_list*,va_list), int16 m, int16 x,
 int map_foreachinpath(int (*func)(struct block_list*,va_list), int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int16 range, int length, int type, ...);
 int map_foreachindir(int (*func)(struct block_list*,va_list), int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int16 range, int length, int offset, int type, ...);
 int map_foreachinmap(int (*func)(struct block_list*,va_list), int16 m, int type, ...);
+int map_iterateinarea(map_iterate_func func, int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int type, void* data);
+int map_iterateinrange(map_iterate_func func, struct block_list* center, int16 range, int type, void* data);
+void map_viewers_rebuild(void);
+int map_getinrange(struct block_list* center, int16 range, int type, struct block_list** out, int max);
 //blocklist nb in one cell
 int map_count_oncell(int16 m,int16 x,int16 y,int type,int flag);
 struct skill_unit *map_find_skill_unit_oncell(struct block_list *,int16 x,int16 y,uint16 skill_id,struct skill_unit *, int flag);
@@ -865,6 +905,7 @@ int map_addflooritem_area(struct block_list* bl, int16 m, int16 x, int16 y, int
 
 // instances
 int map_addinstancemap(const char *name, unsigned short instance_id);
+size_t map_cell_memory(int16 m, size_t *shared);
 int map_delinstancemap(int m);
 
 // player to map session
@@ -999,8 +1040,6 @@ typedef struct elemental_data	TBL_ELEM;
 	( ((bl) == (struct block_list*)NULL || (bl)->type != (type_)) ? (T ## type_ *)NULL : (T ## type_ *)(bl) )
 
 
-#ifdef BETA_THREAD_TEST
-
 extern char default_codepage[32];
 extern int map_server_port;
 extern char map_server_ip[32];
@@ -1014,8 +1053,6 @@ extern char log_db_id[32];
 extern char log_db_pw[32];
 extern char log_db_db[32];
 
-#endif
-
 #include "../common/sql.h"
 
 extern int db_use_sqldbs;
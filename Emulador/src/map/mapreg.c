@@ -5,9 +5,11 @@
 #include "../common/db.h"
 #include "../common/ers.h"
 #include "../common/malloc.h"
+#include "../common/mutex.h"
 #include "../common/showmsg.h"
 #include "../common/sql.h"
 #include "../common/strlib.h"
+#include "../common/thread.h"
 #include "../common/timer.h"
 
 #include "map.h" // mmysql_handle
@@ -22,10 +24,50 @@ static struct eri *mapreg_ers;
 bool skip_insert = false;
 
 static char mapreg_table[32] = "mapreg";
-static bool mapreg_dirty = false; // Whether there are modified regs to be saved
+static bool mapreg_async = true;
+static DBMap* mapreg_dirty; // int64 uid -> 1, permanent variables set or removed since the last save
 
 #define MAPREG_AUTOSAVE_INTERVAL (300*1000)
+#define MAPREG_BATCH_LENGTH (64*1024) // a batched statement is sent once its rows are this long
 
+/*==========================================
+ * Mapreg writer
+ *
+ * Saved variables are written by a writer thread with its own connection,
+ * so a save doesn't stall the map-server. The main thread builds the batched
+ * statements in 'pending', the writer swaps it with 'running' and sends them.
+ * The writer doesn't use the memory manager nor the console.
+ *------------------------------------------*/
+
+struct mapreg_queries {
+	char* buf; // statements, each one followed by a '\0'
+	size_t length, size;
+};
+
+static struct {
+	rAthread thread;
+	Sql* handle; // only used by the writer thread
+	ramutex mutex; // protects everything below
+	racond cond; // signaled when there is something to write
+	racond idle; // signaled when everything was written
+	struct mapreg_queries pending, running;
+	bool busy; // sending 'running'
+	bool terminate;
+	int errors;
+	char last_error[256];
+} mapreg_writer;
+
+
+/**
+ * Marks a permanent variable to be written by the next save.
+ * A variable that is no longer in regs.vars is deleted.
+ *
+ * @param uid: variable's unique identifier
+ */
+static void mapreg_setdirty(int64 uid)
+{
+	i64db_iput(mapreg_dirty, uid, 1);
+}
 
 /**
  * Looks up the value of an integer variable using its uid.
@@ -72,10 +114,8 @@ bool mapreg_setreg(int64 uid, int val)
 	if (val != 0) {
 		if ((m = i64db_get(regs.vars, uid))) {
 			m->u.i = val;
-			if (name[1] != '@') {
-				m->save = true;
-				mapreg_dirty = true;
-			}
+			if (name[1] != '@')
+				mapreg_setdirty(uid);
 		} else {
 			if (i)
 				script_array_update(&regs, uid, false);
@@ -84,15 +124,10 @@ bool mapreg_setreg(int64 uid, int val)
 
 			m->u.i = val;
 			m->uid = uid;
-			m->save = false;
 			m->is_string = false;
 
-			if (name[1] != '@' && !skip_insert) {// write new variable to database
-				char tmp_str[32 * 2 + 1];
-				Sql_EscapeStringLen(mmysql_handle, tmp_str, name, strnlen(name, 32));
-				if (SQL_ERROR == Sql_Query(mmysql_handle, "INSERT INTO `%s`(`varname`,`index`,`value`) VALUES ('%s','%d','%d')", mapreg_table, tmp_str, i, val))
-					Sql_ShowDebug(mmysql_handle);
-			}
+			if (name[1] != '@' && !skip_insert) // write new variable to database
+				mapreg_setdirty(uid);
 			i64db_put(regs.vars, uid, m);
 		}
 	} else { // val == 0
@@ -103,10 +138,8 @@ bool mapreg_setreg(int64 uid, int val)
 		}
 		i64db_remove(regs.vars, uid);
 
-		if (name[1] != '@') {// Remove from database because it is unused.
-			if (SQL_ERROR == Sql_Query(mmysql_handle, "DELETE FROM `%s` WHERE `varname`='%s' AND `index`='%d'", mapreg_table, name, i))
-				Sql_ShowDebug(mmysql_handle);
-		}
+		if (name[1] != '@') // Remove from database because it is unused.
+			mapreg_setdirty(uid);
 	}
 
 	return true;
@@ -129,10 +162,8 @@ bool mapreg_setregstr(int64 uid, const char* str)
 	if (str == NULL || *str == 0) {
 		if (i)
 			script_array_update(&regs, uid, true);
-		if (name[1] != '@') {
-			if (SQL_ERROR == Sql_Query(mmysql_handle, "DELETE FROM `%s` WHERE `varname`='%s' AND `index`='%d'", mapreg_table, name, i))
-				Sql_ShowDebug(mmysql_handle);
-		}
+		if (name[1] != '@')
+			mapreg_setdirty(uid);
 		if ((m = i64db_get(regs.vars, uid))) {
 			if (m->u.str != NULL)
 				aFree(m->u.str);
@@ -144,10 +175,8 @@ bool mapreg_setregstr(int64 uid, const char* str)
 			if (m->u.str != NULL)
 				aFree(m->u.str);
 			m->u.str = aStrdup(str);
-			if (name[1] != '@') {
-				mapreg_dirty = true;
-				m->save = true;
-			}
+			if (name[1] != '@')
+				mapreg_setdirty(uid);
 		} else {
 			if (i)
 				script_array_update(&regs, uid, false);
@@ -156,17 +185,10 @@ bool mapreg_setregstr(int64 uid, const char* str)
 
 			m->uid = uid;
 			m->u.str = aStrdup(str);
-			m->save = false;
 			m->is_string = true;
 
-			if (name[1] != '@' && !skip_insert) { //put returned null, so we must insert.
-				char tmp_str[32 * 2 + 1];
-				char tmp_str2[255 * 2 + 1];
-				Sql_EscapeStringLen(mmysql_handle, tmp_str, name, strnlen(name, 32));
-				Sql_EscapeStringLen(mmysql_handle, tmp_str2, str, strnlen(str, 255));
-				if (SQL_ERROR == Sql_Query(mmysql_handle, "INSERT INTO `%s`(`varname`,`index`,`value`) VALUES ('%s','%d','%s')", mapreg_table, tmp_str, i, tmp_str2))
-					Sql_ShowDebug(mmysql_handle);
-			}
+			if (name[1] != '@' && !skip_insert) //put returned null, so we must insert.
+				mapreg_setdirty(uid);
 			i64db_put(regs.vars, uid, m);
 		}
 	}
@@ -223,37 +245,201 @@ static void script_load_mapreg(void)
 	SqlStmt_Free(stmt);
 
 	skip_insert = false;
-	mapreg_dirty = false;
+}
+
+/**
+ * Sends the statements of a batch, on the writer thread.
+ * A failed statement is retried once after a ping, in case the connection was lost.
+ */
+static void mapreg_writer_send(struct mapreg_queries* queries)
+{
+	size_t pos = 0;
+
+	while( pos < queries->length ) {
+		const char* query = queries->buf + pos;
+		size_t length = strlen(query);
+
+		if( SQL_ERROR == Sql_QueryRaw(mapreg_writer.handle, query, length)
+		&&  (SQL_ERROR == Sql_Ping(mapreg_writer.handle) || SQL_ERROR == Sql_QueryRaw(mapreg_writer.handle, query, length)) )
+		{
+			ramutex_lock(mapreg_writer.mutex);
+			mapreg_writer.errors++;
+			safestrncpy(mapreg_writer.last_error, Sql_LastError(mapreg_writer.handle), sizeof(mapreg_writer.last_error));
+			ramutex_unlock(mapreg_writer.mutex);
+		}
+		pos += length + 1;
+	}
+}
+
+static void* mapreg_writer_main(void* param)
+{
+	Sql_ThreadInit();
+
+	ramutex_lock(mapreg_writer.mutex);
+	for(;;) {
+		struct mapreg_queries swap;
+
+		if( mapreg_writer.pending.length == 0 ) {
+			racond_broadcast(mapreg_writer.idle);
+			if( mapreg_writer.terminate )
+				break; // everything queued before the shutdown was written
+			racond_wait(mapreg_writer.cond, mapreg_writer.mutex, -1);
+			continue;
+		}
+		swap = mapreg_writer.running;
+		mapreg_writer.running = mapreg_writer.pending;
+		mapreg_writer.pending = swap;
+		mapreg_writer.pending.length = 0;
+		mapreg_writer.busy = true;
+		ramutex_unlock(mapreg_writer.mutex);
+
+		mapreg_writer_send(&mapreg_writer.running);
+
+		ramutex_lock(mapreg_writer.mutex);
+		mapreg_writer.running.length = 0;
+		mapreg_writer.busy = false;
+	}
+	ramutex_unlock(mapreg_writer.mutex);
+
+	Sql_ThreadEnd();
+	return NULL;
+}
+
+/**
+ * Reports the errors of the writer thread, which can't use the console.
+ */
+static void mapreg_writer_report(void)
+{
+	static int errors = 0;
+
+	if( mapreg_writer.thread == NULL )
+		return;
+
+	ramutex_lock(mapreg_writer.mutex);
+	if( mapreg_writer.errors != errors ) {
+		ShowError("mapreg: %d queries failed, permanent variables weren't saved. Last error: %s\n", mapreg_writer.errors - errors, mapreg_writer.last_error);
+		errors = mapreg_writer.errors;
+	}
+	ramutex_unlock(mapreg_writer.mutex);
+}
+
+/**
+ * Waits until the writer thread has written everything queued.
+ */
+static void mapreg_writer_sync(void)
+{
+	if( mapreg_writer.thread == NULL )
+		return;
+
+	ramutex_lock(mapreg_writer.mutex);
+	while( mapreg_writer.pending.length || mapreg_writer.busy )
+		racond_wait(mapreg_writer.idle, mapreg_writer.mutex, -1);
+	ramutex_unlock(mapreg_writer.mutex);
+	mapreg_writer_report();
+}
+
+/**
+ * Queues a statement for the writer thread, or runs it when there is no writer.
+ *
+ * @param query: statement
+ * @param length: length of the statement
+ */
+static void mapreg_writer_queue(const char* query, size_t length)
+{
+	struct mapreg_queries* pending = &mapreg_writer.pending;
+
+	if( mapreg_writer.thread == NULL ) {
+		if( SQL_ERROR == Sql_QueryStr(mmysql_handle, query) )
+			Sql_ShowDebug(mmysql_handle);
+		return;
+	}
+
+	ramutex_lock(mapreg_writer.mutex);
+	if( pending->length + length + 1 > pending->size ) {
+		pending->size = max(pending->size*2, pending->length + length + 1);
+		RECREATE(pending->buf, char, pending->size);
+	}
+	memcpy(pending->buf + pending->length, query, length + 1);
+	pending->length += length + 1;
+	racond_signal(mapreg_writer.cond);
+	ramutex_unlock(mapreg_writer.mutex);
+}
+
+/**
+ * Turns the rows of a batch into a statement and queues it.
+ *
+ * @param rows: "(...),(...)" rows of the batch, cleared
+ * @param remove: true for (varname,index) rows to delete, false for rows to replace
+ */
+static void mapreg_queue_batch(StringBuf* rows, bool remove)
+{
+	StringBuf buf;
+
+	if( StringBuf_Length(rows) == 0 )
+		return;
+
+	StringBuf_Init(&buf);
+	if( remove )
+		StringBuf_Printf(&buf, "DELETE FROM `%s` WHERE (`varname`,`index`) IN (%s)", mapreg_table, StringBuf_Value(rows));
+	else
+		StringBuf_Printf(&buf, "REPLACE INTO `%s` (`varname`,`index`,`value`) VALUES %s", mapreg_table, StringBuf_Value(rows));
+	mapreg_writer_queue(StringBuf_Value(&buf), StringBuf_Length(&buf));
+	StringBuf_Destroy(&buf);
+	StringBuf_Clear(rows);
 }
 
 /**
  * Saves permanent variables to database.
+ * Only the variables changed since the last save are written, in batched
+ * REPLACE and DELETE statements.
  */
 static void script_save_mapreg(void)
 {
-	if (mapreg_dirty) {
-		DBIterator *iter = db_iterator(regs.vars);
-		struct mapreg_save *m;
-		for (m = dbi_first(iter); dbi_exists(iter); m = dbi_next(iter)) {
-			if (m->save) {
-				int num = script_getvarid(m->uid);
-				int i = script_getvaridx(m->uid);
-				const char* name = get_str(num);
-				if (!m->is_string) {
-					if (SQL_ERROR == Sql_Query(mmysql_handle, "UPDATE `%s` SET `value`='%d' WHERE `varname`='%s' AND `index`='%d' LIMIT 1", mapreg_table, m->u.i, name, i))
-						Sql_ShowDebug(mmysql_handle);
-				} else {
-					char tmp_str2[2 * 255 + 1];
-					Sql_EscapeStringLen(mmysql_handle, tmp_str2, m->u.str, safestrnlen(m->u.str, 255));
-					if (SQL_ERROR == Sql_Query(mmysql_handle, "UPDATE `%s` SET `value`='%s' WHERE `varname`='%s' AND `index`='%d' LIMIT 1", mapreg_table, tmp_str2, name, i))
-						Sql_ShowDebug(mmysql_handle);
-				}
-				m->save = false;
-			}
+	DBIterator* iter;
+	DBKey key;
+	StringBuf replace, remove;
+
+	if( db_size(mapreg_dirty) == 0 )
+		return;
+
+	StringBuf_Init(&replace);
+	StringBuf_Init(&remove);
+	iter = db_iterator(mapreg_dirty);
+	for( iter->first(iter, &key); iter->exists(iter); iter->next(iter, &key) ) {
+		struct mapreg_save *m = (struct mapreg_save *)i64db_get(regs.vars, key.i64);
+		const char* name = get_str(script_getvarid(key.i64));
+		unsigned int i = script_getvaridx(key.i64);
+		char tmp_str[32 * 2 + 1];
+
+		Sql_EscapeStringLen(mmysql_handle, tmp_str, name, strnlen(name, 32));
+		if( m == NULL ) {
+			if( StringBuf_Length(&remove) )
+				StringBuf_AppendStr(&remove, ",");
+			StringBuf_Printf(&remove, "('%s','%u')", tmp_str, i);
+			if( StringBuf_Length(&remove) >= MAPREG_BATCH_LENGTH )
+				mapreg_queue_batch(&remove, true);
+			continue;
+		}
+
+		if( StringBuf_Length(&replace) )
+			StringBuf_AppendStr(&replace, ",");
+		if( !m->is_string )
+			StringBuf_Printf(&replace, "('%s','%u','%d')", tmp_str, i, m->u.i);
+		else {
+			char tmp_str2[2 * 255 + 1];
+			Sql_EscapeStringLen(mmysql_handle, tmp_str2, m->u.str, safestrnlen(m->u.str, 255));
+			StringBuf_Printf(&replace, "('%s','%u','%s')", tmp_str, i, tmp_str2);
 		}
-		dbi_destroy(iter);
-		mapreg_dirty = false;
+		if( StringBuf_Length(&replace) >= MAPREG_BATCH_LENGTH )
+			mapreg_queue_batch(&replace, false);
 	}
+	dbi_destroy(iter);
+	db_clear(mapreg_dirty);
+
+	mapreg_queue_batch(&remove, true);
+	mapreg_queue_batch(&replace, false);
+	StringBuf_Destroy(&replace);
+	StringBuf_Destroy(&remove);
 }
 
 /**
@@ -261,6 +447,7 @@ static void script_save_mapreg(void)
  */
 static int script_autosave_mapreg(int tid, unsigned int tick, int id, intptr_t data)
 {
+	mapreg_writer_report(); // errors of the previous save
 	script_save_mapreg();
 	return 0;
 }
@@ -297,6 +484,7 @@ int mapreg_destroyreg(DBKey key, DBData *data, va_list ap)
 void mapreg_reload(void)
 {
 	script_save_mapreg();
+	mapreg_writer_sync(); // the variables are loaded back from the database
 
 	regs.vars->clear(regs.vars, mapreg_destroyreg);
 
@@ -315,6 +503,24 @@ void mapreg_final(void)
 {
 	script_save_mapreg();
 
+	if( mapreg_writer.thread != NULL ) { // flush and stop the writer
+		ramutex_lock(mapreg_writer.mutex);
+		mapreg_writer.terminate = true;
+		racond_signal(mapreg_writer.cond);
+		ramutex_unlock(mapreg_writer.mutex);
+		rathread_wait(mapreg_writer.thread, NULL);
+		mapreg_writer_report();
+		mapreg_writer.thread = NULL;
+	}
+	if( mapreg_writer.idle ) racond_destroy(mapreg_writer.idle);
+	if( mapreg_writer.cond ) racond_destroy(mapreg_writer.cond);
+	if( mapreg_writer.mutex ) ramutex_destroy(mapreg_writer.mutex);
+	if( mapreg_writer.pending.buf ) aFree(mapreg_writer.pending.buf);
+	if( mapreg_writer.running.buf ) aFree(mapreg_writer.running.buf);
+	Sql_Free(mapreg_writer.handle);
+	memset(&mapreg_writer, 0, sizeof(mapreg_writer));
+
+	db_destroy(mapreg_dirty);
 	regs.vars->destroy(regs.vars, mapreg_destroyreg);
 
 	ers_destroy(mapreg_ers);
@@ -329,6 +535,7 @@ void mapreg_final(void)
 void mapreg_init(void)
 {
 	regs.vars = i64db_alloc(DB_OPT_BASE);
+	mapreg_dirty = i64db_alloc(DB_OPT_BASE);
 	mapreg_ers = ers_new(sizeof(struct mapreg_save), "mapreg.c:mapreg_ers", ERS_OPT_CLEAN);
 
 	skip_insert = false;
@@ -336,6 +543,26 @@ void mapreg_init(void)
 
 	script_load_mapreg();
 
+	memset(&mapreg_writer, 0, sizeof(mapreg_writer));
+	if( mapreg_async ) {
+		mapreg_writer.handle = Sql_Malloc();
+		if( SQL_ERROR == Sql_Connect(mapreg_writer.handle, map_server_id, map_server_pw, map_server_ip, map_server_port, map_server_db) ) {
+			ShowError("mapreg_init: Couldn't connect the mapreg writer, permanent variables will be saved synchronously.\n");
+			Sql_ShowDebug(mapreg_writer.handle);
+			Sql_Free(mapreg_writer.handle);
+			mapreg_writer.handle = NULL;
+		} else {
+			if( strlen(default_codepage) > 0 && SQL_ERROR == Sql_SetEncoding(mapreg_writer.handle, default_codepage) )
+				Sql_ShowDebug(mapreg_writer.handle);
+			Sql_DisableKeepalive(mapreg_writer.handle); // the writer thread pings it
+			mapreg_writer.mutex = ramutex_create();
+			mapreg_writer.cond = racond_create();
+			mapreg_writer.idle = racond_create();
+			if( (mapreg_writer.thread = rathread_create(mapreg_writer_main, NULL)) == NULL )
+				ShowError("mapreg_init: Couldn't create the mapreg writer thread, permanent variables will be saved synchronously.\n");
+		}
+	}
+
 	add_timer_func_list(script_autosave_mapreg, "script_autosave_mapreg");
 	add_timer_interval(gettick() + MAPREG_AUTOSAVE_INTERVAL, script_autosave_mapreg, 0, 0, MAPREG_AUTOSAVE_INTERVAL);
 }
@@ -347,6 +574,8 @@ bool mapreg_config_read(const char* w1, const char* w2)
 {
 	if(!strcmpi(w1, "mapreg_table"))
 		safestrncpy(mapreg_table, w2, sizeof(mapreg_table));
+	else if(!strcmpi(w1, "mapreg_async"))
+		mapreg_async = config_switch(w2) != 0;
 	else
 		return false;
 
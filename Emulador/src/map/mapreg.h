@@ -13,7 +13,6 @@ struct mapreg_save {
 		char *str;     ///< String value
 	} u;
 	bool is_string;    ///< true if it's a string, false if it's a number
-	bool save;         ///< Whether a save operation is pending
 };
 
 struct reg_db regs;
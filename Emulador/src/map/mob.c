@@ -12,6 +12,9 @@
 #include "../common/strlib.h"
 #include "../common/utils.h"
 #include "../common/socket.h"
+#include "../common/atomic.h"
+#include "../common/mutex.h"
+#include "../common/thread.h"
 
 #include "map.h"
 #include "path.h"
@@ -44,6 +47,7 @@
 #define MAX_MINCHASE 30	//Max minimum chase value to use for mobs.
 #define RUDE_ATTACKED_COUNT 1	//After how many rude-attacks should the skill be used?
 #define MAX_MOB_CHAT 50 //Max Skill's messages
+#define MOB_AI_CANDIDATES 32	//Targets listed per monster by the threaded target search
 
 // On official servers, monsters will only seek targets that are closer to walk to than their
 // search range. The search range is affected depending on if the monster is walking or not.
@@ -1280,20 +1284,54 @@ int mob_target(struct mob_data *md,struct block_list *bl,int dist)
 	return 0;
 }
 
+/// Target search of an active monster
+struct mob_activesearch {
+	struct mob_data *md;
+	struct block_list **target;
+	enum e_mode mode;
+};
+
+/// Targets of a monster listed by the threaded hard AI, nearest first
+struct mob_ai_search {
+	struct mob_data *md;
+	int16 range; // view range of the search, -1 if the monster doesn't search
+	int type; // object types searched
+	int count; // number of targets, -1 if there were too many
+	int id[MOB_AI_CANDIDATES];
+	int dist[MOB_AI_CANDIDATES];
+};
+
+/// Threaded hard AI (battle_config.mob_ai_threads)
+/// Each round the main thread collects the monsters near players, the workers
+/// list their possible targets while the maps are left alone, then the main
+/// thread runs the AI of each monster in collection order over those lists.
+static struct {
+	rAthread *threads;
+	int thread_count;
+	ramutex mutex;
+	racond work_cond, done_cond;
+	volatile int32 generation, next, idle, terminate;
+	struct mob_ai_search *search;
+	int count, max;
+	int round;
+	struct mob_ai_search *current; // search of the monster whose AI is running
+} mob_ai_pool;
+
 /*==========================================
  * The ?? routine of an active monster
  *------------------------------------------*/
-static int mob_ai_sub_hard_activesearch(struct block_list *bl,va_list ap)
+static int mob_ai_sub_hard_activesearch(struct block_list *bl,void *data)
 {
+	struct mob_activesearch *search = (struct mob_activesearch *)data;
 	struct mob_data *md;
 	struct block_list **target;
 	enum e_mode mode;
 	int dist;
 
 	nullpo_ret(bl);
-	md=va_arg(ap,struct mob_data *);
-	target= va_arg(ap,struct block_list**);
-	mode= va_arg(ap,enum e_mode);
+	md = search->md;
+	target = search->target;
+	mode = search->mode;
 
 	//If can't seek yet, not an enemy, or you can't attack it, skip.
 	if ((*target) == bl || !status_check_skilluse(&md->bl, bl, 0, 0))
@@ -1342,6 +1380,36 @@ static int mob_ai_sub_hard_activesearch(struct block_list *bl,va_list ap)
 	return 0;
 }
 
+/// Runs the target search of an active monster over the targets listed by the workers.
+/// Returns false if there is no usable list, the caller must search the area then.
+static bool mob_ai_sub_hard_searchlist(struct mob_activesearch *search, int view_range)
+{
+	struct mob_ai_search *s = mob_ai_pool.current;
+	struct mob_data *md = search->md;
+	int i;
+
+	if( s == NULL || s->md != md || s->count < 0 || s->range != view_range || s->type != DEFAULT_ENEMY_TYPE(md) )
+		return false;
+
+	for( i = 0; i < s->count; i++ )
+	{
+		struct block_list *bl = map_id2bl(s->id[i]);
+
+		if( bl == NULL || bl->prev == NULL || bl->m != md->bl.m || !(bl->type&s->type) )
+			continue; // gone since the list was made
+#ifdef CIRCULAR_AREA
+		if( !check_distance_bl(&md->bl, bl, view_range) )
+#else
+		if( abs(bl->x - md->bl.x) > view_range || abs(bl->y - md->bl.y) > view_range )
+#endif
+			continue;
+		if( *search->target && check_distance_bl(&md->bl, *search->target, distance_bl(&md->bl, bl)) )
+			continue; // not closer than the current target
+		mob_ai_sub_hard_activesearch(bl, search);
+	}
+	return true;
+}
+
 /*==========================================
  * chase target-change routine.
  *------------------------------------------*/
@@ -1837,7 +1905,13 @@ static bool mob_ai_sub_hard(struct mob_data *md, unsigned int tick)
 
 	if ((!tbl && mode&MD_AGGRESSIVE) || md->state.skillstate == MSS_FOLLOW)
 	{
-		map_foreachinrange (mob_ai_sub_hard_activesearch, &md->bl, view_range, DEFAULT_ENEMY_TYPE(md), md, &tbl, mode);
+		struct mob_activesearch search;
+
+		search.md = md;
+		search.target = &tbl;
+		search.mode = mode;
+		if( !mob_ai_sub_hard_searchlist(&search, view_range) )
+			map_iterateinrange(mob_ai_sub_hard_activesearch, &md->bl, view_range, DEFAULT_ENEMY_TYPE(md), &search);
 	}
 	else
 	if (mode&MD_CHANGECHASE && (md->state.skillstate == MSS_RUSH || md->state.skillstate == MSS_FOLLOW))
@@ -1989,16 +2063,21 @@ static bool mob_ai_sub_hard(struct mob_data *md, unsigned int tick)
 	return true;
 }
 
-static int mob_ai_sub_hard_timer(struct block_list *bl,va_list ap)
+static void mob_ai_sub_hard_think(struct mob_data *md, unsigned int tick)
 {
-	struct mob_data *md = (struct mob_data*)bl;
-	unsigned int tick = va_arg(ap, unsigned int);
 	if (mob_ai_sub_hard(md, tick))
 	{	//Hard AI triggered.
 		if(!md->state.spotted)
 			md->state.spotted = 1;
 		md->last_pcneartime = tick;
 	}
+}
+
+static int mob_ai_sub_hard_timer(struct block_list *bl,va_list ap)
+{
+	struct mob_data *md = (struct mob_data*)bl;
+	unsigned int tick = va_arg(ap, unsigned int);
+	mob_ai_sub_hard_think(md, tick);
 	return 0;
 }
 
@@ -2089,6 +2168,195 @@ static int mob_ai_lazy(int tid, unsigned int tick, int id, intptr_t data)
 	return 0;
 }
 
+/*==========================================
+ * Threaded hard AI
+ *------------------------------------------*/
+
+/// Lists the possible targets of a monster, nearest first.
+/// Runs in the worker threads: only reads the maps and the monster.
+static void mob_ai_search_run(struct mob_ai_search *s)
+{
+	struct block_list *found[MOB_AI_CANDIDATES];
+	int i, j, n;
+
+	if( s->range < 0 )
+		return;
+
+	n = map_getinrange(&s->md->bl, s->range, s->type, found, MOB_AI_CANDIDATES);
+	if( n > MOB_AI_CANDIDATES )
+	{
+		s->count = -1; // too many, the main thread searches the area
+		return;
+	}
+
+	for( i = 0; i < n; i++ )
+	{
+		int dist;
+
+		if( found[i] == &s->md->bl )
+			continue;
+		dist = distance_bl(&s->md->bl, found[i]);
+		for( j = s->count; j > 0 && s->dist[j-1] > dist; j-- )
+		{
+			s->id[j] = s->id[j-1];
+			s->dist[j] = s->dist[j-1];
+		}
+		s->id[j] = found[i]->id;
+		s->dist[j] = dist;
+		s->count++;
+	}
+}
+
+/// Takes searches of the current round until none are left.
+static void mob_ai_search_work(void)
+{
+	int i;
+
+	while( (i = InterlockedIncrement(&mob_ai_pool.next) - 1) < mob_ai_pool.count )
+		mob_ai_search_run(&mob_ai_pool.search[i]);
+}
+
+static void* mob_ai_worker_main(void *param)
+{
+	int32 generation = 0;
+
+	for(;;)
+	{
+		ramutex_lock(mob_ai_pool.mutex);
+		while( mob_ai_pool.generation == generation && !mob_ai_pool.terminate )
+			racond_wait(mob_ai_pool.work_cond, mob_ai_pool.mutex, -1);
+		generation = mob_ai_pool.generation;
+		ramutex_unlock(mob_ai_pool.mutex);
+
+		if( InterlockedExchangeAdd(&mob_ai_pool.terminate, 0) )
+			break;
+
+		mob_ai_search_work();
+
+		ramutex_lock(mob_ai_pool.mutex);
+		if( ++mob_ai_pool.idle == mob_ai_pool.thread_count )
+			racond_signal(mob_ai_pool.done_cond);
+		ramutex_unlock(mob_ai_pool.mutex);
+	}
+	return NULL;
+}
+
+/// Adds a monster near a player to the current round.
+static int mob_ai_collect_sub(struct block_list *bl, void *data)
+{
+	struct mob_data *md = (struct mob_data*)bl;
+	struct mob_ai_search *s;
+
+	if( md->ai_round == mob_ai_pool.round )
+		return 0; // already collected for another player
+	md->ai_round = mob_ai_pool.round;
+
+	if( mob_ai_pool.count == mob_ai_pool.max )
+	{
+		mob_ai_pool.max = ( mob_ai_pool.max ) ? mob_ai_pool.max*2 : 256;
+		RECREATE(mob_ai_pool.search, struct mob_ai_search, mob_ai_pool.max);
+	}
+	s = &mob_ai_pool.search[mob_ai_pool.count++];
+	s->md = md;
+	s->count = 0;
+	s->type = DEFAULT_ENEMY_TYPE(md);
+	if( (status_get_mode(&md->bl)&MD_AGGRESSIVE) || md->state.skillstate == MSS_FOLLOW )
+		s->range = ( md->sc.count && md->sc.data[SC_BLIND] ) ? 3 : md->db->range2;
+	else
+		s->range = -1;
+	return 1;
+}
+
+static int mob_ai_collect(struct map_session_data *sd, va_list ap)
+{
+	map_iterateinrange(mob_ai_collect_sub, &sd->bl, AREA_SIZE+ACTIVE_AI_RANGE, BL_MOB, NULL);
+	return 0;
+}
+
+/// Hard AI round using the worker threads.
+/// The monsters think in the same order as in the single-threaded path,
+/// but their targets come from a list made at the start of the round.
+static void mob_ai_hard_threaded(unsigned int tick)
+{
+	int i;
+
+	mob_ai_pool.count = 0;
+	if( ++mob_ai_pool.round == 0 )
+		mob_ai_pool.round = 1;
+	map_foreachpc(mob_ai_collect);
+	if( mob_ai_pool.count == 0 )
+		return;
+
+	// search phase, the main thread helps the workers
+	ramutex_lock(mob_ai_pool.mutex);
+	mob_ai_pool.next = 0;
+	mob_ai_pool.idle = 0;
+	mob_ai_pool.generation++;
+	racond_broadcast(mob_ai_pool.work_cond);
+	ramutex_unlock(mob_ai_pool.mutex);
+
+	mob_ai_search_work();
+
+	ramutex_lock(mob_ai_pool.mutex);
+	while( mob_ai_pool.idle < mob_ai_pool.thread_count )
+		racond_wait(mob_ai_pool.done_cond, mob_ai_pool.mutex, -1);
+	ramutex_unlock(mob_ai_pool.mutex);
+
+	// commit phase
+	map_freeblock_lock();
+	for( i = 0; i < mob_ai_pool.count; i++ )
+	{
+		mob_ai_pool.current = &mob_ai_pool.search[i];
+		mob_ai_sub_hard_think(mob_ai_pool.current->md, tick);
+	}
+	mob_ai_pool.current = NULL;
+	map_freeblock_unlock();
+}
+
+static void mob_ai_pool_init(void)
+{
+	int i;
+
+	memset(&mob_ai_pool, 0, sizeof(mob_ai_pool));
+	if( battle_config.mob_ai_threads <= 0 )
+		return;
+
+	mob_ai_pool.mutex = ramutex_create();
+	mob_ai_pool.work_cond = racond_create();
+	mob_ai_pool.done_cond = racond_create();
+	CREATE(mob_ai_pool.threads, rAthread, battle_config.mob_ai_threads);
+	for( i = 0; i < battle_config.mob_ai_threads; i++ )
+	{
+		if( (mob_ai_pool.threads[i] = rathread_create(mob_ai_worker_main, NULL)) == NULL )
+		{
+			ShowError("mob_ai_pool_init: Couldn't create monster AI thread %d, using %d thread(s).\n", i+1, i);
+			break;
+		}
+		mob_ai_pool.thread_count++;
+	}
+}
+
+static void mob_ai_pool_final(void)
+{
+	int i;
+
+	if( mob_ai_pool.thread_count )
+	{
+		ramutex_lock(mob_ai_pool.mutex);
+		mob_ai_pool.terminate = 1;
+		racond_broadcast(mob_ai_pool.work_cond);
+		ramutex_unlock(mob_ai_pool.mutex);
+		for( i = 0; i < mob_ai_pool.thread_count; i++ )
+			rathread_wait(mob_ai_pool.threads[i], NULL);
+	}
+	if( mob_ai_pool.threads ) aFree(mob_ai_pool.threads);
+	if( mob_ai_pool.done_cond ) racond_destroy(mob_ai_pool.done_cond);
+	if( mob_ai_pool.work_cond ) racond_destroy(mob_ai_pool.work_cond);
+	if( mob_ai_pool.mutex ) ramutex_destroy(mob_ai_pool.mutex);
+	if( mob_ai_pool.search ) aFree(mob_ai_pool.search);
+	memset(&mob_ai_pool, 0, sizeof(mob_ai_pool));
+}
+
 /*==========================================
  * Serious processing for mob in PC field of view   (interval timer function)
  *------------------------------------------*/
@@ -2097,6 +2365,8 @@ static int mob_ai_hard(int tid, unsigned int tick, int id, intptr_t data)
 
 	if (battle_config.mob_ai&0x20)
 		map_foreachmob(mob_ai_sub_lazy,tick);
+	else if (battle_config.mob_ai_threads && mob_ai_pool.thread_count)
+		mob_ai_hard_threaded(tick);
 	else
 		map_foreachpc(mob_ai_sub_foreachclient,tick);
 
@@ -5591,6 +5861,7 @@ void do_init_mob(void){
 	mob_skill_db = idb_alloc(DB_OPT_BASE);
 	mob_summon_db = idb_alloc(DB_OPT_BASE);
 	mob_load();
+	mob_ai_pool_init();
 
 	add_timer_func_list(mob_delayspawn,"mob_delayspawn");
 	add_timer_func_list(mob_delay_item_drop,"mob_delay_item_drop");
@@ -5635,4 +5906,5 @@ void do_final_mob(void){
 	mob_summon_db->destroy(mob_summon_db, mob_summon_db_free);
 	ers_destroy(item_drop_ers);
 	ers_destroy(item_drop_list_ers);
+	mob_ai_pool_final();
 }
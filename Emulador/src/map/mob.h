@@ -237,6 +237,7 @@ struct mob_data {
 	} option;
 
 	unsigned int next_walktime,last_thinktime,last_linktime,last_pcneartime,dmgtick;
+	int ai_round; // last round of the threaded hard AI that collected this mob
 	short move_fail_count;
 	short lootitem_count;
 	short min_chase;
@@ -75,13 +75,24 @@ int npc_get_new_npc_id(void) {
 }
 
 static DBMap* ev_db; // const char* event_name -> struct event_data*
+static DBMap* ev_label_db; // const char* label -> struct event_label_data*
 static DBMap* npcname_db; // const char* npc_name -> struct npc_data*
 
 struct event_data {
 	struct npc_data *nd;
 	int pos;
+	char name[EVENT_NAME_LENGTH]; // "npcname::label", same as the key in ev_db
+	struct event_label_data *label; // events sharing this label
+	struct event_data *label_prev, *label_next;
 };
 
+/// Events of all npcs that share the same label, in load order.
+struct event_label_data {
+	struct event_data *first, *last;
+};
+
+static unsigned int ev_removed = 0; // bumped each time an event is removed from ev_db
+
 static struct eri *timer_event_ers; //For the npc timer data. [Skotlex]
 
 /* hello */
@@ -326,6 +337,58 @@ int npc_event_dequeue(struct map_session_data* sd)
 	return 1;
 }
 
+/// Links the event to the list of events with the same label.
+static void npc_event_label_add(struct event_data* ev, const char* label)
+{
+	struct event_label_data* eld = (struct event_label_data*)strdb_get(ev_label_db, label);
+
+	if( eld == NULL )
+	{
+		CREATE(eld, struct event_label_data, 1);
+		strdb_put(ev_label_db, label, eld);
+	}
+	ev->label = eld;
+	ev->label_prev = eld->last;
+	ev->label_next = NULL;
+	if( eld->last )
+		eld->last->label_next = ev;
+	else
+		eld->first = ev;
+	eld->last = ev;
+}
+
+/// Unlinks the event from its label list, must be called before it's removed from ev_db.
+static void npc_event_label_remove(struct event_data* ev)
+{
+	struct event_label_data* eld = ev->label;
+
+	if( eld == NULL )
+		return;
+	if( ev->label_prev )
+		ev->label_prev->label_next = ev->label_next;
+	else
+		eld->first = ev->label_next;
+	if( ev->label_next )
+		ev->label_next->label_prev = ev->label_prev;
+	else
+		eld->last = ev->label_prev;
+	ev->label = NULL;
+	ev->label_prev = ev->label_next = NULL;
+	ev_removed++;
+}
+
+/// Returns true if the event is still linked to the label.
+static bool npc_event_label_exists(const char* label, struct event_data* ev)
+{
+	struct event_label_data* eld = (struct event_label_data*)strdb_get(ev_label_db, label);
+	struct event_data* it;
+
+	for( it = eld ? eld->first : NULL; it != NULL; it = it->label_next )
+		if( it == ev )
+			return true;
+	return false;
+}
+
 /*==========================================
  * exports a npc event label
  * called from npc_parse_script
@@ -338,10 +401,14 @@ static int npc_event_export(struct npc_data *nd, int i)
 		struct event_data *ev;
 		char buf[EVENT_NAME_LENGTH];
 		snprintf(buf, ARRAYLENGTH(buf), "%s::%s", nd->exname, lname);
+		if( (ev = (struct event_data*)strdb_get(ev_db, buf)) != NULL )
+			npc_event_label_remove(ev); // released by strdb_put below
 		// generate the data and insert it
 		CREATE(ev, struct event_data, 1);
 		ev->nd = nd;
 		ev->pos = pos;
+		safestrncpy(ev->name, buf, sizeof(ev->name));
+		npc_event_label_add(ev, lname);
 		if (strdb_put(ev_db, buf, ev)) // There was already another event of the same name?
 			return 1;
 	}
@@ -351,69 +418,59 @@ static int npc_event_export(struct npc_data *nd, int i)
 int npc_event_sub(struct map_session_data* sd, struct event_data* ev, const char* eventname); //[Lance]
 
 /**
- * Exec name (NPC events) on player or global
- * Do on all NPC when called with foreach
- * @see DBApply
+ * Runs the events with the given label.
+ * @param label : bare event label, "OnInit"
+ * @param name : full event name "npcname::label" to run a single npc, NULL for all of them
+ * @param rid : character attached to the scripts, 0 for none
+ * @return number of events executed
  */
-int npc_event_doall_sub(DBKey key, DBData *data, va_list ap)
+static int npc_event_dolabel(const char* label, const char* name, int rid)
 {
-	const char* p = key.str;
-	struct event_data* ev;
-	int* c;
-	const char* name;
-	int rid;
+	struct event_label_data* eld = (struct event_label_data*)strdb_get(ev_label_db, label);
+	struct event_data *ev, **list;
+	unsigned int removed = ev_removed;
+	int i, count = 0, c = 0;
 
-	nullpo_ret(ev = (struct event_data*)db_data2ptr(data));
-	nullpo_ret(c = va_arg(ap, int *));
-	nullpo_ret(name = va_arg(ap, const char *));
-	rid = va_arg(ap, int);
-
-	p = strchr(p, ':'); // match only the event name
-	if( p && strcmpi(name, p) == 0 /* && !ev->nd->src_id */ ) // Do not run on duplicates. [Paradox924X]
-	{
-		if(rid) // a player may only have 1 script running at the same time
-			npc_event_sub(map_id2sd(rid),ev,key.str);
-		else
-			run_script(ev->nd->u.scr.script,ev->pos,rid,ev->nd->bl.id);
-		(*c)++;
-	}
-
-	return 0;
-}
+	if( eld == NULL )
+		return 0;
 
-/**
- * @see DBApply
- */
-static int npc_event_do_sub(DBKey key, DBData *data, va_list ap)
-{
-	const char* p = key.str;
-	struct event_data* ev;
-	int* c, rid;
-	const char* name;
+	for( ev = eld->first; ev != NULL; ev = ev->label_next )
+		count++;
+	if( count == 0 )
+		return 0;
 
-	nullpo_ret(ev = (struct event_data*)db_data2ptr(data));
-	nullpo_ret(c = va_arg(ap, int *));
-	nullpo_ret(name = va_arg(ap, const char *));
-	rid = va_arg(ap, int);
+	// The scripts may load or unload npcs, work on a copy of the list.
+	CREATE(list, struct event_data*, count);
+	for( i = 0, ev = eld->first; ev != NULL; ev = ev->label_next )
+		list[i++] = ev;
 
-	if( p && strcmpi(name, p) == 0 )
+	for( i = 0; i < count; i++ )
 	{
-		run_script(ev->nd->u.scr.script,ev->pos,rid,ev->nd->bl.id);
-		(*c)++;
+		ev = list[i];
+		if( removed != ev_removed && !npc_event_label_exists(label, ev) )
+			continue; // unloaded by a previous script
+		if( name && strcmpi(name, ev->name) != 0 )
+			continue;
+
+		if( rid && !name ) // a player may only have 1 script running at the same time
+			npc_event_sub(map_id2sd(rid),ev,ev->name);
+		else
+			run_script(ev->nd->u.scr.script,ev->pos,rid,ev->nd->bl.id);
+		c++;
 	}
 
-	return 0;
+	aFree(list);
+	return c;
 }
 
 int npc_event_do_id(const char* name, int rid) {
-	int c = 0;
+	const char* label;
 
 	if( name[0] == ':' && name[1] == ':' )
-		ev_db->foreach(ev_db,npc_event_doall_sub,&c,name,0,rid);
-	else
-		ev_db->foreach(ev_db,npc_event_do_sub,&c,name,rid);
-
-	return c;
+		return npc_event_dolabel(name+2, NULL, 0);
+	if( (label = strstr(name, "::")) == NULL )
+		return 0;
+	return npc_event_dolabel(label+2, name, rid);
 }
 
 // runs the specified event (supports both single-npc and global events)
@@ -430,11 +487,7 @@ int npc_event_doall(const char* name)
 // runs the specified event, with a RID attached (global only)
 int npc_event_doall_id(const char* name, int rid)
 {
-	int c = 0;
-	char buf[64];
-	safesnprintf(buf, sizeof(buf), "::%s", name);
-	ev_db->foreach(ev_db,npc_event_doall_sub,&c,buf,rid);
-	return c;
+	return npc_event_dolabel(name, NULL, rid);
 }
 
 /*==========================================
@@ -2028,6 +2081,7 @@ static int npc_unload_ev(DBKey key, DBData *data, va_list ap)
 	char* npcname = va_arg(ap, char *);
 
 	if(strcmp(ev->nd->exname,npcname)==0){
+		npc_event_label_remove(ev);
 		db_remove(ev_db, key);
 		return 1;
 	}
@@ -2378,7 +2432,7 @@ struct npc_data* npc_add_warp(char* name, short from_mapid, short from_x, short
 	CREATE(nd, struct npc_data, 1);
 	nd->bl.id = npc_get_new_npc_id();
 	map_addnpc(from_mapid, nd);
-	nd->bl.prev = nd->bl.next = NULL;
+	nd->bl.prev = NULL;
 	nd->bl.m = from_mapid;
 	nd->bl.x = from_x;
 	nd->bl.y = from_y;
@@ -2465,7 +2519,7 @@ static const char* npc_parse_warp(char* w1, char* w2, char* w3, char* w4, const
 
 	nd->bl.id = npc_get_new_npc_id();
 	map_addnpc(m, nd);
-	nd->bl.prev = nd->bl.next = NULL;
+	nd->bl.prev = NULL;
 	nd->bl.m = m;
 	nd->bl.x = x;
 	nd->bl.y = y;
@@ -2702,7 +2756,7 @@ static const char* npc_parse_shop(char* w1, char* w2, char* w3, char* w4, const
 		nd->u.shop.discount = is_discount;
 	}
 
-	nd->bl.prev = nd->bl.next = NULL;
+	nd->bl.prev = NULL;
 	nd->bl.m = m;
 	nd->bl.x = x;
 	nd->bl.y = y;
@@ -2735,6 +2789,7 @@ static const char* npc_parse_shop(char* w1, char* w2, char* w3, char* w4, const
 			clif_spawn(&nd->bl);
 	} else
 	{// 'floating' shop?
+		status_change_init(&nd->bl);
 		map_addiddb(&nd->bl);
 	}
 	strdb_put(npcname_db, nd->exname, nd);
@@ -2942,7 +2997,7 @@ static const char* npc_parse_script(char* w1, char* w2, char* w3, char* w4, cons
 		nd->u.scr.ys = -1;
 	}
 
-	nd->bl.prev = nd->bl.next = NULL;
+	nd->bl.prev = NULL;
 	nd->bl.m = m;
 	nd->bl.x = x;
 	nd->bl.y = y;
@@ -2977,6 +3032,7 @@ static const char* npc_parse_script(char* w1, char* w2, char* w3, char* w4, cons
 	else
 	{
 		// we skip map_addnpc, but still add it to the list of ID's
+		status_change_init(&nd->bl);
 		map_addiddb(&nd->bl);
 	}
 	strdb_put(npcname_db, nd->exname, nd);
@@ -3076,7 +3132,7 @@ const char* npc_parse_duplicate(char* w1, char* w2, char* w3, char* w4, const ch
 
 	CREATE(nd, struct npc_data, 1);
 
-	nd->bl.prev = nd->bl.next = NULL;
+	nd->bl.prev = NULL;
 	nd->bl.m = m;
 	nd->bl.x = x;
 	nd->bl.y = y;
@@ -3137,6 +3193,7 @@ const char* npc_parse_duplicate(char* w1, char* w2, char* w3, char* w4, const ch
 		}
 	} else {
 		// we skip map_addnpc, but still add it to the list of ID's
+		status_change_init(&nd->bl);
 		map_addiddb(&nd->bl);
 	}
 	strdb_put(npcname_db, nd->exname, nd);
@@ -3254,7 +3311,7 @@ int npc_duplicate4instance(struct npc_data *snd, int16 m) {
 		CREATE(wnd, struct npc_data, 1);
 		wnd->bl.id = npc_get_new_npc_id();
 		map_addnpc(m, wnd);
-		wnd->bl.prev = wnd->bl.next = NULL;
+		wnd->bl.prev = NULL;
 		wnd->bl.m = m;
 		wnd->bl.x = snd->bl.x;
 		wnd->bl.y = snd->bl.y;
@@ -3694,6 +3751,8 @@ static const char* npc_parse_function(char* w1, char* w2, char* w3, char* w4, co
 		ShowInfo("npc_parse_function: Overwriting user function [%s] (%s:%d)\n", w3, filepath, strline(buffer,start-buffer));
 		script_free_vars(oldscript->local.vars);
 		aFree(oldscript->script_buf);
+		if( oldscript->insn )
+			aFree(oldscript->insn);
 		aFree(oldscript);
 	}
 
@@ -4560,19 +4619,12 @@ void npc_read_event_script(void)
 
 	for (i = 0; i < NPCE_MAX; i++)
 	{
-		DBIterator* iter;
-		DBKey key;
-		DBData *data;
-
-		char name[64]="::";
-		safestrncpy(name+2,config[i].event_name,62);
+		struct event_label_data* eld = (struct event_label_data*)strdb_get(ev_label_db, config[i].event_name);
+		struct event_data* ed;
 
 		script_event[i].event_count = 0;
-		iter = db_iterator(ev_db);
-		for( data = iter->first(iter,&key); iter->exists(iter); data = iter->next(iter,&key) )
+		for( ed = eld ? eld->first : NULL; ed != NULL; ed = ed->label_next )
 		{
-			const char* p = key.str;
-			struct event_data* ed = (struct event_data*)db_data2ptr(data);
 			unsigned char count = script_event[i].event_count;
 
 			if( count >= ARRAYLENGTH(script_event[i].event) )
@@ -4581,14 +4633,10 @@ void npc_read_event_script(void)
 				break;
 			}
 
-			if( (p=strchr(p,':')) && p && strcmpi(name,p)==0 )
-			{
-				script_event[i].event[count] = ed;
-				script_event[i].event_name[count] = key.str;
-				script_event[i].event_count++;
-			}
+			script_event[i].event[count] = ed;
+			script_event[i].event_name[count] = ed->name;
+			script_event[i].event_count++;
 		}
-		dbi_destroy(iter);
 	}
 
 	if (battle_config.etc_log) {
@@ -4627,6 +4675,8 @@ int npc_reload(void) {
 
 	db_clear(npcname_db);
 	db_clear(ev_db);
+	db_clear(ev_label_db);
+	ev_removed++;
 
 	//Remove all npcs/mobs. [Skotlex]
 
@@ -4682,10 +4732,12 @@ int npc_reload(void) {
 
 	//TODO: the following code is copy-pasted from do_init_npc(); clean it up
 	// Reloading npcs now
+	script_cache_begin();
 	for (nsl = npc_src_files; nsl; nsl = nsl->next) {
 		ShowStatus("Loading NPC file: %s"CL_CLL"\r", nsl->name);
 		npc_parsesrcfile(nsl->name,false);
 	}
+	script_cache_end(false); // item scripts weren't reloaded
 	ShowInfo ("Done loading '"CL_WHITE"%d"CL_RESET"' NPCs:"CL_CLL"\n"
 		"\t-'"CL_WHITE"%d"CL_RESET"' Warps\n"
 		"\t-'"CL_WHITE"%d"CL_RESET"' Shops\n"
@@ -4745,6 +4797,8 @@ bool npc_unloadfile( const char* path ) {
 void do_clear_npc(void) {
 	db_clear(npcname_db);
 	db_clear(ev_db);
+	db_clear(ev_label_db);
+	ev_removed++;
 }
 
 /*==========================================
@@ -4753,6 +4807,7 @@ void do_clear_npc(void) {
 void do_final_npc(void) {
 	npc_clear_pathlist();
 	ev_db->destroy(ev_db, NULL);
+	ev_label_db->destroy(ev_label_db, NULL);
 	npcname_db->destroy(npcname_db, NULL);
 	npc_path_db->destroy(npc_path_db, NULL);
 #if PACKETVER >= 20131223
@@ -4812,6 +4867,7 @@ void do_init_npc(void){
 		npc_viewdb2[i - MAX_NPC_CLASS2_START].class_ = i;
 
 	ev_db = strdb_alloc((DBOptions)(DB_OPT_DUP_KEY|DB_OPT_RELEASE_DATA),2*NAME_LENGTH+2+1);
+	ev_label_db = stridb_alloc((DBOptions)(DB_OPT_DUP_KEY|DB_OPT_RELEASE_DATA),NAME_LENGTH);
 	npcname_db = strdb_alloc(DB_OPT_BASE,NAME_LENGTH);
 	npc_path_db = strdb_alloc(DB_OPT_BASE|DB_OPT_DUP_KEY|DB_OPT_RELEASE_DATA,80);
 #if PACKETVER >= 20131223
@@ -4866,6 +4922,7 @@ void do_init_npc(void){
 
 	strdb_put(npcname_db, fake_nd->exname, fake_nd);
 	fake_nd->u.scr.timerid = INVALID_TIMER;
+	status_change_init(&fake_nd->bl);
 	map_addiddb(&fake_nd->bl);
 	// End of initialization
 }
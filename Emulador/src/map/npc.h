@@ -124,6 +124,7 @@ enum actor_classes
 
 #ifdef PCRE_SUPPORT
 void npc_chat_finalize(struct npc_data* nd);
+bool npc_chat_test(struct npc_data* nd, const char* msg, bool use_filter);
 #endif
 
 //Script NPC events.
@@ -13,6 +13,14 @@
 
 #include "../../3rdparty/pcre/include/pcre.h"
 
+#ifdef PCRE_STUDY_JIT_COMPILE
+	#define NPC_CHAT_STUDY PCRE_STUDY_JIT_COMPILE // uses the JIT when pcre was built with it
+	#define npc_chat_free_study(extra) pcre_free_study(extra)
+#else
+	#define NPC_CHAT_STUDY 0
+	#define npc_chat_free_study(extra) pcre_free(extra)
+#endif
+
 
 /**
  *  Written by MouseJstr in a vision... (2/21/2005)
@@ -68,6 +76,7 @@ struct pcrematch_entry {
 	pcre* pcre_;
 	pcre_extra* pcre_extra_;
 	char* label;
+	int label_pos; // position of the label in the script, -1 until it is found
 };
 
 /* A set of patterns that can be activated and deactived with a single command */
@@ -90,6 +99,11 @@ struct pcrematch_set {
 struct npc_parse {
 	struct pcrematch_set* active;
 	struct pcrematch_set* inactive;
+	// All the active patterns in one alternation, a message that doesn't
+	// match it doesn't match any of them (see npc_chat_build_filter)
+	pcre* filter_;
+	pcre_extra* filter_extra_;
+	bool filter_dirty; // the active patterns changed since the filter was built
 };
 
 
@@ -101,11 +115,119 @@ struct npc_parse {
 void finalize_pcrematch_entry(struct pcrematch_entry* e)
 {
 	pcre_free(e->pcre_);
-	pcre_free(e->pcre_extra_);
+	npc_chat_free_study(e->pcre_extra_);
 	aFree(e->pattern);
 	aFree(e->label);
 }
 
+/**
+ * drop the filter of a NPC, it is built again on the next message
+ */
+static void npc_chat_invalidate_filter(struct npc_parse* npcParse)
+{
+	if (npcParse->filter_ != NULL)
+		pcre_free(npcParse->filter_);
+	npc_chat_free_study(npcParse->filter_extra_);
+	npcParse->filter_ = NULL;
+	npcParse->filter_extra_ = NULL;
+	npcParse->filter_dirty = true;
+}
+
+/**
+ * whether a pattern calls or tests a group by number, the numbers change in the filter
+ */
+static bool npc_chat_has_subroutine(const char* pattern)
+{
+	const char* p;
+
+	for (p = strstr(pattern, "(?"); p != NULL; p = strstr(p + 2, "(?")) {
+		if (ISDIGIT(p[2]) || p[2] == 'R')
+			return true;
+		if (p[2] == '(' && (ISDIGIT(p[3]) || p[3] == '+' || p[3] == '-' || p[3] == 'R')) // (?(1)yes|no)
+			return true;
+	}
+	return (strstr(pattern, "\\g<") != NULL || strstr(pattern, "\\g'") != NULL);
+}
+
+/**
+ * Compile the active patterns of a NPC into a single alternation.
+ *
+ * The filter only tells whether one of the patterns matches, the patterns
+ * still run in order to find the first one. Each pattern is wrapped in a
+ * capturing group, so a pattern that doesn't stay inside its group (like
+ * an unterminated \Q) shows up as a wrong group count and no filter is used.
+ * Patterns with backreferences, numbered subroutine calls or numbered
+ * conditions aren't combined.
+ * The filter is only kept when pcre JIT-compiled it, the interpreter is
+ * slower on the alternation than on the patterns one by one.
+ */
+static void npc_chat_build_filter(struct npc_parse* npcParse)
+{
+	struct pcrematch_set* pcreset;
+	struct pcrematch_entry* e;
+	StringBuf buf;
+	int count = 0, groups = 0, filter_groups = -1;
+	const char* err;
+	int erroff;
+
+	npcParse->filter_dirty = false;
+
+	StringBuf_Init(&buf);
+	for (pcreset = npcParse->active; pcreset != NULL; pcreset = pcreset->next) {
+		for (e = pcreset->head; e != NULL; e = e->next) {
+			int backrefs = 0, captures = 0;
+
+			pcre_fullinfo(e->pcre_, NULL, PCRE_INFO_BACKREFMAX, &backrefs);
+			pcre_fullinfo(e->pcre_, NULL, PCRE_INFO_CAPTURECOUNT, &captures);
+			if (backrefs > 0 || npc_chat_has_subroutine(e->pattern)) {
+				StringBuf_Destroy(&buf);
+				return;
+			}
+			StringBuf_Printf(&buf, "%s(%s)", count ? "|" : "", e->pattern);
+			groups += captures + 1;
+			count++;
+		}
+	}
+
+	if (count > 1) { // a single pattern is its own filter
+		npcParse->filter_ = pcre_compile(StringBuf_Value(&buf), PCRE_CASELESS, &err, &erroff, NULL);
+		if (npcParse->filter_ != NULL)
+			pcre_fullinfo(npcParse->filter_, NULL, PCRE_INFO_CAPTURECOUNT, &filter_groups);
+		if (filter_groups != groups) {
+			if (npcParse->filter_ != NULL)
+				pcre_free(npcParse->filter_);
+			npcParse->filter_ = NULL;
+		} else {
+			int jit = 0;
+
+			npcParse->filter_extra_ = pcre_study(npcParse->filter_, NPC_CHAT_STUDY, &err);
+#ifdef PCRE_INFO_JIT
+			pcre_fullinfo(npcParse->filter_, npcParse->filter_extra_, PCRE_INFO_JIT, &jit);
+#endif
+			if (!jit) {
+				pcre_free(npcParse->filter_);
+				npc_chat_free_study(npcParse->filter_extra_);
+				npcParse->filter_ = NULL;
+				npcParse->filter_extra_ = NULL;
+			}
+		}
+	}
+	StringBuf_Destroy(&buf);
+}
+
+/**
+ * find the position of a label in the script of a NPC
+ * @return position, or -1 if the NPC has no such label
+ */
+static int npc_chat_label_pos(struct npc_data* nd, const char* label)
+{
+	struct npc_label_list* lst = nd->u.scr.label_list;
+	int i;
+
+	ARR_FIND(0, nd->u.scr.label_list_num, i, strncmp(lst[i].name, label, sizeof(lst[i].name)) == 0);
+	return (i < nd->u.scr.label_list_num) ? lst[i].pos : -1;
+}
+
 /**
  * Lookup (and possibly create) a new set of patterns by the set id
  */
@@ -176,6 +298,7 @@ static void activate_pcreset(struct npc_data* nd, int setid)
 	if (pcreset->next != NULL)
 		pcreset->next->prev = pcreset;
 	npcParse->active = pcreset;
+	npc_chat_invalidate_filter(npcParse);
 }
 
 /**
@@ -214,6 +337,7 @@ static void deactivate_pcreset(struct npc_data* nd, int setid)
 	if (pcreset->next != NULL)
 		pcreset->next->prev = pcreset;
 	npcParse->inactive = pcreset;
+	npc_chat_invalidate_filter(npcParse);
 }
 
 /**
@@ -249,9 +373,10 @@ static void delete_pcreset(struct npc_data* nd, int setid)
 	if (pcreset->prev != NULL)
 		pcreset->prev->next = pcreset->next;
 	
-	if(active)
+	if(active) {
 		npcParse->active = pcreset->next;
-	else
+		npc_chat_invalidate_filter(npcParse);
+	} else
 		npcParse->inactive = pcreset->next;
 	
 	pcreset->prev = NULL;
@@ -303,13 +428,23 @@ void npc_chat_def_pattern(struct npc_data* nd, int setid, const char* pattern, c
 {
 	const char *err;
 	int erroff;
+	pcre* re = pcre_compile(pattern, PCRE_CASELESS, &err, &erroff, NULL);
+	struct pcrematch_set * s;
+	struct pcrematch_entry *e;
+	
+	if (re == NULL) {
+		ShowError("npc_chat_def_pattern: Invalid pattern '%s' in NPC '%s': %s at offset %d.\n", pattern, nd->exname, err, erroff);
+		return;
+	}
 	
-	struct pcrematch_set * s = lookup_pcreset(nd, setid);
-	struct pcrematch_entry *e = create_pcrematch_entry(s);
+	s = lookup_pcreset(nd, setid);
+	e = create_pcrematch_entry(s);
 	e->pattern = aStrdup(pattern);
 	e->label = aStrdup(label);
-	e->pcre_ = pcre_compile(pattern, PCRE_CASELESS, &err, &erroff, NULL);
-	e->pcre_extra_ = pcre_study(e->pcre_, 0, &err);
+	e->label_pos = npc_chat_label_pos(nd, label);
+	e->pcre_ = re;
+	e->pcre_extra_ = pcre_study(e->pcre_, NPC_CHAT_STUDY, &err);
+	npc_chat_invalidate_filter((struct npc_parse *) nd->chatdb);
 }
 
 /**
@@ -330,10 +465,59 @@ void npc_chat_finalize(struct npc_data* nd)
 	while(npcParse->inactive)
 		delete_pcreset(nd, npcParse->inactive->setid);
 	
+	npc_chat_invalidate_filter(npcParse);
 	// Additional cleaning up [Lance]
 	aFree(npcParse);
 }
 
+/**
+ * Find the first active pattern of a NPC that matches a message
+ * @param use_filter: whether the combined filter may skip the patterns
+ * @param offsets: receives the offsets of the matched strings
+ * @param r: receives the number of matched strings
+ */
+static struct pcrematch_entry* npc_chat_match(struct npc_parse* npcParse, const char* msg, int len, bool use_filter, int* offsets, int offsets_len, int* r)
+{
+	struct pcrematch_set* pcreset;
+	struct pcrematch_entry* e;
+	
+	if (npcParse->filter_dirty)
+		npc_chat_build_filter(npcParse);
+	
+	// none of the patterns match, don't try them one by one
+	if (use_filter && npcParse->filter_ != NULL && pcre_exec(npcParse->filter_, npcParse->filter_extra_, msg, len, 0, 0, NULL, 0) == PCRE_ERROR_NOMATCH)
+		return NULL;
+	
+	// iterate across all active sets
+	for (pcreset = npcParse->active; pcreset != NULL; pcreset = pcreset->next)
+	{
+		// interate across all patterns in that set
+		for (e = pcreset->head; e != NULL; e = e->next)
+		{
+			// perform pattern match
+			*r = pcre_exec(e->pcre_, e->pcre_extra_, msg, len, 0, 0, offsets, offsets_len);
+			if (*r > 0)
+				return e;
+		}
+	}
+	
+	return NULL;
+}
+
+/**
+ * Whether a message matches one of the active patterns of a NPC, without running the label
+ * @param use_filter: false to try the patterns one by one even when there's a filter
+ */
+bool npc_chat_test(struct npc_data* nd, const char* msg, bool use_filter)
+{
+	struct npc_parse* npcParse = (struct npc_parse *) nd->chatdb;
+	int offsets[2*10 + 10], r;
+	
+	if (npcParse == NULL || npcParse->active == NULL)
+		return false;
+	return (npc_chat_match(npcParse, msg, (int)strlen(msg), use_filter, offsets, ARRAYLENGTH(offsets), &r) != NULL);
+}
+
 /**
  * Handler called whenever a global message is spoken in a NPC's area
  */
@@ -342,10 +526,9 @@ int npc_chat_sub(struct block_list* bl, va_list ap)
 	struct npc_data* nd = (struct npc_data *) bl;
 	struct npc_parse* npcParse = (struct npc_parse *) nd->chatdb;
 	char* msg;
-	int len, i;
+	int len, i, r;
+	int offsets[2*10 + 10]; // 1/3 reserved for temp space requred by pcre_exec
 	struct map_session_data* sd;
-	struct npc_label_list* lst;
-	struct pcrematch_set* pcreset;
 	struct pcrematch_entry* e;
 	
 	// Not interested in anything you might have to say...
@@ -356,42 +539,26 @@ int npc_chat_sub(struct block_list* bl, va_list ap)
 	len = va_arg(ap,int);
 	sd = va_arg(ap,struct map_session_data *);
 	
-	// iterate across all active sets
-	for (pcreset = npcParse->active; pcreset != NULL; pcreset = pcreset->next)
+	if ((e = npc_chat_match(npcParse, msg, len, true, offsets, ARRAYLENGTH(offsets), &r)) == NULL)
+		return 0;
+	
+	// save out the matched strings
+	for (i = 0; i < r; i++)
 	{
-		// interate across all patterns in that set
-		for (e = pcreset->head; e != NULL; e = e->next)
-		{
-			int offsets[2*10 + 10]; // 1/3 reserved for temp space requred by pcre_exec
-			
-			// perform pattern match
-			int r = pcre_exec(e->pcre_, e->pcre_extra_, msg, len, 0, 0, offsets, ARRAYLENGTH(offsets));
-			if (r > 0)
-			{
-				// save out the matched strings
-				for (i = 0; i < r; i++)
-				{
-					char var[6], val[255];
-					snprintf(var, sizeof(var), "$@p%i$", i);
-					pcre_copy_substring(msg, offsets, r, i, val, sizeof(val));
-					set_var(sd, var, val);
-				}
-				
-				// find the target label.. this sucks..
-				lst = nd->u.scr.label_list;
-				ARR_FIND(0, nd->u.scr.label_list_num, i, strncmp(lst[i].name, e->label, sizeof(lst[i].name)) == 0);
-				if (i == nd->u.scr.label_list_num) {
-					ShowWarning("Unable to find label: %s\n", e->label);
-					return 0;
-				}
-				
-				// run the npc script
-				run_script(nd->u.scr.script,lst[i].pos,sd->bl.id,nd->bl.id);
-				return 0;
-			}
-		}
+		char var[6], val[255];
+		snprintf(var, sizeof(var), "$@p%i$", i);
+		pcre_copy_substring(msg, offsets, r, i, val, sizeof(val));
+		set_var(sd, var, val);
+	}
+	
+	// the label is found by defpattern, unless it wasn't there yet
+	if (e->label_pos < 0 && (e->label_pos = npc_chat_label_pos(nd, e->label)) < 0) {
+		ShowWarning("Unable to find label: %s\n", e->label);
+		return 0;
 	}
 	
+	// run the npc script
+	run_script(nd->u.scr.script,e->label_pos,sd->bl.id,nd->bl.id);
 	return 0;
 }
 
@@ -30,6 +30,12 @@ static unsigned long party_booking_nextid = 1;
 int party_send_xy_timer(int tid, unsigned int tick, int id, intptr_t data);
 int party_create_byscript;
 
+/// Party members waiting for party_send_xy_timer (block ids)
+static struct {
+	int* ids;
+	int count, max;
+} party_xy_queue;
+
 /*==========================================
  * Fills the given party_member structure according to the sd provided.
  * Used when creating/adding people to a party. [Skotlex]
@@ -103,6 +109,9 @@ void do_final_party(void)
 {
 	party_db->destroy(party_db,NULL);
 	party_booking_db->destroy(party_booking_db,NULL); // Party Booking [Spiria]
+	if( party_xy_queue.ids )
+		aFree(party_xy_queue.ids);
+	memset(&party_xy_queue, 0, sizeof(party_xy_queue));
 }
 // Constructor, init vars
 void do_init_party(void)
@@ -322,6 +331,8 @@ int party_recv_info(struct party* sp, uint32 char_id)
 		if ( member->char_id == 0 )
 			continue;// empty
 		p->data[member_id].sd = party_sd_check(sp->party_id, member->account_id, member->char_id);
+		if( p->data[member_id].sd )
+			party_send_xy_dirty(p->data[member_id].sd); // the cached x/y/hp were cleared
 	}
 
 	party_check_state(p);
@@ -469,6 +480,7 @@ void party_member_joined(struct map_session_data *sd)
 
 	if (i < MAX_PARTY) {
 		p->data[i].sd = sd;
+		party_send_xy_dirty(sd);
 
 		if( p->instance_id )
 			instance_reqinfo(sd,p->instance_id);
@@ -831,6 +843,8 @@ int party_recv_movemap(int party_id,uint32 account_id,uint32 char_id, unsigned s
 	m->lv = lv;
 	//Check if they still exist on this map server
 	p->data[i].sd = party_sd_check(party_id, account_id, char_id);
+	if( p->data[i].sd )
+		party_send_xy_dirty(p->data[i].sd);
 
 	clif_party_info(p,NULL);
 
@@ -973,39 +987,56 @@ int party_skill_check(struct map_session_data *sd, int party_id, uint16 skill_id
 	return 0;
 }
 
-int party_send_xy_timer(int tid, unsigned int tick, int id, intptr_t data)
+/**
+ * Queue a party member for the next party_send_xy_timer.
+ * Called when the member moves, changes map or (party_hp_mode 1) changes hp,
+ * so the timer doesn't have to look at every party.
+ * @param sd Player
+ */
+void party_send_xy_dirty(struct map_session_data *sd)
 {
-	struct party_data* p;
+	nullpo_retv(sd);
 
-	DBIterator *iter = db_iterator(party_db);
+	if( sd->state.party_xy_dirty || !sd->status.party_id )
+		return;
 
-	// for each existing party
-	for( p = (struct party_data*)dbi_first(iter); dbi_exists(iter); p = (struct party_data*)dbi_next(iter) ) {
+	if( party_xy_queue.count == party_xy_queue.max ) {
+		party_xy_queue.max = max(64, party_xy_queue.max*2);
+		RECREATE(party_xy_queue.ids, int, party_xy_queue.max);
+	}
+	party_xy_queue.ids[party_xy_queue.count++] = sd->bl.id;
+	sd->state.party_xy_dirty = 1;
+}
+
+int party_send_xy_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	int j;
+
+	// for each member that moved or changed hp since the last run
+	for( j = 0; j < party_xy_queue.count; j++ ) {
+		struct map_session_data* sd = map_id2sd(party_xy_queue.ids[j]);
+		struct party_data* p;
 		int i;
 
-		if( !p->party.count ) // no online party members so do not iterate
+		if( !sd || !sd->state.party_xy_dirty )
 			continue;
+		sd->state.party_xy_dirty = 0;
 
-		// for each member of this party
-		for( i = 0; i < MAX_PARTY; i++ ) {
-			struct map_session_data* sd = p->data[i].sd;
-
-			if( !sd )
-				continue;
+		if( (p = party_search(sd->status.party_id)) == NULL || (i = party_getmemberid(p, sd)) < 0 || p->data[i].sd != sd )
+			continue;
 
-			if( p->data[i].x != sd->bl.x || p->data[i].y != sd->bl.y ) { // perform position update
-				clif_party_xy(sd);
-				p->data[i].x = sd->bl.x;
-				p->data[i].y = sd->bl.y;
-			}
+		if( p->data[i].x != sd->bl.x || p->data[i].y != sd->bl.y ) { // perform position update
+			clif_party_xy(sd);
+			p->data[i].x = sd->bl.x;
+			p->data[i].y = sd->bl.y;
+		}
 
-			if (battle_config.party_hp_mode && p->data[i].hp != sd->battle_status.hp) { // perform hp update
-				clif_party_hp(sd);
-				p->data[i].hp = sd->battle_status.hp;
-			}
+		if (battle_config.party_hp_mode && p->data[i].hp != sd->battle_status.hp) { // perform hp update
+			clif_party_hp(sd);
+			p->data[i].hp = sd->battle_status.hp;
 		}
 	}
-	dbi_destroy(iter);
+	party_xy_queue.count = 0;
 
 	return 0;
 }
@@ -1023,6 +1054,7 @@ int party_send_xy_clear(struct party_data *p)
 		p->data[i].hp = 0;
 		p->data[i].x = 0;
 		p->data[i].y = 0;
+		party_send_xy_dirty(p->data[i].sd);
 	}
 	return 0;
 }
@@ -1197,6 +1197,8 @@ void pc_setnewpc(struct map_session_data *sd, uint32 account_id, uint32 char_id,
 	sd->canlog_tick = sd->canescape_tick = gettick();
 	//Required to prevent homunculus copuing a base speed of 0.
 	sd->battle_status.speed = sd->base_status.speed = DEFAULT_WALK_SPEED;
+	//Status changes stay readable until pc_authok initializes them.
+	sd->sc.data = status_sc_nodata;
 }
 
 /**
@@ -1797,6 +1799,8 @@ bool pc_authok(struct map_session_data *sd, uint32 login_id2, time_t expiration_
 	sd->regs.vars = i64db_alloc(DB_OPT_BASE);
 	sd->regs.arrays = NULL;
 	sd->vars_dirty = false;
+	sd->vars_dirty_list = NULL;
+	sd->vars_dirty_count = sd->vars_dirty_max = 0;
 	sd->vars_ok = false;
 	sd->vars_received = 0x0;
 
@@ -10512,6 +10516,21 @@ char* pc_readregistry_str(struct map_session_data *sd, int64 reg)
 	return p ? p->value : NULL;
 }
 
+/**
+ * Remember a registry that has to be sent with the next intif_saveregistry,
+ * so saving doesn't have to look through all the variables of the player.
+ * @param sd Player
+ * @param reg Registry key, added once until it is saved (flag.update)
+ */
+static void pc_setregistry_dirty(struct map_session_data *sd, int64 reg)
+{
+	if( sd->vars_dirty_count == sd->vars_dirty_max ) {
+		sd->vars_dirty_max = max(32, sd->vars_dirty_max*2);
+		RECREATE(sd->vars_dirty_list, int64, sd->vars_dirty_max);
+	}
+	sd->vars_dirty_list[sd->vars_dirty_count++] = reg;
+}
+
 /**
  * Serves the following variable types:
  * - 'type' (permanent numeric char reg)
@@ -10569,8 +10588,11 @@ int pc_setregistry(struct map_session_data *sd, int64 reg, int val)
 			if( index )
 				script_array_update(&sd->regs, reg, true);
 		}
-		if (!reg_load)
+		if (!reg_load) {
+			if (!p->flag.update)
+				pc_setregistry_dirty(sd, reg);
 			p->flag.update = 1;/* either way, it will require either delete or replace */
+		}
 	} else if( val ) {
 		DBData prev;
 
@@ -10580,8 +10602,10 @@ int pc_setregistry(struct map_session_data *sd, int64 reg, int val)
 		p = ers_alloc(num_reg_ers, struct script_reg_num);
 
 		p->value = val;
-		if (!reg_load)
+		if (!reg_load) {
 			p->flag.update = 1;
+			pc_setregistry_dirty(sd, reg);
+		}
 
 		if (sd->regs.vars->put(sd->regs.vars, db_i642key(reg), db_ptr2data(p), &prev)) {
 			p = (struct script_reg_num *)db_data2ptr(&prev);
@@ -10624,8 +10648,11 @@ int pc_setregistry_str(struct map_session_data *sd, int64 reg, const char *val)
 			if( index )
 				script_array_update(&sd->regs, reg, true);
 		}
-		if( !reg_load )
+		if( !reg_load ) {
+			if( !p->flag.update )
+				pc_setregistry_dirty(sd, reg);
 			p->flag.update = 1; // either way, it will require either delete or replace
+		}
 	} else if( val[0] ) {
 		DBData prev;
 
@@ -10635,8 +10662,10 @@ int pc_setregistry_str(struct map_session_data *sd, int64 reg, const char *val)
 		p = ers_alloc(str_reg_ers, struct script_reg_str);
 
 		p->value = aStrdup(val);
-		if( !reg_load )
+		if( !reg_load ) {
 			p->flag.update = 1;
+			pc_setregistry_dirty(sd, reg);
+		}
 		p->flag.type = 1;
 
 		if( sd->regs.vars->put(sd->regs.vars, db_i642key(reg), db_ptr2data(p), &prev) ) {
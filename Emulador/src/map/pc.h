@@ -265,7 +265,11 @@ struct map_session_data {
 		unsigned int evade_antiwpefilter : 1; // Required sometimes to show the user previous to use the skill
 		unsigned int bg_afk : 1; // Moved here to reduce searchs
 		unsigned int bg_listen : 1;
+		unsigned int calc_scripts : 1; // status_calc_pc_ is running the bonus scripts
+		unsigned int sc_scripts : 1; // bonus scripts read status changes (getstatus), they must run again when one changes
+		unsigned int party_xy_dirty : 1; // queued for party_send_xy_timer
 	} state;
+	unsigned int status_calc_full, status_calc_partial; // status recalculations, with and without status_calc_pc_ (@stats)
 	struct {
 		unsigned char no_weapon_damage, no_magic_damage, no_misc_damage;
 		unsigned int restart_full_recover : 1;
@@ -640,6 +644,8 @@ struct map_session_data {
 	int achievement_count;
 	int achievement_cutin_timer;
 	bool save_achievement;
+	unsigned int* achievement_done; // bitmap of completed achievements, by achievement_data.index
+	unsigned int achievement_done_gen; // achievement database load this bitmap was built for
 
 	// Graveyard System
 	int graveyard_npc_id;
@@ -713,6 +719,8 @@ struct map_session_data {
 	unsigned char vars_received; // char loading is only complete when you get it all.
 	bool vars_ok;
 	bool vars_dirty;
+	int64* vars_dirty_list; // keys of the registries waiting for intif_saveregistry
+	int vars_dirty_count, vars_dirty_max;
 
 	// temporary debugging of bug #3504
 	const char* delunit_prevfile;
@@ -174,6 +174,73 @@ static int parse_options = 0;
 DBMap* script_get_label_db(void) { return scriptlabel_db; }
 DBMap* script_get_userfunc_db(void) { return userfunc_db; }
 
+/*==========================================
+ * Compiled script cache
+ *
+ * The code compiled by parse_script while the server loads is saved to
+ * script_cache_file, keyed by a hash of the script source. On the next load
+ * a script whose source didn't change is taken from there instead of being
+ * parsed again, as long as the names it uses (constants, parameters, script
+ * commands and user functions) still mean the same thing.
+ *------------------------------------------*/
+
+#define SCRIPT_CACHE_MAGIC "RASC"
+#define SCRIPT_CACHE_VERSION 1
+#define SCRIPT_CACHE_MAX_NAME 255
+
+static char script_cache_file[256] = "db/script_cache.dat";
+static const char script_cache_build[32] = __DATE__ " " __TIME__; // the cache is thrown away when the server is rebuilt
+
+/// Compiled script in the cache.
+/// Layout of data:
+///   uint32 options, uint32 parse time in microseconds, uint32 code size,
+///   uint32 name count, uint32 relocation count, uint32 label count,
+///   code, names (uint16 length, name, int32 type, int32 val, uint8 user function),
+///   relocations (uint32 position of a C_NAME value, uint32 name),
+///   labels (uint32 name, uint32 position)
+struct script_cache_entry {
+	unsigned char* data;
+	uint32 len;
+	bool used; // saved again by script_cache_end
+	bool owned; // data was allocated for this entry, not loaded with the file
+};
+
+/// Name used by the script being parsed, the type and value are the ones from before the parse
+struct script_cache_name {
+	int id;
+	int type;
+	int val;
+	bool userfunc;
+};
+
+static struct {
+	bool active; // between script_cache_begin and script_cache_end
+	unsigned char* file; // loaded cache file
+	DBMap* entries; // uint64 key -> struct script_cache_entry*
+
+	// parse in progress
+	bool recording;
+	bool nocache; // warnings were shown, don't cache it so they show again
+	unsigned int gen;
+	unsigned int* name_gen; // str_data id -> gen when it was added to names
+	int* name_index; // str_data id -> index in names
+	int name_index_size;
+	struct script_cache_name* names;
+	int name_count, name_max;
+	int* labels; // name index, position
+	int label_count, label_max;
+	int* ints; // scratch space
+	int int_max;
+
+	// statistics
+	int hits, misses;
+	clock_t parse_time; // original parse time of the scripts taken from the cache
+	clock_t load_time; // time spent taking them from the cache
+} script_cache;
+
+static int script_cache_touch(int id);
+static void script_cache_label(int id, int pos);
+
 // important buildin function references for usage in scripts
 static int buildin_set_ref = 0;
 static int buildin_callsub_ref = 0;
@@ -186,7 +253,7 @@ static DBMap* autobonus_db = NULL; // char* script -> char* bytecode
 
 struct Script_Config script_config = {
 	1, // warn_func_mismatch_argtypes
-	1, 65535, 2048, //warn_func_mismatch_paramnum/check_cmdcount/check_gotocount
+	1, 1, 1, 65535, 2048, //warn_func_mismatch_paramnum/predecode/cache/check_cmdcount/check_gotocount
 	0, INT_MAX, // input_min_value/input_max_value
 	"OnPCDieEvent", //die_event_name
 	"OnPCKillEvent", //kill_pc_event_name
@@ -592,6 +659,7 @@ static void disp_error_message2(const char *mes,const char *pos,int report)
 #define disp_error_message(mes,pos) disp_error_message2(mes,pos,1)
 
 static void disp_warning_message(const char *mes, const char *pos) {
+	script_cache.nocache = true;
 	script_warning(parser_current_src,parser_current_file,parser_current_line,mes,pos);
 }
 
@@ -684,7 +752,11 @@ int add_str(const char* p)
 		for( i = str_hash[h]; ; i = str_data[i].next )
 		{
 			if( strcasecmp(get_str(i),p) == 0 )
-				return i; // string already in list
+			{// string already in list
+				if( script_cache.recording )
+					script_cache_touch(i);
+				return i;
+			}
 			if( str_data[i].next == 0 )
 				break; // reached the end
 		}
@@ -720,6 +792,8 @@ int add_str(const char* p)
 	str_data[str_num].label = -1;
 	str_pos += len+1;
 
+	if( script_cache.recording )
+		script_cache_touch(str_num);
 	return str_num++;
 }
 
@@ -2350,14 +2424,13 @@ void script_warning(const char* src, const char* file, int start_line, const cha
 }
 
 /*==========================================
- * Analysis of the script
+ * Analysis of the script, see parse_script
  *------------------------------------------*/
-struct script_code* parse_script(const char *src,const char *file,int line,int options)
+static struct script_code* parse_script_sub(const char *src,const char *file,int line,int options)
 {
 	const char *p,*tmpp;
 	int i;
 	struct script_code* code = NULL;
-	static int first=1;
 	char end;
 	bool unresolved_names = false;
 
@@ -2369,12 +2442,6 @@ struct script_code* parse_script(const char *src,const char *file,int line,int o
 		return NULL;// empty script
 
 	memset(&syntax,0,sizeof(syntax));
-	if(first){
-		add_buildin_func();
-		read_constdb();
-		script_hardcoded_constants();
-		first=0;
-	}
 
 	script_buf=(unsigned char *)aMalloc(SCRIPT_BLOCK_SIZE*sizeof(unsigned char));
 	script_pos=0;
@@ -2456,8 +2523,10 @@ struct script_code* parse_script(const char *src,const char *file,int line,int o
 		if(*tmpp==':' && !(!strncasecmp(p,"default:",8) && p + 7 == tmpp)){
 			i=add_word(p);
 			set_label(i,script_pos,p);
-			if( parse_options&SCRIPT_USE_LABEL_DB )
+			if( parse_options&SCRIPT_USE_LABEL_DB ) {
 				strdb_iput(scriptlabel_db, get_str(i), script_pos);
+				script_cache_label(i, script_pos);
+			}
 			p=tmpp+1;
 			p=skip_space(p);
 			continue;
@@ -2548,6 +2617,500 @@ struct script_code* parse_script(const char *src,const char *file,int line,int o
 	return code;
 }
 
+/*==========================================
+ * Compiled script cache
+ *------------------------------------------*/
+
+/// Type of a name as far as parse_script is concerned.
+/// Everything it resets at the start of a parse is C_NOP.
+static int script_cache_type(int id)
+{
+	switch( str_data[id].type ) {
+	case C_INT:
+	case C_PARAM:
+	case C_FUNC:
+		return str_data[id].type;
+	default:
+		return C_NOP;
+	}
+}
+
+static int* script_cache_ints(int count)
+{
+	if( count > script_cache.int_max ) {
+		script_cache.int_max = count + 256;
+		RECREATE(script_cache.ints, int, script_cache.int_max);
+	}
+	return script_cache.ints;
+}
+
+/// Records a name used by the script being parsed.
+/// @return index of the name
+static int script_cache_touch(int id)
+{
+	struct script_cache_name* name;
+
+	if( id >= script_cache.name_index_size ) {
+		int size = script_cache.name_index_size;
+
+		script_cache.name_index_size = str_data_size + 128;
+		RECREATE(script_cache.name_gen, unsigned int, script_cache.name_index_size);
+		RECREATE(script_cache.name_index, int, script_cache.name_index_size);
+		memset(script_cache.name_gen + size, 0, (script_cache.name_index_size - size)*sizeof(unsigned int));
+	}
+	if( script_cache.name_gen[id] == script_cache.gen )
+		return script_cache.name_index[id];
+
+	if( script_cache.name_count == script_cache.name_max ) {
+		script_cache.name_max += 256;
+		RECREATE(script_cache.names, struct script_cache_name, script_cache.name_max);
+	}
+	name = &script_cache.names[script_cache.name_count];
+	name->id = id;
+	name->type = script_cache_type(id);
+	name->val = ( name->type == C_NOP ) ? 0 : str_data[id].val;
+#ifdef SCRIPT_CALLFUNC_CHECK
+	name->userfunc = ( userfunc_db != NULL && strdb_exists(userfunc_db, get_str(id)) );
+#else
+	name->userfunc = false;
+#endif
+	script_cache.name_gen[id] = script_cache.gen;
+	script_cache.name_index[id] = script_cache.name_count;
+	return script_cache.name_count++;
+}
+
+/// Records a label of the script being parsed, for scriptlabel_db.
+static void script_cache_label(int id, int pos)
+{
+	if( !script_cache.recording )
+		return;
+	if( script_cache.label_count + 2 > script_cache.label_max ) {
+		script_cache.label_max += 256;
+		RECREATE(script_cache.labels, int, script_cache.label_max);
+	}
+	script_cache.labels[script_cache.label_count++] = script_cache_touch(id);
+	script_cache.labels[script_cache.label_count++] = pos;
+}
+
+/// Finds the end of the source parse_script reads.
+/// @return end of the script, or NULL if it can't tell
+static const char* script_cache_span(const char* src, int options)
+{
+	const char* p;
+	int depth = 0;
+
+	if( options&SCRIPT_IGNORE_EXTERNAL_BRACKETS )
+		return src + strlen(src);
+
+	for( p = src; *p; ++p ) {
+		switch( *p ) {
+		case '"':
+			for( ++p; *p && *p != '"'; ++p )
+				if( *p == '\\' && p[1] )
+					++p;
+			if( *p == '\0' )
+				return NULL;
+			break;
+		case '/':
+			if( p[1] == '/' ) {
+				if( (p = strchr(p, '\n')) == NULL )
+					return NULL;
+			} else if( p[1] == '*' ) {
+				if( (p = strstr(p + 2, "*/")) == NULL )
+					return NULL;
+				++p;
+			}
+			break;
+		case '{':
+			++depth;
+			break;
+		case '}':
+			if( --depth <= 0 )
+				return ( depth == 0 ) ? p + 1 : NULL;
+			break;
+		}
+	}
+	return NULL;
+}
+
+/// FNV-1a hash of the script source and parse options.
+static uint64 script_cache_key(const char* src, const char* end, int options)
+{
+	uint64 h = 0xcbf29ce484222325ULL;
+
+	for( ; src < end; ++src )
+		h = (h ^ (unsigned char)*src) * 0x100000001b3ULL;
+	h = (h ^ (unsigned int)options) * 0x100000001b3ULL;
+	return h;
+}
+
+static bool script_cache_read(const unsigned char** p, const unsigned char* end, void* dst, size_t len)
+{
+	if( (size_t)(end - *p) < len )
+		return false;
+	memcpy(dst, *p, len);
+	*p += len;
+	return true;
+}
+
+static unsigned char* script_cache_write(unsigned char* p, const void* src, size_t len)
+{
+	memcpy(p, src, len);
+	return p + len;
+}
+
+/// Takes a script from the cache.
+/// @return the code, or NULL if it isn't cached or the names it uses changed
+static struct script_code* script_cache_load(uint64 key, int options)
+{
+	struct script_cache_entry* entry = (struct script_cache_entry*)ui64db_get(script_cache.entries, key);
+	const unsigned char *p, *end, *buf;
+	uint32 opt, parse_us, size, name_count, reloc_count, label_count, i;
+	struct script_code* code;
+	int* ids;
+
+	if( entry == NULL )
+		return NULL;
+
+	p = entry->data;
+	end = p + entry->len;
+	if( !script_cache_read(&p, end, &opt, sizeof(opt)) || !script_cache_read(&p, end, &parse_us, sizeof(parse_us))
+	||  !script_cache_read(&p, end, &size, sizeof(size)) || !script_cache_read(&p, end, &name_count, sizeof(name_count))
+	||  !script_cache_read(&p, end, &reloc_count, sizeof(reloc_count)) || !script_cache_read(&p, end, &label_count, sizeof(label_count))
+	||  opt != (uint32)options || size == 0 || (uint32)(end - p) < size )
+		return NULL;
+	buf = p;
+	p += size;
+
+	ids = script_cache_ints(name_count);
+	for( i = 0; i < name_count; i++ ) {
+		char name[SCRIPT_CACHE_MAX_NAME+1];
+		uint16 len;
+		int32 type, val;
+		uint8 userfunc;
+		int id;
+
+		if( !script_cache_read(&p, end, &len, sizeof(len)) || len > SCRIPT_CACHE_MAX_NAME
+		||  !script_cache_read(&p, end, name, len) || !script_cache_read(&p, end, &type, sizeof(type))
+		||  !script_cache_read(&p, end, &val, sizeof(val)) || !script_cache_read(&p, end, &userfunc, sizeof(userfunc)) )
+			return NULL;
+		name[len] = '\0';
+		id = add_str(name);
+		if( script_cache_type(id) != type || (type != C_NOP && str_data[id].val != val) )
+			return NULL;
+#ifdef SCRIPT_CALLFUNC_CHECK
+		if( ((userfunc_db != NULL && strdb_exists(userfunc_db, name)) ? 1 : 0) != userfunc )
+			return NULL;
+#endif
+		ids[i] = id;
+	}
+	if( (uint32)(end - p) != (reloc_count + label_count)*2*sizeof(uint32) )
+		return NULL;
+
+	CREATE(code, struct script_code, 1);
+	code->script_buf = (unsigned char*)aMalloc(size);
+	code->script_size = (int)size;
+	memcpy(code->script_buf, buf, size);
+	for( i = 0; i < reloc_count; i++ ) {
+		uint32 pos = 0, name = 0;
+
+		if( !script_cache_read(&p, end, &pos, sizeof(pos)) || !script_cache_read(&p, end, &name, sizeof(name))
+		||  pos + 3 > size || name >= name_count ) {
+			aFree(code->script_buf);
+			aFree(code);
+			return NULL;
+		}
+		SETVALUE(code->script_buf, pos, ids[name]);
+	}
+
+	if( options&SCRIPT_USE_LABEL_DB )
+		db_clear(scriptlabel_db);
+	for( i = 0; i < label_count; i++ ) {
+		uint32 name = 0, pos = 0;
+
+		if( !script_cache_read(&p, end, &name, sizeof(name)) || !script_cache_read(&p, end, &pos, sizeof(pos)) )
+			break; // can't happen, the length was checked above
+		if( name < name_count && (options&SCRIPT_USE_LABEL_DB) )
+			strdb_iput(scriptlabel_db, get_str(ids[name]), pos);
+	}
+
+	// names end up as variables, like at the end of parse_script
+	for( i = 0; i < name_count; i++ ) {
+		if( script_cache_type(ids[i]) == C_NOP ) {
+			str_data[ids[i]].type = C_NAME;
+			str_data[ids[i]].label = ids[i];
+			str_data[ids[i]].backpatch = -1;
+		}
+	}
+
+	entry->used = true;
+	script_cache.parse_time += (clock_t)((double)parse_us*CLOCKS_PER_SEC/1000000);
+	return code;
+}
+
+/// Adds a script that was just parsed to the cache.
+static void script_cache_store(uint64 key, int options, struct script_code* code, clock_t parse_time)
+{
+	const unsigned char* buf = code->script_buf;
+	struct script_cache_entry* entry;
+	unsigned char* data, *p;
+	uint32 len, parse_us, reloc_count = 0, i;
+	int pos = 0, *relocs;
+
+	if( script_cache.nocache )
+		return;
+
+	// find the names in the code, they are str_data ids that change from one load to the other
+	relocs = script_cache_ints(code->script_size);
+	while( pos < code->script_size ) {
+		switch( get_com(code->script_buf, &pos) ) {
+		case C_INT:
+			get_num(code->script_buf, &pos);
+			break;
+		case C_POS:
+			pos += 3;
+			break;
+		case C_NAME:
+			relocs[reloc_count++] = pos;
+			pos += 3;
+			break;
+		case C_STR:
+			while( pos < code->script_size && buf[pos] )
+				++pos;
+			++pos;
+			break;
+		case C_EOL: case C_ARG: case C_FUNC: case C_REF: case C_NOP:
+		case C_NEG: case C_NOT: case C_LNOT: case C_OP3:
+		case C_ADD: case C_SUB: case C_MUL: case C_DIV: case C_MOD:
+		case C_EQ: case C_NE: case C_GT: case C_GE: case C_LT: case C_LE:
+		case C_AND: case C_OR: case C_XOR: case C_LAND: case C_LOR:
+		case C_R_SHIFT: case C_L_SHIFT:
+			break;
+		default:
+			return;
+		}
+	}
+	if( pos != code->script_size )
+		return;
+	for( i = 0; i < reloc_count; i++ )
+		script_cache_touch(GETVALUE(buf, relocs[i]));
+
+	len = 6*sizeof(uint32) + code->script_size + (reloc_count*2 + script_cache.label_count)*sizeof(uint32);
+	for( i = 0; i < (uint32)script_cache.name_count; i++ ) {
+		size_t name_len = strlen(get_str(script_cache.names[i].id));
+
+		if( name_len > SCRIPT_CACHE_MAX_NAME )
+			return;
+		len += sizeof(uint16) + (uint32)name_len + 2*sizeof(int32) + sizeof(uint8);
+	}
+
+	data = (unsigned char*)aMalloc(len);
+	parse_us = (uint32)((double)parse_time*1000000/CLOCKS_PER_SEC);
+	p = script_cache_write(data, &options, sizeof(uint32));
+	p = script_cache_write(p, &parse_us, sizeof(parse_us));
+	p = script_cache_write(p, &code->script_size, sizeof(uint32));
+	p = script_cache_write(p, &script_cache.name_count, sizeof(uint32));
+	p = script_cache_write(p, &reloc_count, sizeof(reloc_count));
+	i = script_cache.label_count/2;
+	p = script_cache_write(p, &i, sizeof(i));
+	p = script_cache_write(p, code->script_buf, code->script_size);
+	for( i = 0; i < (uint32)script_cache.name_count; i++ ) {
+		struct script_cache_name* name = &script_cache.names[i];
+		const char* str = get_str(name->id);
+		uint16 name_len = (uint16)strlen(str);
+		int32 type = name->type, val = name->val;
+		uint8 userfunc = name->userfunc ? 1 : 0;
+
+		p = script_cache_write(p, &name_len, sizeof(name_len));
+		p = script_cache_write(p, str, name_len);
+		p = script_cache_write(p, &type, sizeof(type));
+		p = script_cache_write(p, &val, sizeof(val));
+		p = script_cache_write(p, &userfunc, sizeof(userfunc));
+	}
+	for( i = 0; i < reloc_count; i++ ) {
+		uint32 reloc[2];
+
+		reloc[0] = relocs[i];
+		reloc[1] = script_cache.name_index[GETVALUE(buf, relocs[i])];
+		p = script_cache_write(p, reloc, sizeof(reloc));
+	}
+	for( i = 0; i < (uint32)script_cache.label_count; i++ ) {
+		uint32 val = script_cache.labels[i];
+
+		p = script_cache_write(p, &val, sizeof(val));
+	}
+
+	if( (entry = (struct script_cache_entry*)ui64db_get(script_cache.entries, key)) == NULL ) {
+		CREATE(entry, struct script_cache_entry, 1);
+		ui64db_put(script_cache.entries, key, entry);
+	} else if( entry->owned )
+		aFree(entry->data);
+	entry->data = data;
+	entry->len = len;
+	entry->used = true;
+	entry->owned = true;
+}
+
+/// Starts using the script cache, for the scripts parsed until script_cache_end.
+void script_cache_begin(void)
+{
+	char header[4 + sizeof(uint32) + sizeof(script_cache_build)];
+	uint32 version;
+	const unsigned char *p, *end;
+	FILE* fp;
+	long size;
+
+	if( !script_config.cache || script_cache.active )
+		return;
+
+	script_cache.active = true;
+	script_cache.entries = ui64db_alloc(DB_OPT_RELEASE_DATA);
+	script_cache.hits = script_cache.misses = 0;
+	script_cache.parse_time = script_cache.load_time = 0;
+
+	if( (fp = fopen(script_cache_file, "rb")) == NULL )
+		return;
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if( size < (long)sizeof(header) || fread(header, sizeof(header), 1, fp) != 1
+	||  memcmp(header, SCRIPT_CACHE_MAGIC, 4) != 0 || (memcpy(&version, header + 4, sizeof(version)), version) != SCRIPT_CACHE_VERSION
+	||  memcmp(header + 4 + sizeof(uint32), script_cache_build, sizeof(script_cache_build)) != 0 )
+	{// different build, start over
+		fclose(fp);
+		return;
+	}
+	size -= sizeof(header);
+	script_cache.file = (unsigned char*)aMalloc(size + 1);
+	if( fread(script_cache.file, 1, size, fp) != (size_t)size ) {
+		ShowError("script_cache_begin: Could not read %s\n", script_cache_file);
+		size = 0;
+	}
+	fclose(fp);
+
+	p = script_cache.file;
+	end = p + size;
+	while( end - p >= (long)(sizeof(uint32) + sizeof(uint64)) ) {
+		struct script_cache_entry* entry;
+		uint32 len = 0;
+		uint64 key = 0;
+
+		if( !script_cache_read(&p, end, &len, sizeof(len)) || !script_cache_read(&p, end, &key, sizeof(key))
+		||  (uint32)(end - p) < len )
+			break;
+		CREATE(entry, struct script_cache_entry, 1);
+		entry->data = (unsigned char*)p;
+		entry->len = len;
+		ui64db_put(script_cache.entries, key, entry);
+		p += len;
+	}
+}
+
+/// Saves the cache and stops using it.
+/// @param all_loaded: all the scripts were parsed since script_cache_begin, the cached scripts that weren't used are dropped
+void script_cache_end(bool all_loaded)
+{
+	DBIterator* iter;
+	struct script_cache_entry* entry;
+	DBKey key;
+	FILE* fp;
+
+	if( !script_cache.active )
+		return;
+
+	if( (fp = fopen(script_cache_file, "wb")) == NULL )
+		ShowError("script_cache_end: Could not write %s\n", script_cache_file);
+	else {
+		uint32 version = SCRIPT_CACHE_VERSION;
+
+		fwrite(SCRIPT_CACHE_MAGIC, 4, 1, fp);
+		fwrite(&version, sizeof(version), 1, fp);
+		fwrite(script_cache_build, sizeof(script_cache_build), 1, fp);
+	}
+
+	iter = db_iterator(script_cache.entries);
+	for( entry = (struct script_cache_entry*)db_data2ptr(iter->first(iter, &key)); dbi_exists(iter); entry = (struct script_cache_entry*)db_data2ptr(iter->next(iter, &key)) ) {
+		if( fp != NULL && (entry->used || !all_loaded) ) {
+			fwrite(&entry->len, sizeof(entry->len), 1, fp);
+			fwrite(&key.ui64, sizeof(key.ui64), 1, fp);
+			fwrite(entry->data, entry->len, 1, fp);
+		}
+		if( entry->owned )
+			aFree(entry->data);
+	}
+	dbi_destroy(iter);
+	if( fp != NULL )
+		fclose(fp);
+
+	if( script_cache.hits + script_cache.misses > 0 ) {
+		clock_t saved = script_cache.parse_time - script_cache.load_time;
+
+		ShowInfo("Loaded '"CL_WHITE"%d"CL_RESET"' of '"CL_WHITE"%d"CL_RESET"' scripts from the script cache (%d%%), saved about '"CL_WHITE"%u"CL_RESET"' ms of parsing.\n",
+			script_cache.hits, script_cache.hits + script_cache.misses, script_cache.hits*100/(script_cache.hits + script_cache.misses),
+			saved > 0 ? (unsigned int)((double)saved*1000/CLOCKS_PER_SEC) : 0);
+	}
+
+	db_destroy(script_cache.entries);
+	if( script_cache.file )
+		aFree(script_cache.file);
+	if( script_cache.name_gen )
+		aFree(script_cache.name_gen);
+	if( script_cache.name_index )
+		aFree(script_cache.name_index);
+	if( script_cache.names )
+		aFree(script_cache.names);
+	if( script_cache.labels )
+		aFree(script_cache.labels);
+	if( script_cache.ints )
+		aFree(script_cache.ints);
+	memset(&script_cache, 0, sizeof(script_cache));
+}
+
+/*==========================================
+ * Analysis of the script
+ *------------------------------------------*/
+struct script_code* parse_script(const char *src,const char *file,int line,int options)
+{
+	static int first=1;
+	struct script_code* code;
+	const char* end;
+	uint64 key;
+	clock_t start;
+
+	if( src == NULL )
+		return NULL;// empty script
+
+	if(first){
+		add_buildin_func();
+		read_constdb();
+		script_hardcoded_constants();
+		first=0;
+	}
+
+	if( !script_cache.active || (end = script_cache_span(src, options)) == NULL )
+		return parse_script_sub(src, file, line, options);
+
+	key = script_cache_key(src, end, options);
+	start = clock();
+	if( (code = script_cache_load(key, options)) != NULL ) {
+		script_cache.hits++;
+		script_cache.load_time += clock() - start;
+		return code;
+	}
+
+	script_cache.gen++;
+	script_cache.name_count = 0;
+	script_cache.label_count = 0;
+	script_cache.nocache = false;
+	script_cache.recording = true;
+	code = parse_script_sub(src, file, line, options);
+	script_cache.recording = false;
+	script_cache.misses++;
+	if( code != NULL )
+		script_cache_store(key, options, code, clock() - start);
+	return code;
+}
+
 /// Returns the player attached to this script, identified by the rid.
 /// If there is no player attached, the script is terminated.
 TBL_PC *script_rid2sd(struct script_state *st)
@@ -3378,6 +3941,8 @@ void script_free_code(struct script_code* code)
 	if (code->local.arrays)
 		code->local.arrays->destroy(code->local.arrays, script_free_array_db);
 	aFree(code->script_buf);
+	if (code->insn)
+		aFree(code->insn);
 	aFree(code);
 }
 
@@ -4046,6 +4611,237 @@ static void script_attach_state(struct script_state* st)
 	}
 }
 
+/*==========================================
+ * Pre-decoded bytecode
+ *
+ * The bytecode of a script is lowered to fixed-width instructions the first
+ * time it runs, so the operands don't have to be decoded again on every
+ * instruction. st->pos keeps pointing into the bytecode, so the script
+ * commands that jump around don't have to know about it.
+ *------------------------------------------*/
+
+#if defined(__GNUC__)
+	#define SCRIPT_DIRECT_THREADED // computed goto, each instruction jumps straight to the next one
+#endif
+
+/// Lowers the bytecode of a script.
+/// Gives up (insn_count = -1) on anything run_script_main doesn't know how to run.
+/// @return true if the code was lowered
+static bool script_lower(struct script_code* code)
+{
+	const unsigned char* buf = code->script_buf;
+	struct script_insn* insn;
+	int count = 0, pos = 0;
+
+	CREATE(insn, struct script_insn, code->script_size + 1);
+	while( pos < code->script_size )
+	{
+		int start = pos, val = 0;
+		c_op op = get_com(code->script_buf, &pos);
+
+		switch( op )
+		{
+		case C_INT:
+			val = get_num(code->script_buf, &pos);
+			break;
+		case C_POS:
+		case C_NAME:
+			val = GETVALUE(buf, pos);
+			pos += 3;
+			break;
+		case C_STR: {
+			const unsigned char* end = (const unsigned char*)memchr(buf + pos, '\0', code->script_size - pos);
+
+			if( end == NULL )
+				pos = code->script_size + 1; // unterminated
+			else {
+				val = pos; // offset of the string
+				pos = (int)(end - buf) + 1;
+			}
+			break;
+		}
+		case C_EOL: case C_ARG: case C_FUNC: case C_REF: case C_NOP:
+		case C_NEG: case C_NOT: case C_LNOT: case C_OP3:
+		case C_ADD: case C_SUB: case C_MUL: case C_DIV: case C_MOD:
+		case C_EQ: case C_NE: case C_GT: case C_GE: case C_LT: case C_LE:
+		case C_AND: case C_OR: case C_XOR: case C_LAND: case C_LOR:
+		case C_R_SHIFT: case C_L_SHIFT:
+			break;
+		default:
+			pos = code->script_size + 1;
+			break;
+		}
+		if( pos > code->script_size )
+		{
+			aFree(insn);
+			code->insn_count = -1;
+			return false;
+		}
+		insn[count].pos = start;
+		insn[count].val = val;
+		insn[count].op = (unsigned char)op;
+		count++;
+	}
+	// sentinel, stops a script that runs off the end
+	insn[count].pos = code->script_size;
+	insn[count].val = 0;
+	insn[count].op = C_NOP;
+
+	RECREATE(insn, struct script_insn, count + 1);
+	code->insn = insn;
+	code->insn_count = count;
+	return true;
+}
+
+/// Finds the lowered instruction at a position of the bytecode.
+/// @return the instruction, or NULL if the code isn't lowered or pos isn't the start of an instruction
+static const struct script_insn* script_lower_find(struct script_code* code, int pos)
+{
+	int min = 0, max;
+
+	if( code->insn == NULL && (code->insn_count < 0 || !script_lower(code)) )
+		return NULL;
+
+	max = code->insn_count; // including the sentinel
+	while( min <= max )
+	{
+		int mid = (min + max)/2;
+
+		if( code->insn[mid].pos == pos )
+			return &code->insn[mid];
+		if( code->insn[mid].pos < pos )
+			min = mid + 1;
+		else
+			max = mid - 1;
+	}
+	return NULL;
+}
+
+/// Runs the pre-decoded code of a script.
+/// Returns with st->state still RUN if it can't continue (position not in the lowered code),
+/// run_script_main then goes on with the bytecode from st->pos.
+static void run_script_lowered(struct script_state *st, int* cmdcount, int* gotocount)
+{
+	struct script_stack *stack = st->stack;
+	struct script_code *code = st->script;
+	const struct script_insn *insn = script_lower_find(code, st->pos);
+#ifdef SCRIPT_DIRECT_THREADED
+	static const void* dispatch[C_SUB_PRE+1] = {
+		[0 ... C_SUB_PRE] = &&l_unknown,
+		[C_EOL] = &&l_eol, [C_INT] = &&l_int, [C_POS] = &&l_value, [C_NAME] = &&l_value,
+		[C_ARG] = &&l_arg, [C_STR] = &&l_str, [C_FUNC] = &&l_func, [C_REF] = &&l_ref,
+		[C_NEG] = &&l_op1, [C_NOT] = &&l_op1, [C_LNOT] = &&l_op1,
+		[C_ADD] = &&l_op2, [C_SUB] = &&l_op2, [C_MUL] = &&l_op2, [C_DIV] = &&l_op2, [C_MOD] = &&l_op2,
+		[C_EQ] = &&l_op2, [C_NE] = &&l_op2, [C_GT] = &&l_op2, [C_GE] = &&l_op2, [C_LT] = &&l_op2, [C_LE] = &&l_op2,
+		[C_AND] = &&l_op2, [C_OR] = &&l_op2, [C_XOR] = &&l_op2, [C_LAND] = &&l_op2, [C_LOR] = &&l_op2,
+		[C_R_SHIFT] = &&l_op2, [C_L_SHIFT] = &&l_op2,
+		[C_OP3] = &&l_op3, [C_NOP] = &&l_nop,
+	};
+	#define LOWERED_DISPATCH() do{ st->pos = insn[1].pos; goto *dispatch[insn->op]; }while(0)
+#else
+	#define LOWERED_DISPATCH() do{ st->pos = insn[1].pos; goto l_switch; }while(0)
+#endif
+	// same checks as the bytecode interpreter after each instruction
+	#define LOWERED_CHECK() do{ \
+		if( !st->freeloop && *cmdcount > 0 && (--*cmdcount) <= 0 ){ \
+			ShowError("script:run_script_main: infinity loop !\n"); \
+			script_reportsrc(st); \
+			st->state = END; \
+		} \
+		if( st->state != RUN ) \
+			return; \
+	}while(0)
+	#define LOWERED_NEXT() do{ LOWERED_CHECK(); ++insn; LOWERED_DISPATCH(); }while(0)
+
+	if( insn == NULL )
+		return;
+	LOWERED_DISPATCH();
+
+#ifndef SCRIPT_DIRECT_THREADED
+l_switch:
+	switch( insn->op )
+	{
+	case C_EOL: goto l_eol;
+	case C_INT: goto l_int;
+	case C_POS: case C_NAME: goto l_value;
+	case C_ARG: goto l_arg;
+	case C_STR: goto l_str;
+	case C_FUNC: goto l_func;
+	case C_REF: goto l_ref;
+	case C_NEG: case C_NOT: case C_LNOT: goto l_op1;
+	case C_OP3: goto l_op3;
+	case C_NOP: goto l_nop;
+	case C_ADD: case C_SUB: case C_MUL: case C_DIV: case C_MOD:
+	case C_EQ: case C_NE: case C_GT: case C_GE: case C_LT: case C_LE:
+	case C_AND: case C_OR: case C_XOR: case C_LAND: case C_LOR:
+	case C_R_SHIFT: case C_L_SHIFT:
+		goto l_op2;
+	default: goto l_unknown;
+	}
+#endif
+
+l_eol:
+	if( stack->defsp > stack->sp )
+		ShowError("script:run_script_main: unexpected stack position (defsp=%d sp=%d). please report this!!!\n", stack->defsp, stack->sp);
+	else
+		pop_stack(st, stack->defsp, stack->sp);// pop unused stack data. (unused return value)
+	LOWERED_NEXT();
+l_int:
+	push_val(stack, C_INT, insn->val);
+	LOWERED_NEXT();
+l_value:
+	push_val(stack, (enum c_op)insn->op, insn->val);
+	LOWERED_NEXT();
+l_arg:
+	push_val(stack, C_ARG, 0);
+	LOWERED_NEXT();
+l_str:
+	push_str(stack, C_CONSTSTR, (char*)(code->script_buf + insn->val));
+	LOWERED_NEXT();
+l_func:
+	run_func(st);
+	if( st->state == GOTO ){
+		st->state = RUN;
+		if( !st->freeloop && *gotocount > 0 && (--*gotocount) <= 0 ){
+			ShowError("script:run_script_main: infinity loop !\n");
+			script_reportsrc(st);
+			st->state = END;
+		}
+	}
+	LOWERED_CHECK();
+	if( st->script != code || st->pos != insn[1].pos )
+	{// jumped (goto, callsub, callfunc, return, ...)
+		code = st->script;
+		if( (insn = script_lower_find(code, st->pos)) == NULL )
+			return;
+		LOWERED_DISPATCH();
+	}
+	++insn;
+	LOWERED_DISPATCH();
+l_ref:
+	st->op2ref = 1;
+	LOWERED_NEXT();
+l_op1:
+	op_1(st, insn->op);
+	LOWERED_NEXT();
+l_op2:
+	op_2(st, insn->op);
+	LOWERED_NEXT();
+l_op3:
+	op_3(st, insn->op);
+	LOWERED_NEXT();
+l_nop:
+	st->state = END;
+	LOWERED_NEXT();
+l_unknown:
+	st->pos = insn->pos; // let the bytecode interpreter deal with it
+	return;
+
+	#undef LOWERED_NEXT
+	#undef LOWERED_CHECK
+	#undef LOWERED_DISPATCH
+}
+
 /*==========================================
  * The main part of the script execution
  *------------------------------------------*/
@@ -4065,6 +4861,9 @@ void run_script_main(struct script_state *st)
 	} else if(st->state != END)
 		st->state = RUN;
 
+	if( script_config.predecode && st->state == RUN )
+		run_script_lowered(st, &cmdcount, &gotocount);
+
 	while(st->state == RUN) {
 		enum c_op c = get_com(st->script->script_buf,&st->pos);
 		switch(c){
@@ -4213,6 +5012,15 @@ int script_config_read(char *cfgName)
 		if(strcmpi(w1,"warn_func_mismatch_paramnum")==0) {
 			script_config.warn_func_mismatch_paramnum = config_switch(w2);
 		}
+		else if(strcmpi(w1,"predecode")==0) {
+			script_config.predecode = config_switch(w2);
+		}
+		else if(strcmpi(w1,"script_cache")==0) {
+			script_config.cache = config_switch(w2);
+		}
+		else if(strcmpi(w1,"script_cache_file")==0) {
+			safestrncpy(script_cache_file, w2, sizeof(script_cache_file));
+		}
 		else if(strcmpi(w1,"check_cmdcount")==0) {
 			script_config.check_cmdcount = config_switch(w2);
 		}
@@ -4471,23 +5279,6 @@ void queryThread_add(struct script_state *st, bool type) {
 	racond_signal(queryThreadCond);
 }
 /* adds a new log to the queue */
-void queryThread_log(char * entry, int length) {
-	int idx = logThreadData.count;
-
-	EnterSpinLock(&queryThreadLock);
-
-	if( logThreadData.count++ != 0 )
-		RECREATE(logThreadData.entry, char* , logThreadData.count);
-
-	CREATE(logThreadData.entry[idx], char, length + 1 );
-	safestrncpy(logThreadData.entry[idx], entry, length + 1 );
-
-	LeaveSpinLock(&queryThreadLock);
-
-	/* unlock the queryThread */
-	racond_signal(queryThreadCond);
-}
-
 /* queryThread_main */
 static void *queryThread_main(void *x) {
 	Sql *queryThread_handle = Sql_Malloc();
@@ -4544,16 +5335,6 @@ static void *queryThread_main(void *x) {
 			entry->ok = true;/* we're done with this */
 		}
 
-		/* also check for any logs in need to be sent */
-		if( log_config.sql_logs ) {
-			for( i = 0; i < logThreadData.count; i++ ) {
-				if( SQL_ERROR == Sql_Query(logmysql_handle, logThreadData.entry[i]) )
-					Sql_ShowDebug(logmysql_handle);
-				aFree(logThreadData.entry[i]);
-			}
-			logThreadData.count = 0;
-		}
-
 		LeaveSpinLock(&queryThreadLock);
 
 		ramutex_lock( queryThreadMutex );
@@ -4681,12 +5462,6 @@ void do_final_script() {
 	}
 
 	aFree(queryThreadData.entry);
-
-	for( i = 0; i < logThreadData.count; i++ ) {
-		aFree(logThreadData.entry[i]);
-	}
-
-	aFree(logThreadData.entry);
 #endif
 }
 /*==========================================
@@ -4712,8 +5487,6 @@ void do_init_script(void) {
 #ifdef BETA_THREAD_TEST
 	CREATE(queryThreadData.entry, struct queryThreadEntry*, 1);
 	queryThreadData.count = 0;
-	CREATE(logThreadData.entry, char *, 1);
-	logThreadData.count = 0;
 	/* QueryThread Start */
 
 	InitializeSpinLock(&queryThreadLock);
@@ -11651,6 +12424,9 @@ BUILDIN_FUNC(getstatus)
 		return SCRIPT_CMD_SUCCESS;
 	}
 
+	if( sd->state.calc_scripts )
+		sd->state.sc_scripts = 1; // bonus depends on status changes
+
 	if( sd->sc.count == 0 || !sd->sc.data[id] )
 	{// no status is active
 		script_pushint(st, 0);
@@ -24258,6 +25034,23 @@ BUILDIN_FUNC(preg_match) {
 #endif
 }
 
+/** Matches a message against the active pattern sets of the NPC, like public chat does,
+ * without running the label.
+ * testpattern("<message>"{,<no filter>})
+ */
+BUILDIN_FUNC(testpattern) {
+#ifdef PCRE_SUPPORT
+	struct npc_data* nd = map_id2nd(st->oid);
+
+	script_pushint(st, nd != NULL && npc_chat_test(nd, script_getstr(st,2), !(script_hasdata(st,3) && script_getnum(st,3))));
+	return SCRIPT_CMD_SUCCESS;
+#else
+	ShowDebug("script:testpattern: cannot run without PCRE library enabled.\n");
+	script_pushint(st,0);
+	return SCRIPT_CMD_SUCCESS;
+#endif
+}
+
 /// script command definitions
 /// for an explanation on args, see add_buildin_func
 struct script_function buildin_func[] = {
@@ -24560,6 +25353,7 @@ struct script_function buildin_func[] = {
 	BUILDIN_DEF(deletepset,"i"), // Delete a pattern set [MouseJstr]
 #endif
 	BUILDIN_DEF(preg_match,"ss?"),
+	BUILDIN_DEF(testpattern,"s?"),
 	BUILDIN_DEF(dispbottom,"s??"), //added from jA [Lupus]
 	BUILDIN_DEF(recovery,"i???"),
 	BUILDIN_DEF(getpetinfo,"i?"),
@@ -143,6 +143,8 @@ extern unsigned int generic_ui_array_size;
 extern struct Script_Config {
 	unsigned warn_func_mismatch_argtypes : 1;
 	unsigned warn_func_mismatch_paramnum : 1;
+	unsigned predecode : 1;
+	unsigned cache : 1;
 	int check_cmdcount;
 	int check_gotocount;
 	int input_min_value;
@@ -235,11 +237,20 @@ struct script_data {
 
 // Moved defsp from script_state to script_stack since
 // it must be saved when script state is RERUNLINE. [Eoe / jA 1094]
+/// Pre-decoded bytecode instruction, see run_script_main
+struct script_insn {
+	int pos; ///< position of the instruction in script_buf
+	int val; ///< number, label/name value or offset of the string in script_buf
+	unsigned char op; ///< c_op
+};
+
 struct script_code {
 	int script_size;
 	unsigned char* script_buf;
 	struct reg_db local;
 	unsigned short instances;
+	struct script_insn* insn; ///< pre-decoded script_buf, lowered on the first run
+	int insn_count; ///< number of instructions in insn (not counting the sentinel), -1 if it can't be lowered
 };
 
 struct script_stack {
@@ -651,6 +662,8 @@ void script_error(const char* src, const char* file, int start_line, const char*
 void script_warning(const char* src, const char* file, int start_line, const char* error_msg, const char* error_pos);
 
 struct script_code* parse_script(const char* src,const char* file,int line,int options);
+void script_cache_begin(void);
+void script_cache_end(bool all_loaded);
 void run_script_sub(struct script_code *rootscript,int pos,int rid,int oid, char* file, int lineno);
 void run_script(struct script_code *rootscript,int pos,int rid,int oid);
 
@@ -709,8 +722,4 @@ int script_reg_destroy(DBKey key, DBData *data, va_list ap);
 void script_generic_ui_array_expand(unsigned int plus);
 unsigned int *script_array_cpy_list(struct script_array *sa);
 
-#ifdef BETA_THREAD_TEST
-void queryThread_log(char * entry, int length);
-#endif
-
 #endif /* _SCRIPT_H_ */
@@ -2,11 +2,13 @@
 // For more information, see LICENCE in the main folder
 
 #include "../common/cbasetypes.h"
+#include "../common/db.h"  // DBMap
 #include "../common/malloc.h"  // aMalloc, aRealloc, aFree
 #include "../common/showmsg.h"  // ShowError, ShowWarning
 #include "../common/strlib.h"  // safestrncpy
 #include "battle.h"  // battle_config.*
 #include "clif.h"  // clif_open_search_store_info, clif_search_store_info_*
+#include "itemdb.h"  // itemdb_isspecial, itemdb_slot
 #include "pc.h"  // struct map_session_data
 #include "searchstore.h"  // struct s_search_store_info
 
@@ -20,13 +22,6 @@ enum e_searchstore_failure
 	SSI_FAILED_SSILIST_CLICK_TO_OPEN_STORE = 4,  // "No sale (purchase) information available."
 };
 
-/// Search type constants
-enum e_searchstore_searchtype
-{
-	SEARCHTYPE_VENDING      = 0,
-	SEARCHTYPE_BUYING_STORE = 1,
-};
-
 /// Search effect constants
 enum e_searchstore_effecttype
 {
@@ -37,7 +32,17 @@ enum e_searchstore_effecttype
 
 /// Type for shop search function
 typedef bool (*searchstore_search_t)(struct map_session_data* sd, unsigned short nameid);
-typedef bool (*searchstore_searchall_t)(struct map_session_data* sd, const struct s_search_store_search* s);
+
+/// Shops selling or buying an item
+struct s_search_store_catalogue {
+	int count, max;
+	struct s_search_store_entry* entry;
+};
+
+/// Live catalogue of the open shops of each search type, unsigned short nameid -> struct s_search_store_catalogue*
+static DBMap* searchstore_catalogue_db[SEARCHTYPE_MAX];
+
+static const unsigned short searchstore_blankslots[MAX_SLOTS] = { 0 };  // buying stores only buy items without cards
 
 /**
  * Retrieves search function by type.
@@ -55,18 +60,162 @@ static searchstore_search_t searchstore_getsearchfunc(unsigned char type)
 }
 
 /**
- * Retrieves search-all function by type.
- * @param type : type of search to conduct
- * @return : search type
+ * Removes a shop from the search catalogue.
+ * @param sd : shop owner
+ * @param type : type of shop
+ */
+void searchstore_catalogue_remove(struct map_session_data* sd, unsigned char type)
+{
+	struct s_search_store_listing* listing;
+	int i, j;
+
+	if( type >= SEARCHTYPE_MAX )
+		return;
+
+	listing = &sd->searchstore.listing[type];
+	for( i = 0; i < listing->count; i++ ) {
+		struct s_search_store_catalogue* cat = (struct s_search_store_catalogue*)uidb_get(searchstore_catalogue_db[type], listing->nameid[i]);
+
+		if( cat == NULL )
+			continue;
+		for( j = 0; j < cat->count; ) {
+			if( cat->entry[j].sd == sd )
+				cat->entry[j] = cat->entry[--cat->count];
+			else
+				j++;
+		}
+	}
+	listing->count = 0;
+}
+
+/**
+ * Lists a shop slot in the search catalogue.
+ * @param sd : shop owner
+ * @param type : type of shop
+ * @param slot : slot of the item in the shop
+ * @param nameid : item being sold/bought
+ * @param price : zeny price of the item
  */
-static searchstore_searchall_t searchstore_getsearchallfunc(unsigned char type)
+static void searchstore_catalogue_add(struct map_session_data* sd, unsigned char type, unsigned char slot, unsigned short nameid, unsigned int price)
 {
+	struct s_search_store_listing* listing = &sd->searchstore.listing[type];
+	struct s_search_store_catalogue* cat;
+	int i;
+
+	if( (cat = (struct s_search_store_catalogue*)uidb_get(searchstore_catalogue_db[type], nameid)) == NULL ) {
+		CREATE(cat, struct s_search_store_catalogue, 1);
+		uidb_put(searchstore_catalogue_db[type], nameid, cat);
+	}
+	if( cat->count == cat->max ) {
+		cat->max += 8;
+		RECREATE(cat->entry, struct s_search_store_entry, cat->max);
+	}
+	cat->entry[cat->count].sd = sd;
+	cat->entry[cat->count].price = price;
+	cat->entry[cat->count].slot = slot;
+	cat->count++;
+
+	ARR_FIND( 0, listing->count, i, listing->nameid[i] == nameid );
+	if( i == listing->count && listing->count < ARRAYLENGTH(listing->nameid) )
+		listing->nameid[listing->count++] = nameid;
+}
+
+/**
+ * Lists the current items of a shop in the search catalogue, replacing previous ones.
+ * Must be called whenever the items of the shop change.
+ * @param sd : shop owner
+ * @param type : type of shop
+ */
+void searchstore_catalogue_update(struct map_session_data* sd, unsigned char type)
+{
+	int i;
+
+	searchstore_catalogue_remove(sd, type);
+
 	switch( type ) {
-		case SEARCHTYPE_VENDING:      return &vending_searchall;
-		case SEARCHTYPE_BUYING_STORE: return &buyingstore_searchall;
+		case SEARCHTYPE_VENDING:
+			if( !sd->state.vending )
+				break;
+			for( i = 0; i < sd->vend_num; i++ )
+				searchstore_catalogue_add(sd, type, i, sd->status.cart[sd->vending[i].index].nameid, sd->vending[i].value);
+			break;
+		case SEARCHTYPE_BUYING_STORE:
+			if( !sd->state.buyingstore )
+				break;
+			for( i = 0; i < sd->buyingstore.slots; i++ ) {
+				if( sd->buyingstore.items[i].amount )
+					searchstore_catalogue_add(sd, type, i, sd->buyingstore.items[i].nameid, (unsigned int)sd->buyingstore.items[i].price);
+			}
+			break;
 	}
+}
 
-	return NULL;
+/**
+ * Returns the shop slots with the item.
+ * @param type : type of shop
+ * @param nameid : item being sold/bought
+ * @param count : number of entries found
+ * @return : entries, NULL if none
+ */
+const struct s_search_store_entry* searchstore_catalogue_search(unsigned char type, unsigned short nameid, int* count)
+{
+	struct s_search_store_catalogue* cat;
+
+	*count = 0;
+	if( type >= SEARCHTYPE_MAX || (cat = (struct s_search_store_catalogue*)uidb_get(searchstore_catalogue_db[type], nameid)) == NULL )
+		return NULL;
+	*count = cat->count;
+	return cat->entry;
+}
+
+/**
+ * Checks whether a listed shop slot matches the search and adds it to the results.
+ * @param s : parameter of the search
+ * @param type : type of shop
+ * @param e : listed slot
+ * @return : false if the result set is full
+ */
+static bool searchstore_query_entry(const struct s_search_store_search* s, unsigned char type, const struct s_search_store_entry* e)
+{
+	struct map_session_data* pl_sd = e->sd;
+
+	if( s->min_price && s->min_price > e->price ) // too low price
+		return true;
+
+	if( s->max_price && s->max_price < e->price ) // too high price
+		return true;
+
+	if( type == SEARCHTYPE_VENDING ) {
+		struct item* it = &pl_sd->status.cart[pl_sd->vending[e->slot].index];
+
+		if( s->card_count ) { // check cards
+			unsigned int cidx;
+			int c, slot;
+
+			if( itemdb_isspecial(it->card[0]) ) // something, that is not a carded
+				return true;
+			slot = itemdb_slot(it->nameid);
+
+			for( c = 0; c < slot && it->card[c]; c ++ ) {
+				ARR_FIND( 0, s->card_count, cidx, s->cardlist[cidx] == it->card[c] );
+				if( cidx != s->card_count ) // found
+					break;
+			}
+
+			if( c == slot || !it->card[c] ) // no card match
+				return true;
+		}
+
+		return searchstore_result(s->search_sd, pl_sd->vender_id, pl_sd->status.account_id, pl_sd->message, it->nameid, pl_sd->vending[e->slot].amount, e->price, it->card, it->refine);
+	} else {
+		struct s_buyingstore_item* it = &pl_sd->buyingstore.items[e->slot];
+
+		// ignore cards, as there cannot be any
+		if( !it->amount )
+			return true;
+
+		return searchstore_result(s->search_sd, pl_sd->buyer_id, pl_sd->status.account_id, pl_sd->message, it->nameid, it->amount, e->price, searchstore_blankslots, 0);
+	}
 }
 
 /**
@@ -139,10 +288,8 @@ bool searchstore_open(struct map_session_data* sd, unsigned int uses, unsigned s
 void searchstore_query(struct map_session_data* sd, unsigned char type, unsigned int min_price, unsigned int max_price, const unsigned short* itemlist, unsigned int item_count, const unsigned short* cardlist, unsigned int card_count)
 {
 	unsigned int i;
-	struct map_session_data* pl_sd;
-	struct DBIterator *iter;
+	int j, count;
 	struct s_search_store_search s;
-	searchstore_searchall_t store_searchall;
 	time_t querytime;
 
 	if( !battle_config.feature_search_stores )
@@ -151,7 +298,7 @@ void searchstore_query(struct map_session_data* sd, unsigned char type, unsigned
 	if( !sd->searchstore.open )
 		return;
 
-	if( ( store_searchall = searchstore_getsearchallfunc(type) ) == NULL ) {
+	if( type >= SEARCHTYPE_MAX ) {
 		ShowError("searchstore_query: Unknown search type %u (account_id=%d).\n", (unsigned int)type, sd->bl.id);
 		return;
 	}
@@ -205,20 +352,23 @@ void searchstore_query(struct map_session_data* sd, unsigned char type, unsigned
 	s.card_count = card_count;
 	s.min_price  = min_price;
 	s.max_price  = max_price;
-	iter         = db_iterator((type == SEARCHTYPE_VENDING) ? vending_getdb() : buyingstore_getdb());
 
-	for( pl_sd = (struct map_session_data*)dbi_first(iter); dbi_exists(iter);  pl_sd = (struct map_session_data*)dbi_next(iter) ) {
-		if( sd == pl_sd ) // skip own shop, if any
-			continue;
+	for( i = 0; i < item_count; i++ ) {
+		const struct s_search_store_entry* entry = searchstore_catalogue_search(type, itemlist[i], &count);
+
+		for( j = 0; j < count; j++ ) {
+			if( entry[j].sd == sd ) // skip own shop, if any
+				continue;
 
-		if( !store_searchall(pl_sd, &s) ) { // exceeded result size
+			if( !searchstore_query_entry(&s, type, &entry[j]) ) // exceeded result size
+				break;
+		}
+		if( j < count ) {
 			clif_search_store_info_failed(sd, SSI_FAILED_OVER_MAXCOUNT);
 			break;
 		}
 	}
 
-	dbi_destroy(iter);
-
 	if( sd->searchstore.count ) {
 		// reclaim unused memory
 		sd->searchstore.items = (struct s_search_store_info_item*)aRealloc(sd->searchstore.items, sizeof(struct s_search_store_info_item)*sd->searchstore.count);
@@ -417,3 +567,35 @@ bool searchstore_result(struct map_session_data* sd, int store_id, uint32 accoun
 
 	return true;
 }
+
+static int searchstore_catalogue_free(DBKey key, DBData *data, va_list ap)
+{
+	struct s_search_store_catalogue* cat = (struct s_search_store_catalogue*)db_data2ptr(data);
+
+	if( cat->entry )
+		aFree(cat->entry);
+	aFree(cat);
+	return 0;
+}
+
+/**
+ * Initializes the search catalogue.
+ */
+void do_init_searchstore(void)
+{
+	int i;
+
+	for( i = 0; i < SEARCHTYPE_MAX; i++ )
+		searchstore_catalogue_db[i] = uidb_alloc(DB_OPT_BASE);
+}
+
+/**
+ * Destroys the search catalogue.
+ */
+void do_final_searchstore(void)
+{
+	int i;
+
+	for( i = 0; i < SEARCHTYPE_MAX; i++ )
+		searchstore_catalogue_db[i]->destroy(searchstore_catalogue_db[i], searchstore_catalogue_free);
+}
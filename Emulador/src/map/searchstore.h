@@ -6,6 +6,27 @@
 
 #define SEARCHSTORE_RESULTS_PER_PAGE 10
 
+/// Search type constants
+enum e_searchstore_searchtype
+{
+	SEARCHTYPE_VENDING      = 0,
+	SEARCHTYPE_BUYING_STORE = 1,
+	SEARCHTYPE_MAX
+};
+
+/// A shop slot listed in the search catalogue
+struct s_search_store_entry {
+	struct map_session_data* sd;  // shop owner
+	unsigned int price;
+	unsigned char slot;  // index in sd->vending or sd->buyingstore.items
+};
+
+/// items under which a shop is listed in the search catalogue
+struct s_search_store_listing {
+	unsigned short nameid[MAX_VENDING];
+	unsigned char count;
+};
+
 /// information about the search being performed
 struct s_search_store_search {
 	struct map_session_data* search_sd;  // sd of the searching player
@@ -38,6 +59,7 @@ struct s_search_store_info {
 	unsigned short effect;  // 0 = Normal (display coords), 1 = Cash (remote open store)
 	unsigned char type;  // 0 = Vending, 1 = Buying Store
 	bool open;
+	struct s_search_store_listing listing[SEARCHTYPE_MAX];  // own shops, as listed in the catalogue
 };
 
 bool searchstore_open(struct map_session_data* sd, unsigned int uses, unsigned short effect);
@@ -49,6 +71,12 @@ void searchstore_close(struct map_session_data* sd);
 void searchstore_click(struct map_session_data* sd, uint32 account_id, int store_id, unsigned short nameid);
 bool searchstore_queryremote(struct map_session_data* sd, uint32 account_id);
 void searchstore_clearremote(struct map_session_data* sd);
+void searchstore_catalogue_update(struct map_session_data* sd, unsigned char type);
+void searchstore_catalogue_remove(struct map_session_data* sd, unsigned char type);
+const struct s_search_store_entry* searchstore_catalogue_search(unsigned char type, unsigned short nameid, int* count);
 bool searchstore_result(struct map_session_data* sd, int store_id, uint32 account_id, const char* store_name, unsigned short nameid, unsigned short amount, unsigned int price, const unsigned short* card, unsigned char refine);
 
+void do_init_searchstore(void);
+void do_final_searchstore(void);
+
 #endif  // _SEARCHSTORE_H_
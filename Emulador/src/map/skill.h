@@ -300,6 +300,7 @@ struct skill_unit {
 	short range;
 	unsigned alive : 1;
 	unsigned hidden : 1;
+	int slot; /// Index in map[bl.m].skill_units
 };
 
 #define MAX_SKILLUNITGROUPTICKSET 25
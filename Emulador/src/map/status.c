@@ -47,6 +47,15 @@ static struct {
 static int atkmods[3][MAX_WEAPON_TYPE];	/// ATK weapon modification for size (size_fix.txt)
 
 static struct eri *sc_data_ers; /// For sc_data entries
+static struct eri *sc_table_ers; /// For status_change_table
+
+/// Own status change table of an object, status_change.data points to it
+struct status_change_table {
+	struct status_change_entry *data[SC_MAX];
+	short active[SC_MAX]; ///< Types of the status_change.count active entries
+};
+
+struct status_change_entry *status_sc_nodata[SC_MAX]; ///< Table of the objects without status changes
 static struct status_data dummy_status;
 
 short current_equip_item_index; /// Contains inventory index of an equipped item. To pass it into the EQUP_SCRIPT [Lupus]
@@ -211,6 +220,7 @@ void initChangeTables(void)
 	memset(StatusChangeFlagTable, 0, sizeof(StatusChangeFlagTable));
 	memset(StatusChangeStateTable, 0, sizeof(StatusChangeStateTable));
 	memset(StatusDisplayType, 0, sizeof(StatusDisplayType));
+	memset(StatusChangeCalcPcTable, 0, sizeof(StatusChangeCalcPcTable));
 	memset(SCDisabled, 0, sizeof(SCDisabled));
 
 	/* First we define the skill for common ailments. These are used in skill_additional_effect through sc cards. [Skotlex] */
@@ -1288,6 +1298,30 @@ void initChangeTables(void)
 	StatusDisplayType[SC_TIME_ACCESSORY] = true;
 	StatusDisplayType[SC_MAGICAL_FEATHER] = true;
 
+	/* Status changes read by status_calc_pc_ (and pc_calc_skilltree).
+	 * Starting any other status change only recalculates the stats of its SCB_ flags. */
+	StatusChangeCalcPcTable[SC_ARMOR_ELEMENT]	    = true;
+	StatusChangeCalcPcTable[SC_ARMOR_RESIST]	    = true;
+	StatusChangeCalcPcTable[SC_CONCENTRATE]		    = true;
+	StatusChangeCalcPcTable[SC_EARTH_INSIGNIA]	    = true;
+	StatusChangeCalcPcTable[SC_FIRE_CLOAK_OPTION]	    = true;
+	StatusChangeCalcPcTable[SC_FIRE_INSIGNIA]	    = true;
+	StatusChangeCalcPcTable[SC_INTRAVISION]		    = true;
+	StatusChangeCalcPcTable[SC_ITEMSCRIPT]		    = true;
+	StatusChangeCalcPcTable[SC_KNOWLEDGE]		    = true;
+	StatusChangeCalcPcTable[SC_MTF_CRIDAMAGE]	    = true;
+	StatusChangeCalcPcTable[SC_MTF_MLEATKED]	    = true;
+	StatusChangeCalcPcTable[SC_PROVIDENCE]		    = true;
+	StatusChangeCalcPcTable[SC_SERVICE4U]		    = true;
+	StatusChangeCalcPcTable[SC_SIEGFRIED]		    = true;
+	StatusChangeCalcPcTable[SC_SPCOST_RATE]		    = true;
+	StatusChangeCalcPcTable[SC_SPIRIT]		    = true;
+	StatusChangeCalcPcTable[SC_STONE_SHIELD_OPTION]	    = true;
+	StatusChangeCalcPcTable[SC_WATER_DROP_OPTION]	    = true;
+	StatusChangeCalcPcTable[SC_WATER_INSIGNIA]	    = true;
+	StatusChangeCalcPcTable[SC_WIND_CURTAIN_OPTION]	    = true;
+	StatusChangeCalcPcTable[SC_WIND_INSIGNIA]	    = true;
+
 	/* StatusChangeState (SCS_) NOMOVE */
 	StatusChangeStateTable[SC_ANKLE]				|= SCS_NOMOVE;
 	StatusChangeStateTable[SC_AUTOCOUNTER]			|= SCS_NOMOVE;
@@ -3127,6 +3161,9 @@ int status_calc_pc_(struct map_session_data* sd, enum e_status_calc_opt opt)
 	if (++calculating > 10) // Too many recursive calls!
 		return -1;
 
+	sd->state.calc_scripts = 1;
+	sd->state.sc_scripts = 0;
+
 	// Remember player-specific values that are currently being shown to the client (for refresh purposes)
 	memcpy(b_skill, &sd->status.skill, sizeof(b_skill));
 	b_weight = sd->weight;
@@ -4000,6 +4037,7 @@ int status_calc_pc_(struct map_session_data* sd, enum e_status_calc_opt opt)
 // ----- CLIENT-SIDE REFRESH -----
 	if(!sd->bl.prev) {
 		// Will update on LoadEndAck
+		sd->state.calc_scripts = 0;
 		calculating = 0;
 		return 0;
 	}
@@ -4019,6 +4057,7 @@ int status_calc_pc_(struct map_session_data* sd, enum e_status_calc_opt opt)
 	if( (skill = pc_checkskill(sd,SU_SPRITEMABLE)) > 0 )
 		sc_start(&sd->bl, &sd->bl, SC_SPRITEMABLE, 100, 1, -1);
 
+	sd->state.calc_scripts = 0;
 	calculating = 0;
 
 	return 0;
@@ -5012,6 +5051,13 @@ void status_calc_bl_(struct block_list* bl, enum scb_flag flag, enum e_status_ca
 		}
 	}
 
+	if (bl->type == BL_PC) {
+		if (flag&SCB_BASE)
+			((TBL_PC*)bl)->status_calc_full++;
+		else
+			((TBL_PC*)bl)->status_calc_partial++;
+	}
+
 	// Remember previous values
 	status = status_get_status_data(bl);
 	memcpy(&b_status, status, sizeof(struct status_data));
@@ -7627,6 +7673,76 @@ void status_change_init(struct block_list *bl)
 	struct status_change *sc = status_get_sc(bl);
 	nullpo_retv(sc);
 	memset(sc, 0, sizeof (struct status_change));
+	sc->data = status_sc_nodata;
+}
+
+/**
+ * Adds a new entry to the status changes of an object
+ * Allocates the object's own table with its first status change
+ * @param sc: Object's status change data
+ * @param type: Status change (SC_*), must not be active
+ * @return New entry
+ */
+static struct status_change_entry* status_change_add(struct status_change *sc, enum sc_type type)
+{
+	struct status_change_table *table;
+
+	if( sc->data == status_sc_nodata || sc->data == NULL ) {
+		table = ers_alloc(sc_table_ers, struct status_change_table);
+		sc->data = table->data;
+	} else
+		table = (struct status_change_table *)sc->data;
+
+	table->active[sc->count++] = type;
+	return sc->data[type] = ers_alloc(sc_data_ers, struct status_change_entry);
+}
+
+/**
+ * Removes an entry from the status changes of an object, sc->count must already be decremented
+ * Releases the object's own table with its last status change
+ * @param sc: Object's status change data
+ * @param type: Status change (SC_*)
+ */
+static void status_change_remove(struct status_change *sc, enum sc_type type)
+{
+	struct status_change_table *table = (struct status_change_table *)sc->data;
+	int i;
+
+	sc->data[type] = NULL;
+	ARR_FIND(0, sc->count+1, i, table->active[i] == type);
+	if( i <= sc->count )
+		table->active[i] = table->active[sc->count];
+
+	if( sc->count == 0 ) {
+		ers_free(sc_table_ers, table);
+		sc->data = status_sc_nodata;
+	}
+}
+
+/**
+ * Lists the active status changes of an object, by increasing type
+ * @param sc: Object's status change data
+ * @param list: Receives the types, must hold SC_MAX of them
+ * @return Number of active status changes
+ */
+int status_change_getactive(struct status_change *sc, enum sc_type *list)
+{
+	struct status_change_table *table;
+	int i, j, n;
+
+	if( sc == NULL || sc->count == 0 )
+		return 0;
+
+	table = (struct status_change_table *)sc->data;
+	n = sc->count;
+	for( i = 0; i < n; i++ ) { // few entries, insertion sort
+		enum sc_type type = (enum sc_type)table->active[i];
+
+		for( j = i; j > 0 && list[j-1] > type; j-- )
+			list[j] = list[j-1];
+		list[j] = type;
+	}
+	return n;
 }
 
 /*========================================== [Playtester]
@@ -11103,10 +11219,8 @@ int status_change_start(struct block_list* src, struct block_list* bl,enum sc_ty
 		if( sce->timer != INVALID_TIMER )
 			delete_timer(sce->timer, status_change_timer);
 		sc_isnew = false;
-	} else { // New sc
-		++(sc->count);
-		sce = sc->data[type] = ers_alloc(sc_data_ers, struct status_change_entry);
-	}
+	} else // New sc
+		sce = status_change_add(sc, type);
 	sce->val1 = val1;
 	sce->val2 = val2;
 	sce->val3 = val3;
@@ -11133,7 +11247,9 @@ int status_change_start(struct block_list* src, struct block_list* bl,enum sc_ty
 				status_calc_pc(sd, SCO_FORCE);
 				break;
 			default:
-				status_calc_pc(sd, SCO_NONE);
+				// Otherwise status_calc_bl already updated the stats of calc_flag
+				if (StatusChangeCalcPcTable[type] || sd->state.sc_scripts)
+					status_calc_pc(sd, SCO_NONE);
 				break;
 		}
 	}
@@ -11245,14 +11361,17 @@ int status_change_start(struct block_list* src, struct block_list* bl,enum sc_ty
 int status_change_clear(struct block_list* bl, int type)
 {
 	struct status_change* sc;
-	int i;
+	enum sc_type list[SC_MAX];
+	int i, j, n;
 
 	sc = status_get_sc(bl);
 
 	if (!sc || !sc->count)
 		return 0;
 
-	for(i = 0; i < SC_MAX; i++) {
+	n = status_change_getactive(sc, list);
+	for(j = 0; j < n; j++) {
+		i = list[j];
 		if(!sc->data[i])
 			continue;
 
@@ -11394,7 +11513,7 @@ int status_change_clear(struct block_list* bl, int type)
 			if (sc->data[i]->timer != INVALID_TIMER)
 				delete_timer(sc->data[i]->timer, status_change_timer);
 			ers_free(sc_data_ers, sc->data[i]);
-			sc->data[i] = NULL;
+			status_change_remove(sc, (sc_type)i);
 		}
 	}
 
@@ -11479,7 +11598,7 @@ int status_change_end_(struct block_list* bl, enum sc_type type, int tid, const
 	if ( StatusChangeStateTable[type] )
 		status_calc_state(bl,sc,( enum scs_flag ) StatusChangeStateTable[type],false);
 
-	sc->data[type] = NULL;
+	status_change_remove(sc, type);
 
 	if (sd && StatusDisplayType[type])
 		status_display_remove(sd,type);
@@ -13214,7 +13333,8 @@ int status_change_timer_sub(struct block_list* bl, va_list ap)
  */
 void status_change_clear_buffs(struct block_list* bl, uint8 type)
 {
-	int i;
+	int i, j, n;
+	enum sc_type list[SC_MAX];
 	struct status_change *sc= status_get_sc(bl);
 
 	if (!sc || !sc->count)
@@ -13224,8 +13344,10 @@ void status_change_clear_buffs(struct block_list* bl, uint8 type)
 		for (i = SC_COMMON_MIN; i <= SC_COMMON_MAX; i++)
 			status_change_end(bl, (sc_type)i, INVALID_TIMER);
 
-	for( i = SC_COMMON_MAX+1; i < SC_MAX; i++ ) {
-		if(!sc->data[i])
+	n = status_change_getactive(sc, list);
+	for( j = 0; j < n; j++ ) {
+		i = list[j];
+		if(i <= SC_COMMON_MAX || !sc->data[i])
 			continue;
 
 		switch (i) {
@@ -13435,8 +13557,9 @@ void status_change_clear_buffs(struct block_list* bl, uint8 type)
  */
 int status_change_spread(struct block_list *src, struct block_list *bl, bool type)
 {
-	int i, flag = 0;
+	int i, j, n, flag = 0;
 	struct status_change *sc = status_get_sc(src);
+	enum sc_type list[SC_MAX];
 	const struct TimerData *timer = NULL;
 	unsigned int tick;
 	struct status_change_data data;
@@ -13450,8 +13573,10 @@ int status_change_spread(struct block_list *src, struct block_list *bl, bool typ
 	if (status_bl_has_mode(src,MD_STATUS_IMMUNE) || status_bl_has_mode(bl,MD_STATUS_IMMUNE))
 		return 0;
 
-	for( i = SC_COMMON_MIN; i < SC_MAX; i++ ) {
-		if( !sc->data[i] || i == SC_COMMON_MAX )
+	n = status_change_getactive(sc, list);
+	for( j = 0; j < n; j++ ) {
+		i = list[j];
+		if( i < SC_COMMON_MIN || !sc->data[i] || i == SC_COMMON_MAX )
 			continue;
 		if (sc->data[i]->timer != INVALID_TIMER) {
 			timer = get_timer(sc->data[i]->timer);
@@ -13782,14 +13907,17 @@ void status_change_clear_onChangeMap(struct block_list *bl, struct status_change
 	nullpo_retv(bl);
 
 	if (sc && sc->count) {
-		unsigned short i;
+		enum sc_type list[SC_MAX];
+		int i, j, n;
 		bool mapIsVS = map_flag_vs(bl->m);
 		bool mapIsPVP = map[bl->m].flag.pvp;
 		bool mapIsGVG = map_flag_gvg(bl->m);
 		bool mapIsBG = map[bl->m].flag.battleground;
 		unsigned int mapZone = map[bl->m].zone << 3;
 
-		for (i = 0; i < SC_MAX; i++) {
+		n = status_change_getactive(sc, list);
+		for (j = 0; j < n; j++) {
+			i = list[j];
 			if (!sc->data[i] || !SCDisabled[i])
 				continue;
 
@@ -14019,10 +14147,12 @@ int do_init_status(void)
 	status_readdb();
 	natural_heal_prev_tick = gettick();
 	sc_data_ers = ers_new(sizeof(struct status_change_entry),"status.c::sc_data_ers",ERS_OPT_NONE);
+	sc_table_ers = ers_new(sizeof(struct status_change_table),"status.c::sc_table_ers",ERS_OPT_NONE); // tables are released empty
 	add_timer_interval(natural_heal_prev_tick + NATURAL_HEAL_INTERVAL, status_natural_heal_timer, 0, 0, NATURAL_HEAL_INTERVAL);
 	return 0;
 }
 void do_final_status(void)
 {
 	ers_destroy(sc_data_ers);
+	ers_destroy(sc_table_ers);
 }
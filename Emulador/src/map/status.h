@@ -1997,6 +1997,7 @@ int StatusSkillChangeTable[SC_MAX];          /// status -> skill
 int StatusRelevantBLTypes[SI_MAX];           /// "icon" -> enum bl_type (for clif->status_change to identify for which bl types to send packets)
 unsigned int StatusChangeStateTable[SC_MAX]; /// status -> flags
 bool StatusDisplayType[SC_MAX];
+bool StatusChangeCalcPcTable[SC_MAX];        /// status -> read by status_calc_pc_
 
 ///For holding basic status (which can be modified by status changes)
 struct status_data {
@@ -2097,7 +2098,7 @@ struct status_change {
 	unsigned int opt3;// skill state (bitfield)
 	unsigned short opt1;// body state
 	unsigned short opt2;// health state (bitfield)
-	unsigned char count;
+	unsigned short count;
 	//! TODO: See if it is possible to implement the following SC's without requiring extra parameters while the SC is inactive.
 	unsigned char jb_flag; //Joint Beat type flag
 	struct {
@@ -2116,9 +2117,14 @@ struct status_change {
 	unsigned char sg_counter; //Storm gust counter (previous hits from storm gust)
 #endif
 	unsigned char bs_counter; // Blood Sucker counter
-	struct status_change_entry *data[SC_MAX];
+	/// Active entries indexed by sc_type.
+	/// Objects without status changes share status_sc_nodata (all NULL),
+	/// their own table is allocated with the first status change and released with the last.
+	struct status_change_entry **data;
 };
 
+extern struct status_change_entry *status_sc_nodata[SC_MAX];
+
 // for looking up associated data
 sc_type status_skill2sc(int skill);
 int status_sc2skill(sc_type sc);
@@ -2218,6 +2224,7 @@ int status_get_faction_id(struct block_list *bl);
 struct view_data *status_get_viewdata(struct block_list *bl);
 void status_set_viewdata(struct block_list *bl, int class_);
 void status_change_init(struct block_list *bl);
+int status_change_getactive(struct status_change *sc, enum sc_type *list);
 struct status_change *status_get_sc(struct block_list *bl);
 
 int status_isdead(struct block_list *bl);
@@ -3227,6 +3227,11 @@ int unit_free(struct block_list *bl, clr_type clrtype)
 				sd->num_quests = sd->avail_quests = 0;
 			}
 
+			if( sd->achievement_done != NULL ) {
+				aFree(sd->achievement_done);
+				sd->achievement_done = NULL;
+			}
+
 			if (sd->qi_display) {
 				aFree(sd->qi_display);
 				sd->qi_display = NULL;
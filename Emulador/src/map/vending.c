@@ -13,6 +13,7 @@
 #include "chrif.h"
 #include "vending.h"
 #include "pc.h"
+#include "searchstore.h" // searchstore_catalogue_*
 #include "buyingstore.h" // struct s_autotrade_entry, struct s_autotrader
 #include "achievement.h"
 
@@ -63,6 +64,7 @@ void vending_closevending(struct map_session_data* sd)
 		sd->vend_coin = battle_config.vending_zeny_id;
 		clif_closevendingboard(&sd->bl, 0);
 		idb_remove(vending_db, sd->status.char_id);
+		searchstore_catalogue_remove(sd, SEARCHTYPE_VENDING);
 
 		if( map[sd->bl.m].flag.vending_cell ) // Cell becomes available again.
 			map_setcell(sd->bl.m, sd->bl.x, sd->bl.y, CELL_NOVENDING, true);
@@ -318,6 +320,7 @@ void vending_purchasereq(struct map_session_data* sd, int aid, int uid, const ui
 	}
 
 	vsd->vend_num = cursor;
+	searchstore_catalogue_update(vsd, SEARCHTYPE_VENDING);
 
 	//Always save BOTH: customer (buyer) and vender
 	if( save_settings&CHARSAVE_VENDING ) {
@@ -453,6 +456,7 @@ int8 vending_openvending(struct map_session_data* sd, const char* message, const
 	clif_showvendingboard(&sd->bl,message,0);
 
 	idb_put(vending_db, sd->status.char_id, sd);
+	searchstore_catalogue_update(sd, SEARCHTYPE_VENDING);
 
 	if( map[sd->bl.m].flag.vending_cell )
 		map_setcell(sd->bl.m, sd->bl.x, sd->bl.y, CELL_NOVENDING, false);
@@ -482,62 +486,6 @@ bool vending_search(struct map_session_data* sd, unsigned short nameid)
 	return true;
 }
 
-/**
- * Searches for all items in a vending, that match given ids, price and possible cards.
- * @param sd : The vender session to search into
- * @param s : parameter of the search (see s_search_store_search)
- * @return Whether or not the search should be continued.
- */
-bool vending_searchall(struct map_session_data* sd, const struct s_search_store_search* s)
-{
-	int i, c, slot;
-	unsigned int idx, cidx;
-	struct item* it;
-
-	if( !sd->state.vending ) // not vending
-		return true;
-
-	for( idx = 0; idx < s->item_count; idx++ ) {
-		ARR_FIND( 0, sd->vend_num, i, sd->status.cart[sd->vending[i].index].nameid == (short)s->itemlist[idx] );
-		if( i == sd->vend_num ) { // not found
-			continue;
-		}
-		it = &sd->status.cart[sd->vending[i].index];
-
-		if( s->min_price && s->min_price > sd->vending[i].value ) { // too low price
-			continue;
-		}
-
-		if( s->max_price && s->max_price < sd->vending[i].value ) { // too high price
-			continue;
-		}
-
-		if( s->card_count ) { // check cards
-			if( itemdb_isspecial(it->card[0]) ) { // something, that is not a carded
-				continue;
-			}
-			slot = itemdb_slot(it->nameid);
-
-			for( c = 0; c < slot && it->card[c]; c ++ ) {
-				ARR_FIND( 0, s->card_count, cidx, s->cardlist[cidx] == it->card[c] );
-				if( cidx != s->card_count ) { // found
-					break;
-				}
-			}
-
-			if( c == slot || !it->card[c] ) { // no card match
-				continue;
-			}
-		}
-
-		if( !searchstore_result(s->search_sd, sd->vender_id, sd->status.account_id, sd->message, it->nameid, sd->vending[i].amount, sd->vending[i].value, it->card, it->refine) ) { // result set full
-			return false;
-		}
-	}
-
-	return true;
-}
-
 /**
 * Open vending for Autotrader
 * @param sd Player as autotrader
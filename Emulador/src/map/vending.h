@@ -9,7 +9,6 @@
 //#include "map.h"
 
 struct map_session_data;
-struct s_search_store_search;
 
 struct s_vending {
 	short index; /// cart index (return item data)
@@ -28,6 +27,5 @@ int8 vending_openvending(struct map_session_data* sd, const char* message, const
 void vending_vendinglistreq(struct map_session_data* sd, int id);
 void vending_purchasereq(struct map_session_data* sd, int aid, int uid, const uint8* data, int count);
 bool vending_search(struct map_session_data* sd, unsigned short nameid);
-bool vending_searchall(struct map_session_data* sd, const struct s_search_store_search* s);
 
 #endif /* _VENDING_H_ */
@@ -14,6 +14,7 @@
 #include "../common/malloc.h"
 #include "../common/mmo.h"
 #include "../common/showmsg.h"
+#include "../common/strlib.h"
 #include "../common/utils.h"
 
 #include "../config/renewal.h"
@@ -24,6 +25,7 @@ char grf_list_file[256] = "conf/grf-files.txt";
 char map_list_file[256] = "db/map_index.txt";
 char map_cache_file[256];
 int rebuild = 0;
+int format = 1;
 
 FILE *map_cache_fp;
 
@@ -50,6 +52,38 @@ struct map_info {
 	int32 len;
 };
 
+// Map cache v2: main header, index sorted by name, then the compressed cells of every map
+// Cells are stored as the terrain and dynamic flag bytes of the map-server's struct mapcell
+#define MAP_CACHE_V2_MAGIC "MCv2"
+#define MAP_CACHE_V2_CELL_SIZE 2
+
+struct v2_header {
+	char magic[4];
+	uint32 file_size;
+	uint32 map_count;
+	uint32 cell_size;
+};
+
+struct v2_index {
+	char name[MAP_NAME_LENGTH];
+	int16 xs;
+	int16 ys;
+	uint32 offset;
+	uint32 len;
+};
+
+// Map kept in memory until the v2 map cache is written
+struct v2_map {
+	char name[MAP_NAME_LENGTH];
+	int16 xs;
+	int16 ys;
+	unsigned long len;
+	unsigned char *data; // compressed cells
+};
+
+struct v2_map *v2_maps = NULL;
+int v2_count = 0;
+
 
 // Reads a map from GRF's GAT and RSW files
 int read_map(char *name, struct map_data *m)
@@ -123,7 +157,7 @@ void cache_map(char *name, struct map_data *m)
 	// Fill the map header
 	if (strlen(name) > MAP_NAME_LENGTH) // It does not hurt to warn that there are maps with name longer than allowed.
 		ShowWarning ("Map name '%s' size '%d' is too long. Truncating to '%d'.\n", name, strlen(name), MAP_NAME_LENGTH);
-	strncpy(info.name, name, MAP_NAME_LENGTH);
+	safestrncpy(info.name, name, MAP_NAME_LENGTH);
 	info.xs = MakeShortLE(m->xs);
 	info.ys = MakeShortLE(m->ys);
 	info.len = MakeLongLE(len);
@@ -141,6 +175,175 @@ void cache_map(char *name, struct map_data *m)
 	return;
 }
 
+// Converts a gat type to the terrain flags of struct mapcell (walkable, shootable, water)
+unsigned char gat2flags(unsigned char type)
+{
+	switch (type) {
+		case 0: case 2: case 4: case 6: return 0x03; // walkable ground
+		case 3: return 0x07; // walkable water
+		case 5: return 0x02; // gap (snipable)
+		default: return 0x00; // non-walkable ground
+	}
+}
+
+// Adds a map to the v2 map list
+void cache_map_v2(const char *name, int16 xs, int16 ys, unsigned char *cells)
+{
+	struct v2_map *m;
+	unsigned long num_cells = (unsigned long)xs*(unsigned long)ys, xy;
+	unsigned char *flags;
+
+	if (strlen(name) > MAP_NAME_LENGTH) // It does not hurt to warn that there are maps with name longer than allowed.
+		ShowWarning ("Map name '%s' size '%d' is too long. Truncating to '%d'.\n", name, strlen(name), MAP_NAME_LENGTH);
+
+	flags = (unsigned char *)aCalloc(num_cells, MAP_CACHE_V2_CELL_SIZE);
+	for (xy = 0; xy < num_cells; xy++)
+		flags[xy*MAP_CACHE_V2_CELL_SIZE] = gat2flags(cells[xy]);
+
+	v2_maps = (struct v2_map *)aRealloc(v2_maps, (v2_count+1)*sizeof(struct v2_map));
+	m = &v2_maps[v2_count++];
+	safestrncpy(m->name, name, MAP_NAME_LENGTH);
+	m->xs = xs;
+	m->ys = ys;
+	// Create an output buffer twice as big as the uncompressed map... this way we're sure it fits
+	m->len = num_cells*MAP_CACHE_V2_CELL_SIZE*2;
+	m->data = (unsigned char *)aMalloc(m->len);
+	encode_zip(m->data, &m->len, flags, num_cells*MAP_CACHE_V2_CELL_SIZE);
+
+	aFree(flags);
+}
+
+// Loads the maps of an existing v1 or v2 map cache into the v2 map list
+void load_cache_v2(FILE *fp)
+{
+	unsigned char *buf, *p;
+	unsigned long size;
+	uint32 i, count;
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	buf = (unsigned char *)aMalloc(size+1);
+	if (fread(buf, 1, size, fp) != size) {
+		ShowError("Could not read the existing map cache, rebuilding it\n");
+		aFree(buf);
+		return;
+	}
+
+	if (size >= sizeof(struct v2_header) && memcmp(buf, MAP_CACHE_V2_MAGIC, 4) == 0) {
+		count = GetULong(buf+8);
+		if (count > (size - sizeof(struct v2_header)) / sizeof(struct v2_index)) {
+			ShowError("The existing map cache is corrupted (%u maps), rebuilding it\n", count);
+			count = 0;
+		}
+		for (i = 0; i < count; i++) {
+			struct v2_index *index = (struct v2_index *)(buf + sizeof(struct v2_header) + i*sizeof(struct v2_index));
+			unsigned long offset = GetULong((unsigned char *)&index->offset), len = GetULong((unsigned char *)&index->len);
+			struct v2_map *m;
+
+			if (offset > size || len > size - offset) {
+				ShowError("Map #%u of the existing map cache is out of the file, skipping it\n", i);
+				continue;
+			}
+			v2_maps = (struct v2_map *)aRealloc(v2_maps, (v2_count+1)*sizeof(struct v2_map));
+			m = &v2_maps[v2_count++];
+			memcpy(m->name, index->name, MAP_NAME_LENGTH);
+			m->xs = (int16)GetUShort((unsigned char *)&index->xs);
+			m->ys = (int16)GetUShort((unsigned char *)&index->ys);
+			m->len = len;
+			m->data = (unsigned char *)aMalloc(m->len);
+			memcpy(m->data, buf + offset, m->len);
+		}
+	} else if (size >= sizeof(struct main_header)) {
+		// Convert the gat types of a v1 map cache
+		count = GetUShort(buf+4);
+		p = buf + sizeof(struct main_header);
+		for (i = 0; i < count; i++) {
+			struct map_info *info = (struct map_info *)p;
+			char name[MAP_NAME_LENGTH_EXT];
+			int16 xs, ys;
+			int32 zlen;
+			unsigned long len;
+			unsigned char *cells;
+
+			if ((unsigned long)(p - buf) + sizeof(struct map_info) > size)
+				break;
+			xs = (int16)GetUShort((unsigned char *)&info->xs);
+			ys = (int16)GetUShort((unsigned char *)&info->ys);
+			zlen = GetLong((unsigned char *)&info->len);
+			if (xs <= 0 || ys <= 0 || zlen < 0 || (unsigned long)zlen > size - (unsigned long)(p - buf) - sizeof(struct map_info)) {
+				ShowError("Map #%u of the existing map cache is corrupted, skipping the rest\n", i);
+				break;
+			}
+			len = (unsigned long)xs*(unsigned long)ys;
+			cells = (unsigned char *)aCalloc(len, 1);
+
+			decode_zip(cells, &len, p + sizeof(struct map_info), zlen);
+			memcpy(name, info->name, MAP_NAME_LENGTH);
+			name[MAP_NAME_LENGTH] = '\0';
+			cache_map_v2(name, xs, ys, cells);
+			aFree(cells);
+			p += sizeof(struct map_info) + zlen;
+		}
+	}
+
+	aFree(buf);
+}
+
+// Checks whether a map is already in the v2 map list
+int find_map_v2(char *name)
+{
+	int i;
+
+	for (i = 0; i < v2_count; i++)
+		if (strncmp(name, v2_maps[i].name, MAP_NAME_LENGTH) == 0)
+			return 1;
+
+	return 0;
+}
+
+int compare_map_v2(const void *a, const void *b)
+{
+	return strncmp(((const struct v2_map *)a)->name, ((const struct v2_map *)b)->name, MAP_NAME_LENGTH);
+}
+
+// Writes the v2 map list sorted by name, index first then cells
+void write_cache_v2(FILE *fp)
+{
+	struct v2_header v2;
+	struct v2_index index;
+	uint32 offset;
+	int i;
+
+	qsort(v2_maps, v2_count, sizeof(struct v2_map), compare_map_v2);
+
+	offset = sizeof(struct v2_header) + v2_count*sizeof(struct v2_index);
+	memcpy(v2.magic, MAP_CACHE_V2_MAGIC, 4);
+	v2.map_count = MakeLongLE(v2_count);
+	v2.cell_size = MakeLongLE(MAP_CACHE_V2_CELL_SIZE);
+	fseek(fp, sizeof(struct v2_header), SEEK_SET);
+	for (i = 0; i < v2_count; i++) {
+		memcpy(index.name, v2_maps[i].name, MAP_NAME_LENGTH);
+		index.xs = MakeShortLE(v2_maps[i].xs);
+		index.ys = MakeShortLE(v2_maps[i].ys);
+		index.offset = MakeLongLE(offset);
+		index.len = MakeLongLE(v2_maps[i].len);
+		fwrite(&index, sizeof(struct v2_index), 1, fp);
+		offset += v2_maps[i].len;
+	}
+	for (i = 0; i < v2_count; i++) {
+		fwrite(v2_maps[i].data, 1, v2_maps[i].len, fp);
+		aFree(v2_maps[i].data);
+	}
+	v2.file_size = MakeLongLE(offset);
+	fseek(fp, 0, SEEK_SET);
+	fwrite(&v2, sizeof(struct v2_header), 1, fp);
+
+	if (v2_maps)
+		aFree(v2_maps);
+	v2_maps = NULL;
+}
+
 // Checks whether a map is already is the cache
 int find_map(char *name)
 {
@@ -191,6 +394,8 @@ void process_args(int argc, char *argv[])
 				strcpy(map_cache_file, argv[i]);
 		} else if(strcmp(argv[i], "-rebuild") == 0)
 			rebuild = 1;
+		else if(strcmp(argv[i], "-v2") == 0)
+			format = 2;
 	}
 
 }
@@ -245,7 +450,10 @@ int do_init(int argc, char** argv)
 	}
 
 	// Initialize the main header
-	if(rebuild) {
+	if(format == 2) {
+		if(!rebuild)
+			load_cache_v2(map_cache_fp);
+	} else if(rebuild) {
 		header.file_size = sizeof(struct main_header);
 		header.map_count = 0;
 	} else {
@@ -268,10 +476,14 @@ int do_init(int argc, char** argv)
 
 		name[MAP_NAME_LENGTH_EXT-1] = '\0';
 		remove_extension(name);
-		if(find_map(name))
+		if(format == 2 ? find_map_v2(name) : find_map(name))
 			ShowInfo("Map '"CL_WHITE"%s"CL_RESET"' already in cache.\n", name);
 		else if(read_map(name, &map)) {
-			cache_map(name, &map);
+			if(format == 2) {
+				cache_map_v2(name, map.xs, map.ys, map.cells);
+				aFree(map.cells);
+			} else
+				cache_map(name, &map);
 			ShowInfo("Map '"CL_WHITE"%s"CL_RESET"' successfully cached.\n", name);
 		} else
 			ShowError("Map '"CL_WHITE"%s"CL_RESET"' not found!\n", name);
@@ -283,14 +495,23 @@ int do_init(int argc, char** argv)
 
 	// Write the main header and close the map cache
 	ShowStatus("Closing map cache: %s\n", map_cache_file);
-	fseek(map_cache_fp, 0, SEEK_SET);
-	fwrite(&header, sizeof(struct main_header), 1, map_cache_fp);
+	if(format == 2) {
+		// The whole file is rewritten, sorted
+		if((map_cache_fp = freopen(map_cache_file, "wb", map_cache_fp)) == NULL) {
+			ShowError("Failure when writing map cache file %s\n", map_cache_file);
+			exit(EXIT_FAILURE);
+		}
+		write_cache_v2(map_cache_fp);
+	} else {
+		fseek(map_cache_fp, 0, SEEK_SET);
+		fwrite(&header, sizeof(struct main_header), 1, map_cache_fp);
+	}
 	fclose(map_cache_fp);
 
 	ShowStatus("Finalizing grfio\n");
 	grfio_final();
 
-	ShowInfo("%d maps now in cache\n", header.map_count);
+	ShowInfo("%d maps now in cache\n", format == 2 ? v2_count : header.map_count);
 
 	return 0;
 }